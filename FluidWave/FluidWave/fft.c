@@ -0,0 +1,307 @@
+/*****************************************************************************
+ * Fast Fourier transform
+ *****************************************************************************/
+
+#if defined(_MSC_VER)
+ // Make MS math.h define M_PI
+#define _USE_MATH_DEFINES
+#endif
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FFT_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "fft.h"
+
+// Columns gathered together by the 2-D transform, 8 complex floats make a
+// 64 byte cache line per row
+#define FFT_COLUMN_BLOCK 8
+
+//========================================================================
+// Plan
+//========================================================================
+
+struct fft_plan* fft_plan_create(int n)
+{
+	struct fft_plan* plan;
+	int i, j, k, bits, L, size;
+	float* tw;
+	double a;
+
+	if (n < 2 || (n & (n - 1)))
+		return NULL;
+
+	plan = (struct fft_plan*)calloc(1, sizeof(struct fft_plan));
+	if (!plan)
+		return NULL;
+
+	plan->n = n;
+	for (bits = 0; (1 << bits) < n; bits++)
+		;
+	plan->log2n = bits;
+
+#ifdef _OPENMP
+	plan->threads = omp_get_max_threads();
+#else
+	plan->threads = 1;
+#endif
+
+	// Twiddles of all radix-4 stages, stored as three runs w, w^2, w^3
+	size = 0;
+	for (L = (bits & 1) ? 2 : 1; 4 * L <= n; L *= 4)
+		size += 6 * L;
+
+	plan->bitrev = (int*)malloc(n * sizeof(int));
+	plan->twiddle = (float*)malloc((size > 0 ? size : 1) * sizeof(float));
+	plan->scratch = (float*)malloc((size_t)plan->threads * FFT_COLUMN_BLOCK * 2 * n * sizeof(float));
+	if (!plan->bitrev || !plan->twiddle || !plan->scratch)
+	{
+		fft_plan_destroy(plan);
+		return NULL;
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		for (j = 0, k = 0; k < bits; k++)
+			j |= ((i >> k) & 1) << (bits - 1 - k);
+		plan->bitrev[i] = j;
+	}
+
+	tw = plan->twiddle;
+	for (L = (bits & 1) ? 2 : 1; 4 * L <= n; L *= 4)
+	{
+		for (k = 0; k < L; k++)
+		{
+			a = -2.0 * M_PI * k / (4.0 * L);
+			tw[2 * k] = (float)cos(a);
+			tw[2 * k + 1] = (float)sin(a);
+			tw[2 * L + 2 * k] = (float)cos(2.0 * a);
+			tw[2 * L + 2 * k + 1] = (float)sin(2.0 * a);
+			tw[4 * L + 2 * k] = (float)cos(3.0 * a);
+			tw[4 * L + 2 * k + 1] = (float)sin(3.0 * a);
+		}
+		tw += 6 * L;
+	}
+
+	return plan;
+}
+
+void fft_plan_destroy(struct fft_plan* plan)
+{
+	if (!plan)
+		return;
+	free(plan->bitrev);
+	free(plan->twiddle);
+	free(plan->scratch);
+	free(plan);
+}
+
+//========================================================================
+// Butterflies
+//========================================================================
+
+/* One radix-4 stage combines four transforms of length L at offsets 0, L,
+ * 2L and 3L into one of length 4L.  With w = exp(-2 pi i k / 4L):
+ *
+ *   X[k]      = A0 + w^2 A1 +     (w A2 + w^3 A3)
+ *   X[k + L]  = A0 - w^2 A1 - i   (w A2 - w^3 A3)
+ *   X[k + 2L] = A0 + w^2 A1 -     (w A2 + w^3 A3)
+ *   X[k + 3L] = A0 - w^2 A1 + i   (w A2 - w^3 A3)
+ */
+
+static void radix4_scalar(float* d, int L, const float* tw, int k)
+{
+	const float* w1 = tw + 2 * k;
+	const float* w2 = tw + 2 * L + 2 * k;
+	const float* w3 = tw + 4 * L + 2 * k;
+	float* a0 = d + 2 * k;
+	float* a1 = a0 + 2 * L;
+	float* a2 = a1 + 2 * L;
+	float* a3 = a2 + 2 * L;
+	float t1r, t1i, t2r, t2i, t3r, t3i, b0r, b0i, b1r, b1i, c0r, c0i, c1r, c1i;
+
+	t1r = w2[0] * a1[0] - w2[1] * a1[1];
+	t1i = w2[0] * a1[1] + w2[1] * a1[0];
+	t2r = w1[0] * a2[0] - w1[1] * a2[1];
+	t2i = w1[0] * a2[1] + w1[1] * a2[0];
+	t3r = w3[0] * a3[0] - w3[1] * a3[1];
+	t3i = w3[0] * a3[1] + w3[1] * a3[0];
+
+	b0r = a0[0] + t1r; b0i = a0[1] + t1i;
+	b1r = a0[0] - t1r; b1i = a0[1] - t1i;
+	c0r = t2r + t3r; c0i = t2i + t3i;
+	c1r = t2r - t3r; c1i = t2i - t3i;
+
+	// -i (x + iy) = y - ix
+	a0[0] = b0r + c0r; a0[1] = b0i + c0i;
+	a2[0] = b0r - c0r; a2[1] = b0i - c0i;
+	a1[0] = b1r + c1i; a1[1] = b1i - c1r;
+	a3[0] = b1r - c1i; a3[1] = b1i + c1r;
+}
+
+#ifdef FFT_SSE2
+
+// Two complex products at once, lanes re0 im0 re1 im1
+static __m128 cmul2(__m128 a, __m128 b)
+{
+	const __m128 neg_re = _mm_set_ps(0.0f, -0.0f, 0.0f, -0.0f);
+	__m128 br = _mm_shuffle_ps(b, b, _MM_SHUFFLE(2, 2, 0, 0));
+	__m128 bi = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 3, 1, 1));
+	__m128 as = _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1));
+
+	return _mm_add_ps(_mm_mul_ps(a, br), _mm_xor_ps(_mm_mul_ps(as, bi), neg_re));
+}
+
+// Two radix-4 butterflies, k and k + 1
+static void radix4_sse2(float* d, int L, const float* tw, int k)
+{
+	const __m128 neg_im = _mm_set_ps(-0.0f, 0.0f, -0.0f, 0.0f);
+	float* p0 = d + 2 * k;
+	float* p1 = p0 + 2 * L;
+	float* p2 = p1 + 2 * L;
+	float* p3 = p2 + 2 * L;
+	__m128 a0, t1, t2, t3, b0, b1, c0, c1;
+
+	a0 = _mm_loadu_ps(p0);
+	t1 = cmul2(_mm_loadu_ps(p1), _mm_loadu_ps(tw + 2 * L + 2 * k));
+	t2 = cmul2(_mm_loadu_ps(p2), _mm_loadu_ps(tw + 2 * k));
+	t3 = cmul2(_mm_loadu_ps(p3), _mm_loadu_ps(tw + 4 * L + 2 * k));
+
+	b0 = _mm_add_ps(a0, t1);
+	b1 = _mm_sub_ps(a0, t1);
+	c0 = _mm_add_ps(t2, t3);
+	c1 = _mm_sub_ps(t2, t3);
+
+	// -i c1 = (c1.im, -c1.re)
+	c1 = _mm_xor_ps(_mm_shuffle_ps(c1, c1, _MM_SHUFFLE(2, 3, 0, 1)), neg_im);
+
+	_mm_storeu_ps(p0, _mm_add_ps(b0, c0));
+	_mm_storeu_ps(p2, _mm_sub_ps(b0, c0));
+	_mm_storeu_ps(p1, _mm_add_ps(b1, c1));
+	_mm_storeu_ps(p3, _mm_sub_ps(b1, c1));
+}
+
+#endif
+
+static void conjugate(float* data, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		data[2 * i + 1] = -data[2 * i + 1];
+}
+
+//========================================================================
+// 1-D transform
+//========================================================================
+
+void fft_execute(const struct fft_plan* plan, float* data, int direction)
+{
+	int n = plan->n;
+	int i, j, k, L, base;
+	const float* tw;
+	float tr, ti;
+
+	// The inverse is the conjugate of the forward transform of the conjugate
+	if (direction == FFT_INVERSE)
+		conjugate(data, n);
+
+	for (i = 0; i < n; i++)
+	{
+		j = plan->bitrev[i];
+		if (j > i)
+		{
+			tr = data[2 * i]; ti = data[2 * i + 1];
+			data[2 * i] = data[2 * j]; data[2 * i + 1] = data[2 * j + 1];
+			data[2 * j] = tr; data[2 * j + 1] = ti;
+		}
+	}
+
+	// Odd number of bits: one radix-2 stage, all twiddles are 1
+	L = 1;
+	if (plan->log2n & 1)
+	{
+		for (i = 0; i < n; i += 2)
+		{
+			tr = data[2 * i + 2]; ti = data[2 * i + 3];
+			data[2 * i + 2] = data[2 * i] - tr;
+			data[2 * i + 3] = data[2 * i + 1] - ti;
+			data[2 * i] += tr;
+			data[2 * i + 1] += ti;
+		}
+		L = 2;
+	}
+
+	tw = plan->twiddle;
+	for (; 4 * L <= n; L *= 4)
+	{
+		for (base = 0; base < n; base += 4 * L)
+		{
+			k = 0;
+#ifdef FFT_SSE2
+			for (; k + 1 < L; k += 2)
+				radix4_sse2(data + 2 * base, L, tw, k);
+#endif
+			for (; k < L; k++)
+				radix4_scalar(data + 2 * base, L, tw, k);
+		}
+		tw += 6 * L;
+	}
+
+	if (direction == FFT_INVERSE)
+		conjugate(data, n);
+}
+
+//========================================================================
+// 2-D transform
+//========================================================================
+
+void fft_execute_2d(const struct fft_plan* plan, float* data, int direction)
+{
+	int n = plan->n;
+	int r, c, b, cols, tid;
+	float* col;
+
+#pragma omp parallel for num_threads(plan->threads) schedule(static)
+	for (r = 0; r < n; r++)
+		fft_execute(plan, data + 2 * (size_t)n * r, direction);
+
+	// Columns are gathered a cache line at a time into per-thread scratch
+#pragma omp parallel for num_threads(plan->threads) schedule(static) private(r, b, cols, tid, col)
+	for (c = 0; c < n; c += FFT_COLUMN_BLOCK)
+	{
+#ifdef _OPENMP
+		tid = omp_get_thread_num();
+#else
+		tid = 0;
+#endif
+		col = plan->scratch + (size_t)tid * FFT_COLUMN_BLOCK * 2 * n;
+		cols = n - c < FFT_COLUMN_BLOCK ? n - c : FFT_COLUMN_BLOCK;
+
+		for (r = 0; r < n; r++)
+			for (b = 0; b < cols; b++)
+			{
+				col[2 * ((size_t)b * n + r)] = data[2 * ((size_t)r * n + c + b)];
+				col[2 * ((size_t)b * n + r) + 1] = data[2 * ((size_t)r * n + c + b) + 1];
+			}
+
+		for (b = 0; b < cols; b++)
+			fft_execute(plan, col + 2 * (size_t)b * n, direction);
+
+		for (r = 0; r < n; r++)
+			for (b = 0; b < cols; b++)
+			{
+				data[2 * ((size_t)r * n + c + b)] = col[2 * ((size_t)b * n + r)];
+				data[2 * ((size_t)r * n + c + b) + 1] = col[2 * ((size_t)b * n + r) + 1];
+			}
+	}
+}
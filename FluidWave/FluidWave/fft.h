@@ -0,0 +1,53 @@
+/*****************************************************************************
+ * Fast Fourier transform
+ *
+ * In-place complex FFT for power of two sizes: iterative decimation in
+ * time with a radix-2 first stage when log2(n) is odd and radix-4 stages
+ * after it.  The radix-4 butterflies work on two complex values at a time
+ * with SSE2 where available.  The 2-D transform runs its rows and columns
+ * on all OpenMP threads.
+ *
+ * Data is interleaved single precision complex, re0 im0 re1 im1 ...
+ * The forward transform uses exp(-2 pi i jk / n), the inverse exp(+...),
+ * neither is normalised.
+ *
+ * There is no separate real transform: two real signals whose spectra are
+ * Hermitian are recovered from one inverse transform of A + iB, which is
+ * how the ocean generator gets its real fields at half the cost.
+ *****************************************************************************/
+
+#ifndef FFT_H
+#define FFT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FFT_FORWARD -1
+#define FFT_INVERSE 1
+
+struct fft_plan
+{
+	int n;
+	int log2n;
+	int* bitrev;		// bit reversal permutation
+	float* twiddle;		// per radix-4 stage: w, w^2, w^3 for every k, interleaved complex
+	float* scratch;		// one column per thread for the 2-D transform
+	int threads;
+};
+
+// Plan transforms of length n (a power of two >= 2), NULL on failure
+struct fft_plan* fft_plan_create(int n);
+void fft_plan_destroy(struct fft_plan* plan);
+
+// Transform n complex values in place
+void fft_execute(const struct fft_plan* plan, float* data, int direction);
+
+// Transform an n x n row major complex array in place
+void fft_execute_2d(const struct fft_plan* plan, float* data, int direction);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
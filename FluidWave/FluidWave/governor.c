@@ -0,0 +1,227 @@
+/*****************************************************************************
+ * Frame-budget governor for the wave simulation
+ *****************************************************************************/
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "governor.h"
+#include "telemetry.h"
+
+// Weight of the newest sample in the moving averages
+#define GOV_ALPHA 0.1
+
+// Fraction of the frame budget the governor plans to use
+#define GOV_HEADROOM 0.8
+
+// Frames to wait after a quality change before judging its effect
+#define GOV_SETTLE_FRAMES 30
+
+// Frames with spare budget required before quality is raised again
+#define GOV_CALM_FRAMES 120
+
+void governor_init(struct governor* g, double budget, double min_step, double max_step)
+{
+	int i;
+
+	g->budget = budget;
+	g->min_step = min_step;
+	g->max_step = max_step > min_step ? max_step : min_step;
+
+	for (i = 0; i < GOV_PHASE_COUNT; i++)
+	{
+		g->phase_avg[i] = 0.0;
+		g->phase_frame[i] = 0.0;
+	}
+	g->substep_cost = 0.0;
+	g->substeps_frame = 0;
+
+	g->max_substeps = GOV_MAX_SUBSTEPS;
+	g->reported_cap = GOV_MAX_SUBSTEPS;
+	g->normal_interval = 1;
+	g->lod = 0;
+
+	g->frame = 0;
+	g->settle = GOV_SETTLE_FRAMES;
+	g->calm = 0;
+	g->dropping = 0;
+	g->dropped_time = 0.0;
+
+	telemetry_log("governor", "budget %.1f ms, substep %.3f..%.3f s",
+		budget * 1000.0, g->min_step, g->max_step);
+}
+
+//========================================================================
+// Split the elapsed frame time into substeps
+//========================================================================
+
+int governor_plan(struct governor* g, double elapsed, double* step)
+{
+	int n;
+	double lost;
+
+	if (elapsed <= 0.0)
+	{
+		*step = 0.0;
+		g->substeps_frame = 0;
+		return 0;
+	}
+
+	n = (int)ceil(elapsed / g->min_step);
+	if (n > g->max_substeps)
+		n = g->max_substeps;
+
+	// Fewer substeps than needed: stretch them, up to the stability limit
+	*step = elapsed / n;
+	if (*step > g->max_step)
+	{
+		*step = g->max_step;
+		lost = elapsed - n * g->max_step;
+		g->dropped_time += lost;
+
+		if (!g->dropping)
+			telemetry_log("governor", "frame %ld: cannot keep up, dropping %.1f ms of simulated time (cap %d substeps)",
+				g->frame, lost * 1000.0, g->max_substeps);
+		g->dropping = 1;
+	}
+	else if (g->dropping)
+	{
+		telemetry_log("governor", "frame %ld: back in real-time sync, %.3f s dropped in total",
+			g->frame, g->dropped_time);
+		g->dropping = 0;
+	}
+
+	g->substeps_frame = n;
+	return n;
+}
+
+int governor_normals_due(const struct governor* g)
+{
+	return g->frame % g->normal_interval == 0;
+}
+
+void governor_record(struct governor* g, enum governor_phase phase, double seconds)
+{
+	g->phase_frame[phase] += seconds;
+}
+
+//========================================================================
+// Fold the frame measurements in and adapt the settings
+//========================================================================
+
+static void degrade(struct governor* g, double total, int cap, int sync)
+{
+	if (g->normal_interval < GOV_MAX_NORMAL_INTERVAL)
+	{
+		g->normal_interval *= 2;
+		telemetry_log("governor", "frame %ld: %.1f ms per frame, cap %d of %d substeps for sync, normals every %d frames",
+			g->frame, total * 1000.0, cap, sync, g->normal_interval);
+	}
+	else if (g->lod < GOV_MAX_LOD)
+	{
+		g->lod++;
+		telemetry_log("governor", "frame %ld: %.1f ms per frame, cap %d of %d substeps for sync, render lod %d",
+			g->frame, total * 1000.0, cap, sync, g->lod);
+	}
+	else
+		return;
+
+	g->settle = GOV_SETTLE_FRAMES;
+}
+
+static void restore(struct governor* g, int cap)
+{
+	if (g->lod > 0)
+	{
+		g->lod--;
+		telemetry_log("governor", "frame %ld: spare budget (cap %d), render lod %d",
+			g->frame, cap, g->lod);
+	}
+	else if (g->normal_interval > 1)
+	{
+		g->normal_interval /= 2;
+		telemetry_log("governor", "frame %ld: spare budget (cap %d), normals every %d frames",
+			g->frame, cap, g->normal_interval);
+	}
+	else
+		return;
+
+	g->settle = GOV_SETTLE_FRAMES;
+}
+
+void governor_end_frame(struct governor* g)
+{
+	int i, cap, sync;
+	double total, other, avail, cost;
+
+	if (g->substeps_frame > 0)
+	{
+		cost = g->phase_frame[GOV_PHASE_CALC] / g->substeps_frame;
+		if (g->substep_cost == 0.0)
+			g->substep_cost = cost;
+		else
+			g->substep_cost += GOV_ALPHA * (cost - g->substep_cost);
+	}
+	g->substeps_frame = 0;
+
+	for (i = 0; i < GOV_PHASE_COUNT; i++)
+	{
+		if (g->frame == 0)
+			g->phase_avg[i] = g->phase_frame[i];
+		else
+			g->phase_avg[i] += GOV_ALPHA * (g->phase_frame[i] - g->phase_avg[i]);
+		g->phase_frame[i] = 0.0;
+	}
+	g->frame++;
+
+	total = 0.0;
+	for (i = 0; i < GOV_PHASE_COUNT; i++)
+		total += g->phase_avg[i];
+
+	// Substep cap from the time left after the other phases
+	other = g->phase_avg[GOV_PHASE_NORMALS] + g->phase_avg[GOV_PHASE_ADJUST] + g->phase_avg[GOV_PHASE_DRAW];
+	avail = g->budget * GOV_HEADROOM - other;
+
+	if (g->substep_cost > 0.0)
+		cap = avail > 0.0 ? (int)(avail / g->substep_cost) : 1;
+	else
+		cap = GOV_MAX_SUBSTEPS;
+	if (cap < 1)
+		cap = 1;
+	if (cap > GOV_MAX_SUBSTEPS)
+		cap = GOV_MAX_SUBSTEPS;
+
+	// Only report changes that matter, the estimate jitters by a step or two
+	if (abs(cap - g->reported_cap) * 4 > g->reported_cap || (cap == 1 && g->reported_cap != 1))
+	{
+		telemetry_log("governor", "frame %ld: substep cap %d -> %d (%.3f ms per substep, %.1f ms for other phases)",
+			g->frame, g->reported_cap, cap, g->substep_cost * 1000.0, other * 1000.0);
+		g->reported_cap = cap;
+	}
+	g->max_substeps = cap;
+
+	// Substeps per frame needed to stay in sync at the longest stable step
+	sync = (int)ceil(g->budget / g->max_step);
+
+	if (g->settle > 0)
+	{
+		g->settle--;
+		return;
+	}
+
+	if (cap < sync || total > g->budget)
+	{
+		g->calm = 0;
+		degrade(g, total, cap, sync);
+	}
+	else if (cap >= 2 * sync && total < g->budget * GOV_HEADROOM)
+	{
+		if (++g->calm >= GOV_CALM_FRAMES)
+		{
+			g->calm = 0;
+			restore(g, cap);
+		}
+	}
+	else
+		g->calm = 0;
+}
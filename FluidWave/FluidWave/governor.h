@@ -0,0 +1,90 @@
+/*****************************************************************************
+ * Frame-budget governor for the wave simulation
+ *
+ * The main loop reports how long each phase of a frame took.  From those
+ * measurements the governor decides
+ *
+ *   - how many calc_grid() substeps may run per frame and how long each
+ *     substep may be (up to the largest stable step),
+ *   - how often the vertex normals are recomputed,
+ *   - which render level of detail is drawn.
+ *
+ * When the host is loaded it first lengthens the substeps, then trades
+ * normal updates and render detail for simulation time, and only drops
+ * simulated time as a last resort.  Every decision is reported on the
+ * "governor" telemetry channel.
+ *****************************************************************************/
+
+#ifndef GOVERNOR_H
+#define GOVERNOR_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Hard limit for the number of substeps per frame
+#define GOV_MAX_SUBSTEPS 64
+
+// Coarsest render level of detail (each level doubles the quad size)
+#define GOV_MAX_LOD 2
+
+// Largest interval (in frames) between normal updates
+#define GOV_MAX_NORMAL_INTERVAL 8
+
+enum governor_phase
+{
+	GOV_PHASE_CALC,		// all calc_grid() substeps of a frame
+	GOV_PHASE_NORMALS,	// normal and average height update
+	GOV_PHASE_ADJUST,	// vertex height update
+	GOV_PHASE_DRAW,		// draw call submission
+	GOV_PHASE_COUNT
+};
+
+struct governor
+{
+	// Configuration
+	double budget;		// target frame time in seconds
+	double min_step;	// preferred substep length (MAX_DELTA_T)
+	double max_step;	// largest stable substep length
+
+	// Measurements (exponential moving averages, seconds)
+	double phase_avg[GOV_PHASE_COUNT];
+	double substep_cost;
+	double phase_frame[GOV_PHASE_COUNT];
+	int substeps_frame;
+
+	// Decisions
+	int max_substeps;
+	int normal_interval;
+	int lod;
+
+	// Bookkeeping
+	long frame;
+	int settle;			// frames left before the next quality change
+	int calm;			// consecutive frames with spare budget
+	int reported_cap;	// substep cap last written to telemetry
+	int dropping;		// simulated time is currently being dropped
+	double dropped_time;
+};
+
+// Set up the governor for a target frame time and the substep length range
+void governor_init(struct governor* g, double budget, double min_step, double max_step);
+
+// Split the elapsed time of a frame into substeps.  Returns the number of
+// calc_grid() calls to make and stores the step length in *step.
+int governor_plan(struct governor* g, double elapsed, double* step);
+
+// True when the normals are due for an update in the current frame
+int governor_normals_due(const struct governor* g);
+
+// Report the measured duration of a phase of the current frame
+void governor_record(struct governor* g, enum governor_phase phase, double seconds);
+
+// Close the current frame and adapt the settings for the next one
+void governor_end_frame(struct governor* g);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
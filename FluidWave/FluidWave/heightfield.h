@@ -0,0 +1,79 @@
+/*****************************************************************************
+ * Heightfield view
+ *
+ * Describes a grid of heights as an indexed triangle mesh without copying
+ * it.  Vertex positions are derived from the grid origin and spacing and
+ * the height array, triangles from the grid connectivity, so a consumer
+ * such as the ray tracer's scene build can read the solver state directly
+ * instead of going through an .obj file.
+ *
+ * Numbering follows wave.c: vertex (x, y) is y * w + x, quad (x, y) has
+ * the corners (x, y), (x + 1, y), (x + 1, y + 1), (x, y + 1) and is split
+ * into the triangles 0-1-2 and 0-2-3.
+ *
+ * The functions are header only so they compile for the host as C and
+ * C++ and, under nvcc, for the device as well.
+ *****************************************************************************/
+
+#ifndef HEIGHTFIELD_H
+#define HEIGHTFIELD_H
+
+#if defined(__CUDACC__)
+#define HEIGHTFIELD_FN static __host__ __device__ inline
+#else
+#define HEIGHTFIELD_FN static inline
+#endif
+
+struct heightfield_view
+{
+	int w, h;				// vertices along x and y
+	float x0, y0;			// position of vertex (0, 0)
+	float dx, dy;			// vertex spacing
+	float scale;			// z = scale * height value
+	const double* height;	// value of vertex (x, y) at height[x * stride_x + y * stride_y]
+	int stride_x, stride_y;
+};
+
+HEIGHTFIELD_FN int heightfield_vertex_count(const struct heightfield_view* v)
+{
+	return v->w * v->h;
+}
+
+HEIGHTFIELD_FN int heightfield_triangle_count(const struct heightfield_view* v)
+{
+	return 2 * (v->w - 1) * (v->h - 1);
+}
+
+// Position of vertex i
+HEIGHTFIELD_FN void heightfield_vertex(const struct heightfield_view* v, int i, float out[3])
+{
+	int x = i % v->w;
+	int y = i / v->w;
+
+	out[0] = v->x0 + v->dx * (float)x;
+	out[1] = v->y0 + v->dy * (float)y;
+	out[2] = v->scale * (float)v->height[x * v->stride_x + y * v->stride_y];
+}
+
+// Vertex indices of triangle t
+HEIGHTFIELD_FN void heightfield_triangle(const struct heightfield_view* v, int t, int idx[3])
+{
+	int q = t >> 1;
+	int x = q % (v->w - 1);
+	int y = q / (v->w - 1);
+	int v0 = y * v->w + x;
+
+	idx[0] = v0;
+	if (t & 1)
+	{
+		idx[1] = v0 + v->w + 1;
+		idx[2] = v0 + v->w;
+	}
+	else
+	{
+		idx[1] = v0 + 1;
+		idx[2] = v0 + v->w + 1;
+	}
+}
+
+#endif
@@ -0,0 +1,367 @@
+/*****************************************************************************
+ * Spectral ocean height field (Tessendorf)
+ *****************************************************************************/
+
+#if defined(_MSC_VER)
+ // Make MS math.h define M_PI
+#define _USE_MATH_DEFINES
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "fft.h"
+#include "ocean_fft.h"
+
+#define GRAVITY 9.81
+
+//========================================================================
+// Random numbers (xorshift32 + Box-Muller), reproducible per seed
+//========================================================================
+
+static unsigned int rng_next(unsigned int* state)
+{
+	unsigned int x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+static void gaussian_pair(unsigned int* state, float* g1, float* g2)
+{
+	double u1, u2, r;
+
+	u1 = (rng_next(state) + 1.0) / 4294967297.0;
+	u2 = (rng_next(state) + 1.0) / 4294967297.0;
+	r = sqrt(-2.0 * log(u1));
+	*g1 = (float)(r * cos(2.0 * M_PI * u2));
+	*g2 = (float)(r * sin(2.0 * M_PI * u2));
+}
+
+//========================================================================
+// Spectra, as variance density over the wave vector plane
+//========================================================================
+
+static double phillips(const struct ocean_params* par, double kx, double ky)
+{
+	double k2 = kx * kx + ky * ky;
+	double L = par->wind_speed * par->wind_speed / GRAVITY;
+	double l = L / 1000.0;
+	double cosw, p;
+
+	if (k2 < 1e-12)
+		return 0.0;
+
+	cosw = (kx * cos(par->wind_angle) + ky * sin(par->wind_angle)) / sqrt(k2);
+	p = par->amplitude * exp(-1.0 / (k2 * L * L)) / (k2 * k2) * cosw * cosw;
+
+	// Damp waves running against the wind and the shortest ripples
+	if (cosw < 0.0)
+		p *= 0.07;
+	return p * exp(-k2 * l * l);
+}
+
+static double jonswap(const struct ocean_params* par, double kx, double ky)
+{
+	double k = sqrt(kx * kx + ky * ky);
+	double U = par->wind_speed, F = par->fetch, g = GRAVITY;
+	double w, wp, alpha, sigma, r, s, theta, spread;
+
+	if (k < 1e-6)
+		return 0.0;
+
+	// Frequency spectrum at the deep water frequency of k
+	w = sqrt(g * k);
+	alpha = 0.076 * pow(U * U / (F * g), 0.22);
+	wp = 22.0 * pow(g * g / (U * F), 1.0 / 3.0);
+	sigma = w <= wp ? 0.07 : 0.09;
+	r = exp(-(w - wp) * (w - wp) / (2.0 * sigma * sigma * wp * wp));
+	s = alpha * g * g / pow(w, 5.0) * exp(-1.25 * pow(wp / w, 4.0)) * pow(par->gamma, r);
+
+	// cos^2 spreading around the wind direction
+	theta = atan2(ky, kx) - par->wind_angle;
+	theta = atan2(sin(theta), cos(theta));
+	spread = fabs(theta) < M_PI / 2.0 ? 2.0 / M_PI * cos(theta) * cos(theta) : 0.0;
+
+	// S(w) dw -> S(k) k dk dtheta with dw/dk = g / 2w
+	return s * g / (2.0 * w) / k * spread;
+}
+
+//========================================================================
+// Setup
+//========================================================================
+
+void ocean_default_params(struct ocean_params* par, int n)
+{
+	par->n = n;
+	par->length = 256.f;
+	par->spectrum = OCEAN_PHILLIPS;
+	par->wind_speed = 10.f;
+	par->wind_angle = 0.f;
+	par->amplitude = 4e-3f;
+	par->fetch = 100000.f;
+	par->gamma = 3.3f;
+	par->choppiness = 1.f;
+	par->seed = 1;
+}
+
+struct ocean* ocean_create(const struct ocean_params* par)
+{
+	struct ocean* o;
+	int n = par->n;
+	size_t nn = (size_t)n * n;
+	int i, j, m, mi, mj;
+	unsigned int rng = par->seed ? par->seed : 1;
+	double dk = 2.0 * M_PI / par->length;
+	double kx, ky, p, amp;
+	float g1, g2;
+
+	o = (struct ocean*)calloc(1, sizeof(struct ocean));
+	if (!o)
+		return NULL;
+	o->par = *par;
+
+	o->plan = fft_plan_create(n);
+	o->h0 = (float*)malloc(2 * nn * sizeof(float));
+	o->h0_conj = (float*)malloc(2 * nn * sizeof(float));
+	o->omega = (float*)malloc(nn * sizeof(float));
+	for (i = 0; i < 3; i++)
+		o->spec[i] = (float*)malloc(2 * nn * sizeof(float));
+	o->height = (float*)malloc(nn * sizeof(float));
+	o->disp_x = (float*)malloc(nn * sizeof(float));
+	o->disp_y = (float*)malloc(nn * sizeof(float));
+	o->normal = (float*)malloc(3 * nn * sizeof(float));
+
+	if (!o->plan || !o->h0 || !o->h0_conj || !o->omega || !o->spec[0] || !o->spec[1] || !o->spec[2]
+		|| !o->height || !o->disp_x || !o->disp_y || !o->normal)
+	{
+		ocean_destroy(o);
+		return NULL;
+	}
+
+	// h0(k) = (g1 + i g2) sqrt(P(k) dk^2) / 2, so the field has variance
+	// sum P dk^2.  Wave numbers in FFT order, the Nyquist row and column
+	// stay empty so every spectrum below is Hermitian.
+	for (j = 0; j < n; j++)
+	{
+		ky = dk * (j < n / 2 ? j : j - n);
+		for (i = 0; i < n; i++)
+		{
+			kx = dk * (i < n / 2 ? i : i - n);
+			m = j * n + i;
+
+			gaussian_pair(&rng, &g1, &g2);
+			p = par->spectrum == OCEAN_JONSWAP ? jonswap(par, kx, ky) : phillips(par, kx, ky);
+			amp = (i == n / 2 || j == n / 2) ? 0.0 : 0.5 * sqrt(p) * dk;
+
+			o->h0[2 * m] = (float)(g1 * amp);
+			o->h0[2 * m + 1] = (float)(g2 * amp);
+			o->omega[m] = (float)sqrt(GRAVITY * sqrt(kx * kx + ky * ky));
+		}
+	}
+
+	for (j = 0; j < n; j++)
+	{
+		mj = (n - j) % n;
+		for (i = 0; i < n; i++)
+		{
+			mi = (n - i) % n;
+			o->h0_conj[2 * (j * n + i)] = o->h0[2 * (mj * n + mi)];
+			o->h0_conj[2 * (j * n + i) + 1] = -o->h0[2 * (mj * n + mi) + 1];
+		}
+	}
+
+	return o;
+}
+
+void ocean_destroy(struct ocean* o)
+{
+	int i;
+
+	if (!o)
+		return;
+	fft_plan_destroy(o->plan);
+	free(o->h0);
+	free(o->h0_conj);
+	free(o->omega);
+	for (i = 0; i < 3; i++)
+		free(o->spec[i]);
+	free(o->height);
+	free(o->disp_x);
+	free(o->disp_y);
+	free(o->normal);
+	free(o);
+}
+
+//========================================================================
+// Evaluation
+//========================================================================
+
+void ocean_evaluate(struct ocean* o, double t)
+{
+	int n = o->par.n;
+	double dk = 2.0 * M_PI / o->par.length;
+	float chop = o->par.choppiness;
+	int i, j, m;
+	float* s0 = o->spec[0];
+	float* s1 = o->spec[1];
+	float* s2 = o->spec[2];
+
+	/* h(k, t) = h0(k) e^iwt + conj(h0(-k)) e^-iwt, and from it
+	 *
+	 *   D(k) = -i k/|k| h    horizontal displacement
+	 *   S(k) =  i k h        slope
+	 *
+	 * packed as s0 = h + i Dx, s1 = Dy + i Sx, s2 = Sy.
+	 */
+#pragma omp parallel for private(i, m) schedule(static)
+	for (j = 0; j < n; j++)
+	{
+		float ky = (float)(dk * (j < n / 2 ? j : j - n));
+		for (i = 0; i < n; i++)
+		{
+			float kx = (float)(dk * (i < n / 2 ? i : i - n));
+			float k = sqrtf(kx * kx + ky * ky);
+			float kxn, kyn, c, s, hr, hi;
+			const float* a;
+			const float* b;
+
+			m = j * n + i;
+			if (k == 0.f)
+			{
+				s0[2 * m] = s0[2 * m + 1] = 0.f;
+				s1[2 * m] = s1[2 * m + 1] = 0.f;
+				s2[2 * m] = s2[2 * m + 1] = 0.f;
+				continue;
+			}
+
+			c = (float)cos(o->omega[m] * t);
+			s = (float)sin(o->omega[m] * t);
+			a = o->h0 + 2 * m;
+			b = o->h0_conj + 2 * m;
+			hr = a[0] * c - a[1] * s + b[0] * c + b[1] * s;
+			hi = a[0] * s + a[1] * c - b[0] * s + b[1] * c;
+
+			kxn = chop * kx / k;
+			kyn = chop * ky / k;
+
+			s0[2 * m] = hr * (1.f + kxn);
+			s0[2 * m + 1] = hi * (1.f + kxn);
+			s1[2 * m] = kyn * hi - kx * hr;
+			s1[2 * m + 1] = -kyn * hr - kx * hi;
+			s2[2 * m] = -ky * hi;
+			s2[2 * m + 1] = ky * hr;
+		}
+	}
+
+	fft_execute_2d(o->plan, s0, FFT_INVERSE);
+	fft_execute_2d(o->plan, s1, FFT_INVERSE);
+	fft_execute_2d(o->plan, s2, FFT_INVERSE);
+
+#pragma omp parallel for schedule(static)
+	for (m = 0; m < n * n; m++)
+	{
+		float sx = s1[2 * m + 1];
+		float sy = s2[2 * m];
+		float l = 1.f / sqrtf(sx * sx + sy * sy + 1.f);
+
+		o->height[m] = s0[2 * m];
+		o->disp_x[m] = s0[2 * m + 1];
+		o->disp_y[m] = s1[2 * m];
+		o->normal[3 * m] = -sx * l;
+		o->normal[3 * m + 1] = -sy * l;
+		o->normal[3 * m + 2] = l;
+	}
+}
+
+void ocean_sample(const struct ocean* o, float u, float v, float* height, float disp[2], float normal[3])
+{
+	int n = o->par.n;
+	float x = (u - floorf(u)) * n;
+	float y = (v - floorf(v)) * n;
+	int x0 = (int)x % n, y0 = (int)y % n;
+	int x1 = (x0 + 1) % n, y1 = (y0 + 1) % n;
+	float fx = x - floorf(x), fy = y - floorf(y);
+	float w00 = (1.f - fx) * (1.f - fy), w10 = fx * (1.f - fy);
+	float w01 = (1.f - fx) * fy, w11 = fx * fy;
+	int m00 = y0 * n + x0, m10 = y0 * n + x1, m01 = y1 * n + x0, m11 = y1 * n + x1;
+	int c;
+
+	if (height)
+		*height = w00 * o->height[m00] + w10 * o->height[m10] + w01 * o->height[m01] + w11 * o->height[m11];
+	if (disp)
+	{
+		disp[0] = w00 * o->disp_x[m00] + w10 * o->disp_x[m10] + w01 * o->disp_x[m01] + w11 * o->disp_x[m11];
+		disp[1] = w00 * o->disp_y[m00] + w10 * o->disp_y[m10] + w01 * o->disp_y[m01] + w11 * o->disp_y[m11];
+	}
+	if (normal)
+		for (c = 0; c < 3; c++)
+			normal[c] = w00 * o->normal[3 * m00 + c] + w10 * o->normal[3 * m10 + c]
+				+ w01 * o->normal[3 * m01 + c] + w11 * o->normal[3 * m11 + c];
+}
+
+//========================================================================
+// Benchmark
+//========================================================================
+
+static double wall_time(void)
+{
+#ifdef _OPENMP
+	return omp_get_wtime();
+#else
+	return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+void ocean_bench(void)
+{
+	struct ocean_params par;
+	struct ocean* o;
+	int n, r, reps;
+	double t0, setup, eval, fft;
+
+#ifdef _OPENMP
+	printf("ocean: %d threads\n", omp_get_max_threads());
+#else
+	printf("ocean: single threaded build\n");
+#endif
+	printf("   n    setup ms  evaluate ms  2-D FFT ms  Msamples/s\n");
+
+	for (n = 256; n <= 2048; n *= 2)
+	{
+		ocean_default_params(&par, n);
+
+		t0 = wall_time();
+		o = ocean_create(&par);
+		setup = wall_time() - t0;
+		if (!o)
+		{
+			printf("%5d  out of memory\n", n);
+			break;
+		}
+
+		reps = n <= 512 ? 20 : 5;
+		ocean_evaluate(o, 0.0);
+
+		t0 = wall_time();
+		for (r = 0; r < reps; r++)
+			ocean_evaluate(o, 0.1 * r);
+		eval = (wall_time() - t0) / reps;
+
+		t0 = wall_time();
+		for (r = 0; r < reps; r++)
+			fft_execute_2d(o->plan, o->spec[0], FFT_INVERSE);
+		fft = (wall_time() - t0) / reps;
+
+		printf("%5d  %10.2f  %11.2f  %10.2f  %10.1f\n", n, setup * 1000.0, eval * 1000.0,
+			fft * 1000.0, (double)n * n / eval * 1e-6);
+		ocean_destroy(o);
+	}
+}
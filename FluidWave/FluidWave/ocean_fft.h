@@ -0,0 +1,81 @@
+/*****************************************************************************
+ * Spectral ocean height field (Tessendorf)
+ *
+ * An alternative to calc_grid() for open water: the surface is a sum of
+ * deep water waves drawn from a Phillips or JONSWAP spectrum, evaluated at
+ * any time with inverse 2-D FFTs instead of being stepped.  The result is
+ * periodic over the patch, so it tiles seamlessly.
+ *
+ * Every evaluation fills the height, the horizontal (choppy) displacement
+ * and the normal of each of the n x n samples.  Five real fields take three
+ * complex transforms by packing two Hermitian spectra into one.
+ *
+ * Arrays are row major with y as the row: sample (x, y) at y * n + x.
+ *****************************************************************************/
+
+#ifndef OCEAN_FFT_H
+#define OCEAN_FFT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum ocean_spectrum
+{
+	OCEAN_PHILLIPS,
+	OCEAN_JONSWAP
+};
+
+struct ocean_params
+{
+	int n;						// samples per side, a power of two
+	float length;				// patch size in meters
+	enum ocean_spectrum spectrum;
+	float wind_speed;			// m/s at 10 m
+	float wind_angle;			// radians, 0 blows along +x
+	float amplitude;			// Phillips constant A
+	float fetch;				// JONSWAP fetch in meters
+	float gamma;				// JONSWAP peak enhancement, 3.3 is typical
+	float choppiness;			// horizontal displacement factor, 0 disables
+	unsigned int seed;
+};
+
+struct ocean
+{
+	struct ocean_params par;
+	struct fft_plan* plan;
+
+	float* h0;			// h0(k), complex
+	float* h0_conj;		// conj(h0(-k)), complex
+	float* omega;		// dispersion w(k)
+	float* spec[3];		// complex work arrays for the transforms
+
+	// Output
+	float* height;		// meters
+	float* disp_x;		// horizontal displacement in meters
+	float* disp_y;
+	float* normal;		// unit normals, 3 floats per sample
+};
+
+// Default parameters for a patch of n x n samples
+void ocean_default_params(struct ocean_params* par, int n);
+
+// Build the initial spectrum, NULL on failure
+struct ocean* ocean_create(const struct ocean_params* par);
+void ocean_destroy(struct ocean* o);
+
+// Evaluate the surface at time t (seconds)
+void ocean_evaluate(struct ocean* o, double t);
+
+// Bilinear sample at patch coordinates u, v (wrapped to [0, 1)).  Any of
+// the output pointers may be NULL.
+void ocean_sample(const struct ocean* o, float u, float v, float* height, float disp[2], float normal[3]);
+
+// Print evaluation times for 256^2 to 2048^2 samples
+void ocean_bench(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,38 @@
+/*****************************************************************************
+ * Telemetry channel
+ *****************************************************************************/
+
+#include <stdarg.h>
+
+#include "telemetry.h"
+
+static FILE* telemetry_stream = NULL;
+static int telemetry_enabled = 1;
+
+void telemetry_set_stream(FILE* stream)
+{
+	telemetry_stream = stream;
+}
+
+void telemetry_enable(int enabled)
+{
+	telemetry_enabled = enabled;
+}
+
+void telemetry_log(const char* channel, const char* format, ...)
+{
+	FILE* out;
+	va_list args;
+
+	if (!telemetry_enabled)
+		return;
+
+	out = telemetry_stream ? telemetry_stream : stderr;
+
+	fprintf(out, "[telemetry] %s ", channel);
+	va_start(args, format);
+	vfprintf(out, format, args);
+	va_end(args);
+	fputc('\n', out);
+	fflush(out);
+}
@@ -0,0 +1,34 @@
+/*****************************************************************************
+ * Telemetry channel
+ *
+ * Line oriented event log used by the simulation to report what it is doing
+ * at runtime.  Every record is written as
+ *
+ *     [telemetry] <channel> <message>
+ *
+ * to stderr unless another stream has been selected.
+ *****************************************************************************/
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Redirect telemetry records (NULL restores stderr)
+void telemetry_set_stream(FILE* stream);
+
+// Enable or disable the channel as a whole
+void telemetry_enable(int enabled);
+
+// Write one record on the given channel
+void telemetry_log(const char* channel, const char* format, ...);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
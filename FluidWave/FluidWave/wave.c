@@ -10,17 +10,33 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include <GLFW/glfw3.h>
 
 #include <linmath.h>
 
-// Maximum delta T to allow for differential calculations
-#define MAX_DELTA_T 0.01
+#include "governor.h"
+#include "ocean_fft.h"
+#include "telemetry.h"
+#include "wave_amr.h"
+#include "wave_solver.h"
 
-// Animation speed (10.0 looks good)
-#define ANIMATION_SPEED 10.0
+// Frame budget the governor aims for
+#define TARGET_FRAME_TIME (1.0 / 60.0)
+
+// Adaptive mesh refinement: cells per tile, levels and the pressure
+// gradient above which a tile is refined
+#define AMR_TILE 10
+#define AMR_LEVELS 3
+#define AMR_THRESHOLD 2.0
+
+// Spectral ocean: samples per side, patch size in meters and the height
+// exaggeration applied on top of the patch to grid scale
+#define OCEAN_N 64
+#define OCEAN_LENGTH 100.0
+#define OCEAN_EXAGGERATION 5.0
 
 GLfloat alpha = 210.f, beta = -70.f;
 GLfloat zoom = 2.f;
@@ -34,17 +50,18 @@ struct Vertex
 	GLfloat r, g, b;
 };
 
-#define GRIDW 50
-#define GRIDH 50
 #define VERTEXNUM (GRIDW*GRIDH)
 
 #define QUADW (GRIDW - 1)
 #define QUADH (GRIDH - 1)
 #define QUADNUM (QUADW*QUADH)
 
-GLuint quad[4 * QUADNUM];
+GLuint quad[GOV_MAX_LOD + 1][4 * QUADNUM];
+int quadcount[GOV_MAX_LOD + 1];
 struct Vertex vertex[VERTEXNUM];
 
+struct governor gov;
+
 /* The grid will look like this:
  *
  *      3   4   5
@@ -54,6 +71,9 @@ struct Vertex vertex[VERTEXNUM];
  *      |   |   |
  *      *---*---*
  *      0   1   2
+ *
+ * Level of detail n draws quads spanning 2^n grid cells on each side,
+ * the last row and column are shortened to end on the grid border.
  */
 
  //========================================================================
@@ -62,7 +82,7 @@ struct Vertex vertex[VERTEXNUM];
 
 void init_vertices(void)
 {
-	int x, y, p;
+	int x, y, p, lod, step, x1, y1;
 
 	// Place the vertices in a grid
 	for (y = 0; y < GRIDH; y++)
@@ -85,56 +105,35 @@ void init_vertices(void)
 		}
 	}
 
-	for (y = 0; y < QUADH; y++)
+	for (lod = 0; lod <= GOV_MAX_LOD; lod++)
 	{
-		for (x = 0; x < QUADW; x++)
+		step = 1 << lod;
+		p = 0;
+
+		for (y = 0; y < QUADH; y += step)
 		{
-			p = 4 * (y * QUADW + x);
+			y1 = y + step < GRIDH - 1 ? y + step : GRIDH - 1;
+			for (x = 0; x < QUADW; x += step)
+			{
+				x1 = x + step < GRIDW - 1 ? x + step : GRIDW - 1;
 
-			quad[p + 0] = y * GRIDW + x;     // Some point
-			quad[p + 1] = y * GRIDW + x + 1; // Neighbor at the right side
-			quad[p + 2] = (y + 1) * GRIDW + x + 1; // Upper right neighbor
-			quad[p + 3] = (y + 1) * GRIDW + x;     // Upper neighbor
+				quad[lod][p + 0] = y * GRIDW + x;   // Some point
+				quad[lod][p + 1] = y * GRIDW + x1;  // Neighbor at the right side
+				quad[lod][p + 2] = y1 * GRIDW + x1; // Upper right neighbor
+				quad[lod][p + 3] = y1 * GRIDW + x;  // Upper neighbor
+				p += 4;
+			}
 		}
+
+		quadcount[lod] = p / 4;
 	}
 }
 
-double dt;
-double p[GRIDW][GRIDH];		//pressure
-double vx[GRIDW][GRIDH], vy[GRIDW][GRIDH];	//velocity
-double ax[GRIDW][GRIDH], ay[GRIDW][GRIDH];	//accleration
 double normx[GRIDW][GRIDH], normy[GRIDW][GRIDH], normz[GRIDW][GRIDH];	//normals
 double avgHeight[GRIDW][GRIDH];		//average height
 
-//========================================================================
-// Initialize grid
-//========================================================================
-
-void init_grid(void)
-{
-	int x, y;
-	double dx, dy, d;
-
-	for (y = 0; y < GRIDH; y++)
-	{
-		for (x = 0; x < GRIDW; x++)
-		{
-			dx = (double)(x - GRIDW / 2);
-			dy = (double)(y - GRIDH / 2);
-			d = sqrt(dx * dx + dy * dy);
-			if (d < 0.1 * (double)(GRIDW / 2))
-			{
-				d = d * 10.0;
-				p[x][y] = -cos(d * (M_PI / (double)(GRIDW * 8))) * 50.0;
-			}
-			else
-				p[x][y] = 0.0;
-
-			vx[x][y] = 0.0;
-			vy[x][y] = 0.0;
-		}
-	}
-}
+struct wave_amr* amr = NULL;	//adaptive solver, replaces calc_grid() while set
+struct ocean* ocean = NULL;		//spectral ocean, replaces both solvers while set
 
 //========================================================================
 // Compute Normal
@@ -203,7 +202,7 @@ struct Vertex compute_normal(struct Vertex v1, struct Vertex v2, struct Vertex v
 // Draw scene
 //========================================================================
 
-void draw_scene(GLFWwindow* window)
+void draw_scene(GLFWwindow* window, int lod)
 {
 	// Clear the color and depth buffers
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -218,9 +217,7 @@ void draw_scene(GLFWwindow* window)
 	glRotatef(beta, 1.0, 0.0, 0.0);
 	glRotatef(alpha, 0.0, 0.0, 1.0);
 
-	glDrawElements(GL_QUADS, 4 * QUADNUM, GL_UNSIGNED_INT, quad);
-
-	glfwSwapBuffers(window);
+	glDrawElements(GL_QUADS, 4 * quadcount[lod], GL_UNSIGNED_INT, quad[lod]);
 }
 
 
@@ -271,53 +268,14 @@ void adjust_grid(void)
 
 
 //========================================================================
-// Calculate wave propagation
+// Compute normal and average height of each quad from the vertices
 //========================================================================
 
-void calc_grid(void)
+void calc_normals(void)
 {
-	int x, y, x2, y2;
-	double time_step = dt * ANIMATION_SPEED;
-
-	// Compute accelerations
-	for (x = 0; x < GRIDW; x++)
-	{
-		x2 = (x + 1) % GRIDW;
-		for (y = 0; y < GRIDH; y++)
-			ax[x][y] = p[x][y] - p[x2][y];
-	}
-
-	for (y = 0; y < GRIDH; y++)
-	{
-		y2 = (y + 1) % GRIDH;
-		for (x = 0; x < GRIDW; x++)
-			ay[x][y] = p[x][y] - p[x][y2];
-	}
-
-	// Compute speeds
-	for (x = 0; x < GRIDW; x++)
-	{
-		for (y = 0; y < GRIDH; y++)
-		{
-			vx[x][y] = vx[x][y] + ax[x][y] * time_step;
-			vy[x][y] = vy[x][y] + ay[x][y] * time_step;
-		}
-	}
-
-	// Compute pressure
-	for (x = 1; x < GRIDW; x++)
-	{
-		x2 = x - 1;
-		for (y = 1; y < GRIDH; y++)
-		{
-			y2 = y - 1;
-			p[x][y] = p[x][y] + (vx[x2][y] - vx[x][y] + vy[x][y2] - vy[x][y]) * time_step;
-		}
-	}
-
-	// Compute normal and average height
-	int pos;
+	int x, y;
 	struct Vertex v1, v2, v3, v4, n1, n2, n3, n4, n;
+
 	for (x = 0; x < QUADW; x++)
 	{
 		for (y = 0; y < QUADH; y++)
@@ -352,7 +310,150 @@ void calc_grid(void)
 			avgHeight[x][y] = (v1.z + v2.z + v3.z + v4.z) / 4;
 		}
 	}
+}
+
+//========================================================================
+// Switch between the uniform and the adaptive solver
+//========================================================================
+
+void toggle_amr(void)
+{
+	if (amr)
+	{
+		wave_amr_store(amr, &p[0][0], &vx[0][0], &vy[0][0]);
+		wave_amr_destroy(amr);
+		amr = NULL;
+		telemetry_log("amr", "off, uniform %dx%d grid", GRIDW, GRIDH);
+		return;
+	}
+
+	amr = wave_amr_create(GRIDW, GRIDH, AMR_TILE, AMR_LEVELS, AMR_THRESHOLD);
+	if (!amr)
+	{
+		fprintf(stderr, "Error: cannot create the adaptive grid\n");
+		return;
+	}
+	wave_amr_load(amr, &p[0][0], &vx[0][0], &vy[0][0]);
+	telemetry_log("amr", "on, %d levels of %dx%d tiles", AMR_LEVELS, AMR_TILE, AMR_TILE);
+}
+
+//========================================================================
+// Switch the spectral ocean on and off
+//========================================================================
+
+void toggle_ocean(void)
+{
+	struct ocean_params par;
+
+	if (ocean)
+	{
+		ocean_destroy(ocean);
+		ocean = NULL;
+		init_vertices();
+		init_grid();
+		if (amr)
+			wave_amr_load(amr, &p[0][0], &vx[0][0], &vy[0][0]);
+		telemetry_log("ocean", "off");
+		return;
+	}
+
+	ocean_default_params(&par, OCEAN_N);
+	par.length = (float)OCEAN_LENGTH;
+	ocean = ocean_create(&par);
+	if (!ocean)
+	{
+		fprintf(stderr, "Error: cannot create the ocean spectrum\n");
+		return;
+	}
+	telemetry_log("ocean", "on, %dx%d spectrum over %.0f m", OCEAN_N, OCEAN_N, OCEAN_LENGTH);
+}
+
+//========================================================================
+// Sample the ocean at time t into the pressure grid and the normals and
+// displace the vertices horizontally.  The patch covers the grid once, so the grid
+// keeps its -1..1 extent and heights are scaled to match.
+//========================================================================
+
+void ocean_grid(double t)
+{
+	double scale = 2.0 / OCEAN_LENGTH;
+	float h, disp[2], n[3];
+	int x, y, pos;
+
+	ocean_evaluate(ocean, t);
+
+	for (y = 0; y < GRIDH; y++)
+	{
+		for (x = 0; x < GRIDW; x++)
+		{
+			ocean_sample(ocean, (float)x / (float)GRIDW, (float)y / (float)GRIDH, &h, disp, n);
+
+			p[x][y] = h * scale * OCEAN_EXAGGERATION * 50.0;
+			normx[x][y] = n[0];
+			normy[x][y] = n[1];
+			normz[x][y] = n[2];
+
+			pos = y * GRIDW + x;
+			vertex[pos].x = (GLfloat)((x - GRIDW / 2) / (double)(GRIDW / 2) + disp[0] * scale);
+			vertex[pos].y = (GLfloat)((y - GRIDH / 2) / (double)(GRIDH / 2) + disp[1] * scale);
+		}
+	}
+}
 
+//========================================================================
+// Compare the adaptive solver against a uniform grid at its finest
+// resolution (every tile refined) and report the memory both use
+//========================================================================
+
+void amr_report(int steps)
+{
+	static double pa[GRIDW][GRIDH], pf[GRIDW][GRIDH];
+	struct wave_amr *adaptive, *full;
+	int tiles_a[AMR_MAX_LEVELS], tiles_f[AMR_MAX_LEVELS];
+	size_t bytes_a, bytes_f;
+	double err, peak;
+	int s, x, y;
+
+	init_grid();
+	adaptive = wave_amr_create(GRIDW, GRIDH, AMR_TILE, AMR_LEVELS, AMR_THRESHOLD);
+	full = wave_amr_create(GRIDW, GRIDH, AMR_TILE, AMR_LEVELS, 0.0);
+	if (!adaptive || !full)
+	{
+		fprintf(stderr, "Error: cannot create the adaptive grid\n");
+		exit(EXIT_FAILURE);
+	}
+	wave_amr_load(adaptive, &p[0][0], &vx[0][0], &vy[0][0]);
+	wave_amr_load(full, &p[0][0], &vx[0][0], &vy[0][0]);
+
+	printf("step    max|p|   max error   adaptive tiles/bytes     uniform tiles/bytes\n");
+	for (s = 0; s <= steps; s++)
+	{
+		if (s % 50 == 0)
+		{
+			wave_amr_store(adaptive, &pa[0][0], NULL, NULL);
+			wave_amr_store(full, &pf[0][0], NULL, NULL);
+
+			err = peak = 0.0;
+			for (x = 0; x < GRIDW; x++)
+				for (y = 0; y < GRIDH; y++)
+				{
+					err = fmax(err, fabs(pa[x][y] - pf[x][y]));
+					peak = fmax(peak, fabs(pf[x][y]));
+				}
+
+			bytes_a = wave_amr_usage(adaptive, tiles_a);
+			bytes_f = wave_amr_usage(full, tiles_f);
+			printf("%4d  %8.3f  %10.5f  %4d/%4d/%4d %9lu  %4d/%4d/%4d %9lu\n", s, peak, err,
+				tiles_a[0], tiles_a[1], tiles_a[2], (unsigned long)bytes_a,
+				tiles_f[0], tiles_f[1], tiles_f[2], (unsigned long)bytes_f);
+		}
+
+		wave_amr_step(adaptive, MAX_DELTA_T * ANIMATION_SPEED);
+		wave_amr_step(full, MAX_DELTA_T * ANIMATION_SPEED);
+	}
+
+	wave_amr_destroy(adaptive);
+	wave_amr_destroy(full);
 }
 
 //========================================================================
@@ -381,6 +482,14 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 		break;
 	case GLFW_KEY_SPACE:
 		init_grid();
+		if (amr)
+			wave_amr_load(amr, &p[0][0], &vx[0][0], &vy[0][0]);
+		break;
+	case GLFW_KEY_M:
+		toggle_amr();
+		break;
+	case GLFW_KEY_O:
+		toggle_ocean();
 		break;
 	case GLFW_KEY_LEFT:
 		alpha += 5;
@@ -488,8 +597,19 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 int main(int argc, char* argv[])
 {
 	GLFWwindow* window;
-	double t, dt_total, t_old;
-	int width, height;
+	double t, dt_total, t_old, t_phase;
+	int width, height, steps;
+
+	if (argc > 1 && strcmp(argv[1], "--amr-report") == 0)
+	{
+		amr_report(argc > 2 ? atoi(argv[2]) : 400);
+		exit(EXIT_SUCCESS);
+	}
+	if (argc > 1 && strcmp(argv[1], "--bench-ocean") == 0)
+	{
+		ocean_bench();
+		exit(EXIT_SUCCESS);
+	}
 
 	glfwSetErrorCallback(error_callback);
 
@@ -523,6 +643,8 @@ int main(int argc, char* argv[])
 	init_grid();
 	adjust_grid();
 
+	// Initialize frame-budget governor
+	governor_init(&gov, TARGET_FRAME_TIME, MAX_DELTA_T, MAX_STABLE_DELTA_T);
 
 	// Initialize timer
 	t_old = glfwGetTime() - 0.01;
@@ -533,23 +655,53 @@ int main(int argc, char* argv[])
 		dt_total = t - t_old;
 		t_old = t;
 
-		// Safety - iterate if dt_total is too large
-		while (dt_total > 0.f)
+		t_phase = glfwGetTime();
+		if (ocean)
 		{
-			// Select iteration time step
-			dt = dt_total > MAX_DELTA_T ? MAX_DELTA_T : dt_total;
-			dt_total -= dt;
-
-			// Calculate wave propagation
-			calc_grid();
+			// The spectrum is evaluated at t directly, nothing to step.  Its
+			// cost counts with the vertex update, so the governor plans no
+			// substeps and keeps the substep cost it learned from the solvers
+			ocean_grid(t);
+			governor_record(&gov, GOV_PHASE_ADJUST, glfwGetTime() - t_phase);
+		}
+		else
+		{
+			// Let the governor cap the substeps so a slow frame cannot make
+			// the next one slower still
+			steps = governor_plan(&gov, dt_total, &dt);
+			while (steps-- > 0)
+			{
+				// Calculate wave propagation
+				if (amr)
+					wave_amr_step(amr, dt * ANIMATION_SPEED);
+				else
+					calc_grid();
+			}
+			if (amr)
+				wave_amr_store(amr, &p[0][0], NULL, NULL);
+			governor_record(&gov, GOV_PHASE_CALC, glfwGetTime() - t_phase);
 		}
 
 		// Compute height of each vertex
+		t_phase = glfwGetTime();
 		adjust_grid();
+		governor_record(&gov, GOV_PHASE_ADJUST, glfwGetTime() - t_phase);
+
+		if (!ocean && governor_normals_due(&gov))
+		{
+			t_phase = glfwGetTime();
+			calc_normals();
+			governor_record(&gov, GOV_PHASE_NORMALS, glfwGetTime() - t_phase);
+		}
 
 		// Draw wave grid to OpenGL display
-		draw_scene(window);
+		t_phase = glfwGetTime();
+		draw_scene(window, gov.lod);
+		governor_record(&gov, GOV_PHASE_DRAW, glfwGetTime() - t_phase);
+
+		governor_end_frame(&gov);
 
+		glfwSwapBuffers(window);
 		glfwPollEvents();
 	}
 
@@ -0,0 +1,683 @@
+/*****************************************************************************
+ * Block-structured adaptive mesh refinement for the wave simulation
+ *****************************************************************************/
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wave_amr.h"
+
+// Fields of a tile
+#define FIELD_P 0
+#define FIELD_VX 1
+#define FIELD_VY 2
+
+// Base level steps between two regrids
+#define AMR_REGRID_INTERVAL 8
+
+/* Tile storage, n = tile size:
+ *
+ *   one ghost ring around the n x n interior, row major with y as the row,
+ *   interior cell (i, j) at (j + 1) * (n + 2) + (i + 1), i, j in [-1, n].
+ *
+ * vx(i, j) lives on the face between cells i and i + 1, vy(i, j) on the
+ * face between cells j and j + 1, exactly like vx[x][y] and vy[x][y] in
+ * calc_grid().  As there, the pressure of level 0 row and column 0 never
+ * changes; on finer levels that is every cell those cover.
+ */
+
+static int idx(int n, int i, int j)
+{
+	return (j + 1) * (n + 2) + (i + 1);
+}
+
+static int wrap(int v, int size)
+{
+	v %= size;
+	return v < 0 ? v + size : v;
+}
+
+static double* field(const struct amr_patch* t, int f, int old)
+{
+	switch (f)
+	{
+	case FIELD_P:
+		return old ? t->p_old : t->p;
+	case FIELD_VX:
+		return old ? t->vx_old : t->vx;
+	default:
+		return old ? t->vy_old : t->vy;
+	}
+}
+
+//========================================================================
+// Tile management
+//========================================================================
+
+static struct amr_patch* patch_new(const struct wave_amr* a, int ti, int tj)
+{
+	struct amr_patch* t;
+	size_t size = (size_t)(a->tile + 2) * (a->tile + 2);
+
+	t = (struct amr_patch*)malloc(sizeof(struct amr_patch));
+	if (!t)
+		return NULL;
+
+	// One block for all six fields
+	t->p = (double*)calloc(6 * size, sizeof(double));
+	if (!t->p)
+	{
+		free(t);
+		return NULL;
+	}
+
+	t->ti = ti;
+	t->tj = tj;
+	t->vx = t->p + size;
+	t->vy = t->p + 2 * size;
+	t->p_old = t->p + 3 * size;
+	t->vx_old = t->p + 4 * size;
+	t->vy_old = t->p + 5 * size;
+	return t;
+}
+
+static void patch_free(struct amr_patch* t)
+{
+	if (t)
+	{
+		free(t->p);
+		free(t);
+	}
+}
+
+static struct amr_patch* tile_at(const struct wave_amr* a, int l, int ti, int tj)
+{
+	const struct amr_level* lev = &a->level[l];
+
+	return lev->tile[wrap(tj, lev->th) * lev->tw + wrap(ti, lev->tw)];
+}
+
+static void rebuild_list(struct wave_amr* a, int l)
+{
+	struct amr_level* lev = &a->level[l];
+	int k;
+
+	lev->count = 0;
+	for (k = 0; k < lev->tw * lev->th; k++)
+		if (lev->tile[k])
+			lev->list[lev->count++] = lev->tile[k];
+}
+
+//========================================================================
+// Sampling across levels
+//========================================================================
+
+static double coarse_value(const struct wave_amr* a, int l, int gx, int gy, int f, double frac);
+
+// Value of a field at a cell of level l, at the given fraction of the
+// level's current step.  Falls back to coarser levels where l is absent.
+static double level_value(const struct wave_amr* a, int l, int gx, int gy, int f, double frac)
+{
+	int n = a->tile;
+	struct amr_patch* t;
+	int k;
+	double cur, old;
+
+	gx = wrap(gx, a->w << l);
+	gy = wrap(gy, a->h << l);
+
+	t = tile_at(a, l, gx / n, gy / n);
+	if (!t)
+		return coarse_value(a, l, gx, gy, f, 1.0);
+
+	k = idx(n, gx % n, gy % n);
+	cur = field(t, f, 0)[k];
+	if (frac >= 1.0)
+		return cur;
+
+	old = field(t, f, 1)[k];
+	return old + (cur - old) * frac;
+}
+
+// Value of a field at a cell of level l (l >= 1) interpolated from level l - 1
+static double coarse_value(const struct wave_amr* a, int l, int gx, int gy, int f, double frac)
+{
+	int cx, cy;
+
+	gx = wrap(gx, a->w << l);
+	gy = wrap(gy, a->h << l);
+	cx = gx >> 1;
+	cy = gy >> 1;
+
+	switch (f)
+	{
+	case FIELD_VX:
+		// Odd faces coincide with a coarse face, even ones split a coarse cell
+		if (gx & 1)
+			return level_value(a, l - 1, cx, cy, f, frac);
+		return 0.5 * (level_value(a, l - 1, cx - 1, cy, f, frac) + level_value(a, l - 1, cx, cy, f, frac));
+	case FIELD_VY:
+		if (gy & 1)
+			return level_value(a, l - 1, cx, cy, f, frac);
+		return 0.5 * (level_value(a, l - 1, cx, cy - 1, f, frac) + level_value(a, l - 1, cx, cy, f, frac));
+	default:
+		return level_value(a, l - 1, cx, cy, f, frac);
+	}
+}
+
+//========================================================================
+// Ghost cells
+//========================================================================
+
+static void fill_ghost(const struct wave_amr* a, int l, struct amr_patch* t, int i, int j, double frac)
+{
+	int n = a->tile;
+	int gx = t->ti * n + i;
+	int gy = t->tj * n + j;
+	int k = idx(n, i, j);
+	int ks, f;
+	struct amr_patch* s;
+
+	gx = wrap(gx, a->w << l);
+	gy = wrap(gy, a->h << l);
+
+	s = tile_at(a, l, gx / n, gy / n);
+	if (s)
+	{
+		// Neighbour on the same level, already at the same time
+		ks = idx(n, gx % n, gy % n);
+		t->p[k] = s->p[ks];
+		t->vx[k] = s->vx[ks];
+		t->vy[k] = s->vy[ks];
+	}
+	else
+	{
+		for (f = FIELD_P; f <= FIELD_VY; f++)
+			field(t, f, 0)[k] = coarse_value(a, l, gx, gy, f, frac);
+	}
+}
+
+static void fill_ghosts(struct wave_amr* a, int l, double frac)
+{
+	struct amr_level* lev = &a->level[l];
+	int n = a->tile;
+	int c, i, j;
+
+	for (c = 0; c < lev->count; c++)
+	{
+		for (i = -1; i <= n; i++)
+		{
+			fill_ghost(a, l, lev->list[c], i, -1, frac);
+			fill_ghost(a, l, lev->list[c], i, n, frac);
+		}
+		for (j = 0; j < n; j++)
+		{
+			fill_ghost(a, l, lev->list[c], -1, j, frac);
+			fill_ghost(a, l, lev->list[c], n, j, frac);
+		}
+	}
+}
+
+//========================================================================
+// Time stepping
+//========================================================================
+
+// Cells of level l in level 0 row or column 0, whose pressure is held
+static int held_cells(int l)
+{
+	return 1 << l;
+}
+
+// First interior index of a tile at tile coordinate tc whose pressure
+// changes, given held cells along that axis
+static int first_free(int n, int tc, int held)
+{
+	int first = held - tc * n;
+	return first < 0 ? 0 : first > n ? n : first;
+}
+
+// One calc_grid() step on a tile.  With the spacing and the step both
+// halved per level the factor in front of the differences stays the same.
+static void step_patch(int n, int l, struct amr_patch* t, double c)
+{
+	int i, j;
+	int i0 = first_free(n, t->ti, held_cells(l));
+	int j0 = first_free(n, t->tj, held_cells(l));
+	double* p = t->p;
+	double* vx = t->vx;
+	double* vy = t->vy;
+
+	// Accelerations and speeds, including the faces of the left and
+	// bottom ghosts the pressure update below reads from
+	for (j = 0; j < n; j++)
+		for (i = -1; i < n; i++)
+			vx[idx(n, i, j)] += (p[idx(n, i, j)] - p[idx(n, i + 1, j)]) * c;
+
+	for (j = -1; j < n; j++)
+		for (i = 0; i < n; i++)
+			vy[idx(n, i, j)] += (p[idx(n, i, j)] - p[idx(n, i, j + 1)]) * c;
+
+	// Pressure, except where calc_grid() leaves it alone
+	for (j = j0; j < n; j++)
+		for (i = i0; i < n; i++)
+			p[idx(n, i, j)] += (vx[idx(n, i - 1, j)] - vx[idx(n, i, j)]
+				+ vy[idx(n, i, j - 1)] - vy[idx(n, i, j)]) * c;
+}
+
+// Average a fine level onto the part of its parent level it covers
+static void restrict_level(struct wave_amr* a, int l)
+{
+	struct amr_level* lev = &a->level[l];
+	int n = a->tile, h = n / 2;
+	int c, i, j, ox, oy, k, i0, j0;
+	struct amr_patch *t, *pt;
+
+	for (c = 0; c < lev->count; c++)
+	{
+		t = lev->list[c];
+		pt = tile_at(a, l - 1, t->ti >> 1, t->tj >> 1);
+		ox = (t->ti & 1) * h;
+		oy = (t->tj & 1) * h;
+		i0 = first_free(n, pt->ti, held_cells(l - 1));
+		j0 = first_free(n, pt->tj, held_cells(l - 1));
+
+		for (j = 0; j < h; j++)
+		{
+			for (i = 0; i < h; i++)
+			{
+				k = idx(n, ox + i, oy + j);
+				if (ox + i >= i0 && oy + j >= j0)
+					pt->p[k] = 0.25 * (t->p[idx(n, 2 * i, 2 * j)] + t->p[idx(n, 2 * i + 1, 2 * j)]
+						+ t->p[idx(n, 2 * i, 2 * j + 1)] + t->p[idx(n, 2 * i + 1, 2 * j + 1)]);
+				pt->vx[k] = 0.5 * (t->vx[idx(n, 2 * i + 1, 2 * j)] + t->vx[idx(n, 2 * i + 1, 2 * j + 1)]);
+				pt->vy[k] = 0.5 * (t->vy[idx(n, 2 * i, 2 * j + 1)] + t->vy[idx(n, 2 * i + 1, 2 * j + 1)]);
+			}
+		}
+	}
+}
+
+static void advance(struct wave_amr* a, int l, double c, double frac)
+{
+	struct amr_level* lev = &a->level[l];
+	size_t size = (size_t)(a->tile + 2) * (a->tile + 2);
+	int i;
+
+	for (i = 0; i < lev->count; i++)
+		memcpy(lev->list[i]->p_old, lev->list[i]->p, 3 * size * sizeof(double));
+
+	fill_ghosts(a, l, frac);
+
+	for (i = 0; i < lev->count; i++)
+		step_patch(a->tile, l, lev->list[i], c);
+
+	// Subcycle the finer level, twice half the step, then fold it back
+	if (l + 1 < a->levels && a->level[l + 1].count > 0)
+	{
+		advance(a, l + 1, c, 0.0);
+		advance(a, l + 1, c, 0.5);
+		restrict_level(a, l + 1);
+	}
+}
+
+void wave_amr_step(struct wave_amr* a, double time_step)
+{
+	advance(a, 0, time_step, 1.0);
+
+	a->steps++;
+	if (a->regrid_interval > 0 && a->steps % a->regrid_interval == 0)
+		wave_amr_regrid(a);
+}
+
+//========================================================================
+// Refinement
+//========================================================================
+
+// Flag the tiles of level l + 1 whose region of level l has a steep gradient
+static void flag_gradient(struct wave_amr* a, int l, unsigned char* flag)
+{
+	struct amr_level* lev = &a->level[l];
+	struct amr_level* fine = &a->level[l + 1];
+	int n = a->tile, h = n / 2;
+	int c, qx, qy, i, j, x, y;
+	double g, gmax, scale = (double)(1 << l);
+	struct amr_patch* t;
+
+	fill_ghosts(a, l, 1.0);
+
+	for (c = 0; c < lev->count; c++)
+	{
+		t = lev->list[c];
+		for (qy = 0; qy < 2; qy++)
+		{
+			for (qx = 0; qx < 2; qx++)
+			{
+				gmax = 0.0;
+				for (j = 0; j < h; j++)
+				{
+					y = qy * h + j;
+					for (i = 0; i < h; i++)
+					{
+						x = qx * h + i;
+						g = fabs(t->p[idx(n, x + 1, y)] - t->p[idx(n, x, y)])
+							+ fabs(t->p[idx(n, x, y + 1)] - t->p[idx(n, x, y)]);
+						if (g > gmax)
+							gmax = g;
+					}
+				}
+
+				if (a->threshold <= 0.0 || gmax * scale > a->threshold)
+					flag[(2 * t->tj + qy) * fine->tw + 2 * t->ti + qx] = 1;
+			}
+		}
+	}
+}
+
+// Grow the flags by one tile so features do not leave the fine region
+// between two regrids
+static void dilate(const struct amr_level* lev, unsigned char* flag)
+{
+	int ti, tj, dx, dy, k;
+
+	for (k = 0; k < lev->tw * lev->th; k++)
+	{
+		if (flag[k] != 1)
+			continue;
+		ti = k % lev->tw;
+		tj = k / lev->tw;
+		for (dy = -1; dy <= 1; dy++)
+			for (dx = -1; dx <= 1; dx++)
+			{
+				int kk = wrap(tj + dy, lev->th) * lev->tw + wrap(ti + dx, lev->tw);
+				if (!flag[kk])
+					flag[kk] = 2;
+			}
+	}
+}
+
+// A tile of level l is properly nested if the parents of it and of all its
+// neighbours exist, so its ghosts never need more than one level of fallback
+static int nested(const struct wave_amr* a, int l, int ti, int tj)
+{
+	const struct amr_level* lev = &a->level[l];
+	int dx, dy;
+
+	if (l <= 1)
+		return 1;
+
+	for (dy = -1; dy <= 1; dy++)
+		for (dx = -1; dx <= 1; dx++)
+			if (!tile_at(a, l - 1, wrap(ti + dx, lev->tw) >> 1, wrap(tj + dy, lev->th) >> 1))
+				return 0;
+	return 1;
+}
+
+// True if a tile of level l + 1 relies on the tile (ti, tj) of level l
+static int needed(const struct wave_amr* a, int l, int ti, int tj)
+{
+	const struct amr_level* fine;
+	int ci, cj, dx, dy, fx, fy;
+
+	if (l + 1 >= a->levels)
+		return 0;
+
+	fine = &a->level[l + 1];
+	for (cj = 2 * tj - 2; cj <= 2 * tj + 3; cj++)
+		for (ci = 2 * ti - 2; ci <= 2 * ti + 3; ci++)
+		{
+			if (!tile_at(a, l + 1, ci, cj))
+				continue;
+			for (dy = -1; dy <= 1; dy++)
+				for (dx = -1; dx <= 1; dx++)
+				{
+					fx = wrap(ci + dx, fine->tw) >> 1;
+					fy = wrap(cj + dy, fine->th) >> 1;
+					if (fx == wrap(ti, a->level[l].tw) && fy == wrap(tj, a->level[l].th))
+						return 1;
+				}
+		}
+	return 0;
+}
+
+// Initialise a new tile, ghosts included, from its parent level
+static void prolong_patch(const struct wave_amr* a, int l, struct amr_patch* t)
+{
+	int n = a->tile;
+	int i, j, f, k;
+
+	for (j = -1; j <= n; j++)
+		for (i = -1; i <= n; i++)
+		{
+			k = idx(n, i, j);
+			for (f = FIELD_P; f <= FIELD_VY; f++)
+				field(t, f, 0)[k] = field(t, f, 1)[k] = coarse_value(a, l, t->ti * n + i, t->tj * n + j, f, 1.0);
+		}
+}
+
+void wave_amr_regrid(struct wave_amr* a)
+{
+	unsigned char* flag[AMR_MAX_LEVELS] = { NULL };
+	struct amr_level* lev;
+	struct amr_patch* t;
+	int l, k, ti, tj, dx, dy;
+
+	for (l = 1; l < a->levels; l++)
+	{
+		lev = &a->level[l];
+		flag[l] = (unsigned char*)calloc((size_t)lev->tw * lev->th, 1);
+		if (!flag[l])
+			goto done;
+		flag_gradient(a, l - 1, flag[l]);
+		dilate(lev, flag[l]);
+	}
+
+	// A flagged tile keeps the parents of its neighbourhood flagged as well
+	for (l = a->levels - 1; l >= 2; l--)
+	{
+		lev = &a->level[l];
+		for (k = 0; k < lev->tw * lev->th; k++)
+		{
+			if (!flag[l][k])
+				continue;
+			ti = k % lev->tw;
+			tj = k / lev->tw;
+			for (dy = -1; dy <= 1; dy++)
+				for (dx = -1; dx <= 1; dx++)
+					flag[l - 1][(wrap(tj + dy, lev->th) >> 1) * a->level[l - 1].tw + (wrap(ti + dx, lev->tw) >> 1)] = 1;
+		}
+	}
+
+	// Coarsen, finest level first so dependencies are released in order
+	for (l = a->levels - 1; l >= 1; l--)
+	{
+		lev = &a->level[l];
+		for (k = 0; k < lev->tw * lev->th; k++)
+		{
+			if (!lev->tile[k] || flag[l][k] || needed(a, l, k % lev->tw, k / lev->tw))
+				continue;
+			patch_free(lev->tile[k]);
+			lev->tile[k] = NULL;
+		}
+		rebuild_list(a, l);
+	}
+
+	// Refine, coarsest level first so new tiles can nest in new parents
+	for (l = 1; l < a->levels; l++)
+	{
+		lev = &a->level[l];
+		for (k = 0; k < lev->tw * lev->th; k++)
+		{
+			if (lev->tile[k] || !flag[l][k] || !nested(a, l, k % lev->tw, k / lev->tw))
+				continue;
+			t = patch_new(a, k % lev->tw, k / lev->tw);
+			if (!t)
+				continue;
+			prolong_patch(a, l, t);
+			lev->tile[k] = t;
+		}
+		rebuild_list(a, l);
+	}
+
+done:
+	for (l = 1; l < a->levels; l++)
+		free(flag[l]);
+}
+
+//========================================================================
+// Construction and data exchange
+//========================================================================
+
+struct wave_amr* wave_amr_create(int w, int h, int tile, int levels, double threshold)
+{
+	struct wave_amr* a;
+	struct amr_level* lev;
+	int l, k;
+
+	if (tile < 2 || tile % 2 || w % tile || h % tile || levels < 1 || levels > AMR_MAX_LEVELS)
+		return NULL;
+
+	a = (struct wave_amr*)calloc(1, sizeof(struct wave_amr));
+	if (!a)
+		return NULL;
+
+	a->w = w;
+	a->h = h;
+	a->tile = tile;
+	a->levels = levels;
+	a->threshold = threshold;
+	a->regrid_interval = AMR_REGRID_INTERVAL;
+
+	for (l = 0; l < levels; l++)
+	{
+		lev = &a->level[l];
+		lev->tw = (w / tile) << l;
+		lev->th = (h / tile) << l;
+		lev->tile = (struct amr_patch**)calloc((size_t)lev->tw * lev->th, sizeof(struct amr_patch*));
+		lev->list = (struct amr_patch**)calloc((size_t)lev->tw * lev->th, sizeof(struct amr_patch*));
+		if (!lev->tile || !lev->list)
+		{
+			wave_amr_destroy(a);
+			return NULL;
+		}
+	}
+
+	// The base level is always complete
+	lev = &a->level[0];
+	for (k = 0; k < lev->tw * lev->th; k++)
+	{
+		lev->tile[k] = patch_new(a, k % lev->tw, k / lev->tw);
+		if (!lev->tile[k])
+		{
+			wave_amr_destroy(a);
+			return NULL;
+		}
+	}
+	rebuild_list(a, 0);
+
+	return a;
+}
+
+void wave_amr_destroy(struct wave_amr* a)
+{
+	int l, k;
+
+	if (!a)
+		return;
+
+	for (l = 0; l < a->levels; l++)
+	{
+		if (a->level[l].tile)
+			for (k = 0; k < a->level[l].tw * a->level[l].th; k++)
+				patch_free(a->level[l].tile[k]);
+		free(a->level[l].tile);
+		free(a->level[l].list);
+	}
+	free(a);
+}
+
+void wave_amr_load(struct wave_amr* a, const double* p, const double* vx, const double* vy)
+{
+	struct amr_level* lev;
+	int n = a->tile;
+	int l, k, x, y;
+	struct amr_patch* t;
+
+	// Drop all refinement
+	for (l = 1; l < a->levels; l++)
+	{
+		lev = &a->level[l];
+		for (k = 0; k < lev->tw * lev->th; k++)
+		{
+			patch_free(lev->tile[k]);
+			lev->tile[k] = NULL;
+		}
+		lev->count = 0;
+	}
+
+	for (y = 0; y < a->h; y++)
+		for (x = 0; x < a->w; x++)
+		{
+			t = tile_at(a, 0, x / n, y / n);
+			k = idx(n, x % n, y % n);
+			t->p[k] = p[x * a->h + y];
+			t->vx[k] = vx[x * a->h + y];
+			t->vy[k] = vy[x * a->h + y];
+		}
+
+	// Each regrid can only add one level
+	for (l = 1; l < a->levels; l++)
+		wave_amr_regrid(a);
+}
+
+void wave_amr_store(const struct wave_amr* a, double* p, double* vx, double* vy)
+{
+	int n = a->tile;
+	int k, x, y;
+	struct amr_patch* t;
+
+	for (y = 0; y < a->h; y++)
+		for (x = 0; x < a->w; x++)
+		{
+			t = tile_at(a, 0, x / n, y / n);
+			k = idx(n, x % n, y % n);
+			if (p)
+				p[x * a->h + y] = t->p[k];
+			if (vx)
+				vx[x * a->h + y] = t->vx[k];
+			if (vy)
+				vy[x * a->h + y] = t->vy[k];
+		}
+}
+
+double wave_amr_sample(const struct wave_amr* a, double x, double y)
+{
+	int n = a->tile;
+	int l, gx, gy;
+	struct amr_patch* t;
+
+	for (l = a->levels - 1; l >= 0; l--)
+	{
+		gx = wrap((int)floor(x * (1 << l)), a->w << l);
+		gy = wrap((int)floor(y * (1 << l)), a->h << l);
+		t = tile_at(a, l, gx / n, gy / n);
+		if (t)
+			return t->p[idx(n, gx % n, gy % n)];
+	}
+	return 0.0;
+}
+
+size_t wave_amr_usage(const struct wave_amr* a, int* tiles)
+{
+	size_t size = (size_t)(a->tile + 2) * (a->tile + 2);
+	size_t bytes = 0;
+	int l;
+
+	for (l = 0; l < a->levels; l++)
+	{
+		if (tiles)
+			tiles[l] = a->level[l].count;
+		bytes += a->level[l].count * (sizeof(struct amr_patch) + 6 * size * sizeof(double));
+		bytes += 2 * (size_t)a->level[l].tw * a->level[l].th * sizeof(struct amr_patch*);
+	}
+	return bytes;
+}
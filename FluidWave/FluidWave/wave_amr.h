@@ -0,0 +1,88 @@
+/*****************************************************************************
+ * Block-structured adaptive mesh refinement for the wave simulation
+ *
+ * Same propagation scheme as calc_grid(), run on a hierarchy of levels.
+ * Every level is cut into square tiles of the same cell count; a tile at
+ * level l+1 covers a quarter of a tile at level l with twice the
+ * resolution.  Level 0 is always complete, finer tiles only exist where
+ * the pressure gradient exceeds the refinement threshold.
+ *
+ *   - Ghost cells of a tile come from its neighbours on the same level or,
+ *     where there is none, from the parent level interpolated in time.
+ *   - Fine levels take two half-length steps per parent step.
+ *   - After its children have caught up a level takes their average, so
+ *     level 0 always holds the composite solution.
+ *
+ * Arrays exchanged with the uniform solver are laid out as in wave.c,
+ * i.e. value[x][y] of a w x h grid.
+ *****************************************************************************/
+
+#ifndef WAVE_AMR_H
+#define WAVE_AMR_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AMR_MAX_LEVELS 4
+
+struct amr_patch
+{
+	int ti, tj;			// tile coordinates on its level
+	double* p;			// pressure, (tile + 2)^2 with one ghost ring
+	double* vx;			// velocity on the +x face of each cell
+	double* vy;			// velocity on the +y face of each cell
+	double* p_old;		// state at the start of the current step,
+	double* vx_old;		// interpolated by the children for their ghosts
+	double* vy_old;
+};
+
+struct amr_level
+{
+	int tw, th;					// tiles across the domain
+	struct amr_patch** tile;	// tw * th, NULL where the level is absent
+	struct amr_patch** list;	// the present tiles
+	int count;
+};
+
+struct wave_amr
+{
+	int w, h;			// level 0 size in cells
+	int tile;			// cells per tile side (even, divides w and h)
+	int levels;			// number of levels in use
+	double threshold;	// refine where |grad p| exceeds this (<= 0 refines everywhere)
+	int regrid_interval;
+	long steps;
+	struct amr_level level[AMR_MAX_LEVELS];
+};
+
+// Create a hierarchy over a w x h base grid.  Returns NULL if the sizes do
+// not fit the tile size or memory runs out.
+struct wave_amr* wave_amr_create(int w, int h, int tile, int levels, double threshold);
+void wave_amr_destroy(struct wave_amr* a);
+
+// Replace the whole state by a uniform w x h solution and refine it
+void wave_amr_load(struct wave_amr* a, const double* p, const double* vx, const double* vy);
+
+// Copy the composite solution back to uniform w x h arrays (any may be NULL)
+void wave_amr_store(const struct wave_amr* a, double* p, double* vx, double* vy);
+
+// Advance by one base level step; time_step is dt * ANIMATION_SPEED
+void wave_amr_step(struct wave_amr* a, double time_step);
+
+// Re-evaluate the refinement criterion and add or remove tiles
+void wave_amr_regrid(struct wave_amr* a);
+
+// Pressure at a point given in level 0 cell units, from the finest level
+double wave_amr_sample(const struct wave_amr* a, double x, double y);
+
+// Number of tiles per level and total bytes held by the tiles
+size_t wave_amr_usage(const struct wave_amr* a, int* tiles);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,113 @@
+/*****************************************************************************
+ * Uniform wave solver, see wave_solver.h
+ *****************************************************************************/
+
+#if defined(_MSC_VER)
+ // Make MS math.h define M_PI
+#define _USE_MATH_DEFINES
+#endif
+
+#include <math.h>
+
+#include "wave_solver.h"
+
+double dt;
+double p[GRIDW][GRIDH];		//pressure
+double vx[GRIDW][GRIDH], vy[GRIDW][GRIDH];	//velocity
+static double ax[GRIDW][GRIDH], ay[GRIDW][GRIDH];	//accleration
+
+//========================================================================
+// Initialize grid
+//========================================================================
+
+void init_grid(void)
+{
+	int x, y;
+	double dx, dy, d;
+
+	for (y = 0; y < GRIDH; y++)
+	{
+		for (x = 0; x < GRIDW; x++)
+		{
+			dx = (double)(x - GRIDW / 2);
+			dy = (double)(y - GRIDH / 2);
+			d = sqrt(dx * dx + dy * dy);
+			if (d < 0.1 * (double)(GRIDW / 2))
+			{
+				d = d * 10.0;
+				p[x][y] = -cos(d * (M_PI / (double)(GRIDW * 8))) * 50.0;
+			}
+			else
+				p[x][y] = 0.0;
+
+			vx[x][y] = 0.0;
+			vy[x][y] = 0.0;
+		}
+	}
+}
+
+//========================================================================
+// Describe the current wave surface as a triangle mesh for the ray
+// tracer, with the same positions adjust_grid() gives the vertices
+//========================================================================
+
+void wave_heightfield(struct heightfield_view* view)
+{
+	view->w = GRIDW;
+	view->h = GRIDH;
+	view->x0 = (float)(-(GRIDW / 2)) / (float)(GRIDW / 2);
+	view->y0 = (float)(-(GRIDH / 2)) / (float)(GRIDH / 2);
+	view->dx = 1.f / (float)(GRIDW / 2);
+	view->dy = 1.f / (float)(GRIDH / 2);
+	view->scale = (float)(1.0 / 50.0);
+	view->height = &p[0][0];
+	view->stride_x = GRIDH;
+	view->stride_y = 1;
+}
+
+
+//========================================================================
+// Calculate wave propagation
+//========================================================================
+
+void calc_grid(void)
+{
+	int x, y, x2, y2;
+	double time_step = dt * ANIMATION_SPEED;
+
+	// Compute accelerations
+	for (x = 0; x < GRIDW; x++)
+	{
+		x2 = (x + 1) % GRIDW;
+		for (y = 0; y < GRIDH; y++)
+			ax[x][y] = p[x][y] - p[x2][y];
+	}
+
+	for (y = 0; y < GRIDH; y++)
+	{
+		y2 = (y + 1) % GRIDH;
+		for (x = 0; x < GRIDW; x++)
+			ay[x][y] = p[x][y] - p[x][y2];
+	}
+
+	// Compute speeds
+	for (x = 0; x < GRIDW; x++)
+	{
+		for (y = 0; y < GRIDH; y++)
+		{
+			vx[x][y] = vx[x][y] + ax[x][y] * time_step;
+			vy[x][y] = vy[x][y] + ay[x][y] * time_step;
+		}
+	}
+
+	// Compute pressure
+	for (x = 1; x < GRIDW; x++)
+	{
+		x2 = x - 1;
+		for (y = 1; y < GRIDH; y++)
+		{
+			y2 = y - 1;
+			p[x][y] = p[x][y] + (vx[x2][y] - vx[x][y] + vy[x][y2] - vy[x][y]) * time_step;
+		}
+	}
+}
@@ -0,0 +1,55 @@
+/*****************************************************************************
+ * Uniform wave solver
+ *
+ * The grid state and propagation of the wave simulation, apart from the
+ * window and drawing in wave.c, so other programs can link the solver and
+ * step it themselves.  The ray tracer's host backend does so to render the
+ * live surface through wave_heightfield().
+ *
+ * Arrays are value[x][y] of the GRIDW x GRIDH grid; wave.c and the
+ * adaptive solver exchange them as they are.
+ *****************************************************************************/
+
+#ifndef WAVE_SOLVER_H
+#define WAVE_SOLVER_H
+
+#include "heightfield.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GRIDW 50
+#define GRIDH 50
+
+// Maximum delta T to allow for differential calculations
+#define MAX_DELTA_T 0.01
+
+// Largest delta T the propagation stays stable for (time step 0.4 < 1/sqrt(2)),
+// used by the governor when it has to stretch the substeps
+#define MAX_STABLE_DELTA_T 0.04
+
+// Animation speed (10.0 looks good)
+#define ANIMATION_SPEED 10.0
+
+extern double dt;							// length of the next calc_grid() step
+extern double p[GRIDW][GRIDH];				// pressure
+extern double vx[GRIDW][GRIDH], vy[GRIDW][GRIDH];	// velocity
+
+// Pressure dip in the middle of a still grid
+void init_grid(void);
+
+// Advance the grid by one step of dt
+void calc_grid(void);
+
+// The current surface as a triangle mesh, with the positions adjust_grid()
+// gives the vertices.  Only heights come from the grid: in ocean mode the
+// horizontal displacement ocean_grid() gives the drawn vertices is not in
+// the view.
+void wave_heightfield(struct heightfield_view* view);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
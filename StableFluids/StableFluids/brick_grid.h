@@ -0,0 +1,179 @@
+/*****************************************************************************
+ * Bricked 3-D grid
+ *
+ * An nx x ny x nz grid of cells kept as 8 x 8 x 8 bricks that exist only
+ * where a solver asks for them; everywhere else, and outside the box, the
+ * grid reads as a background value.  A liquid fills a small part of its
+ * box, so memory follows the liquid instead of the box.
+ *
+ * Bricks are found through a dense table with one pointer per brick of the
+ * box (32K entries for 256^3), cells inside a brick are x fastest.  Bricks
+ * are allocated and released between passes, by one thread; released
+ * bricks are kept on a free list for reuse.
+ *****************************************************************************/
+
+#ifndef BRICK_GRIDH
+#define BRICK_GRIDH
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#define BRICK_LOG2 3
+#define BRICK_SIZE (1 << BRICK_LOG2)
+#define BRICK_MASK (BRICK_SIZE - 1)
+#define BRICK_CELLS (BRICK_SIZE * BRICK_SIZE * BRICK_SIZE)
+
+template <class T>
+class brick_grid
+{
+public:
+	brick_grid() : nx(0), ny(0), nz(0), bx(0), by(0), bz(0), background(), used(0) {}
+
+	brick_grid(int nx, int ny, int nz, T background)
+		: nx(nx), ny(ny), nz(nz),
+		bx((nx + BRICK_MASK) >> BRICK_LOG2), by((ny + BRICK_MASK) >> BRICK_LOG2), bz((nz + BRICK_MASK) >> BRICK_LOG2),
+		background(background), table((size_t)bx * by * bz, nullptr), used(0)
+	{
+	}
+
+	int brick_count() const { return (int)table.size(); }
+	int allocated_count() const { return used; }
+
+	// Bytes held by bricks, including those on the free list, plus the table
+	size_t bytes() const { return storage.size() * BRICK_CELLS * sizeof(T) + table.size() * sizeof(T*); }
+
+	int brick_index(int x, int y, int z) const
+	{
+		return ((z >> BRICK_LOG2) * by + (y >> BRICK_LOG2)) * bx + (x >> BRICK_LOG2);
+	}
+
+	static int cell_index(int x, int y, int z)
+	{
+		return (((z & BRICK_MASK) << BRICK_LOG2 | (y & BRICK_MASK)) << BRICK_LOG2) | (x & BRICK_MASK);
+	}
+
+	// First cell of brick b
+	void brick_origin(int b, int& x, int& y, int& z) const
+	{
+		x = (b % bx) << BRICK_LOG2;
+		y = (b / bx % by) << BRICK_LOG2;
+		z = (b / bx / by) << BRICK_LOG2;
+	}
+
+	bool allocated(int b) const { return table[b] != nullptr; }
+	T* brick(int b) { return table[b]; }
+	const T* brick(int b) const { return table[b]; }
+
+	// A new brick is filled with the background value
+	T* allocate(int b)
+	{
+		if (table[b])
+			return table[b];
+		if (spare.empty())
+		{
+			storage.emplace_back(new T[BRICK_CELLS]);
+			spare.push_back(storage.back().get());
+		}
+		table[b] = spare.back();
+		spare.pop_back();
+		std::fill(table[b], table[b] + BRICK_CELLS, background);
+		used++;
+		return table[b];
+	}
+
+	void release(int b)
+	{
+		if (!table[b])
+			return;
+		spare.push_back(table[b]);
+		table[b] = nullptr;
+		used--;
+	}
+
+	// Cell of an allocated brick
+	T& at(int x, int y, int z) { return table[brick_index(x, y, z)][cell_index(x, y, z)]; }
+
+	// Value of a cell, the background outside the box or in a missing brick
+	T get(int x, int y, int z) const
+	{
+		if ((unsigned)x >= (unsigned)nx || (unsigned)y >= (unsigned)ny || (unsigned)z >= (unsigned)nz)
+			return background;
+		const T* p = table[brick_index(x, y, z)];
+		return p ? p[cell_index(x, y, z)] : background;
+	}
+
+	// The same with the coordinates clamped to the box
+	T clamped(int x, int y, int z) const
+	{
+		x = x < 0 ? 0 : (x >= nx ? nx - 1 : x);
+		y = y < 0 ? 0 : (y >= ny ? ny - 1 : y);
+		z = z < 0 ? 0 : (z >= nz ? nz - 1 : z);
+		const T* p = table[brick_index(x, y, z)];
+		return p ? p[cell_index(x, y, z)] : background;
+	}
+
+	// Trilinear interpolation at a position in cell units, cell (i, j, k)
+	// being at (i, j, k), clamped to the box.  Needs at least 2 cells a side.
+	T sample(float x, float y, float z) const
+	{
+		x = x < 0.f ? 0.f : (x > (float)(nx - 1) ? (float)(nx - 1) : x);
+		y = y < 0.f ? 0.f : (y > (float)(ny - 1) ? (float)(ny - 1) : y);
+		z = z < 0.f ? 0.f : (z > (float)(nz - 1) ? (float)(nz - 1) : z);
+
+		int i = std::min((int)x, nx - 2);
+		int j = std::min((int)y, ny - 2);
+		int k = std::min((int)z, nz - 2);
+		float fx = x - (float)i, fy = y - (float)j, fz = z - (float)k;
+		T c000, c100, c010, c110, c001, c101, c011, c111;
+
+		// Most samples have all 8 cells in one brick
+		if ((i & BRICK_MASK) != BRICK_MASK && (j & BRICK_MASK) != BRICK_MASK && (k & BRICK_MASK) != BRICK_MASK)
+		{
+			const T* p = table[brick_index(i, j, k)];
+			if (!p)
+				return background;
+			p += cell_index(i, j, k);
+			c000 = p[0];
+			c100 = p[1];
+			c010 = p[BRICK_SIZE];
+			c110 = p[BRICK_SIZE + 1];
+			c001 = p[BRICK_SIZE * BRICK_SIZE];
+			c101 = p[BRICK_SIZE * BRICK_SIZE + 1];
+			c011 = p[BRICK_SIZE * BRICK_SIZE + BRICK_SIZE];
+			c111 = p[BRICK_SIZE * BRICK_SIZE + BRICK_SIZE + 1];
+		}
+		else
+		{
+			c000 = get(i, j, k);
+			c100 = get(i + 1, j, k);
+			c010 = get(i, j + 1, k);
+			c110 = get(i + 1, j + 1, k);
+			c001 = get(i, j, k + 1);
+			c101 = get(i + 1, j, k + 1);
+			c011 = get(i, j + 1, k + 1);
+			c111 = get(i + 1, j + 1, k + 1);
+		}
+
+		T c00 = c000 + (c100 - c000) * fx;
+		T c10 = c010 + (c110 - c010) * fx;
+		T c01 = c001 + (c101 - c001) * fx;
+		T c11 = c011 + (c111 - c011) * fx;
+		T c0 = c00 + (c10 - c00) * fy;
+		T c1 = c01 + (c11 - c01) * fy;
+		return c0 + (c1 - c0) * fz;
+	}
+
+	int nx, ny, nz;		// cells
+	int bx, by, bz;		// bricks
+	T background;
+
+private:
+	std::vector<T*> table;
+	std::vector<std::unique_ptr<T[]>> storage;
+	std::vector<T*> spare;
+	int used;
+};
+
+#endif
@@ -0,0 +1,64 @@
+/*****************************************************************************
+ * 2-D field
+ *
+ * The CPU stand-in for a float texture of the WebGL demos: w x h texels of
+ * c interleaved channels, row major with y as the row.  Texel (x, y) sits
+ * at texture coordinate ((x + 0.5) / w, (y + 0.5) / h).
+ *****************************************************************************/
+
+#ifndef FIELDH
+#define FIELDH
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+class field
+{
+public:
+	field() : w(0), h(0), c(0) {}
+	field(int w, int h, int c) : w(w), h(h), c(c), data((size_t)w * h * c, 0.f) {}
+
+	float* at(int x, int y) { return &data[((size_t)y * w + x) * c]; }
+	const float* at(int x, int y) const { return &data[((size_t)y * w + x) * c]; }
+
+	// Texel with wrap around, as fract() does in the shaders
+	const float* wrap(int x, int y) const
+	{
+		x %= w; if (x < 0) x += w;
+		y %= h; if (y < 0) y += h;
+		return at(x, y);
+	}
+
+	void clear() { std::fill(data.begin(), data.end(), 0.f); }
+
+	// Bilinear sample at texture coordinates (u, v), clamped at the edges
+	// like a LINEAR filtered CLAMP_TO_EDGE texture
+	void sample(float u, float v, float* out) const
+	{
+		float x = u * (float)w - 0.5f;
+		float y = v * (float)h - 0.5f;
+		float fx0 = std::floor(x), fy0 = std::floor(y);
+		float fx = x - fx0, fy = y - fy0;
+		int x0 = (int)fx0, y0 = (int)fy0;
+		int x1 = x0 + 1, y1 = y0 + 1;
+		int k;
+
+		x0 = x0 < 0 ? 0 : (x0 >= w ? w - 1 : x0);
+		x1 = x1 < 0 ? 0 : (x1 >= w ? w - 1 : x1);
+		y0 = y0 < 0 ? 0 : (y0 >= h ? h - 1 : y0);
+		y1 = y1 < 0 ? 0 : (y1 >= h ? h - 1 : y1);
+
+		const float* a = at(x0, y0);
+		const float* b = at(x1, y0);
+		const float* d = at(x0, y1);
+		const float* e = at(x1, y1);
+		for (k = 0; k < c; k++)
+			out[k] = (a[k] * (1.f - fx) + b[k] * fx) * (1.f - fy) + (d[k] * (1.f - fx) + e[k] * fx) * fy;
+	}
+
+	int w, h, c;
+	std::vector<float> data;
+};
+
+#endif
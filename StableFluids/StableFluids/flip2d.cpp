@@ -0,0 +1,539 @@
+/*****************************************************************************
+ * 2-D FLIP / APIC, see flip2d.h
+ *****************************************************************************/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FLIP_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "flip2d.h"
+
+#define SORT_CHUNK 32768		// particles per sort job
+#define PARTICLE_CHUNK 4096		// particles per gather job, a multiple of 4
+#define JITTER 0.5f				// of the seed spacing, peak to peak
+
+static double seconds_since(std::chrono::steady_clock::time_point t0)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// Uniform in [0, 1) from an integer, for the seed jitter
+static float hash_unit(uint32_t v)
+{
+	v ^= v >> 16;
+	v *= 0x7feb352du;
+	v ^= v >> 15;
+	v *= 0x846ca68bu;
+	v ^= v >> 16;
+	return (float)(v >> 8) * (1.f / 16777216.f);
+}
+
+// Corners and weight of the bilinear stencil at g, in cells of a periodic
+// axis of n.  g lies within a cell of [0, n).
+static inline void stencil(float g, int n, int& i0, int& i1, float& f)
+{
+	float t = std::floor(g);
+
+	f = g - t;
+	i0 = (int)t;
+	if (i0 < 0)
+		i0 += n;
+	else if (i0 >= n)
+		i0 -= n;
+	i1 = i0 + 1 < n ? i0 + 1 : 0;
+}
+
+//========================================================================
+// Setup
+//========================================================================
+
+flip2d::flip2d(const flip2d_options& o, tile_executor& e)
+	: opt(o), exec(e)
+{
+	n = opt.size;
+	tiles = std::max(2, (n / std::max(opt.tile, 2)) & ~1);
+	count = n * n * opt.seeds * opt.seeds;
+
+	for (std::vector<float>* a : { &px, &py, &pu, &pv, c, c + 1, c + 2, c + 3 })
+		a->resize(count);
+	for (std::vector<float>* a : { &u, &v, &uw, &vw, &du, &dv, &divergence, &pressure })
+		a->resize((size_t)n * n);
+	tile_start.resize((size_t)tiles * tiles + 1);
+
+	mg.reset(new multigrid(n, exec));
+	reset();
+}
+
+void flip2d::reset()
+{
+	int s = opt.seeds;
+	float spacing = 1.f / (float)(n * s);
+
+	exec.for_each(n * s, [&](int y)
+	{
+		for (int x = 0; x < n * s; x++)
+		{
+			int i = y * n * s + x;
+			float jx = JITTER * (hash_unit(2 * i) - 0.5f);
+			float jy = JITTER * (hash_unit(2 * i + 1) - 0.5f);
+			float fx, fy;
+
+			px[i] = ((float)x + 0.5f + jx) * spacing;
+			py[i] = ((float)y + 0.5f + jy) * spacing;
+			fx = 2.f * px[i] - 1.f;
+			fy = 2.f * py[i] - 1.f;
+			pu[i] = 0.5f * std::sin(2.f * 3.1415f * fy);
+			pv[i] = 0.5f * std::sin(2.f * 3.1415f * fx);
+			c[0][i] = c[1][i] = c[2][i] = c[3][i] = 0.f;
+		}
+	});
+	std::fill(pressure.begin(), pressure.end(), 0.f);
+}
+
+//========================================================================
+// Sort
+//========================================================================
+
+// A counting sort on the tile of each particle's cell: every chunk counts
+// its tiles, then scatters its particles after those of smaller tiles and
+// of the same tile in earlier chunks.
+void flip2d::sort()
+{
+	int chunks = (count + SORT_CHUNK - 1) / SORT_CHUNK;
+	const int bins = tiles * tiles;
+
+	keys.resize(count);
+	order.resize(count);
+	histogram.resize((size_t)chunks * bins);
+
+	exec.for_each(chunks, [&](int k)
+	{
+		int* hist = histogram.data() + (size_t)k * bins;
+
+		std::fill(hist, hist + bins, 0);
+		for (int i = k * SORT_CHUNK; i < std::min((k + 1) * SORT_CHUNK, count); i++)
+		{
+			int x = std::min((int)(px[i] * (float)n), n - 1);
+			int y = std::min((int)(py[i] * (float)n), n - 1);
+
+			keys[i] = (y * tiles / n) * tiles + x * tiles / n;
+			hist[keys[i]]++;
+		}
+	});
+
+	int total = 0;
+	for (int d = 0; d < bins; d++)
+	{
+		tile_start[d] = total;
+		for (int k = 0; k < chunks; k++)
+		{
+			int h = histogram[(size_t)k * bins + d];
+
+			histogram[(size_t)k * bins + d] = total;
+			total += h;
+		}
+	}
+	tile_start[bins] = total;
+
+	exec.for_each(chunks, [&](int k)
+	{
+		int* next = histogram.data() + (size_t)k * bins;
+
+		for (int i = k * SORT_CHUNK; i < std::min((k + 1) * SORT_CHUNK, count); i++)
+			order[next[keys[i]]++] = i;
+	});
+
+	// The gradients only matter to APIC
+	std::vector<float>* fields[] = { &px, &py, &pu, &pv, c, c + 1, c + 2, c + 3 };
+	int used = opt.transfer == FLIP2D_APIC ? 8 : 4;
+
+	scratch.resize(count);
+	for (int f = 0; f < used; f++)
+	{
+		std::vector<float>* a = fields[f];
+		const float* from = a->data();
+
+		exec.for_each(chunks, [&](int k)
+		{
+			for (int i = k * SORT_CHUNK; i < std::min((k + 1) * SORT_CHUNK, count); i++)
+				scratch[i] = from[order[i]];
+		});
+		a->swap(scratch);
+	}
+}
+
+//========================================================================
+// Particles to grid
+//========================================================================
+
+void flip2d::splat()
+{
+	bool affine = opt.transfer == FLIP2D_APIC;
+	int half = tiles / 2;
+	float scale = (float)n;
+
+	exec.for_each(n, [&](int y)
+	{
+		size_t row = (size_t)y * n;
+
+		std::fill(u.begin() + row, u.begin() + row + n, 0.f);
+		std::fill(v.begin() + row, v.begin() + row + n, 0.f);
+		std::fill(uw.begin() + row, uw.begin() + row + n, 0.f);
+		std::fill(vw.begin() + row, vw.begin() + row + n, 0.f);
+	});
+
+	// A particle of a tile writes the faces from one cell before the tile
+	// to one after it, so tiles two apart never share a face
+	for (int colour = 0; colour < 4; colour++)
+		exec.for_each(half * half, [&](int k)
+		{
+			int tx = 2 * (k % half) + (colour & 1);
+			int ty = 2 * (k / half) + (colour >> 1);
+			int t = ty * tiles + tx;
+
+			for (int i = tile_start[t]; i < tile_start[t + 1]; i++)
+			{
+				float x = px[i] * scale, y = py[i] * scale;
+				int x0, x1, y0, y1;
+				float fx, fy;
+				float a[4] = { pu[i], pu[i], pu[i], pu[i] };
+
+				// u on (i, j + 1/2)
+				stencil(x, n, x0, x1, fx);
+				stencil(y - 0.5f, n, y0, y1, fy);
+				if (affine)
+				{
+					a[0] += c[0][i] * -fx + c[1][i] * -fy;
+					a[1] += c[0][i] * (1.f - fx) + c[1][i] * -fy;
+					a[2] += c[0][i] * -fx + c[1][i] * (1.f - fy);
+					a[3] += c[0][i] * (1.f - fx) + c[1][i] * (1.f - fy);
+				}
+				u[y0 * n + x0] += (1.f - fx) * (1.f - fy) * a[0];
+				u[y0 * n + x1] += fx * (1.f - fy) * a[1];
+				u[y1 * n + x0] += (1.f - fx) * fy * a[2];
+				u[y1 * n + x1] += fx * fy * a[3];
+				uw[y0 * n + x0] += (1.f - fx) * (1.f - fy);
+				uw[y0 * n + x1] += fx * (1.f - fy);
+				uw[y1 * n + x0] += (1.f - fx) * fy;
+				uw[y1 * n + x1] += fx * fy;
+
+				// v on (i + 1/2, j)
+				stencil(x - 0.5f, n, x0, x1, fx);
+				stencil(y, n, y0, y1, fy);
+				a[0] = a[1] = a[2] = a[3] = pv[i];
+				if (affine)
+				{
+					a[0] += c[2][i] * -fx + c[3][i] * -fy;
+					a[1] += c[2][i] * (1.f - fx) + c[3][i] * -fy;
+					a[2] += c[2][i] * -fx + c[3][i] * (1.f - fy);
+					a[3] += c[2][i] * (1.f - fx) + c[3][i] * (1.f - fy);
+				}
+				v[y0 * n + x0] += (1.f - fx) * (1.f - fy) * a[0];
+				v[y0 * n + x1] += fx * (1.f - fy) * a[1];
+				v[y1 * n + x0] += (1.f - fx) * fy * a[2];
+				v[y1 * n + x1] += fx * fy * a[3];
+				vw[y0 * n + x0] += (1.f - fx) * (1.f - fy);
+				vw[y0 * n + x1] += fx * (1.f - fy);
+				vw[y1 * n + x0] += (1.f - fx) * fy;
+				vw[y1 * n + x1] += fx * fy;
+			}
+		});
+
+	// Weighted means, kept in du and dv to take the change over the
+	// projection
+	exec.for_each(n, [&](int y)
+	{
+		for (int i = y * n; i < (y + 1) * n; i++)
+		{
+			u[i] = uw[i] > 0.f ? u[i] / uw[i] : 0.f;
+			v[i] = vw[i] > 0.f ? v[i] / vw[i] : 0.f;
+			du[i] = u[i];
+			dv[i] = v[i];
+		}
+	});
+}
+
+//========================================================================
+// Projection
+//========================================================================
+
+// In cells: A p = -div u with A of poisson.h, then u -= grad p makes the
+// discrete divergence zero
+void flip2d::project()
+{
+	multigrid_options mo;
+
+	mo.tolerance = opt.pressure_tolerance;
+
+	exec.for_each(n, [&](int y)
+	{
+		int y1 = y + 1 < n ? y + 1 : 0;
+
+		for (int x = 0; x < n; x++)
+		{
+			int x1 = x + 1 < n ? x + 1 : 0;
+
+			divergence[y * n + x] = -(u[y * n + x1] - u[y * n + x] + v[y1 * n + x] - v[y * n + x]);
+		}
+	});
+
+	// Warm started from the last step's pressure
+	last_pressure = mg->solve(divergence.data(), pressure.data(), mo);
+
+	exec.for_each(n, [&](int y)
+	{
+		int y0 = y > 0 ? y - 1 : n - 1;
+
+		for (int x = 0; x < n; x++)
+		{
+			int x0 = x > 0 ? x - 1 : n - 1;
+			int i = y * n + x;
+
+			u[i] -= pressure[i] - pressure[y * n + x0];
+			v[i] -= pressure[i] - pressure[y0 * n + x];
+			du[i] = u[i] - du[i];
+			dv[i] = v[i] - dv[i];
+		}
+	});
+}
+
+//========================================================================
+// Grid to particles
+//========================================================================
+
+namespace
+{
+
+// Bilinear sample of one face grid and its change, with the gradient of
+// the sample in cells for APIC
+struct face_sample
+{
+	float value, change, gx, gy;
+};
+
+}
+
+static inline face_sample sample_faces(const float* g, const float* d, int n, float x, float y)
+{
+	int x0, x1, y0, y1;
+	float fx, fy;
+	face_sample s;
+
+	stencil(x, n, x0, x1, fx);
+	stencil(y, n, y0, y1, fy);
+
+	float g00 = g[y0 * n + x0], g10 = g[y0 * n + x1];
+	float g01 = g[y1 * n + x0], g11 = g[y1 * n + x1];
+	float b0 = g00 + fx * (g10 - g00), b1 = g01 + fx * (g11 - g01);
+	float d0 = d[y0 * n + x0] + fx * (d[y0 * n + x1] - d[y0 * n + x0]);
+	float d1 = d[y1 * n + x0] + fx * (d[y1 * n + x1] - d[y1 * n + x0]);
+
+	s.value = b0 + fy * (b1 - b0);
+	s.change = d0 + fy * (d1 - d0);
+	s.gx = (1.f - fy) * (g10 - g00) + fy * (g11 - g01);
+	s.gy = b1 - b0;
+	return s;
+}
+
+#ifdef FLIP_SSE2
+
+// The same for four particles; g and d are loaded per lane
+static inline void sample_faces4(const float* g, const float* d, int n, __m128 x, __m128 y,
+	__m128& value, __m128& change, __m128& gx, __m128& gy)
+{
+	const __m128 one = _mm_set1_ps(1.f);
+	const __m128 nf = _mm_set1_ps((float)n);
+	const __m128i ni = _mm_set1_epi32(n);
+	const __m128i last = _mm_set1_epi32(n - 1);
+	const __m128i onei = _mm_set1_epi32(1);
+
+	// Shifted by n to truncate non-negative values, then wrapped
+	__m128 sx = _mm_add_ps(x, nf), sy = _mm_add_ps(y, nf);
+	__m128i tx = _mm_cvttps_epi32(sx), ty = _mm_cvttps_epi32(sy);
+	__m128 fx = _mm_sub_ps(sx, _mm_cvtepi32_ps(tx));
+	__m128 fy = _mm_sub_ps(sy, _mm_cvtepi32_ps(ty));
+	__m128i x0 = _mm_sub_epi32(tx, ni), y0 = _mm_sub_epi32(ty, ni);
+
+	x0 = _mm_add_epi32(x0, _mm_and_si128(_mm_cmplt_epi32(x0, _mm_setzero_si128()), ni));
+	x0 = _mm_sub_epi32(x0, _mm_and_si128(_mm_cmpgt_epi32(x0, last), ni));
+	y0 = _mm_add_epi32(y0, _mm_and_si128(_mm_cmplt_epi32(y0, _mm_setzero_si128()), ni));
+	y0 = _mm_sub_epi32(y0, _mm_and_si128(_mm_cmpgt_epi32(y0, last), ni));
+
+	__m128i x1 = _mm_add_epi32(x0, onei), y1 = _mm_add_epi32(y0, onei);
+
+	x1 = _mm_sub_epi32(x1, _mm_and_si128(_mm_cmpgt_epi32(x1, last), ni));
+	y1 = _mm_sub_epi32(y1, _mm_and_si128(_mm_cmpgt_epi32(y1, last), ni));
+
+	// Rows as y n, exact in float for n * n below 2^24
+	__m128i r0 = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(y0), nf));
+	__m128i r1 = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(y1), nf));
+	alignas(16) int o[4][4];
+
+	_mm_store_si128((__m128i*)o[0], _mm_add_epi32(r0, x0));
+	_mm_store_si128((__m128i*)o[1], _mm_add_epi32(r0, x1));
+	_mm_store_si128((__m128i*)o[2], _mm_add_epi32(r1, x0));
+	_mm_store_si128((__m128i*)o[3], _mm_add_epi32(r1, x1));
+
+	__m128 g00 = _mm_setr_ps(g[o[0][0]], g[o[0][1]], g[o[0][2]], g[o[0][3]]);
+	__m128 g10 = _mm_setr_ps(g[o[1][0]], g[o[1][1]], g[o[1][2]], g[o[1][3]]);
+	__m128 g01 = _mm_setr_ps(g[o[2][0]], g[o[2][1]], g[o[2][2]], g[o[2][3]]);
+	__m128 g11 = _mm_setr_ps(g[o[3][0]], g[o[3][1]], g[o[3][2]], g[o[3][3]]);
+	__m128 d00 = _mm_setr_ps(d[o[0][0]], d[o[0][1]], d[o[0][2]], d[o[0][3]]);
+	__m128 d10 = _mm_setr_ps(d[o[1][0]], d[o[1][1]], d[o[1][2]], d[o[1][3]]);
+	__m128 d01 = _mm_setr_ps(d[o[2][0]], d[o[2][1]], d[o[2][2]], d[o[2][3]]);
+	__m128 d11 = _mm_setr_ps(d[o[3][0]], d[o[3][1]], d[o[3][2]], d[o[3][3]]);
+
+	__m128 ex = _mm_sub_ps(g10, g00), ex1 = _mm_sub_ps(g11, g01);
+	__m128 b0 = _mm_add_ps(g00, _mm_mul_ps(fx, ex));
+	__m128 b1 = _mm_add_ps(g01, _mm_mul_ps(fx, ex1));
+	__m128 e0 = _mm_add_ps(d00, _mm_mul_ps(fx, _mm_sub_ps(d10, d00)));
+	__m128 e1 = _mm_add_ps(d01, _mm_mul_ps(fx, _mm_sub_ps(d11, d01)));
+
+	value = _mm_add_ps(b0, _mm_mul_ps(fy, _mm_sub_ps(b1, b0)));
+	change = _mm_add_ps(e0, _mm_mul_ps(fy, _mm_sub_ps(e1, e0)));
+	gx = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(one, fy), ex), _mm_mul_ps(fy, ex1));
+	gy = _mm_sub_ps(b1, b0);
+}
+
+#endif
+
+void flip2d::gather()
+{
+	bool affine = opt.transfer == FLIP2D_APIC;
+	int chunks = (count + PARTICLE_CHUNK - 1) / PARTICLE_CHUNK;
+	float scale = (float)n;
+	float r = opt.pic_ratio;
+	float dt = opt.dt;
+
+	exec.for_each(chunks, [&](int k)
+	{
+		int i = k * PARTICLE_CHUNK;
+		int end = std::min(i + PARTICLE_CHUNK, count);
+
+#ifdef FLIP_SSE2
+		const __m128 s = _mm_set1_ps(scale), h = _mm_set1_ps(0.5f);
+		const __m128 ratio = _mm_set1_ps(r), keep = _mm_set1_ps(1.f - r);
+		const __m128 step = _mm_set1_ps(dt), one = _mm_set1_ps(1.f);
+
+		for (; i + 4 <= end; i += 4)
+		{
+			__m128 x = _mm_loadu_ps(&px[i]), y = _mm_loadu_ps(&py[i]);
+			__m128 cx = _mm_mul_ps(x, s), cy = _mm_mul_ps(y, s);
+			__m128 ua, uc, ugx, ugy, va, vc, vgx, vgy;
+
+			sample_faces4(u.data(), du.data(), n, cx, _mm_sub_ps(cy, h), ua, uc, ugx, ugy);
+			sample_faces4(v.data(), dv.data(), n, _mm_sub_ps(cx, h), cy, va, vc, vgx, vgy);
+
+			if (affine)
+			{
+				_mm_storeu_ps(&pu[i], ua);
+				_mm_storeu_ps(&pv[i], va);
+				_mm_storeu_ps(&c[0][i], ugx);
+				_mm_storeu_ps(&c[1][i], ugy);
+				_mm_storeu_ps(&c[2][i], vgx);
+				_mm_storeu_ps(&c[3][i], vgy);
+			}
+			else
+			{
+				__m128 pu4 = _mm_add_ps(_mm_loadu_ps(&pu[i]), uc);
+				__m128 pv4 = _mm_add_ps(_mm_loadu_ps(&pv[i]), vc);
+
+				_mm_storeu_ps(&pu[i], _mm_add_ps(_mm_mul_ps(keep, pu4), _mm_mul_ps(ratio, ua)));
+				_mm_storeu_ps(&pv[i], _mm_add_ps(_mm_mul_ps(keep, pv4), _mm_mul_ps(ratio, va)));
+			}
+
+			// Move with the grid velocity and wrap into [0, 1)
+			x = _mm_add_ps(x, _mm_mul_ps(step, ua));
+			y = _mm_add_ps(y, _mm_mul_ps(step, va));
+			x = _mm_add_ps(x, _mm_and_ps(_mm_cmplt_ps(x, _mm_setzero_ps()), one));
+			x = _mm_sub_ps(x, _mm_and_ps(_mm_cmpge_ps(x, one), one));
+			y = _mm_add_ps(y, _mm_and_ps(_mm_cmplt_ps(y, _mm_setzero_ps()), one));
+			y = _mm_sub_ps(y, _mm_and_ps(_mm_cmpge_ps(y, one), one));
+			_mm_storeu_ps(&px[i], x);
+			_mm_storeu_ps(&py[i], y);
+		}
+#endif
+		for (; i < end; i++)
+		{
+			float x = px[i] * scale, y = py[i] * scale;
+			face_sample a = sample_faces(u.data(), du.data(), n, x, y - 0.5f);
+			face_sample b = sample_faces(v.data(), dv.data(), n, x - 0.5f, y);
+
+			if (affine)
+			{
+				pu[i] = a.value;
+				pv[i] = b.value;
+				c[0][i] = a.gx;
+				c[1][i] = a.gy;
+				c[2][i] = b.gx;
+				c[3][i] = b.gy;
+			}
+			else
+			{
+				pu[i] = (1.f - r) * (pu[i] + a.change) + r * a.value;
+				pv[i] = (1.f - r) * (pv[i] + b.change) + r * b.value;
+			}
+
+			x = px[i] + dt * a.value;
+			y = py[i] + dt * b.value;
+			x -= std::floor(x);
+			y -= std::floor(y);
+			px[i] = x < 1.f ? x : 0.f;
+			py[i] = y < 1.f ? y : 0.f;
+		}
+	});
+}
+
+//========================================================================
+// Step
+//========================================================================
+
+void flip2d::step(flip2d_timing* timing)
+{
+	flip2d_timing t;
+	auto t0 = std::chrono::steady_clock::now();
+
+	sort();
+	t.sort = seconds_since(t0);
+
+	t0 = std::chrono::steady_clock::now();
+	splat();
+	t.splat = seconds_since(t0);
+
+	t0 = std::chrono::steady_clock::now();
+	project();
+	t.pressure = seconds_since(t0);
+
+	t0 = std::chrono::steady_clock::now();
+	gather();
+	t.gather = seconds_since(t0);
+
+	if (timing)
+	{
+		timing->sort += t.sort;
+		timing->splat += t.splat;
+		timing->pressure += t.pressure;
+		timing->gather += t.gather;
+	}
+}
+
+double flip2d::energy() const
+{
+	double e = exec.sum(n, [&](int y)
+	{
+		double row = 0.0;
+
+		for (int i = y * n; i < (y + 1) * n; i++)
+			row += (double)u[i] * u[i] + (double)v[i] * v[i];
+		return row;
+	});
+
+	return 0.5 * e / ((double)n * n);
+}
@@ -0,0 +1,114 @@
+/*****************************************************************************
+ * 2-D FLIP / APIC on the CPU
+ *
+ * Particles carry the velocity between steps, so advection does not
+ * resample the grid and loses far less detail than the semi-Lagrangian
+ * advect of stam2d.h:
+ *
+ *   sort -> splat to the grid -> project -> gather back and move
+ *
+ * The grid is periodic and staggered, u on the left and v on the bottom
+ * face of each cell, and the projection is the 5-point problem of
+ * poisson.h solved by multigrid.h.  FLIP adds the change of the grid
+ * velocity to the particles and blends in a little of the new grid
+ * velocity (PIC) against noise; APIC (Jiang et al. 2015) takes the new
+ * grid velocity together with its gradient, which the next splat carries
+ * back, so rotation survives the round trip without FLIP's noise.
+ *
+ * The splat runs without atomics: the particles are sorted by tile of the
+ * grid, and the tiles are coloured by the parity of their row and column,
+ * so tiles of one colour are a tile apart and the faces their particles
+ * write do not overlap.  Each colour is one pass of the tile_executor.
+ * The gather works on four particles at a time with SSE: weights, indices
+ * and blends in lanes, the loads of the corners per lane.
+ *****************************************************************************/
+
+#ifndef FLIP2DH
+#define FLIP2DH
+
+#include <memory>
+#include <vector>
+
+#include "multigrid.h"
+#include "poisson.h"
+#include "tile_executor.h"
+
+enum flip2d_transfer
+{
+	FLIP2D_FLIP,			// FLIP blended with opt.pic_ratio of PIC
+	FLIP2D_APIC				// affine particle-in-cell
+};
+
+struct flip2d_options
+{
+	int size = 256;					// grid is size x size cells over the unit box
+	int seeds = 2;					// particles per cell along each axis
+	float dt = 1.f / 120.f;
+	flip2d_transfer transfer = FLIP2D_FLIP;
+	float pic_ratio = 0.03f;		// of the new grid velocity in the FLIP update
+	int tile = 16;					// cells per side of a splat tile, at least 2
+	double pressure_tolerance = 1e-5;
+};
+
+// Seconds spent in each stage, accumulated over steps
+struct flip2d_timing
+{
+	double sort = 0.0;
+	double splat = 0.0;
+	double pressure = 0.0;		// divergence, solve and gradient
+	double gather = 0.0;		// gather and move
+};
+
+class flip2d
+{
+public:
+	flip2d(const flip2d_options& opt, tile_executor& exec);
+
+	// The initial velocity of the demo, halved to box units as its advect
+	// does, on a jittered lattice of seeds x seeds particles per cell
+	void reset();
+
+	void step(flip2d_timing* timing = nullptr);
+
+	int particle_count() const { return count; }
+
+	// Kinetic energy per unit area of the grid velocity after the last
+	// projection
+	double energy() const;
+
+	// Iterations and residual of the last pressure solve
+	const poisson_stats& pressure_stats() const { return last_pressure; }
+
+	flip2d_options opt;
+
+private:
+	void sort();
+	void splat();
+	void project();
+	void gather();
+
+	tile_executor& exec;
+	int n;						// cells along a side
+	int tiles;					// tiles along a side, even
+	int count;					// particles
+
+	// Particles, in tile order after sort().  c holds the APIC gradients
+	// of u and v along x and y, in cells.
+	std::vector<float> px, py, pu, pv;
+	std::vector<float> c[4];
+
+	std::vector<int> tile_start;		// tiles * tiles + 1 particle offsets
+	std::vector<int> keys, order, histogram;
+	std::vector<float> scratch;
+
+	// Staggered grid: sums of weighted velocities and of weights during
+	// the splat, then the velocity, the change over the projection for
+	// FLIP, divergence and pressure
+	std::vector<float> u, v, uw, vw, du, dv;
+	std::vector<float> divergence, pressure;
+
+	std::unique_ptr<multigrid> mg;
+	poisson_stats last_pressure;
+};
+
+#endif
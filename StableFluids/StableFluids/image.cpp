@@ -0,0 +1,37 @@
+/*****************************************************************************
+ * Image output
+ *****************************************************************************/
+
+#include <cstdio>
+#include <vector>
+
+#include "image.h"
+
+bool write_ppm(const char* path, const field& f, bool threshold)
+{
+	std::vector<unsigned char> row((size_t)f.w * 3);
+	FILE* fp;
+	int x, y, k;
+	float v;
+
+	fp = fopen(path, "wb");
+	if (!fp)
+		return false;
+
+	fprintf(fp, "P6\n%d %d\n255\n", f.w, f.h);
+	for (y = f.h - 1; y >= 0; y--)
+	{
+		for (x = 0; x < f.w; x++)
+			for (k = 0; k < 3; k++)
+			{
+				v = k < f.c ? f.at(x, y)[k] : 0.f;
+				if (threshold)
+					v = v >= 0.5f ? 1.f : 0.f;
+				v = v < 0.f ? 0.f : (v > 1.f ? 1.f : v);
+				row[3 * x + k] = (unsigned char)(v * 255.f + 0.5f);
+			}
+		fwrite(row.data(), 1, row.size(), fp);
+	}
+
+	return fclose(fp) == 0;
+}
@@ -0,0 +1,15 @@
+/*****************************************************************************
+ * Image output
+ *****************************************************************************/
+
+#ifndef IMAGEH
+#define IMAGEH
+
+#include "field.h"
+
+// Write the first three channels of f as a binary PPM, top row first.
+// Values are clamped to [0, 1], or thresholded at 0.5 like the demo's
+// drawTextureThreshold.  Returns false if the file cannot be written.
+bool write_ppm(const char* path, const field& f, bool threshold);
+
+#endif
@@ -0,0 +1,477 @@
+/*****************************************************************************
+ * Narrow band level set
+ *****************************************************************************/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <utility>
+
+#include "level_set.h"
+
+#define LEAF (1 << VOLUME_LEAF_LOG2)		// cells along a side of a leaf
+#define BLOCK (LEAF + 2)					// a leaf and a cell of its neighbours
+#define BLOCK_CELLS (BLOCK * BLOCK * BLOCK)
+
+static double seconds_since(std::chrono::steady_clock::time_point t0)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// Cell (x, y, z) of a leaf in its block, -1 to LEAF along each axis
+static int at(int x, int y, int z)
+{
+	return ((z + 1) * BLOCK + y + 1) * BLOCK + x + 1;
+}
+
+// Godunov update of |grad phi| = 1 from the nearest distance along each
+// axis, in cells
+static float eikonal(float a, float b, float c)
+{
+	if (a > b)
+		std::swap(a, b);
+	if (b > c)
+		std::swap(b, c);
+	if (a > b)
+		std::swap(a, b);
+
+	float u = a + 1.f;
+	if (u <= b)
+		return u;
+	u = 0.5f * (a + b + std::sqrt(2.f - (a - b) * (a - b)));
+	if (u <= c)
+		return u;
+
+	float s = a + b + c;
+	return (s + std::sqrt(s * s - 3.f * (a * a + b * b + c * c - 1.f))) / 3.f;
+}
+
+level_set::level_set(int nx, int ny, int nz, const level_set_options& opt, tile_executor& exec)
+	: opt(opt), exec(exec), phi(opt.band)
+{
+	n[0] = nx;
+	n[1] = ny;
+	n[2] = nz;
+}
+
+void level_set::reset(const std::function<float(float, float, float)>& f)
+{
+	const float band = opt.band, reach = band + 0.5f * LEAF * std::sqrt(3.f);
+	int bx = (n[0] + LEAF - 1) / LEAF, by = (n[1] + LEAF - 1) / LEAF, bz = (n[2] + LEAF - 1) / LEAF;
+	std::vector<float> centre((size_t)bx * by * bz);
+
+	phi.clear();
+	phi.background = band;
+
+	// Leaves where the surface may come within the band, inside tiles
+	// elsewhere below zero
+	exec.for_each(bz, [&](int k)
+	{
+		for (int j = 0; j < by; j++)
+			for (int i = 0; i < bx; i++)
+				centre[((size_t)k * by + j) * bx + i] = f(LEAF * i + 0.5f * (LEAF - 1), LEAF * j + 0.5f * (LEAF - 1),
+					LEAF * k + 0.5f * (LEAF - 1));
+	});
+	for (int k = 0; k < bz; k++)
+		for (int j = 0; j < by; j++)
+			for (int i = 0; i < bx; i++)
+			{
+				float d = centre[((size_t)k * by + j) * bx + i];
+
+				if (std::fabs(d) < reach)
+					phi.touch_leaf(LEAF * i, LEAF * j, LEAF * k);
+				else if (d < 0.f)
+					phi.set_tile(LEAF * i, LEAF * j, LEAF * k, -band);
+			}
+
+	phi.for_each_leaf(exec, [&](sparse_volume<float>::leaf& l)
+	{
+		for (int z = 0; z < LEAF; z++)
+			for (int y = 0; y < LEAF; y++)
+				for (int x = 0; x < LEAF; x++)
+				{
+					float d = f((float)(l.origin[0] + x), (float)(l.origin[1] + y), (float)(l.origin[2] + z));
+					l.values[sparse_volume<float>::cell_index(x, y, z)] = std::max(-band, std::min(band, d));
+				}
+	});
+
+	redistance();
+	prune();
+}
+
+void level_set::advect(const level_set_velocity& velocity, float dt, level_set_timing* timing)
+{
+	level_set_timing t;
+	const float band = opt.band;
+
+	auto t0 = std::chrono::steady_clock::now();
+	dilate();
+	t.dilate = seconds_since(t0);
+
+	t0 = std::chrono::steady_clock::now();
+	cur.resize((size_t)phi.leaf_count() * VOLUME_LEAF_CELLS);
+	exec.for_each(phi.leaf_count(), [&](int b)
+	{
+		const sparse_volume<float>& v = phi;
+		sparse_volume<float>::const_accessor a(v);
+		const int* o = v.leaf_at(b).origin;
+		float* out = &cur[(size_t)b * VOLUME_LEAF_CELLS];
+
+		for (int z = 0; z < LEAF; z++)
+			for (int y = 0; y < LEAF; y++)
+				for (int x = 0; x < LEAF; x++)
+				{
+					float p[3] = { (float)(o[0] + x), (float)(o[1] + y), (float)(o[2] + z) }, u[3];
+
+					velocity(p, u);
+					float s = a.sample(p[0] - dt * u[0], p[1] - dt * u[1], p[2] - dt * u[2]);
+					out[sparse_volume<float>::cell_index(x, y, z)] = std::max(-band, std::min(band, s));
+				}
+	});
+	store();
+	t.advect = seconds_since(t0);
+
+	t0 = std::chrono::steady_clock::now();
+	redistance();
+	t.redistance = seconds_since(t0);
+
+	t0 = std::chrono::steady_clock::now();
+	prune();
+	t.prune = seconds_since(t0);
+
+	if (timing)
+	{
+		timing->dilate += t.dilate;
+		timing->advect += t.advect;
+		timing->redistance += t.redistance;
+		timing->prune += t.prune;
+	}
+}
+
+//========================================================================
+// Redistancing
+//========================================================================
+
+void level_set::redistance()
+{
+	const sparse_volume<float>& v = phi;
+	const float band = opt.band;
+	int leaves = v.leaf_count();
+	size_t cells = (size_t)leaves * VOLUME_LEAF_CELLS;
+
+	find_neighbours();
+	cur.resize(cells);
+	next.resize(cells);
+	fixed.resize(cells);
+	exec.for_each(leaves, [&](int b)
+	{
+		std::copy(v.leaf_at(b).values, v.leaf_at(b).values + VOLUME_LEAF_CELLS, &cur[(size_t)b * VOLUME_LEAF_CELLS]);
+	});
+
+	// Fix the cells with a neighbour across the surface at phi over its
+	// central gradient, no farther than where the surface crosses their
+	// edges; start the rest at the band
+	exec.for_each(leaves, [&](int b)
+	{
+		float block[BLOCK_CELLS];
+		float* out = &next[(size_t)b * VOLUME_LEAF_CELLS];
+		unsigned char* fix = &fixed[(size_t)b * VOLUME_LEAF_CELLS];
+		const int step[3] = { 1, BLOCK, BLOCK * BLOCK };
+
+		load(b, cur.data(), block);
+		for (int z = 0; z < LEAF; z++)
+			for (int y = 0; y < LEAF; y++)
+				for (int x = 0; x < LEAF; x++)
+				{
+					int c = at(x, y, z), i = sparse_volume<float>::cell_index(x, y, z);
+					float f = block[c], crossing = 2.f, g2 = 0.f;
+
+					for (int a = 0; a < 3; a++)
+					{
+						float m = block[c - step[a]], p = block[c + step[a]];
+
+						if ((m < 0.f) != (f < 0.f))
+							crossing = std::min(crossing, f / (f - m));
+						if ((p < 0.f) != (f < 0.f))
+							crossing = std::min(crossing, f / (f - p));
+						g2 += 0.25f * (p - m) * (p - m);
+					}
+
+					fix[i] = crossing < 2.f;
+					if (fix[i])
+					{
+						float d = g2 > 0.f ? std::min(std::fabs(f) / std::sqrt(g2), crossing) : crossing;
+						out[i] = f < 0.f ? -d : d;
+					}
+					else
+						out[i] = f < 0.f ? -band : band;
+				}
+	});
+	std::swap(cur, next);
+
+	// Sweep every leaf in the eight orders, on the faces of its neighbours
+	// from the last iteration.  After the first, only leaves that moved or
+	// have a neighbour that did are swept again.
+	last = level_set_stats();
+	moved.assign(leaves, 1);
+	moving.resize(leaves);
+	for (int it = 0; it < opt.max_iterations; it++)
+	{
+		double unsettled = exec.sum(leaves, [&](int b) -> double
+		{
+			float block[BLOCK_CELLS];
+			const float* in = &cur[(size_t)b * VOLUME_LEAF_CELLS];
+			float* out = &next[(size_t)b * VOLUME_LEAF_CELLS];
+			const unsigned char* fix = &fixed[(size_t)b * VOLUME_LEAF_CELLS];
+			bool stale = moved[b] != 0;
+			int count = 0;
+
+			for (int f = 0; f < 6; f++)
+				stale |= neighbours[6 * b + f] >= 0 && moved[neighbours[6 * b + f]];
+			moving[b] = 0;
+			if (!stale)
+			{
+				std::copy(in, in + VOLUME_LEAF_CELLS, out);
+				return 0.0;
+			}
+
+			load(b, cur.data(), block);
+			for (int s = 0; s < 8; s++)
+			{
+				int dx = s & 1 ? -1 : 1, dy = s & 2 ? -1 : 1, dz = s & 4 ? -1 : 1, x0 = dx > 0 ? 0 : LEAF - 1;
+
+				for (int k = 0, z = dz > 0 ? 0 : LEAF - 1; k < LEAF; k++, z += dz)
+					for (int j = 0, y = dy > 0 ? 0 : LEAF - 1; j < LEAF; j++, y += dy)
+					{
+						int c = at(x0, y, z), i = sparse_volume<float>::cell_index(x0, y, z);
+
+						for (int r = 0; r < LEAF; r++, c += dx, i += dx)
+						{
+							if (fix[i])
+								continue;
+
+							float f = block[c];
+							float ax = std::min(std::fabs(block[c - 1]), std::fabs(block[c + 1]));
+							float ay = std::min(std::fabs(block[c - BLOCK]), std::fabs(block[c + BLOCK]));
+							float az = std::min(std::fabs(block[c - BLOCK * BLOCK]), std::fabs(block[c + BLOCK * BLOCK]));
+
+							// The update is at least the nearest plus 1 / sqrt(3)
+							if (std::min(ax, std::min(ay, az)) + 0.57735f >= std::fabs(f))
+								continue;
+
+							float u = eikonal(ax, ay, az);
+							if (u < std::fabs(f))
+								block[c] = f < 0.f ? -u : u;
+						}
+					}
+			}
+
+			for (int z = 0; z < LEAF; z++)
+				for (int y = 0; y < LEAF; y++)
+					for (int x = 0; x < LEAF; x++)
+					{
+						int i = sparse_volume<float>::cell_index(x, y, z);
+
+						out[i] = block[at(x, y, z)];
+						count += std::fabs(out[i] - in[i]) > opt.tolerance;
+					}
+			moving[b] = count > 0;
+			return count;
+		});
+		std::swap(cur, next);
+		std::swap(moved, moving);
+		last.iterations = it + 1;
+		last.unsettled = (int)unsettled;
+		if (unsettled == 0.0)
+			break;
+	}
+	store();
+}
+
+// The leaves across the faces of each leaf, x-, x+, y-, ..., or the tile
+// value there
+void level_set::find_neighbours()
+{
+	const sparse_volume<float>& v = phi;
+
+	neighbours.resize(6 * (size_t)v.leaf_count());
+	tiles.resize(6 * (size_t)v.leaf_count());
+	exec.for_each(v.leaf_count(), [&](int b)
+	{
+		const int* o = v.leaf_at(b).origin;
+
+		for (int f = 0; f < 6; f++)
+		{
+			int p[3] = { o[0], o[1], o[2] };
+
+			p[f >> 1] += f & 1 ? LEAF : -LEAF;
+			neighbours[6 * b + f] = v.find_leaf(p[0], p[1], p[2]);
+			tiles[6 * b + f] = neighbours[6 * b + f] < 0 ? v.get(p[0], p[1], p[2]) : 0.f;
+		}
+	});
+}
+
+// Leaf b of values, one leaf after the other, with the faces of its
+// neighbours around it
+void level_set::load(int b, const float* values, float* block) const
+{
+	const float* own = values + (size_t)b * VOLUME_LEAF_CELLS;
+
+	for (int z = 0; z < LEAF; z++)
+		for (int y = 0; y < LEAF; y++)
+			std::copy(own + sparse_volume<float>::cell_index(0, y, z), own + sparse_volume<float>::cell_index(0, y, z) + LEAF,
+				block + at(0, y, z));
+
+	for (int f = 0; f < 6; f++)
+	{
+		int a = f >> 1, nb = neighbours[6 * b + f];
+		const float* other = nb < 0 ? nullptr : values + (size_t)nb * VOLUME_LEAF_CELLS;
+
+		for (int j = 0; j < LEAF; j++)
+			for (int i = 0; i < LEAF; i++)
+			{
+				// Cell of the face in this block and in the neighbour
+				int p[3], q[3];
+
+				p[a] = f & 1 ? LEAF : -1;
+				q[a] = f & 1 ? 0 : LEAF - 1;
+				p[(a + 1) % 3] = q[(a + 1) % 3] = i;
+				p[(a + 2) % 3] = q[(a + 2) % 3] = j;
+				block[at(p[0], p[1], p[2])] = other ? other[sparse_volume<float>::cell_index(q[0], q[1], q[2])]
+					: tiles[6 * b + f];
+			}
+	}
+}
+
+// Copy the swept values back to the leaves, the cells inside the band active
+void level_set::store()
+{
+	const float band = opt.band;
+
+	exec.for_each(phi.leaf_count(), [&](int b)
+	{
+		sparse_volume<float>::leaf& l = phi.leaf_at(b);
+		const float* in = &cur[(size_t)b * VOLUME_LEAF_CELLS];
+
+		std::fill(l.mask, l.mask + VOLUME_LEAF_CELLS / 64, (uint64_t)0);
+		for (int i = 0; i < VOLUME_LEAF_CELLS; i++)
+		{
+			l.values[i] = in[i];
+			if (std::fabs(in[i]) < band)
+				l.activate(i);
+		}
+	});
+}
+
+//========================================================================
+// Band
+//========================================================================
+
+// Add the neighbours in the box across every face, edge and corner of a
+// leaf where the band reaches it, bit (dz + 1) * 9 + (dy + 1) * 3 + dx + 1
+// of the leaf's directions
+void level_set::dilate()
+{
+	const sparse_volume<float>& v = phi;
+	std::vector<uint32_t> directions(v.leaf_count());
+
+	exec.for_each(v.leaf_count(), [&](int b)
+	{
+		const sparse_volume<float>::leaf& l = v.leaf_at(b);
+		uint32_t bits = 0;
+
+		for (int z = 0; z < LEAF; z++)
+			for (int y = 0; y < LEAF; y++)
+				for (int x = 0; x < LEAF; x++)
+				{
+					int i = sparse_volume<float>::cell_index(x, y, z);
+					int sx = x == 0 ? -1 : (x == LEAF - 1 ? 1 : 0);
+					int sy = y == 0 ? -1 : (y == LEAF - 1 ? 1 : 0);
+					int sz = z == 0 ? -1 : (z == LEAF - 1 ? 1 : 0);
+
+					if ((sx | sy | sz) == 0 || !l.active(i))
+						continue;
+					for (int dz = std::min(sz, 0); dz <= std::max(sz, 0); dz++)
+						for (int dy = std::min(sy, 0); dy <= std::max(sy, 0); dy++)
+							for (int dx = std::min(sx, 0); dx <= std::max(sx, 0); dx++)
+								bits |= 1u << ((dz + 1) * 9 + (dy + 1) * 3 + dx + 1);
+				}
+		directions[b] = bits;
+	});
+
+	for (int b = 0, count = v.leaf_count(); b < count; b++)
+	{
+		int o[3] = { v.leaf_at(b).origin[0], v.leaf_at(b).origin[1], v.leaf_at(b).origin[2] };
+
+		for (int d = 0; d < 27; d++)
+			if ((directions[b] >> d) & 1)
+			{
+				int x = o[0] + LEAF * (d % 3 - 1), y = o[1] + LEAF * (d / 3 % 3 - 1), z = o[2] + LEAF * (d / 9 - 1);
+
+				if (x >= 0 && y >= 0 && z >= 0 && x < n[0] && y < n[1] && z < n[2])
+					phi.touch_leaf(x, y, z);
+			}
+	}
+}
+
+// Turn leaves without an active cell back into tiles of their sign
+void level_set::prune()
+{
+	const float band = opt.band;
+
+	phi.prune([&](const sparse_volume<float>::leaf& l, float& value)
+	{
+		for (int w = 0; w < VOLUME_LEAF_CELLS / 64; w++)
+			if (l.mask[w])
+				return false;
+		value = l.values[0] < 0.f ? -band : band;
+		return true;
+	});
+}
+
+//========================================================================
+// Measures
+//========================================================================
+
+double level_set::inside_volume() const
+{
+	const sparse_volume<float>& v = phi;
+	int bx = (n[0] + LEAF - 1) / LEAF, by = (n[1] + LEAF - 1) / LEAF, bz = (n[2] + LEAF - 1) / LEAF;
+
+	// A cell beside the surface counts by its distance to it
+	double inside = exec.sum(v.leaf_count(), [&](int b) -> double
+	{
+		const sparse_volume<float>::leaf& l = v.leaf_at(b);
+		double s = 0.0;
+
+		for (int z = 0; z < LEAF; z++)
+			for (int y = 0; y < LEAF; y++)
+				for (int x = 0; x < LEAF; x++)
+					if (l.origin[0] + x < n[0] && l.origin[1] + y < n[1] && l.origin[2] + z < n[2])
+						s += std::max(0.f, std::min(1.f, 0.5f - l.values[sparse_volume<float>::cell_index(x, y, z)]));
+		return s;
+	});
+
+	// Tiles inside, a slice of blocks per job
+	inside += exec.sum(bz, [&](int k) -> double
+	{
+		double s = 0.0;
+
+		for (int j = 0; j < by; j++)
+			for (int i = 0; i < bx; i++)
+			{
+				int x = LEAF * i, y = LEAF * j, z = LEAF * k;
+
+				if (v.find_leaf(x, y, z) < 0 && v.get(x, y, z) < 0.f)
+					s += (double)std::min(LEAF, n[0] - x) * std::min(LEAF, n[1] - y) * std::min(LEAF, n[2] - z);
+			}
+		return s;
+	});
+	return inside;
+}
+
+size_t level_set::bytes() const
+{
+	return phi.bytes() + (cur.capacity() + next.capacity() + tiles.capacity()) * sizeof(float)
+		+ fixed.capacity() + neighbours.capacity() * sizeof(int);
+}
@@ -0,0 +1,112 @@
+/*****************************************************************************
+ * Narrow band level set
+ *
+ * A signed distance in cells, negative inside, kept only within opt.band
+ * cells of its zero level, in the leaves of a sparse_volume.  The blocks of
+ * the box without a leaf are tiles of -band inside and +band outside, so
+ * work and memory follow the area of the surface, not the volume of the
+ * box.  Each step is
+ *
+ *   dilate -> advect -> redistance -> prune
+ *
+ * Dilation adds the 26 neighbours of every leaf that holds the band, so a
+ * surface moving at most a cell per step stays on leaves.  Advection is
+ * semi-Lagrangian, as in stam3d, over the leaves only.
+ *
+ * Redistancing is fast sweeping (Zhao 2005) by blocks.  The cells beside
+ * the surface are fixed from where it crosses their edges, the others start
+ * at the band, and every iteration runs the eight sweep orders of the
+ * Godunov update of |grad phi| = 1 through each leaf, all leaves in
+ * parallel, reading the faces of their neighbours as the last iteration
+ * left them.  Distance moves a leaf per iteration, so a band of a few cells
+ * settles in two or three.  Leaves left without a cell inside the band are
+ * pruned back to tiles.
+ *****************************************************************************/
+
+#ifndef LEVEL_SETH
+#define LEVEL_SETH
+
+#include <functional>
+#include <vector>
+
+#include "sparse_volume.h"
+#include "tile_executor.h"
+
+struct level_set_options
+{
+	float band = 3.f;				// |phi| clamp, cells, at most a leaf
+	int max_iterations = 8;			// of the block sweeps per redistance
+	float tolerance = 1e-3f;		// change, cells, that counts as settled
+};
+
+// Seconds spent in each stage, accumulated over steps
+struct level_set_timing
+{
+	double dilate = 0.0;
+	double advect = 0.0;
+	double redistance = 0.0;
+	double prune = 0.0;
+};
+
+struct level_set_stats
+{
+	int iterations = 0;				// of the block sweeps in the last redistance
+	int unsettled = 0;				// cells still moving after the last iteration
+};
+
+// Writes the velocity at p, both in cells, in cells per unit time
+typedef std::function<void(const float* p, float* v)> level_set_velocity;
+
+class level_set
+{
+public:
+	// Over a box of nx x ny x nz cells
+	level_set(int nx, int ny, int nz, const level_set_options& opt, tile_executor& exec);
+
+	// The zero level of f(x, y, z) at cell positions, redistanced.  f is
+	// sampled at the centre of each leaf to place the band, so |f| must not
+	// exceed the distance to its zero level.
+	void reset(const std::function<float(float, float, float)>& f);
+
+	// Move the surface by dt; the velocity times dt must stay under a cell
+	void advect(const level_set_velocity& velocity, float dt, level_set_timing* timing = nullptr);
+
+	void redistance();
+
+	const sparse_volume<float>& volume() const { return phi; }
+	int leaf_count() const { return phi.leaf_count(); }
+	const level_set_stats& stats() const { return last; }
+
+	// Cells inside, those beside the surface in part
+	double inside_volume() const;
+
+	// Bytes of the volume and the sweep buffers
+	size_t bytes() const;
+
+	level_set_options opt;
+
+private:
+	void dilate();
+	void prune();
+	void find_neighbours();
+	void load(int b, const float* values, float* block) const;
+	void store();
+
+	tile_executor& exec;
+	int n[3];
+
+	sparse_volume<float> phi;
+
+	// Per leaf, in leaf order: the values being swept and the next
+	// iteration, cells fixed beside the surface, and the six leaves across
+	// the faces with the tile value read where one is missing
+	std::vector<float> cur, next;
+	std::vector<unsigned char> fixed;
+	std::vector<unsigned char> moved, moving;		// leaves changed by the last iteration and this one
+	std::vector<int> neighbours;
+	std::vector<float> tiles;
+
+	level_set_stats last;
+};
+
+#endif
@@ -0,0 +1,1166 @@
+/*****************************************************************************
+ * Stable fluids, offline driver
+ *
+ *   StableFluids bench  [size] [steps] [threads] [solver]
+ *   StableFluids render [size] [frames] [prefix] [threads]
+ *   StableFluids dump   [size] [steps]
+ *   StableFluids bench-pressure [min size] [max size] [threads]
+ *   StableFluids bench3d [size] [frames] [threads]
+ *   StableFluids water   [size] [frames] [prefix] [threads]
+ *   StableFluids bench-mc [size] [threads]
+ *   StableFluids bench-sph [particles] [frames] [threads]
+ *   StableFluids splash    [particles] [frames] [prefix] [threads]
+ *   StableFluids bench-flip [size] [steps] [max threads]
+ *   StableFluids bench-advect [size] [steps] [threads]
+ *   StableFluids bench-vorticity [size] [steps] [threads]
+ *   StableFluids bench-volume [size] [threads] [path]
+ *   StableFluids bench-levelset [size] [steps] [threads]
+ *
+ * bench times each stage of the 2-D pipeline, on one thread and on all of
+ * them unless a thread count is given; the pressure solver is one of
+ * jacobi (the default), multigrid, pcg, pcg-ic and pcg-mg.  render writes
+ * the dye of every frame to prefix0000.ppm, prefix0001.ppm, ...  dump
+ * prints the velocity and dye of a small grid as text, for comparison with
+ * the values read back from the WebGL demo.  bench-pressure compares the
+ * pressure solvers on one solve per grid size.
+ *
+ * bench3d runs the 3-D dam break and reports cells per second and the
+ * memory of the bricks against dense fields.  water writes its surface
+ * every frame to prefix0000.obj, prefix0001.obj, ... for cuda_ray.
+ * bench-mc times marching cubes on a rippled sphere, stored sparsely, and
+ * on a gyroid that fills the box.
+ *
+ * bench-sph runs the SPH dam break and reports particles per second over
+ * the substeps; splash writes the surface around its particles every
+ * frame, as water does.
+ *
+ * bench-flip times the FLIP and APIC solvers on 1, 2, 4, ... threads up to
+ * the maximum given (32 by default) at a fixed grid, and compares the
+ * kinetic energy each keeps against the grid solver of bench.
+ *
+ * bench-advect runs the 2-D pipeline with each advection scheme at half
+ * the size and at the size given, and measures the dye against a BFECC run
+ * at four times the size, box filtered down.
+ *
+ * bench-vorticity runs the 2-D pipeline without confinement at the size
+ * given, then at half and a quarter of it over a range of confinement
+ * strengths, and reports the rms curl and speed of each against those of
+ * the first, box filtered down.
+ *
+ * bench-volume stores the rippled sphere of bench-mc in a sparse_volume,
+ * times random and coherent lookups and a pass over its leaves, writes it
+ * to path (bench.vol by default) and maps it back.
+ *
+ * bench-levelset builds a narrow band level set of a sphere from a distance
+ * scaled out of shape, rotates it a cell per step about the box axis, and
+ * reports the time of each stage, cells of the band per second and the
+ * error against the exact distance.
+ *****************************************************************************/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <vector>
+
+#include "flip2d.h"
+#include "image.h"
+#include "level_set.h"
+#include "marching_cubes.h"
+#include "mesh.h"
+#include "multigrid.h"
+#include "pcg.h"
+#include "poisson.h"
+#include "sparse_volume.h"
+#include "sph.h"
+#include "stam2d.h"
+#include "stam3d.h"
+#include "tile_executor.h"
+
+static int arg_int(int argc, char* argv[], int i, int fallback)
+{
+	return argc > i ? atoi(argv[i]) : fallback;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: StableFluids bench  [size] [steps] [threads] [jacobi|multigrid|pcg|pcg-ic|pcg-mg]\n"
+		"       StableFluids render [size] [frames] [prefix] [threads]\n"
+		"       StableFluids dump   [size] [steps]\n"
+		"       StableFluids bench-pressure [min size] [max size] [threads]\n"
+		"       StableFluids bench3d [size] [frames] [threads]\n"
+		"       StableFluids water   [size] [frames] [prefix] [threads]\n"
+		"       StableFluids bench-mc [size] [threads]\n"
+		"       StableFluids bench-sph [particles] [frames] [threads]\n"
+		"       StableFluids splash    [particles] [frames] [prefix] [threads]\n"
+		"       StableFluids bench-flip [size] [steps] [max threads]\n"
+		"       StableFluids bench-advect [size] [steps] [threads]\n"
+		"       StableFluids bench-vorticity [size] [steps] [threads]\n"
+		"       StableFluids bench-volume [size] [threads] [path]\n"
+		"       StableFluids bench-levelset [size] [steps] [threads]\n");
+}
+
+//========================================================================
+// Benchmark
+//========================================================================
+
+static double bench_run(int size, int steps, int threads, stam2d_pressure solver, pcg_preconditioner precond)
+{
+	tile_executor exec(threads);
+	stam2d_options opt;
+	stam2d_timing t;
+	double total, cells;
+
+	opt.size = size;
+	opt.apply_pressure = true;
+	opt.dye_spots = true;
+	opt.pressure_solver = solver;
+	opt.pcg_precond = precond;
+
+	stam2d sim(opt, exec);
+	sim.step();
+
+	auto t0 = std::chrono::steady_clock::now();
+	for (int i = 0; i < steps; i++)
+		sim.step(&t);
+	total = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	cells = (double)size * size * steps;
+
+	printf("%5d  %7d  %8.2f  %8.2f  %10.2f  %8.2f  %6.2f  %9.2f  %9.1f\n", size, exec.thread_count(),
+		1000.0 * t.advect / steps, 1000.0 * t.divergence / steps, 1000.0 * t.pressure / steps,
+		1000.0 * t.gradient / steps, 1000.0 * t.splat / steps, 1000.0 * total / steps, cells / total * 1e-6);
+	return total;
+}
+
+static void bench(int size, int steps, int threads, const char* name)
+{
+	stam2d_pressure solver = STAM2D_JACOBI;
+	pcg_preconditioner precond = PCG_NONE;
+	double one, all;
+
+	if (strcmp(name, "multigrid") == 0)
+		solver = STAM2D_MULTIGRID;
+	else if (strncmp(name, "pcg", 3) == 0)
+	{
+		solver = STAM2D_PCG;
+		if (strcmp(name, "pcg-ic") == 0)
+			precond = PCG_INCOMPLETE_CHOLESKY;
+		else if (strcmp(name, "pcg-mg") == 0)
+			precond = PCG_MULTIGRID;
+	}
+
+	if (solver != STAM2D_JACOBI)
+		printf("stable fluids %dx%d, %d steps, %s pressure to %g\n", size, size, steps, name, stam2d_options().pressure_tolerance);
+	else
+		printf("stable fluids %dx%d, %d steps, %d Jacobi iterations\n", size, size, steps, stam2d_options().jacobi_iterations);
+	printf(" size  threads    advect  diverge  pressure ms  gradient   splat   step ms  Mcells/s\n");
+
+	if (threads > 0)
+	{
+		bench_run(size, steps, threads, solver, precond);
+		return;
+	}
+
+	one = bench_run(size, steps, 1, solver, precond);
+	tile_executor probe;
+	if (probe.thread_count() > 1)
+	{
+		all = bench_run(size, steps, 0, solver, precond);
+		printf("speedup %.2fx on %d threads\n", one / all, probe.thread_count());
+	}
+}
+
+//========================================================================
+// Pressure solver benchmark
+//========================================================================
+
+static void bench_pressure_row(const char* name, int n, const poisson_stats& st, double tolerance)
+{
+	if (st.residual < tolerance)
+		printf("%5d  %-14s %8d  %10.2e  %10.1f\n", n, name, st.iterations, st.residual, 1000.0 * st.seconds);
+	else
+		printf("%5d  %-14s %8d  %10.2e  %10.1f  not converged\n", n, name, st.iterations, st.residual, 1000.0 * st.seconds);
+}
+
+static void bench_pressure(int min_size, int max_size, int threads)
+{
+	tile_executor exec(threads);
+	multigrid_options mopt;
+	poisson_stats st;
+	const int jacobi_cap = 2000;
+
+	printf("pressure solve to %g relative residual, %d threads, Jacobi capped at %d sweeps\n",
+		mopt.tolerance, exec.thread_count(), jacobi_cap);
+	printf(" size  solver         iterations   residual    time ms\n");
+
+	for (int n = min_size; n <= max_size; n *= 2)
+	{
+		std::vector<float> b((size_t)n * n), x((size_t)n * n);
+		unsigned int seed = 1;
+
+		// Smooth divergence plus noise, like the splats of the demo
+		for (int y = 0; y < n; y++)
+			for (int i = 0; i < n; i++)
+			{
+				seed = seed * 1664525u + 1013904223u;
+				b[(size_t)y * n + i] = (float)(sin(6.2831853 * 3.0 * i / n) * cos(6.2831853 * 2.0 * y / n))
+					+ 0.1f * ((float)(seed >> 8) / 16777216.f - 0.5f);
+			}
+
+		std::fill(x.begin(), x.end(), 0.f);
+		st = poisson_jacobi(exec, n, b.data(), x.data(), 0.0, 50);
+		bench_pressure_row("jacobi x50", n, st, mopt.tolerance);
+
+		std::fill(x.begin(), x.end(), 0.f);
+		st = poisson_jacobi(exec, n, b.data(), x.data(), mopt.tolerance, jacobi_cap);
+		bench_pressure_row("jacobi", n, st, mopt.tolerance);
+
+		multigrid mg(n, exec);
+		for (int gamma = 1; gamma <= 2; gamma++)
+		{
+			mopt.gamma = gamma;
+			std::fill(x.begin(), x.end(), 0.f);
+			st = mg.solve(b.data(), x.data(), mopt);
+			bench_pressure_row(gamma == 1 ? "multigrid V" : "multigrid W", n, st, mopt.tolerance);
+		}
+
+		pcg cg(n, exec);
+		for (int k = PCG_NONE; k <= PCG_MULTIGRID; k++)
+		{
+			static const char* names[] = { "pcg", "pcg ic", "pcg multigrid" };
+			pcg_options popt;
+
+			popt.preconditioner = (pcg_preconditioner)k;
+			popt.tolerance = mopt.tolerance;
+			std::fill(x.begin(), x.end(), 0.f);
+			st = cg.solve(b.data(), x.data(), popt);
+			bench_pressure_row(names[k], n, st, mopt.tolerance);
+		}
+	}
+}
+
+//========================================================================
+// 3-D benchmark
+//========================================================================
+
+static double bench3d_run(int size, int frames, int threads)
+{
+	tile_executor exec(threads);
+	stam3d_options opt;
+	stam3d_timing t;
+	stam3d_stats st;
+	double total;
+
+	opt.size = size;
+	stam3d sim(opt, exec);
+
+	auto t0 = std::chrono::steady_clock::now();
+	for (int f = 0; f < frames; f++)
+		sim.step_frame(&t, &st);
+	total = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+	printf("%5d  %7d  %8d  %8.2f  %8.2f  %8.2f  %8.2f  %8.2f  %8.1f  %9.1f  %9.2f\n", size, exec.thread_count(),
+		st.substeps, 1000.0 * t.bricks / st.substeps, 1000.0 * t.advect / st.substeps,
+		1000.0 * t.redistance / st.substeps, 1000.0 * t.pressure / st.substeps, 1000.0 * t.extrapolate / st.substeps,
+		(double)st.pressure_iterations / st.substeps, (double)st.liquid_cells / total * 1e-6,
+		(double)size * size * size * st.substeps / total * 1e-6);
+	printf("       %d of %d bricks live, %.1f MB against %.1f MB dense\n", sim.live_bricks(),
+		sim.level_set().brick_count(), sim.bytes() / 1048576.0, sim.dense_bytes() / 1048576.0);
+	return total;
+}
+
+static void bench3d(int size, int frames, int threads)
+{
+	double one, all;
+
+	printf("3-D dam break %d^3, %d frames of %.4f s\n", size, frames, stam3d_options().frame_dt);
+	printf(" size  threads  substeps   bricks    advect  redist  pressure ms  extrap  cg iters  Mliquid/s  Mcells/s\n");
+
+	if (threads > 0)
+	{
+		bench3d_run(size, frames, threads);
+		return;
+	}
+
+	one = bench3d_run(size, frames, 1);
+	tile_executor probe;
+	if (probe.thread_count() > 1)
+	{
+		all = bench3d_run(size, frames, 0);
+		printf("speedup %.2fx on %d threads\n", one / all, probe.thread_count());
+	}
+}
+
+//========================================================================
+// Marching cubes benchmark
+//========================================================================
+
+// A sphere of radius 0.35 with ripples, as a distance in cells clamped to
+// +-4 and kept in the bricks within that band or inside; or a gyroid of 8
+// periods, every brick present
+static void bench_mc_field(brick_grid<float>& f, bool sphere, tile_executor& exec)
+{
+	int n = f.nx;
+	float band = 4.f;
+	auto value = [&](int x, int y, int z)
+	{
+		float px = ((float)x + 0.5f) / (float)n - 0.5f;
+		float py = ((float)y + 0.5f) / (float)n - 0.5f;
+		float pz = ((float)z + 0.5f) / (float)n - 0.5f;
+
+		if (sphere)
+		{
+			float r = 0.35f * (1.f + 0.04f * std::sin(40.f * px) * std::sin(40.f * py) * std::sin(40.f * pz));
+			float d = (std::sqrt(px * px + py * py + pz * pz) - r) * (float)n;
+			return d < -band ? -band : (d > band ? band : d);
+		}
+		float k = 2.f * 3.14159265f * 8.f;
+		return std::sin(k * px) * std::cos(k * py) + std::sin(k * py) * std::cos(k * pz) + std::sin(k * pz) * std::cos(k * px);
+	};
+
+	f = brick_grid<float>(n, n, n, sphere ? band : 0.f);
+	for (int b = 0; b < f.brick_count(); b++)
+	{
+		int x0, y0, z0;
+
+		f.brick_origin(b, x0, y0, z0);
+		float cx = ((float)x0 + 0.5f * BRICK_SIZE) / (float)n - 0.5f;
+		float cy = ((float)y0 + 0.5f * BRICK_SIZE) / (float)n - 0.5f;
+		float cz = ((float)z0 + 0.5f * BRICK_SIZE) / (float)n - 0.5f;
+		float d = (std::sqrt(cx * cx + cy * cy + cz * cz) - 0.35f) * (float)n;
+
+		// The ripples move the surface by 0.014 at most, the brick spans
+		// sqrt(3) 4 cells from its centre
+		if (!sphere || d - 0.014f * n - 7.f < band)
+			f.allocate(b);
+	}
+
+	std::vector<int> bricks;
+	for (int b = 0; b < f.brick_count(); b++)
+		if (f.allocated(b))
+			bricks.push_back(b);
+	exec.for_each((int)bricks.size(), [&](int i)
+	{
+		int x0, y0, z0;
+		float* p = f.brick(bricks[i]);
+
+		f.brick_origin(bricks[i], x0, y0, z0);
+		for (int z = z0; z < std::min(z0 + BRICK_SIZE, n); z++)
+			for (int y = y0; y < std::min(y0 + BRICK_SIZE, n); y++)
+				for (int x = x0; x < std::min(x0 + BRICK_SIZE, n); x++)
+					p[f.cell_index(x, y, z)] = value(x, y, z);
+	});
+}
+
+static double bench_mc_run(const brick_grid<float>& f, const char* name, int threads)
+{
+	tile_executor exec(threads);
+	marching_cubes mc(exec);
+	mesh m;
+
+	// Once to size the slab buffers, then timed
+	mc.extract(f, 0.f, 1.f / (float)f.nx, m);
+	mc.extract(f, 0.f, 1.f / (float)f.nx, m);
+	const marching_cubes_stats& st = mc.stats();
+
+	printf("%5d  %-7s %7d  %8.1f  %9d  %9d  %8.1f  %8.1f  %7.1f  %7.1f  %7d\n", f.nx, name, exec.thread_count(),
+		1000.0 * st.seconds, m.vertex_count(), m.face_count(), m.face_count() / st.seconds * 1e-6,
+		f.bytes() / 1048576.0, (m.vertices.size() + m.faces.size()) * 4 / 1048576.0, st.cache_bytes / 1048576.0,
+		st.active_blocks);
+	return st.seconds;
+}
+
+static void bench_mc(int size, int threads)
+{
+	printf("marching cubes on %d^3 fields\n", size);
+	printf(" size  field   threads  time ms   vertices  triangles  Mtris/s  field MB   mesh MB  cache MB  blocks\n");
+
+	for (int shape = 0; shape < 2; shape++)
+	{
+		const char* name = shape == 0 ? "sphere" : "gyroid";
+		brick_grid<float> f(size, size, size, 0.f);
+		double one, all;
+
+		{
+			tile_executor exec(threads);
+			bench_mc_field(f, shape == 0, exec);
+		}
+
+		if (threads > 0)
+		{
+			bench_mc_run(f, name, threads);
+			continue;
+		}
+
+		one = bench_mc_run(f, name, 1);
+		tile_executor probe;
+		if (probe.thread_count() > 1)
+		{
+			all = bench_mc_run(f, name, 0);
+			printf("speedup %.2fx on %d threads\n", one / all, probe.thread_count());
+		}
+	}
+}
+
+//========================================================================
+// Sparse volume benchmark
+//========================================================================
+
+static double seconds_between(std::chrono::steady_clock::time_point t0)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// Sum of the cells of every leaf, one slot per leaf so the order is fixed
+static double bench_volume_leaves(const sparse_volume<float>& v, int threads)
+{
+	tile_executor exec(threads);
+	std::vector<double> sums(v.leaf_count());
+
+	auto t0 = std::chrono::steady_clock::now();
+	v.for_each_leaf(exec, [&](const sparse_volume<float>::leaf& l)
+	{
+		double s = 0.0;
+
+		for (int i = 0; i < VOLUME_LEAF_CELLS; i++)
+			s += l.values[i];
+		sums[&l - &v.leaf_at(0)] = s;
+	});
+	double t = seconds_between(t0);
+
+	printf("leaf pass on %d threads: %.2f ms, %.0f Mcells/s\n", exec.thread_count(), 1000.0 * t,
+		(double)v.leaf_count() * VOLUME_LEAF_CELLS / t * 1e-6);
+	return t;
+}
+
+static int bench_volume(int size, int threads, const char* path)
+{
+	brick_grid<float> bricks;
+	sparse_volume<float> v;
+	const int lookups = 1 << 24;
+	std::vector<int> at(3 * (size_t)lookups);
+	double sum[4] = { 0.0, 0.0, 0.0, 0.0 }, t;
+
+	{
+		tile_executor exec(threads);
+
+		bricks = brick_grid<float>(size, size, size, 0.f);
+		bench_mc_field(bricks, true, exec);
+	}
+
+	auto t0 = std::chrono::steady_clock::now();
+	v.copy_from(bricks);
+	t = seconds_between(t0);
+	printf("rippled sphere %d^3: %d leaves, %d nodes, built in %.1f ms\n", size, v.leaf_count(), v.node_count(), 1000.0 * t);
+	printf("memory: sparse %.1f MB, bricks %.1f MB, dense %.1f MB\n", v.bytes() / 1048576.0, bricks.bytes() / 1048576.0,
+		(double)size * size * size * sizeof(float) / 1048576.0);
+
+	// Random cells of the box, most of them outside any leaf, then every
+	// cell of every leaf in order
+	uint32_t r = 12345;
+	for (size_t i = 0; i < at.size(); i++)
+	{
+		r = r * 1664525u + 1013904223u;
+		at[i] = (int)((r >> 8) % (uint32_t)size);
+	}
+
+	t0 = std::chrono::steady_clock::now();
+	for (int i = 0; i < lookups; i++)
+		sum[0] += bricks.get(at[3 * i], at[3 * i + 1], at[3 * i + 2]);
+	double brick_random = seconds_between(t0);
+
+	t0 = std::chrono::steady_clock::now();
+	for (int i = 0; i < lookups; i++)
+		sum[1] += v.get(at[3 * i], at[3 * i + 1], at[3 * i + 2]);
+	double volume_random = seconds_between(t0);
+
+	sparse_volume<float>::const_accessor a(v);
+	t0 = std::chrono::steady_clock::now();
+	for (int i = 0; i < lookups; i++)
+		sum[2] += a.get(at[3 * i], at[3 * i + 1], at[3 * i + 2]);
+	double accessor_random = seconds_between(t0);
+
+	t0 = std::chrono::steady_clock::now();
+	for (int l = 0; l < v.leaf_count(); l++)
+	{
+		const int* o = v.leaf_at(l).origin;
+
+		for (int z = o[2]; z < o[2] + 8; z++)
+			for (int y = o[1]; y < o[1] + 8; y++)
+				for (int x = o[0]; x < o[0] + 8; x++)
+					sum[3] += a.get(x, y, z);
+	}
+	double accessor_coherent = seconds_between(t0);
+
+	double direct = 0.0;
+	for (int l = 0; l < v.leaf_count(); l++)
+		for (int i = 0; i < VOLUME_LEAF_CELLS; i++)
+			direct += v.leaf_at(l).values[i];
+
+	printf("lookups, Mcells/s: bricks random %.1f, volume random %.1f, accessor random %.1f, accessor coherent %.1f\n",
+		lookups / brick_random * 1e-6, lookups / volume_random * 1e-6, lookups / accessor_random * 1e-6,
+		(double)v.leaf_count() * VOLUME_LEAF_CELLS / accessor_coherent * 1e-6);
+	if (sum[0] != sum[1] || sum[1] != sum[2] || sum[3] != direct)
+	{
+		fprintf(stderr, "Error: lookups differ\n");
+		return EXIT_FAILURE;
+	}
+
+	double one = bench_volume_leaves(v, 1);
+	tile_executor probe;
+	if (threads != 1 && probe.thread_count() > 1)
+		printf("speedup %.2fx\n", one / bench_volume_leaves(v, threads));
+
+	t0 = std::chrono::steady_clock::now();
+	if (!v.write(path))
+	{
+		fprintf(stderr, "Error: cannot write %s\n", path);
+		return EXIT_FAILURE;
+	}
+	double write = seconds_between(t0);
+
+	sparse_volume<float> m;
+	t0 = std::chrono::steady_clock::now();
+	if (!m.map(path))
+	{
+		fprintf(stderr, "Error: cannot map %s\n", path);
+		return EXIT_FAILURE;
+	}
+	double map = seconds_between(t0);
+
+	sparse_volume<float>::const_accessor b(m);
+	double mapped = 0.0;
+	t0 = std::chrono::steady_clock::now();
+	for (int i = 0; i < lookups; i++)
+		mapped += b.get(at[3 * i], at[3 * i + 1], at[3 * i + 2]);
+	double mapped_random = seconds_between(t0);
+
+	printf("%s: %.1f MB, written in %.1f ms, mapped in %.3f ms, %.1f Mcells/s random through the mapping\n", path,
+		m.bytes() / 1048576.0, 1000.0 * write, 1000.0 * map, lookups / mapped_random * 1e-6);
+	if (mapped != sum[2] || m.leaf_count() != v.leaf_count())
+	{
+		fprintf(stderr, "Error: %s does not read back\n", path);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+//========================================================================
+// Level set benchmark
+//========================================================================
+
+// Mean and largest error of phi against the distance to a sphere, over the
+// cells of the band
+static void bench_levelset_error(const level_set& ls, const float* centre, float radius, float band, tile_executor& exec,
+	double& mean, double& worst)
+{
+	const sparse_volume<float>& v = ls.volume();
+	std::vector<double> largest(v.leaf_count());
+	std::vector<int> counts(v.leaf_count());
+
+	double total = exec.sum(v.leaf_count(), [&](int b) -> double
+	{
+		const sparse_volume<float>::leaf& l = v.leaf_at(b);
+		double s = 0.0;
+
+		largest[b] = 0.0;
+		counts[b] = 0;
+		for (int z = 0; z < 8; z++)
+			for (int y = 0; y < 8; y++)
+				for (int x = 0; x < 8; x++)
+				{
+					float dx = l.origin[0] + x - centre[0], dy = l.origin[1] + y - centre[1], dz = l.origin[2] + z - centre[2];
+					float d = std::sqrt(dx * dx + dy * dy + dz * dz) - radius;
+
+					if (std::fabs(d) < band - 1.f)
+					{
+						double e = std::fabs(l.values[sparse_volume<float>::cell_index(x, y, z)] - d);
+
+						s += e;
+						largest[b] = std::max(largest[b], e);
+						counts[b]++;
+					}
+				}
+		return s;
+	});
+
+	int count = 0;
+	worst = 0.0;
+	for (int b = 0; b < v.leaf_count(); b++)
+	{
+		worst = std::max(worst, largest[b]);
+		count += counts[b];
+	}
+	mean = count ? total / count : 0.0;
+}
+
+static void bench_levelset(int size, int steps, int threads)
+{
+	tile_executor exec(threads);
+	level_set_options opt;
+	level_set ls(size, size, size, opt, exec);
+	const float radius = 0.15f * size, axis = 0.5f * size, omega = 1.f / (0.35f * size);
+	float centre[3] = { 0.5f * size, 0.7f * size, 0.5f * size };
+	double mean, worst;
+
+	// Never above the distance, so the band is placed, but well off it
+	auto t0 = std::chrono::steady_clock::now();
+	ls.reset([&](float x, float y, float z)
+	{
+		float dx = x - centre[0], dy = y - centre[1], dz = z - centre[2];
+
+		return (std::sqrt(dx * dx + dy * dy + dz * dz) - radius) * (0.75f + 0.25f * std::sin(0.3f * x) * std::cos(0.2f * z));
+	});
+	double reset = seconds_between(t0);
+	double volume = ls.inside_volume();
+
+	bench_levelset_error(ls, centre, radius, opt.band, exec, mean, worst);
+	printf("sphere in %d^3 on %d threads: %d leaves, %.1f Mcells of band, %d sweep iterations, built in %.1f ms\n", size,
+		exec.thread_count(), ls.leaf_count(), (double)ls.leaf_count() * VOLUME_LEAF_CELLS * 1e-6, ls.stats().iterations,
+		1000.0 * reset);
+	printf("memory: %.1f MB, dense %.1f MB\n", ls.bytes() / 1048576.0, (double)size * size * size * sizeof(float) / 1048576.0);
+	printf("redistanced: error %.4f mean, %.4f worst cells; volume %.0f cells, exact %.0f\n", mean, worst, volume,
+		4.0 / 3.0 * 3.14159265358979 * radius * radius * radius);
+
+	// Rigid rotation about the z axis through the middle, a cell per step
+	// at the far side of the sphere
+	level_set_timing t;
+	int64_t cells = 0;
+	for (int s = 0; s < steps; s++)
+	{
+		ls.advect([&](const float* p, float* u)
+		{
+			u[0] = -omega * (p[1] - axis);
+			u[1] = omega * (p[0] - axis);
+			u[2] = 0.f;
+		}, 1.f, &t);
+		cells += (int64_t)ls.leaf_count() * VOLUME_LEAF_CELLS;
+	}
+
+	double total = t.dilate + t.advect + t.redistance + t.prune;
+	float angle = omega * steps, x = centre[0] - axis, y = centre[1] - axis;
+
+	centre[0] = axis + x * std::cos(angle) - y * std::sin(angle);
+	centre[1] = axis + x * std::sin(angle) + y * std::cos(angle);
+	bench_levelset_error(ls, centre, radius, opt.band, exec, mean, worst);
+	printf("%d steps: %.1f ms per step (dilate %.1f, advect %.1f, redistance %.1f, prune %.1f), %.1f Mcells/s\n", steps,
+		1000.0 * total / steps, 1000.0 * t.dilate / steps, 1000.0 * t.advect / steps, 1000.0 * t.redistance / steps,
+		1000.0 * t.prune / steps, cells / total * 1e-6);
+	printf("after %.1f degrees: %d leaves, %d sweep iterations, error %.4f mean, %.4f worst cells, volume %+.2f%%\n",
+		angle * 57.2957795f, ls.leaf_count(), ls.stats().iterations, mean, worst, 100.0 * (ls.inside_volume() / volume - 1.0));
+}
+
+//========================================================================
+// SPH benchmark
+//========================================================================
+
+static double bench_sph_run(int particles, int frames, int threads)
+{
+	tile_executor exec(threads);
+	sph_options opt;
+	sph_timing t;
+	sph_stats st;
+	double total;
+
+	opt.particles = particles;
+	sph sim(opt, exec);
+
+	auto t0 = std::chrono::steady_clock::now();
+	for (int f = 0; f < frames; f++)
+		sim.step_frame(&t, &st);
+	total = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+	printf("%9d  %7d  %8d  %8.2f  %8.2f  %8.2f  %8.2f  %6.1f  %7.4f  %10.2f  %8.1f\n", sim.particle_count(),
+		exec.thread_count(), st.substeps, 1000.0 * t.sort / st.substeps, 1000.0 * t.density / st.substeps,
+		1000.0 * t.pressure / st.substeps, 1000.0 * t.integrate / st.substeps, (double)st.iterations / st.substeps,
+		st.density_error, (double)sim.particle_count() * st.substeps / total * 1e-6, sim.bytes() / 1048576.0);
+	return total;
+}
+
+static void bench_sph(int particles, int frames, int threads)
+{
+	double one, all;
+
+	printf("SPH dam break, %d frames of %.4f s\n", frames, sph_options().frame_dt);
+	printf("particles  threads  substeps   sort ms  dens ms  press ms   integr  iters  density  Mparticle/s  MB\n");
+
+	if (threads > 0)
+	{
+		bench_sph_run(particles, frames, threads);
+		return;
+	}
+
+	one = bench_sph_run(particles, frames, 1);
+	tile_executor probe;
+	if (probe.thread_count() > 1)
+	{
+		all = bench_sph_run(particles, frames, 0);
+		printf("speedup %.2fx on %d threads\n", one / all, probe.thread_count());
+	}
+}
+
+//========================================================================
+// FLIP benchmark
+//========================================================================
+
+static double bench_flip_run(int size, int steps, int threads, flip2d_transfer transfer, double one)
+{
+	tile_executor exec(threads);
+	flip2d_options opt;
+	flip2d_timing t;
+	double total;
+
+	opt.size = size;
+	opt.transfer = transfer;
+
+	flip2d sim(opt, exec);
+	sim.step();
+
+	auto t0 = std::chrono::steady_clock::now();
+	for (int i = 0; i < steps; i++)
+		sim.step(&t);
+	total = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+	printf("%5s  %7d  %7.2f  %8.2f  %8.2f  %9.2f  %7.2f  %11.2f  %7.2f\n", transfer == FLIP2D_APIC ? "APIC" : "FLIP",
+		exec.thread_count(), 1000.0 * t.sort / steps, 1000.0 * t.splat / steps, 1000.0 * t.pressure / steps,
+		1000.0 * t.gather / steps, 1000.0 * total / steps, (double)sim.particle_count() * steps / total * 1e-6,
+		one > 0.0 ? one / total : 1.0);
+	return total;
+}
+
+// Kinetic energy of the 2-D grid solver, in the box units of flip2d
+static double stam2d_energy(const stam2d& sim, tile_executor& exec)
+{
+	const field& v = sim.velocity();
+	double e = exec.sum(v.h, [&](int y)
+	{
+		double row = 0.0;
+
+		for (int x = 0; x < v.w; x++)
+		{
+			const float* p = v.at(x, y);
+
+			row += 0.25 * ((double)p[0] * p[0] + (double)p[1] * p[1]);
+		}
+		return row;
+	});
+
+	return 0.5 * e / ((double)v.w * v.h);
+}
+
+static void bench_flip(int size, int steps, int max_threads)
+{
+	printf("FLIP / APIC %dx%d, %d particles per cell, %d steps\n", size, size,
+		flip2d_options().seeds * flip2d_options().seeds, steps);
+	printf(" mode  threads  sort ms  splat ms  press ms  gather ms  step ms  Mparticle/s  speedup\n");
+
+	for (flip2d_transfer transfer : { FLIP2D_FLIP, FLIP2D_APIC })
+	{
+		double one = bench_flip_run(size, steps, 1, transfer, 0.0);
+
+		for (int threads = 2; threads <= max_threads; threads *= 2)
+			bench_flip_run(size, steps, threads, transfer, one);
+	}
+
+	// Energy after steps against that after the first projection; the
+	// initial field is not divergence free
+	tile_executor exec;
+	stam2d_options so;
+	flip2d_options fo;
+
+	so.size = fo.size = size;
+	so.apply_pressure = true;
+	so.pressure_solver = STAM2D_MULTIGRID;
+	stam2d grid(so, exec);
+	flip2d flip(fo, exec);
+	fo.transfer = FLIP2D_APIC;
+	flip2d apic(fo, exec);
+
+	grid.step();
+	flip.step();
+	apic.step();
+
+	double e0[3] = { stam2d_energy(grid, exec), flip.energy(), apic.energy() };
+
+	for (int i = 1; i < steps; i++)
+	{
+		grid.step();
+		flip.step();
+		apic.step();
+	}
+	printf("kinetic energy kept over %d steps: grid %.4f, FLIP %.4f, APIC %.4f\n", steps,
+		stam2d_energy(grid, exec) / e0[0], flip.energy() / e0[1], apic.energy() / e0[2]);
+}
+
+//========================================================================
+// Advection benchmark
+//========================================================================
+
+static const char* advection_name(stam2d_advection a)
+{
+	return a == STAM2D_BFECC ? "BFECC" : (a == STAM2D_MACCORMACK ? "MacCormack" : "semi-Lagrangian");
+}
+
+static void bench_advect_run(int size, int steps, stam2d_advection advection, tile_executor& exec, field& dye,
+	stam2d_timing& t, double& total)
+{
+	stam2d_options opt;
+
+	opt.size = size;
+	opt.advect_v = false;
+	opt.advection = advection;
+
+	stam2d sim(opt, exec);
+
+	auto t0 = std::chrono::steady_clock::now();
+	for (int i = 0; i < steps; i++)
+		sim.step(&t);
+	total = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	dye = sim.color();
+}
+
+// Mean absolute difference of the dye from the reference, box filtered
+// down to its size
+static double dye_error(const field& dye, const field& reference)
+{
+	int f = reference.w / dye.w;
+	double e = 0.0;
+
+	for (int y = 0; y < dye.h; y++)
+		for (int x = 0; x < dye.w; x++)
+			for (int k = 0; k < dye.c; k++)
+			{
+				double mean = 0.0;
+
+				for (int j = 0; j < f; j++)
+					for (int i = 0; i < f; i++)
+						mean += reference.at(x * f + i, y * f + j)[k];
+				e += std::fabs(dye.at(x, y)[k] - mean / ((double)f * f));
+			}
+	return e / ((double)dye.w * dye.h * dye.c);
+}
+
+static void bench_advect(int size, int steps, int threads)
+{
+	static const stam2d_advection schemes[3] = { STAM2D_SEMI_LAGRANGIAN, STAM2D_MACCORMACK, STAM2D_BFECC };
+	tile_executor exec(threads);
+	stam2d_timing t;
+	field reference, dye;
+	double total, error[3][2];
+
+	size &= ~1;
+	printf("advection, %d steps, dye against BFECC at %dx%d\n", steps, 4 * size, 4 * size);
+	bench_advect_run(4 * size, steps, STAM2D_BFECC, exec, reference, t, total);
+
+	printf("         scheme   size  advect ms   step ms  dye error\n");
+	for (int a = 0; a < 3; a++)
+		for (int h = 0; h < 2; h++)
+		{
+			int n = h ? size : size / 2;
+
+			t = stam2d_timing();
+			bench_advect_run(n, steps, schemes[a], exec, dye, t, total);
+			error[a][h] = dye_error(dye, reference);
+			printf("%15s  %5d  %9.3f  %8.3f  %9.5f\n", advection_name(schemes[a]), n,
+				1000.0 * t.advect / steps, 1000.0 * total / steps, error[a][h]);
+		}
+
+	for (int a = 1; a < 3; a++)
+		printf("%s at %d: %.2fx the error of semi-Lagrangian at %d\n", advection_name(schemes[a]), size / 2,
+			error[a][0] / error[0][1], size);
+}
+
+//========================================================================
+// Vorticity confinement benchmark
+//========================================================================
+
+// The reference box filtered down to size
+static field box_filter(const field& reference, int size)
+{
+	int f = reference.w / size;
+	field out(size, size, reference.c);
+
+	for (int y = 0; y < size; y++)
+		for (int x = 0; x < size; x++)
+			for (int k = 0; k < reference.c; k++)
+			{
+				double mean = 0.0;
+
+				for (int j = 0; j < f; j++)
+					for (int i = 0; i < f; i++)
+						mean += reference.at(x * f + i, y * f + j)[k];
+				out.at(x, y)[k] = (float)(mean / ((double)f * f));
+			}
+	return out;
+}
+
+// Root mean square of the curl, taken as vorticity_confinement does, and
+// of the speed
+static void velocity_detail(const field& v, double& curl, double& speed)
+{
+	double c2 = 0.0, s2 = 0.0;
+
+	for (int y = 0; y < v.h; y++)
+		for (int x = 0; x < v.w; x++)
+		{
+			double c = 0.5 * v.w * ((v.wrap(x + 1, y)[1] - v.wrap(x - 1, y)[1]) - (v.wrap(x, y + 1)[0] - v.wrap(x, y - 1)[0]));
+
+			c2 += c * c;
+			s2 += (double)v.at(x, y)[0] * v.at(x, y)[0] + (double)v.at(x, y)[1] * v.at(x, y)[1];
+		}
+	curl = std::sqrt(c2 / ((double)v.w * v.h));
+	speed = std::sqrt(s2 / ((double)v.w * v.h));
+}
+
+static double bench_vorticity_run(int size, int steps, float strength, tile_executor& exec, field& velocity)
+{
+	stam2d_options opt;
+	stam2d_timing t;
+	double total;
+
+	opt.size = size;
+	opt.apply_pressure = true;
+	opt.pressure_solver = STAM2D_MULTIGRID;
+	opt.vorticity = strength;
+
+	stam2d sim(opt, exec);
+
+	auto t0 = std::chrono::steady_clock::now();
+	for (int i = 0; i < steps; i++)
+		sim.step(&t);
+	total = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	velocity = sim.velocity();
+
+	printf("%5d  %8.2f  %12.3f  %8.3f", size, strength, 1000.0 * t.vorticity / steps, 1000.0 * total / steps);
+	return total;
+}
+
+// Detail is the rms curl at the scale of the coarse grid, against that of
+// the reference filtered down to it
+static void bench_vorticity(int size, int steps, int threads)
+{
+	static const float strengths[] = { 0.f, 0.25f, 0.5f, 1.f, 2.f, 4.f, 8.f };
+	tile_executor exec(threads);
+	field reference, velocity;
+	double full;
+
+	size &= ~3;
+	printf("vorticity confinement, %d steps, against no confinement at %dx%d\n", steps, size, size);
+	printf(" size  strength  vorticity ms   step ms  rms curl  rms speed  speedup\n");
+	full = bench_vorticity_run(size, steps, 0.f, exec, reference);
+	printf("      1.000      1.000\n");
+
+	for (int n = size / 2; n >= size / 4; n /= 2)
+	{
+		double target, target_speed, curl, speed;
+		float best = 0.f;
+		double best_curl = 0.0, best_time = 0.0;
+
+		velocity_detail(box_filter(reference, n), target, target_speed);
+		for (float s : strengths)
+		{
+			double total = bench_vorticity_run(n, steps, s, exec, velocity);
+
+			velocity_detail(velocity, curl, speed);
+			printf("  %8.3f  %9.3f  %7.2f\n", curl / target, speed / target_speed, full / total);
+			if (s == 0.f || std::fabs(curl - target) < std::fabs(best_curl - target))
+				best = s, best_curl = curl, best_time = total;
+		}
+		printf("%d matches the curl of %d best with strength %.2f (%.3f), %.2fx faster\n", n, size, best,
+			best_curl / target, full / best_time);
+	}
+}
+
+//========================================================================
+// Offline rendering
+//========================================================================
+
+static int render(int size, int frames, const char* prefix, int threads)
+{
+	tile_executor exec(threads);
+	stam2d_options opt;
+	char path[1024];
+
+	opt.size = size;
+	opt.apply_pressure = true;
+	opt.dye_spots = true;
+
+	stam2d sim(opt, exec);
+
+	for (int f = 0; f < frames; f++)
+	{
+		auto t0 = std::chrono::steady_clock::now();
+		sim.step();
+		double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+		snprintf(path, sizeof(path), "%s%04d.ppm", prefix, f);
+		if (!write_ppm(path, sim.color(), false))
+		{
+			fprintf(stderr, "Error: cannot write %s\n", path);
+			return EXIT_FAILURE;
+		}
+		printf("%s  %.1f ms\n", path, 1000.0 * t);
+	}
+	return EXIT_SUCCESS;
+}
+
+static int water(int size, int frames, const char* prefix, int threads)
+{
+	tile_executor exec(threads);
+	stam3d_options opt;
+	mesh surface;
+	char path[1024];
+
+	opt.size = size;
+	stam3d sim(opt, exec);
+
+	for (int f = 0; f < frames; f++)
+	{
+		auto t0 = std::chrono::steady_clock::now();
+		sim.step_frame();
+		sim.surface(surface);
+		double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+		snprintf(path, sizeof(path), "%s%04d.obj", prefix, f);
+		if (!write_obj(path, surface))
+		{
+			fprintf(stderr, "Error: cannot write %s\n", path);
+			return EXIT_FAILURE;
+		}
+		printf("%s  %d vertices  %d faces  %.1f ms\n", path, surface.vertex_count(), surface.face_count(), 1000.0 * t);
+	}
+	return EXIT_SUCCESS;
+}
+
+static int splash(int particles, int frames, const char* prefix, int threads)
+{
+	tile_executor exec(threads);
+	sph_options opt;
+	mesh surface;
+	char path[1024];
+
+	opt.particles = particles;
+	sph sim(opt, exec);
+
+	for (int f = 0; f < frames; f++)
+	{
+		auto t0 = std::chrono::steady_clock::now();
+		sim.step_frame();
+		sim.surface(surface);
+		double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+		snprintf(path, sizeof(path), "%s%04d.obj", prefix, f);
+		if (!write_obj(path, surface))
+		{
+			fprintf(stderr, "Error: cannot write %s\n", path);
+			return EXIT_FAILURE;
+		}
+		printf("%s  %d vertices  %d faces  %.1f ms\n", path, surface.vertex_count(), surface.face_count(), 1000.0 * t);
+	}
+	return EXIT_SUCCESS;
+}
+
+//========================================================================
+// Text dump
+//========================================================================
+
+static void dump(int size, int steps)
+{
+	tile_executor exec(1);
+	stam2d_options opt;
+	int x, y;
+
+	opt.size = size;
+	opt.apply_pressure = true;
+
+	stam2d sim(opt, exec);
+	for (int i = 0; i < steps; i++)
+		sim.step();
+
+	printf("# x y vx vy r g b after %d steps\n", steps);
+	for (y = 0; y < size; y++)
+		for (x = 0; x < size; x++)
+		{
+			const float* v = sim.velocity().at(x, y);
+			const float* c = sim.color().at(x, y);
+
+			printf("%d %d %.7g %.7g %.7g %.7g %.7g\n", x, y, v[0], v[1], c[0], c[1], c[2]);
+		}
+}
+
+//========================================================================
+// main
+//========================================================================
+
+int main(int argc, char* argv[])
+{
+	if (argc > 1 && strcmp(argv[1], "bench") == 0)
+	{
+		bench(arg_int(argc, argv, 2, 2048), arg_int(argc, argv, 3, 20), arg_int(argc, argv, 4, 0),
+			argc > 5 ? argv[5] : "jacobi");
+		return EXIT_SUCCESS;
+	}
+	if (argc > 1 && strcmp(argv[1], "bench-pressure") == 0)
+	{
+		bench_pressure(arg_int(argc, argv, 2, 512), arg_int(argc, argv, 3, 4096), arg_int(argc, argv, 4, 0));
+		return EXIT_SUCCESS;
+	}
+	if (argc > 1 && strcmp(argv[1], "render") == 0)
+		return render(arg_int(argc, argv, 2, 2048), arg_int(argc, argv, 3, 120),
+			argc > 4 ? argv[4] : "dye", arg_int(argc, argv, 5, 0));
+	if (argc > 1 && strcmp(argv[1], "bench3d") == 0)
+	{
+		bench3d(arg_int(argc, argv, 2, 128), arg_int(argc, argv, 3, 10), arg_int(argc, argv, 4, 0));
+		return EXIT_SUCCESS;
+	}
+	if (argc > 1 && strcmp(argv[1], "bench-mc") == 0)
+	{
+		bench_mc(arg_int(argc, argv, 2, 512), arg_int(argc, argv, 3, 0));
+		return EXIT_SUCCESS;
+	}
+	if (argc > 1 && strcmp(argv[1], "bench-volume") == 0)
+		return bench_volume(arg_int(argc, argv, 2, 512), arg_int(argc, argv, 3, 0), argc > 4 ? argv[4] : "bench.vol");
+	if (argc > 1 && strcmp(argv[1], "bench-levelset") == 0)
+	{
+		bench_levelset(arg_int(argc, argv, 2, 512), arg_int(argc, argv, 3, 20), arg_int(argc, argv, 4, 0));
+		return EXIT_SUCCESS;
+	}
+	if (argc > 1 && strcmp(argv[1], "bench-sph") == 0)
+	{
+		bench_sph(arg_int(argc, argv, 2, 1000000), arg_int(argc, argv, 3, 5), arg_int(argc, argv, 4, 0));
+		return EXIT_SUCCESS;
+	}
+	if (argc > 1 && strcmp(argv[1], "bench-flip") == 0)
+	{
+		bench_flip(arg_int(argc, argv, 2, 1024), arg_int(argc, argv, 3, 20), arg_int(argc, argv, 4, 32));
+		return EXIT_SUCCESS;
+	}
+	if (argc > 1 && strcmp(argv[1], "bench-advect") == 0)
+	{
+		bench_advect(arg_int(argc, argv, 2, 256), arg_int(argc, argv, 3, 30), arg_int(argc, argv, 4, 0));
+		return EXIT_SUCCESS;
+	}
+	if (argc > 1 && strcmp(argv[1], "bench-vorticity") == 0)
+	{
+		bench_vorticity(arg_int(argc, argv, 2, 512), arg_int(argc, argv, 3, 120), arg_int(argc, argv, 4, 0));
+		return EXIT_SUCCESS;
+	}
+	if (argc > 1 && strcmp(argv[1], "splash") == 0)
+		return splash(arg_int(argc, argv, 2, 1000000), arg_int(argc, argv, 3, 120),
+			argc > 4 ? argv[4] : "data_part", arg_int(argc, argv, 5, 0));
+	if (argc > 1 && strcmp(argv[1], "water") == 0)
+		return water(arg_int(argc, argv, 2, 128), arg_int(argc, argv, 3, 120),
+			argc > 4 ? argv[4] : "data_part", arg_int(argc, argv, 5, 0));
+	if (argc > 1 && strcmp(argv[1], "dump") == 0)
+	{
+		dump(arg_int(argc, argv, 2, 16), arg_int(argc, argv, 3, 1));
+		return EXIT_SUCCESS;
+	}
+
+	usage();
+	return EXIT_FAILURE;
+}
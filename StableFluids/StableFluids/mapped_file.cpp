@@ -0,0 +1,99 @@
+/*****************************************************************************
+ * Read-only file mapping
+ *****************************************************************************/
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mapped_file.h"
+
+#ifdef _WIN32
+
+bool mapped_file::open(const char* path)
+{
+	HANDLE file;
+	LARGE_INTEGER n;
+
+	close();
+	file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	if (!GetFileSizeEx(file, &n) || n.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	// The view keeps the file open
+	handle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(file);
+	if (!handle)
+		return false;
+	base = MapViewOfFile(handle, FILE_MAP_READ, 0, 0, 0);
+	if (!base)
+	{
+		CloseHandle(handle);
+		handle = nullptr;
+		return false;
+	}
+	length = (size_t)n.QuadPart;
+	return true;
+}
+
+void mapped_file::close()
+{
+	if (base)
+		UnmapViewOfFile(base);
+	if (handle)
+		CloseHandle(handle);
+	base = nullptr;
+	handle = nullptr;
+	length = 0;
+}
+
+#else
+
+bool mapped_file::open(const char* path)
+{
+	struct stat st;
+	int fd;
+
+	close();
+	fd = ::open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		::close(fd);
+		return false;
+	}
+
+	// The mapping keeps the file open
+	base = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (base == MAP_FAILED)
+	{
+		base = nullptr;
+		return false;
+	}
+	length = (size_t)st.st_size;
+	return true;
+}
+
+void mapped_file::close()
+{
+	if (base)
+		munmap(base, length);
+	base = nullptr;
+	length = 0;
+}
+
+#endif
@@ -0,0 +1,36 @@
+/*****************************************************************************
+ * Read-only file mapping
+ *
+ * Maps a whole file into memory, MapViewOfFile on Windows and mmap
+ * elsewhere, so a large volume is paged in as it is read instead of being
+ * copied up front.
+ *****************************************************************************/
+
+#ifndef MAPPED_FILEH
+#define MAPPED_FILEH
+
+#include <cstddef>
+
+class mapped_file
+{
+public:
+	mapped_file() : base(nullptr), length(0), handle(nullptr) {}
+	~mapped_file() { close(); }
+
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	// Returns false if the file cannot be opened or mapped, or is empty
+	bool open(const char* path);
+	void close();
+
+	const void* data() const { return base; }
+	size_t size() const { return length; }
+
+private:
+	void* base;
+	size_t length;
+	void* handle;		// of the mapping object on Windows
+};
+
+#endif
@@ -0,0 +1,627 @@
+/*****************************************************************************
+ * Parallel marching cubes
+ *****************************************************************************/
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "marching_cubes.h"
+
+#define MC_BLOCK_LOG2 3
+#define MC_BLOCK (1 << MC_BLOCK_LOG2)	// cubes along a block
+#define MC_GROUP 4						// blocks along a group
+#define MC_CORNERS (MC_BLOCK + 1)
+#define MC_EDGES (MC_BLOCK * MC_BLOCK * MC_BLOCK * 3)
+
+/* Corners and edges of a cube in the usual marching cubes order:
+ *
+ *   corner 0 (0, 0, 0)  1 (1, 0, 0)  2 (1, 1, 0)  3 (0, 1, 0)
+ *          4 (0, 0, 1)  5 (1, 0, 1)  6 (1, 1, 1)  7 (0, 1, 1)
+ *
+ *   edges 0-1 1-2 2-3 3-0, 4-5 5-6 6-7 7-4, 0-4 1-5 2-6 3-7
+ *
+ * An edge belongs to its lower corner and is named there by its axis.
+ */
+static const int corner_offset[8][3] =
+{
+	{ 0, 0, 0 }, { 1, 0, 0 }, { 1, 1, 0 }, { 0, 1, 0 },
+	{ 0, 0, 1 }, { 1, 0, 1 }, { 1, 1, 1 }, { 0, 1, 1 }
+};
+
+static const int edge_owner[12][4] =
+{
+	{ 0, 0, 0, 0 }, { 1, 0, 0, 1 }, { 0, 1, 0, 0 }, { 0, 0, 0, 1 },
+	{ 0, 0, 1, 0 }, { 1, 0, 1, 1 }, { 0, 1, 1, 0 }, { 0, 0, 1, 1 },
+	{ 0, 0, 0, 2 }, { 1, 0, 0, 2 }, { 1, 1, 0, 2 }, { 0, 1, 0, 2 }
+};
+
+/* Triangles of each case, bit c set when corner c is below the level.
+ * Built from the faces of the cube: on every face the level cuts off each
+ * run of corners below it, which only depends on the face, so neighbouring
+ * cubes agree and the surface is closed.  The cuts of a case chain into
+ * loops that are split into fans.
+ */
+static const signed char triangles[256][16] =
+{
+	{ -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 0, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 1, 0, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 1, 3, 8, 9, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 10, 2, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 0, 3, 10, 2, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 10, 0, 9, 10, 2, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 2, 3, 8, 10, 2, 8, 9, 10, -1, -1, -1, -1, -1, -1, -1 },
+	{ 3, 2, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 2, 11, 8, 0, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 3, 2, 11, 1, 0, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 2, 11, 8, 1, 2, 8, 9, 1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 3, 10, 11, 3, 1, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 10, 11, 8, 1, 10, 8, 0, 1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 3, 10, 11, 3, 9, 10, 3, 0, 9, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 10, 11, 8, 9, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 7, 4, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 7, 0, 3, 7, 4, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 7, 4, 8, 1, 0, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 7, 1, 3, 7, 9, 1, 7, 4, 9, -1, -1, -1, -1, -1, -1, -1 },
+	{ 7, 4, 8, 10, 2, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 7, 0, 3, 7, 4, 0, 10, 2, 1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 7, 4, 8, 10, 0, 9, 10, 2, 0, -1, -1, -1, -1, -1, -1, -1 },
+	{ 7, 2, 3, 7, 10, 2, 7, 9, 10, 7, 4, 9, -1, -1, -1, -1 },
+	{ 7, 4, 8, 3, 2, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 7, 2, 11, 7, 0, 2, 7, 4, 0, -1, -1, -1, -1, -1, -1, -1 },
+	{ 7, 4, 8, 3, 2, 11, 1, 0, 9, -1, -1, -1, -1, -1, -1, -1 },
+	{ 7, 2, 11, 7, 1, 2, 7, 9, 1, 7, 4, 9, -1, -1, -1, -1 },
+	{ 7, 4, 8, 3, 10, 11, 3, 1, 10, -1, -1, -1, -1, -1, -1, -1 },
+	{ 7, 10, 11, 7, 1, 10, 7, 0, 1, 7, 4, 0, -1, -1, -1, -1 },
+	{ 7, 4, 8, 3, 10, 11, 3, 9, 10, 3, 0, 9, -1, -1, -1, -1 },
+	{ 7, 10, 11, 7, 9, 10, 7, 4, 9, -1, -1, -1, -1, -1, -1, -1 },
+	{ 9, 4, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 0, 3, 9, 4, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 1, 4, 5, 1, 0, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 1, 3, 8, 5, 1, 8, 4, 5, -1, -1, -1, -1, -1, -1, -1 },
+	{ 9, 4, 5, 10, 2, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 0, 3, 9, 4, 5, 10, 2, 1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 10, 4, 5, 10, 0, 4, 10, 2, 0, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 2, 3, 8, 10, 2, 8, 5, 10, 8, 4, 5, -1, -1, -1, -1 },
+	{ 3, 2, 11, 9, 4, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 2, 11, 8, 0, 2, 9, 4, 5, -1, -1, -1, -1, -1, -1, -1 },
+	{ 3, 2, 11, 1, 4, 5, 1, 0, 4, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 2, 11, 8, 1, 2, 8, 5, 1, 8, 4, 5, -1, -1, -1, -1 },
+	{ 3, 10, 11, 3, 1, 10, 9, 4, 5, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 10, 11, 8, 1, 10, 8, 0, 1, 9, 4, 5, -1, -1, -1, -1 },
+	{ 3, 10, 11, 3, 5, 10, 3, 4, 5, 3, 0, 4, -1, -1, -1, -1 },
+	{ 8, 10, 11, 8, 5, 10, 8, 4, 5, -1, -1, -1, -1, -1, -1, -1 },
+	{ 7, 9, 8, 7, 5, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 7, 0, 3, 7, 9, 0, 7, 5, 9, -1, -1, -1, -1, -1, -1, -1 },
+	{ 7, 0, 8, 7, 1, 0, 7, 5, 1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 7, 1, 3, 7, 5, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 7, 9, 8, 7, 5, 9, 10, 2, 1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 7, 0, 3, 7, 9, 0, 7, 5, 9, 10, 2, 1, -1, -1, -1, -1 },
+	{ 7, 0, 8, 7, 2, 0, 7, 10, 2, 7, 5, 10, -1, -1, -1, -1 },
+	{ 7, 2, 3, 7, 10, 2, 7, 5, 10, -1, -1, -1, -1, -1, -1, -1 },
+	{ 7, 9, 8, 7, 5, 9, 3, 2, 11, -1, -1, -1, -1, -1, -1, -1 },
+	{ 7, 2, 11, 7, 0, 2, 7, 9, 0, 7, 5, 9, -1, -1, -1, -1 },
+	{ 7, 0, 8, 7, 1, 0, 7, 5, 1, 3, 2, 11, -1, -1, -1, -1 },
+	{ 7, 2, 11, 7, 1, 2, 7, 5, 1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 7, 9, 8, 7, 5, 9, 3, 10, 11, 3, 1, 10, -1, -1, -1, -1 },
+	{ 7, 10, 11, 7, 1, 10, 7, 0, 1, 7, 9, 0, 7, 5, 9, -1 },
+	{ 7, 0, 8, 7, 3, 0, 7, 11, 3, 7, 10, 11, 7, 5, 10, -1 },
+	{ 7, 10, 11, 7, 5, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 5, 6, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 0, 3, 5, 6, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 1, 0, 9, 5, 6, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 1, 3, 8, 9, 1, 5, 6, 10, -1, -1, -1, -1, -1, -1, -1 },
+	{ 5, 2, 1, 5, 6, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 0, 3, 5, 2, 1, 5, 6, 2, -1, -1, -1, -1, -1, -1, -1 },
+	{ 5, 0, 9, 5, 2, 0, 5, 6, 2, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 2, 3, 8, 6, 2, 8, 5, 6, 8, 9, 5, -1, -1, -1, -1 },
+	{ 3, 2, 11, 5, 6, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 2, 11, 8, 0, 2, 5, 6, 10, -1, -1, -1, -1, -1, -1, -1 },
+	{ 3, 2, 11, 1, 0, 9, 5, 6, 10, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 2, 11, 8, 1, 2, 8, 9, 1, 5, 6, 10, -1, -1, -1, -1 },
+	{ 3, 6, 11, 3, 5, 6, 3, 1, 5, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 6, 11, 8, 5, 6, 8, 1, 5, 8, 0, 1, -1, -1, -1, -1 },
+	{ 3, 6, 11, 3, 5, 6, 3, 9, 5, 3, 0, 9, -1, -1, -1, -1 },
+	{ 8, 6, 11, 8, 5, 6, 8, 9, 5, -1, -1, -1, -1, -1, -1, -1 },
+	{ 7, 4, 8, 5, 6, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 7, 0, 3, 7, 4, 0, 5, 6, 10, -1, -1, -1, -1, -1, -1, -1 },
+	{ 7, 4, 8, 1, 0, 9, 5, 6, 10, -1, -1, -1, -1, -1, -1, -1 },
+	{ 7, 1, 3, 7, 9, 1, 7, 4, 9, 5, 6, 10, -1, -1, -1, -1 },
+	{ 7, 4, 8, 5, 2, 1, 5, 6, 2, -1, -1, -1, -1, -1, -1, -1 },
+	{ 7, 0, 3, 7, 4, 0, 5, 2, 1, 5, 6, 2, -1, -1, -1, -1 },
+	{ 7, 4, 8, 5, 0, 9, 5, 2, 0, 5, 6, 2, -1, -1, -1, -1 },
+	{ 7, 2, 3, 7, 6, 2, 7, 5, 6, 7, 9, 5, 7, 4, 9, -1 },
+	{ 7, 4, 8, 3, 2, 11, 5, 6, 10, -1, -1, -1, -1, -1, -1, -1 },
+	{ 7, 2, 11, 7, 0, 2, 7, 4, 0, 5, 6, 10, -1, -1, -1, -1 },
+	{ 7, 4, 8, 3, 2, 11, 1, 0, 9, 5, 6, 10, -1, -1, -1, -1 },
+	{ 7, 2, 11, 7, 1, 2, 7, 9, 1, 7, 4, 9, 5, 6, 10, -1 },
+	{ 7, 4, 8, 3, 6, 11, 3, 5, 6, 3, 1, 5, -1, -1, -1, -1 },
+	{ 7, 6, 11, 7, 5, 6, 7, 1, 5, 7, 0, 1, 7, 4, 0, -1 },
+	{ 7, 4, 8, 3, 6, 11, 3, 5, 6, 3, 9, 5, 3, 0, 9, -1 },
+	{ 7, 6, 11, 7, 5, 6, 7, 9, 5, 7, 4, 9, -1, -1, -1, -1 },
+	{ 9, 6, 10, 9, 4, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 0, 3, 9, 6, 10, 9, 4, 6, -1, -1, -1, -1, -1, -1, -1 },
+	{ 1, 6, 10, 1, 4, 6, 1, 0, 4, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 1, 3, 8, 10, 1, 8, 6, 10, 8, 4, 6, -1, -1, -1, -1 },
+	{ 9, 2, 1, 9, 6, 2, 9, 4, 6, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 0, 3, 9, 2, 1, 9, 6, 2, 9, 4, 6, -1, -1, -1, -1 },
+	{ 4, 2, 0, 4, 6, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 2, 3, 8, 6, 2, 8, 4, 6, -1, -1, -1, -1, -1, -1, -1 },
+	{ 3, 2, 11, 9, 6, 10, 9, 4, 6, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 2, 11, 8, 0, 2, 9, 6, 10, 9, 4, 6, -1, -1, -1, -1 },
+	{ 3, 2, 11, 1, 6, 10, 1, 4, 6, 1, 0, 4, -1, -1, -1, -1 },
+	{ 8, 2, 11, 8, 1, 2, 8, 10, 1, 8, 6, 10, 8, 4, 6, -1 },
+	{ 3, 6, 11, 3, 4, 6, 3, 9, 4, 3, 1, 9, -1, -1, -1, -1 },
+	{ 8, 6, 11, 8, 4, 6, 8, 9, 4, 8, 1, 9, 8, 0, 1, -1 },
+	{ 3, 6, 11, 3, 4, 6, 3, 0, 4, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 6, 11, 8, 4, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 7, 9, 8, 7, 10, 9, 7, 6, 10, -1, -1, -1, -1, -1, -1, -1 },
+	{ 7, 0, 3, 7, 9, 0, 7, 10, 9, 7, 6, 10, -1, -1, -1, -1 },
+	{ 7, 0, 8, 7, 1, 0, 7, 10, 1, 7, 6, 10, -1, -1, -1, -1 },
+	{ 7, 1, 3, 7, 10, 1, 7, 6, 10, -1, -1, -1, -1, -1, -1, -1 },
+	{ 7, 9, 8, 7, 1, 9, 7, 2, 1, 7, 6, 2, -1, -1, -1, -1 },
+	{ 7, 0, 3, 7, 9, 0, 7, 1, 9, 7, 2, 1, 7, 6, 2, -1 },
+	{ 7, 0, 8, 7, 2, 0, 7, 6, 2, -1, -1, -1, -1, -1, -1, -1 },
+	{ 7, 2, 3, 7, 6, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 7, 9, 8, 7, 10, 9, 7, 6, 10, 3, 2, 11, -1, -1, -1, -1 },
+	{ 7, 2, 11, 7, 0, 2, 7, 9, 0, 7, 10, 9, 7, 6, 10, -1 },
+	{ 7, 0, 8, 7, 1, 0, 7, 10, 1, 7, 6, 10, 3, 2, 11, -1 },
+	{ 7, 2, 11, 7, 1, 2, 7, 10, 1, 7, 6, 10, -1, -1, -1, -1 },
+	{ 7, 9, 8, 7, 1, 9, 7, 3, 1, 7, 11, 3, 7, 6, 11, -1 },
+	{ 7, 6, 11, 9, 0, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 7, 0, 8, 7, 3, 0, 7, 11, 3, 7, 6, 11, -1, -1, -1, -1 },
+	{ 7, 6, 11, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 11, 6, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 0, 3, 11, 6, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 11, 6, 7, 1, 0, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 1, 3, 8, 9, 1, 11, 6, 7, -1, -1, -1, -1, -1, -1, -1 },
+	{ 11, 6, 7, 10, 2, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 0, 3, 11, 6, 7, 10, 2, 1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 11, 6, 7, 10, 0, 9, 10, 2, 0, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 2, 3, 8, 10, 2, 8, 9, 10, 11, 6, 7, -1, -1, -1, -1 },
+	{ 3, 6, 7, 3, 2, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 6, 7, 8, 2, 6, 8, 0, 2, -1, -1, -1, -1, -1, -1, -1 },
+	{ 3, 6, 7, 3, 2, 6, 1, 0, 9, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 6, 7, 8, 2, 6, 8, 1, 2, 8, 9, 1, -1, -1, -1, -1 },
+	{ 3, 6, 7, 3, 10, 6, 3, 1, 10, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 6, 7, 8, 10, 6, 8, 1, 10, 8, 0, 1, -1, -1, -1, -1 },
+	{ 3, 6, 7, 3, 10, 6, 3, 9, 10, 3, 0, 9, -1, -1, -1, -1 },
+	{ 8, 6, 7, 8, 10, 6, 8, 9, 10, -1, -1, -1, -1, -1, -1, -1 },
+	{ 11, 4, 8, 11, 6, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 11, 0, 3, 11, 4, 0, 11, 6, 4, -1, -1, -1, -1, -1, -1, -1 },
+	{ 11, 4, 8, 11, 6, 4, 1, 0, 9, -1, -1, -1, -1, -1, -1, -1 },
+	{ 11, 1, 3, 11, 9, 1, 11, 4, 9, 11, 6, 4, -1, -1, -1, -1 },
+	{ 11, 4, 8, 11, 6, 4, 10, 2, 1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 11, 0, 3, 11, 4, 0, 11, 6, 4, 10, 2, 1, -1, -1, -1, -1 },
+	{ 11, 4, 8, 11, 6, 4, 10, 0, 9, 10, 2, 0, -1, -1, -1, -1 },
+	{ 11, 2, 3, 11, 10, 2, 11, 9, 10, 11, 4, 9, 11, 6, 4, -1 },
+	{ 3, 4, 8, 3, 6, 4, 3, 2, 6, -1, -1, -1, -1, -1, -1, -1 },
+	{ 0, 6, 4, 0, 2, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 3, 4, 8, 3, 6, 4, 3, 2, 6, 1, 0, 9, -1, -1, -1, -1 },
+	{ 1, 4, 9, 1, 6, 4, 1, 2, 6, -1, -1, -1, -1, -1, -1, -1 },
+	{ 3, 4, 8, 3, 6, 4, 3, 10, 6, 3, 1, 10, -1, -1, -1, -1 },
+	{ 10, 0, 1, 10, 4, 0, 10, 6, 4, -1, -1, -1, -1, -1, -1, -1 },
+	{ 3, 4, 8, 3, 6, 4, 3, 10, 6, 3, 9, 10, 3, 0, 9, -1 },
+	{ 10, 4, 9, 10, 6, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 11, 6, 7, 9, 4, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 0, 3, 11, 6, 7, 9, 4, 5, -1, -1, -1, -1, -1, -1, -1 },
+	{ 11, 6, 7, 1, 4, 5, 1, 0, 4, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 1, 3, 8, 5, 1, 8, 4, 5, 11, 6, 7, -1, -1, -1, -1 },
+	{ 11, 6, 7, 9, 4, 5, 10, 2, 1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 0, 3, 11, 6, 7, 9, 4, 5, 10, 2, 1, -1, -1, -1, -1 },
+	{ 11, 6, 7, 10, 4, 5, 10, 0, 4, 10, 2, 0, -1, -1, -1, -1 },
+	{ 8, 2, 3, 8, 10, 2, 8, 5, 10, 8, 4, 5, 11, 6, 7, -1 },
+	{ 3, 6, 7, 3, 2, 6, 9, 4, 5, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 6, 7, 8, 2, 6, 8, 0, 2, 9, 4, 5, -1, -1, -1, -1 },
+	{ 3, 6, 7, 3, 2, 6, 1, 4, 5, 1, 0, 4, -1, -1, -1, -1 },
+	{ 8, 6, 7, 8, 2, 6, 8, 1, 2, 8, 5, 1, 8, 4, 5, -1 },
+	{ 3, 6, 7, 3, 10, 6, 3, 1, 10, 9, 4, 5, -1, -1, -1, -1 },
+	{ 8, 6, 7, 8, 10, 6, 8, 1, 10, 8, 0, 1, 9, 4, 5, -1 },
+	{ 3, 6, 7, 3, 10, 6, 3, 5, 10, 3, 4, 5, 3, 0, 4, -1 },
+	{ 8, 6, 7, 8, 10, 6, 8, 5, 10, 8, 4, 5, -1, -1, -1, -1 },
+	{ 11, 9, 8, 11, 5, 9, 11, 6, 5, -1, -1, -1, -1, -1, -1, -1 },
+	{ 11, 0, 3, 11, 9, 0, 11, 5, 9, 11, 6, 5, -1, -1, -1, -1 },
+	{ 11, 0, 8, 11, 1, 0, 11, 5, 1, 11, 6, 5, -1, -1, -1, -1 },
+	{ 11, 1, 3, 11, 5, 1, 11, 6, 5, -1, -1, -1, -1, -1, -1, -1 },
+	{ 11, 9, 8, 11, 5, 9, 11, 6, 5, 10, 2, 1, -1, -1, -1, -1 },
+	{ 11, 0, 3, 11, 9, 0, 11, 5, 9, 11, 6, 5, 10, 2, 1, -1 },
+	{ 11, 0, 8, 11, 2, 0, 11, 10, 2, 11, 5, 10, 11, 6, 5, -1 },
+	{ 11, 2, 3, 11, 10, 2, 11, 5, 10, 11, 6, 5, -1, -1, -1, -1 },
+	{ 3, 9, 8, 3, 5, 9, 3, 6, 5, 3, 2, 6, -1, -1, -1, -1 },
+	{ 9, 6, 5, 9, 2, 6, 9, 0, 2, -1, -1, -1, -1, -1, -1, -1 },
+	{ 3, 0, 8, 3, 1, 0, 3, 5, 1, 3, 6, 5, 3, 2, 6, -1 },
+	{ 1, 6, 5, 1, 2, 6, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 3, 9, 8, 3, 5, 9, 3, 6, 5, 3, 10, 6, 3, 1, 10, -1 },
+	{ 9, 6, 5, 9, 10, 6, 9, 1, 10, 9, 0, 1, -1, -1, -1, -1 },
+	{ 3, 0, 8, 10, 6, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 10, 6, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 11, 5, 7, 11, 10, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 0, 3, 11, 5, 7, 11, 10, 5, -1, -1, -1, -1, -1, -1, -1 },
+	{ 11, 5, 7, 11, 10, 5, 1, 0, 9, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 1, 3, 8, 9, 1, 11, 5, 7, 11, 10, 5, -1, -1, -1, -1 },
+	{ 11, 5, 7, 11, 1, 5, 11, 2, 1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 0, 3, 11, 5, 7, 11, 1, 5, 11, 2, 1, -1, -1, -1, -1 },
+	{ 11, 5, 7, 11, 9, 5, 11, 0, 9, 11, 2, 0, -1, -1, -1, -1 },
+	{ 8, 2, 3, 8, 11, 2, 8, 7, 11, 8, 5, 7, 8, 9, 5, -1 },
+	{ 3, 5, 7, 3, 10, 5, 3, 2, 10, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 5, 7, 8, 10, 5, 8, 2, 10, 8, 0, 2, -1, -1, -1, -1 },
+	{ 3, 5, 7, 3, 10, 5, 3, 2, 10, 1, 0, 9, -1, -1, -1, -1 },
+	{ 8, 5, 7, 8, 10, 5, 8, 2, 10, 8, 1, 2, 8, 9, 1, -1 },
+	{ 3, 5, 7, 3, 1, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 5, 7, 8, 1, 5, 8, 0, 1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 3, 5, 7, 3, 9, 5, 3, 0, 9, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 5, 7, 8, 9, 5, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 11, 4, 8, 11, 5, 4, 11, 10, 5, -1, -1, -1, -1, -1, -1, -1 },
+	{ 11, 0, 3, 11, 4, 0, 11, 5, 4, 11, 10, 5, -1, -1, -1, -1 },
+	{ 11, 4, 8, 11, 5, 4, 11, 10, 5, 1, 0, 9, -1, -1, -1, -1 },
+	{ 11, 1, 3, 11, 9, 1, 11, 4, 9, 11, 5, 4, 11, 10, 5, -1 },
+	{ 11, 4, 8, 11, 5, 4, 11, 1, 5, 11, 2, 1, -1, -1, -1, -1 },
+	{ 11, 0, 3, 11, 4, 0, 11, 5, 4, 11, 1, 5, 11, 2, 1, -1 },
+	{ 11, 4, 8, 11, 5, 4, 11, 9, 5, 11, 0, 9, 11, 2, 0, -1 },
+	{ 11, 2, 3, 5, 4, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 3, 4, 8, 3, 5, 4, 3, 10, 5, 3, 2, 10, -1, -1, -1, -1 },
+	{ 5, 2, 10, 5, 0, 2, 5, 4, 0, -1, -1, -1, -1, -1, -1, -1 },
+	{ 3, 4, 8, 3, 5, 4, 3, 10, 5, 3, 2, 10, 1, 0, 9, -1 },
+	{ 1, 4, 9, 1, 5, 4, 1, 10, 5, 1, 2, 10, -1, -1, -1, -1 },
+	{ 3, 4, 8, 3, 5, 4, 3, 1, 5, -1, -1, -1, -1, -1, -1, -1 },
+	{ 5, 0, 1, 5, 4, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 3, 4, 8, 3, 5, 4, 3, 9, 5, 3, 0, 9, -1, -1, -1, -1 },
+	{ 5, 4, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 11, 4, 7, 11, 9, 4, 11, 10, 9, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 0, 3, 11, 4, 7, 11, 9, 4, 11, 10, 9, -1, -1, -1, -1 },
+	{ 11, 4, 7, 11, 0, 4, 11, 1, 0, 11, 10, 1, -1, -1, -1, -1 },
+	{ 8, 1, 3, 8, 10, 1, 8, 11, 10, 8, 7, 11, 8, 4, 7, -1 },
+	{ 11, 4, 7, 11, 9, 4, 11, 1, 9, 11, 2, 1, -1, -1, -1, -1 },
+	{ 8, 0, 3, 11, 4, 7, 11, 9, 4, 11, 1, 9, 11, 2, 1, -1 },
+	{ 11, 4, 7, 11, 0, 4, 11, 2, 0, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 2, 3, 8, 11, 2, 8, 7, 11, 8, 4, 7, -1, -1, -1, -1 },
+	{ 3, 4, 7, 3, 9, 4, 3, 10, 9, 3, 2, 10, -1, -1, -1, -1 },
+	{ 8, 4, 7, 8, 9, 4, 8, 10, 9, 8, 2, 10, 8, 0, 2, -1 },
+	{ 3, 4, 7, 3, 0, 4, 3, 1, 0, 3, 10, 1, 3, 2, 10, -1 },
+	{ 8, 4, 7, 1, 2, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 3, 4, 7, 3, 9, 4, 3, 1, 9, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 4, 7, 8, 9, 4, 8, 1, 9, 8, 0, 1, -1, -1, -1, -1 },
+	{ 3, 4, 7, 3, 0, 4, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 8, 4, 7, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 11, 9, 8, 11, 10, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 11, 0, 3, 11, 9, 0, 11, 10, 9, -1, -1, -1, -1, -1, -1, -1 },
+	{ 11, 0, 8, 11, 1, 0, 11, 10, 1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 11, 1, 3, 11, 10, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 11, 9, 8, 11, 1, 9, 11, 2, 1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 11, 0, 3, 11, 9, 0, 11, 1, 9, 11, 2, 1, -1, -1, -1, -1 },
+	{ 11, 0, 8, 11, 2, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 11, 2, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 3, 9, 8, 3, 10, 9, 3, 2, 10, -1, -1, -1, -1, -1, -1, -1 },
+	{ 9, 2, 10, 9, 0, 2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 3, 0, 8, 3, 1, 0, 3, 10, 1, 3, 2, 10, -1, -1, -1, -1 },
+	{ 1, 2, 10, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 3, 9, 8, 3, 1, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 9, 0, 1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ 3, 0, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+	{ -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 }
+};
+
+static int cache_index(int x, int y, int z, int axis)
+{
+	return (((z * MC_BLOCK + y) * MC_BLOCK + x) * 3) + axis;
+}
+
+marching_cubes::marching_cubes(tile_executor& exec)
+	: exec(exec)
+{
+}
+
+void marching_cubes::extract(const brick_grid<float>& f, float iso, float h, mesh& out)
+{
+	auto t0 = std::chrono::steady_clock::now();
+
+	// Corners run from -1 to n along each axis; below they are counted from
+	// 0, so corner c is cell c - 1 of the field
+	int nc[3] = { f.nx + 2, f.ny + 2, f.nz + 2 };
+	int nb[3], ng[3];
+
+	for (int a = 0; a < 3; a++)
+	{
+		nb[a] = (nc[a] + MC_BLOCK - 1) / MC_BLOCK;
+		ng[a] = (nb[a] + MC_GROUP - 1) / MC_GROUP;
+	}
+
+	//========================================================================
+	// Min / max pyramid
+	//========================================================================
+
+	brick_min.resize(f.brick_count());
+	brick_max.resize(f.brick_count());
+
+	exec.for_each(f.brick_count(), [&](int b)
+	{
+		const float* p = f.brick(b);
+		float lo = f.background, hi = f.background;
+
+		if (p)
+		{
+			lo = hi = p[0];
+			for (int i = 1; i < BRICK_CELLS; i++)
+			{
+				lo = std::min(lo, p[i]);
+				hi = std::max(hi, p[i]);
+			}
+		}
+		brick_min[b] = lo;
+		brick_max[b] = hi;
+	});
+
+	// Whether the level crosses the corners [c0, c1] of each axis, from the
+	// ranges of the bricks they touch
+	auto crossed = [&](const int* c0, const int* c1)
+	{
+		int lo[3], hi[3];
+		float vmin = iso, vmax = iso;
+		bool outside = false;
+
+		for (int a = 0; a < 3; a++)
+		{
+			int n = a == 0 ? f.nx : (a == 1 ? f.ny : f.nz);
+
+			lo[a] = c0[a] - 1;
+			hi[a] = std::min(c1[a], nc[a] - 1) - 1;
+			outside |= lo[a] < 0 || hi[a] >= n;
+			lo[a] = std::max(lo[a], 0) >> BRICK_LOG2;
+			hi[a] = std::min(hi[a], n - 1) >> BRICK_LOG2;
+		}
+
+		bool first = !outside;
+		if (outside)
+			vmin = vmax = f.background;
+		for (int z = lo[2]; z <= hi[2]; z++)
+			for (int y = lo[1]; y <= hi[1]; y++)
+				for (int x = lo[0]; x <= hi[0]; x++)
+				{
+					int b = (z * f.by + y) * f.bx + x;
+
+					vmin = first ? brick_min[b] : std::min(vmin, brick_min[b]);
+					vmax = first ? brick_max[b] : std::max(vmax, brick_max[b]);
+					first = false;
+				}
+		return vmin < iso && vmax >= iso;
+	};
+
+	group_live.resize((size_t)ng[0] * ng[1] * ng[2]);
+
+	exec.for_each((int)group_live.size(), [&](int g)
+	{
+		int gx = g % ng[0], gy = g / ng[0] % ng[1], gz = g / ng[0] / ng[1];
+		int span = MC_GROUP * MC_BLOCK;
+		int c0[3] = { gx * span, gy * span, gz * span };
+		int c1[3] = { c0[0] + span, c0[1] + span, c0[2] + span };
+
+		group_live[g] = crossed(c0, c1);
+	});
+
+	//========================================================================
+	// Active blocks
+	//========================================================================
+
+	slabs.resize(nb[2]);
+	for (slab& s : slabs)
+	{
+		s.blocks.clear();
+		s.vertices.clear();
+		s.faces.clear();
+	}
+
+	exec.for_each(nb[2], [&](int bz)
+	{
+		int gz = bz / MC_GROUP;
+
+		for (int gy = 0; gy < ng[1]; gy++)
+			for (int gx = 0; gx < ng[0]; gx++)
+			{
+				if (!group_live[((size_t)gz * ng[1] + gy) * ng[0] + gx])
+					continue;
+
+				for (int by = gy * MC_GROUP; by < std::min((gy + 1) * MC_GROUP, nb[1]); by++)
+					for (int bx = gx * MC_GROUP; bx < std::min((gx + 1) * MC_GROUP, nb[0]); bx++)
+					{
+						int c0[3] = { bx * MC_BLOCK, by * MC_BLOCK, bz * MC_BLOCK };
+						int c1[3] = { c0[0] + MC_BLOCK, c0[1] + MC_BLOCK, c0[2] + MC_BLOCK };
+
+						if (crossed(c0, c1))
+							slabs[bz].blocks.push_back((bz * nb[1] + by) * nb[0] + bx);
+					}
+			}
+	});
+
+	// Active blocks are numbered in slab order; each gets an edge cache of
+	// vertex numbers relative to its first vertex, written only for the
+	// crossed edges, which are the only ones read
+	block_slot.assign((size_t)nb[0] * nb[1] * nb[2], -1);
+	int active = 0;
+
+	for (const slab& s : slabs)
+		for (int blk : s.blocks)
+			block_slot[blk] = active++;
+
+	if (cache.size() < (size_t)active * MC_EDGES)
+		cache.resize((size_t)active * MC_EDGES);
+	block_first.resize(active);
+
+	// The corners of a block, the ones past the box reading as the
+	// background, and for each row of corners along x a mask of those below
+	// the level
+	auto gather = [&](int bx, int by, int bz, float* v, unsigned* row)
+	{
+		for (int k = 0; k < MC_CORNERS; k++)
+			for (int j = 0; j < MC_CORNERS; j++)
+			{
+				unsigned m = 0;
+
+				for (int i = 0; i < MC_CORNERS; i++)
+				{
+					*v = f.get(bx * MC_BLOCK + i - 1, by * MC_BLOCK + j - 1, bz * MC_BLOCK + k - 1);
+					m |= (unsigned)(*v++ < iso) << i;
+				}
+				*row++ = m;
+			}
+	};
+
+	//========================================================================
+	// Vertices
+	//========================================================================
+
+	exec.for_each(nb[2], [&](int bz)
+	{
+		slab& s = slabs[bz];
+		float v[MC_CORNERS * MC_CORNERS * MC_CORNERS];
+		unsigned row[MC_CORNERS * MC_CORNERS];
+
+		for (int blk : s.blocks)
+		{
+			int bx = blk % nb[0], by = blk / nb[0] % nb[1];
+			int c0[3] = { bx * MC_BLOCK, by * MC_BLOCK, bz * MC_BLOCK };
+			int slot = block_slot[blk];
+			unsigned short* ids = &cache[(size_t)slot * MC_EDGES];
+			int count = 0;
+			int end[3];
+
+			gather(bx, by, bz, v, row);
+			block_first[slot] = (int)(s.vertices.size() / 3);
+
+			// The block owns the edges leaving its first MC_BLOCK corners
+			// along each axis, up to the last corner
+			for (int a = 0; a < 3; a++)
+				end[a] = std::min(MC_BLOCK, nc[a] - c0[a]);
+			unsigned owned = (1u << end[0]) - 1;
+			unsigned inner = (1u << std::min(MC_BLOCK, nc[0] - 1 - c0[0])) - 1;
+
+			for (int k = 0; k < end[2]; k++)
+				for (int j = 0; j < end[1]; j++)
+				{
+					unsigned m = row[k * MC_CORNERS + j];
+					unsigned cut[3] =
+					{
+						(m ^ m >> 1) & inner,
+						c0[1] + j + 1 < nc[1] ? (m ^ row[k * MC_CORNERS + j + 1]) & owned : 0,
+						c0[2] + k + 1 < nc[2] ? (m ^ row[(k + 1) * MC_CORNERS + j]) & owned : 0
+					};
+
+					if (!(cut[0] | cut[1] | cut[2]))
+						continue;
+
+					for (int i = 0; i < end[0]; i++)
+						for (int a = 0; a < 3; a++)
+						{
+							static const int step[3] = { 1, MC_CORNERS, MC_CORNERS * MC_CORNERS };
+							int c = (k * MC_CORNERS + j) * MC_CORNERS + i;
+							int here[3] = { c0[0] + i, c0[1] + j, c0[2] + k };
+
+							if (!(cut[a] >> i & 1))
+								continue;
+
+							float t = (iso - v[c]) / (v[c + step[a]] - v[c]);
+							ids[cache_index(i, j, k, a)] = (unsigned short)count++;
+							for (int d = 0; d < 3; d++)
+								s.vertices.push_back(((float)here[d] - 0.5f + (d == a ? t : 0.f)) * h);
+						}
+				}
+		}
+	});
+
+	vertex_base.assign(nb[2] + 1, 0);
+	for (int bz = 0; bz < nb[2]; bz++)
+		vertex_base[bz + 1] = vertex_base[bz] + (int)(slabs[bz].vertices.size() / 3);
+
+	//========================================================================
+	// Triangles
+	//========================================================================
+
+	exec.for_each(nb[2], [&](int bz)
+	{
+		slab& s = slabs[bz];
+		float v[MC_CORNERS * MC_CORNERS * MC_CORNERS];
+		unsigned row[MC_CORNERS * MC_CORNERS];
+
+		for (int blk : s.blocks)
+		{
+			int bx = blk % nb[0], by = blk / nb[0] % nb[1];
+			int c0[3] = { bx * MC_BLOCK, by * MC_BLOCK, bz * MC_BLOCK };
+			const unsigned short* ids[8];
+			int base[8];
+			int end[3];
+
+			gather(bx, by, bz, v, row);
+
+			// The edges of the cubes belong to this block or to the ones
+			// after it along x, y and z; those that hold crossed edges are
+			// active
+			for (int o = 0; o < 8; o++)
+			{
+				int ox = bx + (o & 1), oy = by + (o >> 1 & 1), oz = bz + (o >> 2);
+				int slot = ox < nb[0] && oy < nb[1] && oz < nb[2] ? block_slot[((size_t)oz * nb[1] + oy) * nb[0] + ox] : -1;
+
+				ids[o] = slot >= 0 ? &cache[(size_t)slot * MC_EDGES] : nullptr;
+				base[o] = slot >= 0 ? vertex_base[oz] + block_first[slot] : 0;
+			}
+
+			// A cube needs its far corners inside the corner range
+			for (int a = 0; a < 3; a++)
+				end[a] = std::min(MC_BLOCK, nc[a] - 1 - c0[a]);
+			unsigned full = (1u << (end[0] + 1)) - 1;
+
+			for (int k = 0; k < end[2]; k++)
+				for (int j = 0; j < end[1]; j++)
+				{
+					// Rows y, y + 1 at z and z + 1
+					unsigned m0 = row[k * MC_CORNERS + j], m1 = row[k * MC_CORNERS + j + 1];
+					unsigned m2 = row[(k + 1) * MC_CORNERS + j], m3 = row[(k + 1) * MC_CORNERS + j + 1];
+
+					if (!((m0 | m1 | m2 | m3) & full) || (m0 & m1 & m2 & m3 & full) == full)
+						continue;
+
+					for (int i = 0; i < end[0]; i++)
+					{
+						int cube = (m0 >> i & 1) | (m0 >> i & 2) | (m1 >> i & 2) << 1 | (m1 >> i & 1) << 3
+							| (m2 >> i & 1) << 4 | (m2 >> i & 2) << 4 | (m3 >> i & 2) << 5 | (m3 >> i & 1) << 7;
+
+						if (cube == 0 || cube == 0xff)
+							continue;
+
+						for (const signed char* e = triangles[cube]; *e >= 0; e++)
+						{
+							const int* o = edge_owner[*e];
+							int x = i + o[0], y = j + o[1], z = k + o[2];
+							int owner = (x >> MC_BLOCK_LOG2) | (y >> MC_BLOCK_LOG2) << 1 | (z >> MC_BLOCK_LOG2) << 2;
+
+							s.faces.push_back(base[owner]
+								+ ids[owner][cache_index(x & (MC_BLOCK - 1), y & (MC_BLOCK - 1), z & (MC_BLOCK - 1), o[3])]);
+						}
+					}
+				}
+		}
+	});
+
+	//========================================================================
+	// Merge
+	//========================================================================
+
+	face_base.assign(nb[2] + 1, 0);
+	for (int bz = 0; bz < nb[2]; bz++)
+		face_base[bz + 1] = face_base[bz] + slabs[bz].faces.size();
+
+	out.vertices.resize((size_t)vertex_base[nb[2]] * 3);
+	out.faces.resize(face_base[nb[2]]);
+	exec.for_each(nb[2], [&](int bz)
+	{
+		const slab& s = slabs[bz];
+
+		std::copy(s.vertices.begin(), s.vertices.end(), out.vertices.begin() + (size_t)vertex_base[bz] * 3);
+		std::copy(s.faces.begin(), s.faces.end(), out.faces.begin() + face_base[bz]);
+	});
+
+	st.blocks = (int)block_slot.size();
+	st.active_blocks = active;
+	st.cache_bytes = cache.capacity() * sizeof(unsigned short) + block_first.capacity() * sizeof(int)
+		+ block_slot.capacity() * sizeof(int) + group_live.capacity() + (brick_min.capacity() + brick_max.capacity()) * sizeof(float);
+	st.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
@@ -0,0 +1,69 @@
+/*****************************************************************************
+ * Parallel marching cubes
+ *
+ * Extracts a level of a bricked field as an indexed triangle mesh, cell
+ * (i, j, k) sitting at ((i + 0.5) h, (j + 0.5) h, (k + 0.5) h).  Outside
+ * the box the field reads as its background, so a surface that meets the
+ * walls is closed there.
+ *
+ * The cubes are grouped in blocks of 8^3 and the blocks in slabs, one
+ * block thick along z, that run in parallel on a tile_executor.  A min /
+ * max pyramid over bricks, blocks and groups of 4^3 blocks skips space the
+ * level does not cross.  Every crossed edge gets one vertex, made by the
+ * block that owns the edge's lower corner and kept in that block's edge
+ * cache, so the triangles of neighbouring cubes and slabs share it.  The
+ * slabs' vertices and faces are then concatenated in slab order, so the
+ * mesh does not depend on the thread count.
+ *****************************************************************************/
+
+#ifndef MARCHING_CUBESH
+#define MARCHING_CUBESH
+
+#include <cstddef>
+#include <vector>
+
+#include "brick_grid.h"
+#include "mesh.h"
+#include "tile_executor.h"
+
+struct marching_cubes_stats
+{
+	int blocks = 0;				// in the box
+	int active_blocks = 0;		// crossed by the level
+	size_t cache_bytes = 0;		// edge caches, pyramid and block tables
+	double seconds = 0.0;
+};
+
+class marching_cubes
+{
+public:
+	explicit marching_cubes(tile_executor& exec);
+
+	// Triangles face the side where f is at or above iso.  The slab
+	// buffers and edge caches are kept for the next call.
+	void extract(const brick_grid<float>& f, float iso, float h, mesh& out);
+
+	// Of the last call
+	const marching_cubes_stats& stats() const { return st; }
+
+private:
+	struct slab
+	{
+		std::vector<int> blocks;	// active blocks
+		std::vector<float> vertices;
+		std::vector<int> faces;
+	};
+
+	tile_executor& exec;
+	std::vector<float> brick_min, brick_max;
+	std::vector<char> group_live;
+	std::vector<slab> slabs;
+	std::vector<int> block_slot;		// of each block, -1 if not crossed
+	std::vector<int> block_first;		// slab vertex of each active block
+	std::vector<unsigned short> cache;	// MC_EDGES vertex numbers per active block
+	std::vector<int> vertex_base;
+	std::vector<size_t> face_base;
+	marching_cubes_stats st;
+};
+
+#endif
@@ -0,0 +1,26 @@
+/*****************************************************************************
+ * Indexed triangle mesh
+ *****************************************************************************/
+
+#include <cstdio>
+
+#include "mesh.h"
+
+bool write_obj(const char* path, const mesh& m)
+{
+	FILE* fp;
+	int i, n;
+
+	fp = fopen(path, "w");
+	if (!fp)
+		return false;
+
+	n = m.vertex_count();
+	for (i = 0; i < n; i++)
+		fprintf(fp, "v %.6g %.6g %.6g\n", m.vertices[3 * i], m.vertices[3 * i + 1], m.vertices[3 * i + 2]);
+	n = m.face_count();
+	for (i = 0; i < n; i++)
+		fprintf(fp, "f %d %d %d\n", m.faces[3 * i] + 1, m.faces[3 * i + 1] + 1, m.faces[3 * i + 2] + 1);
+
+	return fclose(fp) == 0;
+}
@@ -0,0 +1,28 @@
+/*****************************************************************************
+ * Indexed triangle mesh
+ *
+ * The vertex / face arrays that cuda_ray's ReadOBJFile fills: three floats
+ * per vertex and three vertex indices per face, zero based in memory and
+ * one based in the file.
+ *****************************************************************************/
+
+#ifndef MESHH
+#define MESHH
+
+#include <vector>
+
+struct mesh
+{
+	std::vector<float> vertices;	// x, y, z
+	std::vector<int> faces;			// a, b, c, counter-clockwise seen from outside
+
+	int vertex_count() const { return (int)(vertices.size() / 3); }
+	int face_count() const { return (int)(faces.size() / 3); }
+	void clear() { vertices.clear(); faces.clear(); }
+};
+
+// Write "v x y z" and "f a b c" lines.  Returns false if the file cannot be
+// written.
+bool write_obj(const char* path, const mesh& m);
+
+#endif
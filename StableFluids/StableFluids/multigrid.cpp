@@ -0,0 +1,227 @@
+/*****************************************************************************
+ * Geometric multigrid Poisson solver
+ *****************************************************************************/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+
+#include "multigrid.h"
+
+multigrid::multigrid(int n, tile_executor& exec, int coarsest)
+	: exec(exec), symmetric(false)
+{
+	level l;
+	float s = 1.f;
+
+	for (;;)
+	{
+		l.n = n;
+		l.s = s;
+		l.x.assign((size_t)n * n, 0.f);
+		l.b.assign((size_t)n * n, 0.f);
+		l.r.assign((size_t)n * n, 0.f);
+		levels.push_back(l);
+
+		if (n & 1 || n <= coarsest)
+			break;
+		n /= 2;
+		s *= 0.25f;
+	}
+}
+
+//========================================================================
+// Red-black Gauss-Seidel
+//========================================================================
+
+void multigrid::smooth(level& l, int sweeps, bool reverse)
+{
+	int n = l.n;
+	float inv_s = 1.f / l.s;
+	float* x = l.x.data();
+	const float* b = l.b.data();
+
+	// With an odd size the colours meet at the periodic seam, so tiles on
+	// either side would read each other's updates
+	auto pass = [&](const std::function<void(int, int, int, int)>& fn)
+	{
+		if (n & 1)
+			fn(0, 0, n, n);
+		else
+			exec.run(n, n, fn);
+	};
+
+	for (int sweep = 0; sweep < sweeps; sweep++)
+		for (int k = 0; k < 2; k++)
+		{
+			int color = reverse ? 1 - k : k;
+
+			pass([&](int x0, int y0, int x1, int y1)
+			{
+				for (int y = y0; y < y1; y++)
+				{
+					float* row = x + (size_t)y * n;
+					const float* up = x + (size_t)(y + 1 < n ? y + 1 : 0) * n;
+					const float* down = x + (size_t)(y > 0 ? y - 1 : n - 1) * n;
+					const float* rhs = b + (size_t)y * n;
+
+					for (int i = x0 + ((x0 + y + color) & 1); i < x1; i += 2)
+					{
+						int ip = i + 1 < n ? i + 1 : 0;
+						int im = i > 0 ? i - 1 : n - 1;
+
+						row[i] = 0.25f * (rhs[i] * inv_s + row[ip] + row[im] + up[i] + down[i]);
+					}
+				}
+			});
+		}
+}
+
+//========================================================================
+// Transfers
+//========================================================================
+
+void multigrid::restrict_residual(const level& fine, level& coarse)
+{
+	int n = coarse.n;
+	int fn = fine.n;
+	const float* r = fine.r.data();
+	float* b = coarse.b.data();
+
+	exec.run(n, n, [&](int x0, int y0, int x1, int y1)
+	{
+		for (int y = y0; y < y1; y++)
+		{
+			const float* r0 = r + (size_t)(2 * y) * fn;
+			const float* r1 = r0 + fn;
+
+			for (int i = x0; i < x1; i++)
+				b[(size_t)y * n + i] = 0.25f * (r0[2 * i] + r0[2 * i + 1] + r1[2 * i] + r1[2 * i + 1]);
+		}
+	});
+}
+
+void multigrid::prolong_add(const level& coarse, level& fine)
+{
+	int n = coarse.n;
+	int fn = fine.n;
+	const float* c = coarse.x.data();
+	float* x = fine.x.data();
+
+	// Each fine cell takes 9/16 of its coarse cell, 3/16 of the two coarse
+	// neighbours on its side and 1/16 of the diagonal one
+	exec.run(fn, fn, [&](int x0, int y0, int x1, int y1)
+	{
+		for (int y = y0; y < y1; y++)
+		{
+			int j = y >> 1;
+			int jn = (y & 1) ? (j + 1 < n ? j + 1 : 0) : (j > 0 ? j - 1 : n - 1);
+			const float* c0 = c + (size_t)j * n;
+			const float* c1 = c + (size_t)jn * n;
+			float* row = x + (size_t)y * fn;
+
+			for (int i = x0; i < x1; i++)
+			{
+				int k = i >> 1;
+				int kn = (i & 1) ? (k + 1 < n ? k + 1 : 0) : (k > 0 ? k - 1 : n - 1);
+
+				row[i] += 0.5625f * c0[k] + 0.1875f * (c0[kn] + c1[k]) + 0.0625f * c1[kn];
+			}
+		}
+	});
+}
+
+//========================================================================
+// Cycles
+//========================================================================
+
+void multigrid::cycle(int l, const multigrid_options& opt)
+{
+	level& fine = levels[l];
+
+	if (l + 1 == (int)levels.size())
+	{
+		smooth(fine, opt.coarse_sweeps, false);
+		poisson_remove_mean(exec, fine.n, fine.x.data());
+		return;
+	}
+
+	level& coarse = levels[l + 1];
+
+	smooth(fine, opt.pre_smooth, false);
+	poisson_residual(exec, fine.n, fine.s, fine.b.data(), fine.x.data(), fine.r.data());
+	restrict_residual(fine, coarse);
+
+	std::fill(coarse.x.begin(), coarse.x.end(), 0.f);
+	for (int g = 0; g < opt.gamma; g++)
+		cycle(l + 1, opt);
+
+	prolong_add(coarse, fine);
+	// Black before red on the way up keeps the cycle symmetric, which the
+	// preconditioner of PCG needs; as a solver the same order is faster
+	smooth(fine, opt.post_smooth, symmetric);
+}
+
+poisson_stats multigrid::solve(const float* b, float* x, const multigrid_options& opt)
+{
+	level& top = levels[0];
+	int n = top.n;
+	size_t total = (size_t)n * n;
+	std::vector<float> rhs(b, b + total);
+	std::vector<double> sol(x, x + total);
+	poisson_stats st;
+	double bnorm;
+
+	auto t0 = std::chrono::steady_clock::now();
+
+	poisson_remove_mean(exec, n, rhs.data());
+	bnorm = poisson_norm(exec, n, rhs.data());
+	if (bnorm == 0.0)
+		bnorm = 1.0;
+
+	/* Smooth modes of a large grid have solutions of order n^2 |b|, whose
+	 * Laplacian cancels most of the digits of a float.  So each cycle solves
+	 * for the correction of the residual equation in float, and the solution
+	 * and its residual are kept in double.
+	 */
+	for (;;)
+	{
+		st.residual = poisson_residual(exec, n, rhs.data(), sol.data(), top.b.data()) / bnorm;
+		if (st.residual < opt.tolerance || st.iterations >= opt.max_cycles)
+			break;
+
+		std::fill(top.x.begin(), top.x.end(), 0.f);
+		cycle(0, opt);
+		exec.for_each(n, [&](int y)
+		{
+			for (size_t i = (size_t)y * n; i < (size_t)(y + 1) * n; i++)
+				sol[i] += top.x[i];
+		});
+		st.iterations++;
+	}
+
+	exec.for_each(n, [&](int y)
+	{
+		for (size_t i = (size_t)y * n; i < (size_t)(y + 1) * n; i++)
+			x[i] = (float)sol[i];
+	});
+	poisson_remove_mean(exec, n, x);
+
+	st.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	return st;
+}
+
+void multigrid::precondition(const float* r, float* z, const multigrid_options& opt)
+{
+	level& top = levels[0];
+	size_t total = (size_t)top.n * top.n;
+
+	std::copy(r, r + total, top.b.begin());
+	std::fill(top.x.begin(), top.x.end(), 0.f);
+	symmetric = true;
+	cycle(0, opt);
+	symmetric = false;
+	std::copy(top.x.begin(), top.x.end(), z);
+	poisson_remove_mean(exec, top.n, z);
+}
@@ -0,0 +1,67 @@
+/*****************************************************************************
+ * Geometric multigrid Poisson solver
+ *
+ * Solves the periodic problem of poisson.h with V or W cycles until the
+ * relative residual is below a tolerance, instead of a fixed number of
+ * Jacobi sweeps.  Cell centred: restriction averages 2 x 2 cells, the
+ * correction is interpolated bilinearly, and every level rediscretises the
+ * operator with s = 1 / h^2.  The smoother is red-black Gauss-Seidel, each
+ * colour one pass over the tiles of a tile_executor.
+ *
+ * Levels halve the grid while it stays even and larger than the coarsest
+ * size, so any n works; powers of two coarsen the furthest.
+ *****************************************************************************/
+
+#ifndef MULTIGRIDH
+#define MULTIGRIDH
+
+#include <vector>
+
+#include "poisson.h"
+#include "tile_executor.h"
+
+struct multigrid_options
+{
+	int gamma = 1;				// 1 for V cycles, 2 for W cycles
+	int pre_smooth = 2;
+	int post_smooth = 2;
+	int coarse_sweeps = 40;		// Gauss-Seidel sweeps on the coarsest grid
+	double tolerance = 1e-5;	// on ||b - Ax|| / ||b||
+	int max_cycles = 50;
+};
+
+class multigrid
+{
+public:
+	// Coarsening stops at the first odd size or at coarsest and below
+	multigrid(int n, tile_executor& exec, int coarsest = 4);
+
+	int size() const { return levels[0].n; }
+	int level_count() const { return (int)levels.size(); }
+
+	// Solve Ax = b, x holds the initial guess.  The solution is accumulated
+	// in double and the residual reported is that of the double solution.
+	poisson_stats solve(const float* b, float* x, const multigrid_options& opt);
+
+	// z = M^-1 r with M^-1 one cycle from a zero guess, for PCG
+	void precondition(const float* r, float* z, const multigrid_options& opt);
+
+private:
+	struct level
+	{
+		int n;
+		float s;
+		std::vector<float> x, b, r;
+	};
+
+	void smooth(level& l, int sweeps, bool reverse);
+	void restrict_residual(const level& fine, level& coarse);
+	void prolong_add(const level& coarse, level& fine);
+	void cycle(int l, const multigrid_options& opt);
+
+	tile_executor& exec;
+	std::vector<level> levels;
+	bool symmetric;		// reverse the colours of the post-smoothing
+};
+
+#endif
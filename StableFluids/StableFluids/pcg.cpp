@@ -0,0 +1,403 @@
+/*****************************************************************************
+ * Preconditioned conjugate gradient Poisson solver
+ *****************************************************************************/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PCG_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "pcg.h"
+
+// Rows per work item of the vector kernels
+#define PCG_ROW_BLOCK 16
+
+// Rows per incomplete Cholesky band
+#define PCG_IC_BAND 64
+
+// MIC(0) modification and its safety threshold (Bridson)
+#define PCG_MIC_TAU 0.97f
+#define PCG_MIC_SIGMA 0.25f
+
+//========================================================================
+// Row kernels
+//========================================================================
+
+#ifdef PCG_SSE2
+
+// Sum of the four float products in lanes, in double
+static inline __m128d madd_pd(__m128d acc, __m128 a, __m128 b)
+{
+	__m128 ab = _mm_mul_ps(a, b);
+
+	acc = _mm_add_pd(acc, _mm_cvtps_pd(ab));
+	return _mm_add_pd(acc, _mm_cvtps_pd(_mm_movehl_ps(ab, ab)));
+}
+
+static inline double hsum_pd(__m128d v)
+{
+	return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+#endif
+
+// q = A p on one row, returns p . q
+static double apply_dot_row(int n, const float* p, const float* up, const float* down, float* q)
+{
+	double acc = 0.0;
+	int i = 1;
+
+	q[0] = 4.f * p[0] - p[1] - p[n - 1] - up[0] - down[0];
+	acc += (double)p[0] * q[0];
+
+#ifdef PCG_SSE2
+	const __m128 four = _mm_set1_ps(4.f);
+	__m128d sum = _mm_setzero_pd();
+
+	for (; i + 4 < n; i += 4)
+	{
+		__m128 c = _mm_loadu_ps(p + i);
+		__m128 v = _mm_mul_ps(four, c);
+
+		v = _mm_sub_ps(v, _mm_loadu_ps(p + i - 1));
+		v = _mm_sub_ps(v, _mm_loadu_ps(p + i + 1));
+		v = _mm_sub_ps(v, _mm_loadu_ps(up + i));
+		v = _mm_sub_ps(v, _mm_loadu_ps(down + i));
+		_mm_storeu_ps(q + i, v);
+		sum = madd_pd(sum, c, v);
+	}
+	acc += hsum_pd(sum);
+#endif
+
+	for (; i < n - 1; i++)
+	{
+		q[i] = 4.f * p[i] - p[i - 1] - p[i + 1] - up[i] - down[i];
+		acc += (double)p[i] * q[i];
+	}
+
+	q[n - 1] = 4.f * p[n - 1] - p[n - 2] - p[0] - up[n - 1] - down[n - 1];
+	acc += (double)p[n - 1] * q[n - 1];
+	return acc;
+}
+
+// x += alpha p, r -= alpha q, returns r . r
+static double update_row(int n, double alpha, const float* p, const float* q, double* x, float* r)
+{
+	float a = (float)alpha;
+	double acc = 0.0;
+	int i = 0;
+
+#ifdef PCG_SSE2
+	const __m128 va = _mm_set1_ps(a);
+	const __m128d vad = _mm_set1_pd(alpha);
+	__m128d sum = _mm_setzero_pd();
+
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 vp = _mm_loadu_ps(p + i);
+		__m128 vr = _mm_sub_ps(_mm_loadu_ps(r + i), _mm_mul_ps(va, _mm_loadu_ps(q + i)));
+
+		_mm_storeu_pd(x + i, _mm_add_pd(_mm_loadu_pd(x + i), _mm_mul_pd(vad, _mm_cvtps_pd(vp))));
+		_mm_storeu_pd(x + i + 2, _mm_add_pd(_mm_loadu_pd(x + i + 2), _mm_mul_pd(vad, _mm_cvtps_pd(_mm_movehl_ps(vp, vp)))));
+		_mm_storeu_ps(r + i, vr);
+		sum = madd_pd(sum, vr, vr);
+	}
+	acc += hsum_pd(sum);
+#endif
+
+	for (; i < n; i++)
+	{
+		x[i] += alpha * p[i];
+		r[i] -= a * q[i];
+		acc += (double)r[i] * r[i];
+	}
+	return acc;
+}
+
+// p = z + beta p
+static void xpay_row(int n, float beta, const float* z, float* p)
+{
+	int i = 0;
+
+#ifdef PCG_SSE2
+	const __m128 vb = _mm_set1_ps(beta);
+
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_ps(p + i, _mm_add_ps(_mm_loadu_ps(z + i), _mm_mul_ps(vb, _mm_loadu_ps(p + i))));
+#endif
+
+	for (; i < n; i++)
+		p[i] = z[i] + beta * p[i];
+}
+
+static double dot_row(int n, const float* a, const float* b)
+{
+	double acc = 0.0;
+	int i = 0;
+
+#ifdef PCG_SSE2
+	__m128d sum = _mm_setzero_pd();
+
+	for (; i + 4 <= n; i += 4)
+		sum = madd_pd(sum, _mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+	acc += hsum_pd(sum);
+#endif
+
+	for (; i < n; i++)
+		acc += (double)a[i] * b[i];
+	return acc;
+}
+
+//========================================================================
+// Setup
+//========================================================================
+
+pcg::pcg(int n, tile_executor& exec)
+	: exec(exec), n(n), band(PCG_IC_BAND),
+	r((size_t)n * n), z((size_t)n * n), p((size_t)n * n), q((size_t)n * n), x((size_t)n * n)
+{
+}
+
+//========================================================================
+// Modified incomplete Cholesky
+//========================================================================
+
+/* Within a band the stencil keeps its links to the right and up except
+ * the periodic ones and those leaving the band; the diagonal stays 4, so
+ * the factored matrix is symmetric positive definite.
+ */
+
+void pcg::factor_ic()
+{
+	int bands = (n + band - 1) / band;
+
+	ic_precon.assign((size_t)n * n, 0.f);
+
+	exec.for_each(bands, [&](int b)
+	{
+		int y0 = b * band;
+		int y1 = y0 + band < n ? y0 + band : n;
+
+		for (int y = y0; y < y1; y++)
+		{
+			float* pre = ic_precon.data() + (size_t)y * n;
+			const float* below = pre - n;
+
+			for (int i = 0; i < n; i++)
+			{
+				float e = 4.f;
+
+				if (i > 0)
+				{
+					// Left neighbour links right (-1) and, unless on the top row, up (-1)
+					float a = pre[i - 1];
+					float up = y + 1 < y1 ? 1.f : 0.f;
+
+					e -= a * a + PCG_MIC_TAU * up * a * a;
+				}
+				if (y > y0)
+				{
+					float a = below[i];
+					float right = i + 1 < n ? 1.f : 0.f;
+
+					e -= a * a + PCG_MIC_TAU * right * a * a;
+				}
+				if (e < PCG_MIC_SIGMA * 4.f)
+					e = 4.f;
+				pre[i] = 1.f / std::sqrt(e);
+			}
+		}
+	});
+}
+
+void pcg::apply_ic(const float* res, float* out)
+{
+	int bands = (n + band - 1) / band;
+
+	exec.for_each(bands, [&](int b)
+	{
+		int y0 = b * band;
+		int y1 = y0 + band < n ? y0 + band : n;
+		const float* pre = ic_precon.data();
+
+		// Solve L t = r: the link from below is a plain vector operation,
+		// the one from the left a recurrence along the row
+		for (int y = y0; y < y1; y++)
+		{
+			const float* pr = pre + (size_t)y * n;
+			const float* rr = res + (size_t)y * n;
+			float* t = out + (size_t)y * n;
+
+			if (y > y0)
+			{
+				const float* pb = pr - n;
+				const float* tb = t - n;
+
+				for (int i = 0; i < n; i++)
+					t[i] = rr[i] + pb[i] * tb[i];
+			}
+			else
+				std::copy(rr, rr + n, t);
+
+			t[0] *= pr[0];
+			for (int i = 1; i < n; i++)
+				t[i] = (t[i] + pr[i - 1] * t[i - 1]) * pr[i];
+		}
+
+		// Solve L^T z = t, from the top right
+		for (int y = y1 - 1; y >= y0; y--)
+		{
+			const float* pr = pre + (size_t)y * n;
+			float* t = out + (size_t)y * n;
+
+			if (y + 1 < y1)
+			{
+				const float* ta = t + n;
+
+				for (int i = 0; i < n; i++)
+					t[i] += pr[i] * ta[i];
+			}
+
+			t[n - 1] *= pr[n - 1];
+			for (int i = n - 2; i >= 0; i--)
+				t[i] = (t[i] + pr[i] * t[i + 1]) * pr[i];
+		}
+	});
+}
+
+// z = M^-1 r
+void pcg::precondition(const pcg_options& opt)
+{
+	switch (opt.preconditioner)
+	{
+	case PCG_INCOMPLETE_CHOLESKY:
+		if (ic_precon.empty())
+			factor_ic();
+		apply_ic(r.data(), z.data());
+		poisson_remove_mean(exec, n, z.data());
+		break;
+	case PCG_MULTIGRID:
+		if (!mg)
+			mg.reset(new multigrid(n, exec));
+		mg->precondition(r.data(), z.data(), multigrid_options());
+		break;
+	default:
+		std::copy(r.begin(), r.end(), z.begin());
+		break;
+	}
+}
+
+//========================================================================
+// Solve
+//========================================================================
+
+poisson_stats pcg::solve(const float* b, float* out, const pcg_options& opt)
+{
+	size_t total = (size_t)n * n;
+	int blocks = (n + PCG_ROW_BLOCK - 1) / PCG_ROW_BLOCK;
+	std::vector<float> rhs(b, b + total);
+	poisson_stats st;
+	double bnorm, rho, rho_new, rr, pq, alpha;
+	bool restart = true;
+
+	auto t0 = std::chrono::steady_clock::now();
+
+	poisson_remove_mean(exec, n, rhs.data());
+	bnorm = poisson_norm(exec, n, rhs.data());
+	if (bnorm == 0.0)
+		bnorm = 1.0;
+
+	std::copy(out, out + total, x.begin());
+	rho = 0.0;
+
+	auto row_sum = [&](const std::function<double(int)>& row)
+	{
+		return exec.sum(blocks, [&](int blk)
+		{
+			int y1 = (blk + 1) * PCG_ROW_BLOCK < n ? (blk + 1) * PCG_ROW_BLOCK : n;
+			double acc = 0.0;
+
+			for (int y = blk * PCG_ROW_BLOCK; y < y1; y++)
+				acc += row(y);
+			return acc;
+		});
+	};
+
+	for (;;)
+	{
+		// (Re)start from the true residual, which also guards the exit
+		// against drift of the recursive one
+		if (restart)
+		{
+			st.residual = poisson_residual(exec, n, rhs.data(), x.data(), r.data()) / bnorm;
+			if (st.residual < opt.tolerance || st.iterations >= opt.max_iterations)
+				break;
+
+			precondition(opt);
+			std::copy(z.begin(), z.end(), p.begin());
+			rho = row_sum([&](int y) { return dot_row(n, r.data() + (size_t)y * n, z.data() + (size_t)y * n); });
+			restart = false;
+		}
+
+		pq = row_sum([&](int y)
+		{
+			const float* pp = p.data();
+
+			return apply_dot_row(n, pp + (size_t)y * n, pp + (size_t)(y + 1 < n ? y + 1 : 0) * n,
+				pp + (size_t)(y > 0 ? y - 1 : n - 1) * n, q.data() + (size_t)y * n);
+		});
+		if (pq <= 0.0)
+		{
+			restart = true;
+			st.iterations++;
+			continue;
+		}
+
+		alpha = rho / pq;
+		rr = row_sum([&](int y)
+		{
+			size_t row = (size_t)y * n;
+
+			return update_row(n, alpha, p.data() + row, q.data() + row, x.data() + row, r.data() + row);
+		});
+		st.iterations++;
+
+		if (std::sqrt(rr) / bnorm < opt.tolerance || st.iterations >= opt.max_iterations)
+		{
+			restart = true;
+			continue;
+		}
+
+		if (opt.preconditioner == PCG_NONE)
+		{
+			rho_new = rr;
+			std::copy(r.begin(), r.end(), z.begin());
+		}
+		else
+		{
+			precondition(opt);
+			rho_new = row_sum([&](int y) { return dot_row(n, r.data() + (size_t)y * n, z.data() + (size_t)y * n); });
+		}
+
+		float beta = (float)(rho_new / rho);
+		rho = rho_new;
+		exec.for_each(blocks, [&](int blk)
+		{
+			int y1 = (blk + 1) * PCG_ROW_BLOCK < n ? (blk + 1) * PCG_ROW_BLOCK : n;
+
+			for (int y = blk * PCG_ROW_BLOCK; y < y1; y++)
+				xpay_row(n, beta, z.data() + (size_t)y * n, p.data() + (size_t)y * n);
+		});
+	}
+
+	for (size_t i = 0; i < total; i++)
+		out[i] = (float)x[i];
+	poisson_remove_mean(exec, n, out);
+
+	st.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	return st;
+}
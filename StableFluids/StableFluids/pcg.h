@@ -0,0 +1,70 @@
+/*****************************************************************************
+ * Preconditioned conjugate gradient Poisson solver
+ *
+ * Solves the periodic problem of poisson.h without ever forming the
+ * matrix: the operator is the 5-point stencil applied row by row on the
+ * tile_executor.  Each iteration makes three passes over memory, with the
+ * dot products fused into the stencil apply and into the x / r update,
+ * and the inner loops use SSE2 where available.  x and the residual it
+ * reports are kept in double, as in multigrid.h.
+ *
+ * Preconditioners:
+ *
+ *   PCG_NONE                   plain CG
+ *   PCG_INCOMPLETE_CHOLESKY    modified incomplete Cholesky, MIC(0), of
+ *                              the stencil without its periodic links,
+ *                              factored per band of rows so the triangular
+ *                              solves run in parallel
+ *   PCG_MULTIGRID              one symmetric multigrid V cycle
+ *****************************************************************************/
+
+#ifndef PCGH
+#define PCGH
+
+#include <memory>
+#include <vector>
+
+#include "multigrid.h"
+#include "poisson.h"
+#include "tile_executor.h"
+
+enum pcg_preconditioner
+{
+	PCG_NONE,
+	PCG_INCOMPLETE_CHOLESKY,
+	PCG_MULTIGRID
+};
+
+struct pcg_options
+{
+	pcg_preconditioner preconditioner = PCG_MULTIGRID;
+	double tolerance = 1e-5;	// on ||b - Ax|| / ||b||
+	int max_iterations = 2000;
+};
+
+class pcg
+{
+public:
+	pcg(int n, tile_executor& exec);
+
+	int size() const { return n; }
+
+	// Solve Ax = b, x holds the initial guess
+	poisson_stats solve(const float* b, float* x, const pcg_options& opt);
+
+private:
+	void factor_ic();
+	void apply_ic(const float* r, float* z);
+	void precondition(const pcg_options& opt);
+
+	tile_executor& exec;
+	int n;
+	int band;							// rows per incomplete Cholesky band
+
+	std::vector<float> r, z, p, q;
+	std::vector<double> x;
+	std::vector<float> ic_precon;		// 1 / sqrt of the MIC(0) pivots, empty until needed
+	std::unique_ptr<multigrid> mg;		// created on first use
+};
+
+#endif
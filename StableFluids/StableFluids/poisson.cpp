@@ -0,0 +1,177 @@
+/*****************************************************************************
+ * Periodic Poisson problem
+ *****************************************************************************/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#include "poisson.h"
+
+// Rows per work item of the reductions
+#define POISSON_ROW_BLOCK 16
+
+double poisson_residual(tile_executor& exec, int n, float s, const float* b, const float* x, float* r)
+{
+	int blocks = (n + POISSON_ROW_BLOCK - 1) / POISSON_ROW_BLOCK;
+
+	return std::sqrt(exec.sum(blocks, [&](int blk)
+	{
+		int y0 = blk * POISSON_ROW_BLOCK;
+		int y1 = y0 + POISSON_ROW_BLOCK < n ? y0 + POISSON_ROW_BLOCK : n;
+		double acc = 0.0;
+
+		for (int y = y0; y < y1; y++)
+		{
+			const float* row = x + (size_t)y * n;
+			const float* up = x + (size_t)(y + 1 < n ? y + 1 : 0) * n;
+			const float* down = x + (size_t)(y > 0 ? y - 1 : n - 1) * n;
+			const float* rhs = b + (size_t)y * n;
+			float* res = r + (size_t)y * n;
+
+			for (int i = 0; i < n; i++)
+			{
+				int ip = i + 1 < n ? i + 1 : 0;
+				int im = i > 0 ? i - 1 : n - 1;
+				float v = rhs[i] - s * (4.f * row[i] - row[ip] - row[im] - up[i] - down[i]);
+
+				res[i] = v;
+				acc += (double)v * v;
+			}
+		}
+		return acc;
+	}));
+}
+
+double poisson_residual(tile_executor& exec, int n, const float* b, const double* x, float* r)
+{
+	return std::sqrt(exec.sum(n, [&](int y)
+	{
+		const double* row = x + (size_t)y * n;
+		const double* up = x + (size_t)(y + 1 < n ? y + 1 : 0) * n;
+		const double* down = x + (size_t)(y > 0 ? y - 1 : n - 1) * n;
+		const float* rhs = b + (size_t)y * n;
+		float* res = r + (size_t)y * n;
+		double acc = 0.0;
+
+		for (int i = 0; i < n; i++)
+		{
+			int ip = i + 1 < n ? i + 1 : 0;
+			int im = i > 0 ? i - 1 : n - 1;
+			double v = rhs[i] - (4.0 * row[i] - row[ip] - row[im] - up[i] - down[i]);
+
+			res[i] = (float)v;
+			acc += v * v;
+		}
+		return acc;
+	}));
+}
+
+double poisson_norm(tile_executor& exec, int n, const float* v)
+{
+	size_t total = (size_t)n * n;
+	int blocks = (n + POISSON_ROW_BLOCK - 1) / POISSON_ROW_BLOCK;
+
+	return std::sqrt(exec.sum(blocks, [&](int blk)
+	{
+		size_t i0 = (size_t)blk * POISSON_ROW_BLOCK * n;
+		size_t i1 = i0 + (size_t)POISSON_ROW_BLOCK * n < total ? i0 + (size_t)POISSON_ROW_BLOCK * n : total;
+		double acc = 0.0;
+
+		for (size_t i = i0; i < i1; i++)
+			acc += (double)v[i] * v[i];
+		return acc;
+	}));
+}
+
+void poisson_remove_mean(tile_executor& exec, int n, float* v)
+{
+	size_t total = (size_t)n * n;
+	int blocks = (n + POISSON_ROW_BLOCK - 1) / POISSON_ROW_BLOCK;
+	float mean;
+
+	mean = (float)(exec.sum(blocks, [&](int blk)
+	{
+		size_t i0 = (size_t)blk * POISSON_ROW_BLOCK * n;
+		size_t i1 = i0 + (size_t)POISSON_ROW_BLOCK * n < total ? i0 + (size_t)POISSON_ROW_BLOCK * n : total;
+		double acc = 0.0;
+
+		for (size_t i = i0; i < i1; i++)
+			acc += v[i];
+		return acc;
+	}) / (double)total);
+
+	exec.for_each(blocks, [&](int blk)
+	{
+		size_t i0 = (size_t)blk * POISSON_ROW_BLOCK * n;
+		size_t i1 = i0 + (size_t)POISSON_ROW_BLOCK * n < total ? i0 + (size_t)POISSON_ROW_BLOCK * n : total;
+
+		for (size_t i = i0; i < i1; i++)
+			v[i] -= mean;
+	});
+}
+
+//========================================================================
+// Jacobi
+//========================================================================
+
+poisson_stats poisson_jacobi(tile_executor& exec, int n, const float* b, float* x, double tolerance, int max_iterations)
+{
+	std::vector<float> rhs(b, b + (size_t)n * n);
+	std::vector<float> tmp((size_t)n * n);
+	float* cur = x;
+	float* nxt = tmp.data();
+	poisson_stats st;
+	double bnorm;
+	int it;
+
+	auto t0 = std::chrono::steady_clock::now();
+
+	poisson_remove_mean(exec, n, rhs.data());
+	bnorm = poisson_norm(exec, n, rhs.data());
+	if (bnorm == 0.0)
+		bnorm = 1.0;
+
+	// The residual costs about as much as a sweep, check it every few
+	for (it = 0; it < max_iterations; it++)
+	{
+		if (it % 10 == 0)
+		{
+			st.residual = poisson_residual(exec, n, 1.f, rhs.data(), cur, nxt) / bnorm;
+			if (st.residual < tolerance)
+				break;
+		}
+
+		exec.run(n, n, [&](int x0, int y0, int x1, int y1)
+		{
+			for (int y = y0; y < y1; y++)
+			{
+				const float* row = cur + (size_t)y * n;
+				const float* up = cur + (size_t)(y + 1 < n ? y + 1 : 0) * n;
+				const float* down = cur + (size_t)(y > 0 ? y - 1 : n - 1) * n;
+				const float* r = rhs.data() + (size_t)y * n;
+				float* o = nxt + (size_t)y * n;
+
+				for (int i = x0; i < x1; i++)
+				{
+					int ip = i + 1 < n ? i + 1 : 0;
+					int im = i > 0 ? i - 1 : n - 1;
+
+					o[i] = 0.25f * (r[i] + row[ip] + row[im] + up[i] + down[i]);
+				}
+			}
+		});
+		std::swap(cur, nxt);
+	}
+
+	if (it == max_iterations)
+		st.residual = poisson_residual(exec, n, 1.f, rhs.data(), cur, nxt) / bnorm;
+	if (cur != x)
+		std::copy(cur, cur + (size_t)n * n, x);
+
+	st.iterations = it;
+	st.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	return st;
+}
@@ -0,0 +1,44 @@
+/*****************************************************************************
+ * Periodic Poisson problem
+ *
+ * The pressure equation of the stable fluids step on an n x n periodic
+ * grid, written with the 5-point stencil
+ *
+ *   s (4 x(i, j) - x(i+1, j) - x(i-1, j) - x(i, j+1) - x(i, j-1)) = b(i, j)
+ *
+ * where s = 1 / h^2 (1 on the finest grid).  Constants are in the null
+ * space, so b must sum to zero; the solvers remove its mean.
+ *
+ * Arrays are row major, n * n floats.  Norms are plain L2 norms.
+ *****************************************************************************/
+
+#ifndef POISSONH
+#define POISSONH
+
+#include "tile_executor.h"
+
+struct poisson_stats
+{
+	int iterations = 0;		// sweeps or cycles
+	double residual = 0.0;	// final ||b - Ax|| / ||b||
+	double seconds = 0.0;
+};
+
+// r = b - Ax, returns ||r||
+double poisson_residual(tile_executor& exec, int n, float s, const float* b, const float* x, float* r);
+
+// The same for a double precision x on the finest grid (s = 1)
+double poisson_residual(tile_executor& exec, int n, const float* b, const double* x, float* r);
+
+// ||v||
+double poisson_norm(tile_executor& exec, int n, const float* v);
+
+// Subtract the mean from v
+void poisson_remove_mean(tile_executor& exec, int n, float* v);
+
+// Plain Jacobi iteration, the method of the WebGL demos, until the relative
+// residual drops below tolerance or max_iterations sweeps are done.  x holds
+// the initial guess.
+poisson_stats poisson_jacobi(tile_executor& exec, int n, const float* b, float* x, double tolerance, int max_iterations);
+
+#endif
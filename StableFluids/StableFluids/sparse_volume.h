@@ -0,0 +1,574 @@
+/*****************************************************************************
+ * Sparse volume
+ *
+ * A VDB-style tree for 3-D fields that are mostly empty and have no fixed
+ * box: a root hash from the origin of each 128^3 region to an internal
+ * node, 16^3 children per internal node, and 8^3 leaves, x fastest, each
+ * with a mask of its active cells.  Cells without a leaf read as the tile
+ * value their internal node keeps for the leaf, as VDB's tiles, and cells
+ * without a node as the background value; a level set marks its inside
+ * that way.  Unlike brick_grid, whose table spans its whole box, memory
+ * follows the leaves alone, and coordinates may be negative.
+ *
+ * Nodes and leaves are kept in arrays and refer to each other by index,
+ * so the same arrays are the file format: write() stores them one after
+ * the other and map() reads them back through a file mapping, in place,
+ * paging leaves in only as they are touched.  A mapped volume is copied
+ * into memory on its first change.
+ *
+ * Lookups through an accessor remember the last leaf and internal node,
+ * so runs of nearby cells cost a compare and a load.  Leaves are added by
+ * one thread; the cells of existing leaves may be written from parallel
+ * jobs, such as for_each_leaf() hands out.
+ *****************************************************************************/
+
+#ifndef SPARSE_VOLUMEH
+#define SPARSE_VOLUMEH
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#include "brick_grid.h"
+#include "mapped_file.h"
+#include "tile_executor.h"
+
+#define VOLUME_LEAF_LOG2 3
+#define VOLUME_LEAF_CELLS (1 << (3 * VOLUME_LEAF_LOG2))
+#define VOLUME_NODE_LOG2 4				// leaves per internal node along an axis
+#define VOLUME_NODE_CHILDREN (1 << (3 * VOLUME_NODE_LOG2))
+#define VOLUME_SPAN_LOG2 (VOLUME_LEAF_LOG2 + VOLUME_NODE_LOG2)
+#define VOLUME_EMPTY INT64_MIN			// key of a free root slot
+#define VOLUME_ALIGN 64					// of the sections of a file
+
+template <class T>
+struct volume_leaf
+{
+	int32_t origin[3];					// first cell
+	int32_t pad;
+	uint64_t mask[VOLUME_LEAF_CELLS / 64];		// active cells
+	T values[VOLUME_LEAF_CELLS];
+
+	bool active(int i) const { return (mask[i >> 6] >> (i & 63)) & 1; }
+	void activate(int i) { mask[i >> 6] |= (uint64_t)1 << (i & 63); }
+};
+
+template <class T>
+struct volume_node
+{
+	int32_t origin[3];
+	int32_t pad;
+	uint64_t mask[VOLUME_NODE_CHILDREN / 64];	// children present
+	int32_t child[VOLUME_NODE_CHILDREN];		// leaf index, -1 if none
+	T tile[VOLUME_NODE_CHILDREN];				// value of the cells of a missing leaf
+};
+
+struct volume_slot
+{
+	int64_t key;		// packed origin of the node, VOLUME_EMPTY if free
+	int32_t node;
+	int32_t pad;
+};
+
+// Start of a file; the sections follow at the offsets given, in the
+// native byte order
+struct volume_header
+{
+	char magic[8];
+	uint32_t value_size;
+	uint32_t leaf_cells;
+	uint32_t node_children;
+	uint32_t root_capacity;
+	uint32_t node_count;
+	uint32_t leaf_count;
+	uint64_t root_offset, node_offset, leaf_offset;
+	unsigned char background[16];
+};
+
+static const char volume_magic[8] = { 'S', 'F', 'V', 'O', 'L', 'U', 'M', '2' };
+
+template <class T>
+class sparse_volume
+{
+public:
+	typedef volume_leaf<T> leaf;
+	typedef volume_node<T> node;
+
+	explicit sparse_volume(T background = T()) : background(background) { clear(); }
+
+	sparse_volume(const sparse_volume&) = delete;
+	sparse_volume& operator=(const sparse_volume&) = delete;
+
+	void clear()
+	{
+		file.close();
+		root.assign(64, volume_slot{ VOLUME_EMPTY, -1, 0 });
+		nodes.clear();
+		leaves.clear();
+		used_slots = 0;
+		refresh();
+	}
+
+	int leaf_count() const { return leaf_total; }
+	int node_count() const { return node_total; }
+	bool is_mapped() const { return file.data() != nullptr; }
+
+	// Bytes of the root, nodes and leaves, in memory or mapped
+	size_t bytes() const
+	{
+		if (is_mapped())
+			return file.size();
+		return root.capacity() * sizeof(volume_slot) + nodes.capacity() * sizeof(node)
+			+ leaves.capacity() * sizeof(leaf);
+	}
+
+	static int cell_index(int x, int y, int z)
+	{
+		const int m = (1 << VOLUME_LEAF_LOG2) - 1;
+
+		return (((z & m) << VOLUME_LEAF_LOG2 | (y & m)) << VOLUME_LEAF_LOG2) | (x & m);
+	}
+
+	static int child_index(int x, int y, int z)
+	{
+		const int m = (1 << VOLUME_NODE_LOG2) - 1;
+		int i = (x >> VOLUME_LEAF_LOG2) & m, j = (y >> VOLUME_LEAF_LOG2) & m, k = (z >> VOLUME_LEAF_LOG2) & m;
+
+		return ((k << VOLUME_NODE_LOG2 | j) << VOLUME_NODE_LOG2) | i;
+	}
+
+	const leaf& leaf_at(int i) const { return leaf_data[i]; }
+	leaf& leaf_at(int i) { make_writable(); return leaves[i]; }
+
+	// Index of the leaf holding cell (x, y, z), -1 if there is none
+	int find_leaf(int x, int y, int z) const
+	{
+		int n = find_node(x, y, z);
+
+		return n < 0 ? -1 : node_data[n].child[child_index(x, y, z)];
+	}
+
+	// The same, adding the leaf, filled with its tile value, if missing
+	int touch_leaf(int x, int y, int z)
+	{
+		make_writable();
+
+		int n = find_node(x, y, z);
+		if (n < 0)
+			n = add_node(x, y, z);
+
+		int c = child_index(x, y, z);
+		if (nodes[n].child[c] < 0)
+		{
+			const int m = ~((1 << VOLUME_LEAF_LOG2) - 1);
+			leaf l;
+
+			l.origin[0] = x & m;
+			l.origin[1] = y & m;
+			l.origin[2] = z & m;
+			l.pad = 0;
+			std::fill(l.mask, l.mask + VOLUME_LEAF_CELLS / 64, (uint64_t)0);
+			std::fill(l.values, l.values + VOLUME_LEAF_CELLS, nodes[n].tile[c]);
+			nodes[n].child[c] = (int32_t)leaves.size();
+			nodes[n].mask[c >> 6] |= (uint64_t)1 << (c & 63);
+			leaves.push_back(l);
+			refresh();
+		}
+		return nodes[n].child[c];
+	}
+
+	T get(int x, int y, int z) const
+	{
+		int n = find_node(x, y, z);
+
+		if (n < 0)
+			return background;
+
+		int c = child_index(x, y, z), l = node_data[n].child[c];
+
+		return l < 0 ? node_data[n].tile[c] : leaf_data[l].values[cell_index(x, y, z)];
+	}
+
+	// Sets the tile value of the leaf-sized block holding (x, y, z), which
+	// its cells read as while it has no leaf
+	void set_tile(int x, int y, int z, T v)
+	{
+		make_writable();
+
+		int n = find_node(x, y, z);
+		if (n < 0)
+			n = add_node(x, y, z);
+		nodes[n].tile[child_index(x, y, z)] = v;
+	}
+
+	// Sets and activates the cell
+	void set(int x, int y, int z, T v)
+	{
+		leaf& l = leaves[touch_leaf(x, y, z)];
+		int i = cell_index(x, y, z);
+
+		l.values[i] = v;
+		l.activate(i);
+	}
+
+	// Calls fn on every leaf, as jobs of exec
+	void for_each_leaf(tile_executor& exec, const std::function<void(leaf&)>& fn)
+	{
+		make_writable();
+		exec.for_each(leaf_total, [&](int i) { fn(leaves[i]); });
+	}
+
+	void for_each_leaf(tile_executor& exec, const std::function<void(const leaf&)>& fn) const
+	{
+		exec.for_each(leaf_total, [&](int i) { fn(leaf_data[i]); });
+	}
+
+	// Drops the leaves for which drop(l, value) returns true, their blocks
+	// reading as the value it sets from then on.  Leaves keep their order.
+	void prune(const std::function<bool(const leaf&, T&)>& drop)
+	{
+		int kept = 0;
+
+		make_writable();
+		for (int i = 0; i < leaf_total; i++)
+		{
+			leaf& l = leaves[i];
+			node& n = nodes[find_node(l.origin[0], l.origin[1], l.origin[2])];
+			int c = child_index(l.origin[0], l.origin[1], l.origin[2]);
+			T value;
+
+			if (drop(l, value))
+			{
+				n.child[c] = -1;
+				n.mask[c >> 6] &= ~((uint64_t)1 << (c & 63));
+				n.tile[c] = value;
+				continue;
+			}
+			n.child[c] = kept;
+			if (kept != i)
+				leaves[kept] = l;
+			kept++;
+		}
+		leaves.resize(kept);
+		refresh();
+	}
+
+	// Leaves for the allocated bricks of g, every cell active
+	void copy_from(const brick_grid<T>& g)
+	{
+		clear();
+		background = g.background;
+		leaves.reserve(g.allocated_count());
+		for (int b = 0; b < g.brick_count(); b++)
+			if (g.allocated(b))
+			{
+				int x, y, z;
+
+				g.brick_origin(b, x, y, z);
+				leaf& l = leaves[touch_leaf(x, y, z)];
+				std::copy(g.brick(b), g.brick(b) + BRICK_CELLS, l.values);
+				std::fill(l.mask, l.mask + VOLUME_LEAF_CELLS / 64, ~(uint64_t)0);
+			}
+	}
+
+	// Returns false if the file cannot be written
+	bool write(const char* path) const
+	{
+		volume_header h;
+		FILE* fp;
+		bool ok;
+
+		static_assert(sizeof(T) <= sizeof(h.background), "volume values are at most 16 bytes");
+		memset(&h, 0, sizeof(h));
+		memcpy(h.magic, volume_magic, sizeof(h.magic));
+		memcpy(h.background, &background, sizeof(T));
+		h.value_size = sizeof(T);
+		h.leaf_cells = VOLUME_LEAF_CELLS;
+		h.node_children = VOLUME_NODE_CHILDREN;
+		h.root_capacity = root_mask + 1;
+		h.node_count = node_total;
+		h.leaf_count = leaf_total;
+		h.root_offset = aligned(sizeof(h));
+		h.node_offset = aligned(h.root_offset + (uint64_t)h.root_capacity * sizeof(volume_slot));
+		h.leaf_offset = aligned(h.node_offset + (uint64_t)h.node_count * sizeof(node));
+
+		fp = fopen(path, "wb");
+		if (!fp)
+			return false;
+		ok = fwrite(&h, sizeof(h), 1, fp) == 1;
+		ok = ok && pad(fp, sizeof(h), h.root_offset);
+		ok = ok && fwrite(root_data, sizeof(volume_slot), h.root_capacity, fp) == h.root_capacity;
+		ok = ok && pad(fp, h.root_offset + (uint64_t)h.root_capacity * sizeof(volume_slot), h.node_offset);
+		ok = ok && fwrite(node_data, sizeof(node), h.node_count, fp) == h.node_count;
+		ok = ok && pad(fp, h.node_offset + (uint64_t)h.node_count * sizeof(node), h.leaf_offset);
+		ok = ok && fwrite(leaf_data, sizeof(leaf), h.leaf_count, fp) == h.leaf_count;
+		return fclose(fp) == 0 && ok;
+	}
+
+	// Read a file written by write() in place.  Returns false if it cannot
+	// be mapped or does not hold a volume of T, leaving the volume empty.
+	bool map(const char* path)
+	{
+		clear();
+		if (!file.open(path))
+			return false;
+
+		const unsigned char* base = (const unsigned char*)file.data();
+		volume_header h;
+
+		if (file.size() < sizeof(h))
+			return map_failed();
+		memcpy(&h, base, sizeof(h));
+		if (memcmp(h.magic, volume_magic, sizeof(h.magic)) != 0 || h.value_size != sizeof(T)
+			|| h.leaf_cells != VOLUME_LEAF_CELLS || h.node_children != VOLUME_NODE_CHILDREN
+			|| h.root_capacity == 0 || (h.root_capacity & (h.root_capacity - 1)) != 0
+			|| h.root_offset + (uint64_t)h.root_capacity * sizeof(volume_slot) > file.size()
+			|| h.node_offset + (uint64_t)h.node_count * sizeof(node) > file.size()
+			|| h.leaf_offset + (uint64_t)h.leaf_count * sizeof(leaf) > file.size())
+			return map_failed();
+
+		memcpy(&background, h.background, sizeof(T));
+		root_data = (const volume_slot*)(base + h.root_offset);
+		root_mask = h.root_capacity - 1;
+		node_data = (const node*)(base + h.node_offset);
+		leaf_data = (const leaf*)(base + h.leaf_offset);
+		node_total = (int)h.node_count;
+		leaf_total = (int)h.leaf_count;
+		return true;
+	}
+
+	// Remembers the last leaf and internal node looked up
+	class const_accessor
+	{
+	public:
+		explicit const_accessor(const sparse_volume& v) : v(v) { reset(); }
+
+		// After leaves are added
+		void reset()
+		{
+			for (int a = 0; a < 3; a++)
+				leaf_origin[a] = node_origin[a] = INT_MIN;
+			cached_leaf = cached_node = -1;
+			cached_tile = v.background;
+		}
+
+		T get(int x, int y, int z)
+		{
+			int l = lookup(x, y, z);
+
+			return l < 0 ? cached_tile : v.leaf_data[l].values[cell_index(x, y, z)];
+		}
+
+		// Trilinear interpolation at a position in cell units, cell
+		// (i, j, k) being at (i, j, k)
+		T sample(float x, float y, float z)
+		{
+			float fi = std::floor(x), fj = std::floor(y), fk = std::floor(z);
+			int i = (int)fi, j = (int)fj, k = (int)fk;
+			float fx = x - fi, fy = y - fj, fz = z - fk;
+			T v000 = get(i, j, k), v010 = get(i, j + 1, k), v001 = get(i, j, k + 1), v011 = get(i, j + 1, k + 1);
+			T c00 = v000 + (get(i + 1, j, k) - v000) * fx;
+			T c10 = v010 + (get(i + 1, j + 1, k) - v010) * fx;
+			T c01 = v001 + (get(i + 1, j, k + 1) - v001) * fx;
+			T c11 = v011 + (get(i + 1, j + 1, k + 1) - v011) * fx;
+			T c0 = c00 + (c10 - c00) * fy;
+			T c1 = c01 + (c11 - c01) * fy;
+
+			return c0 + (c1 - c0) * fz;
+		}
+
+	protected:
+		int lookup(int x, int y, int z)
+		{
+			const int lm = ~((1 << VOLUME_LEAF_LOG2) - 1), nm = ~((1 << VOLUME_SPAN_LOG2) - 1);
+
+			if ((x & lm) == leaf_origin[0] && (y & lm) == leaf_origin[1] && (z & lm) == leaf_origin[2])
+				return cached_leaf;
+			if ((x & nm) != node_origin[0] || (y & nm) != node_origin[1] || (z & nm) != node_origin[2])
+			{
+				node_origin[0] = x & nm;
+				node_origin[1] = y & nm;
+				node_origin[2] = z & nm;
+				cached_node = v.find_node(x, y, z);
+			}
+			leaf_origin[0] = x & lm;
+			leaf_origin[1] = y & lm;
+			leaf_origin[2] = z & lm;
+			if (cached_node < 0)
+			{
+				cached_leaf = -1;
+				cached_tile = v.background;
+				return -1;
+			}
+
+			int c = child_index(x, y, z);
+
+			cached_leaf = v.node_data[cached_node].child[c];
+			cached_tile = v.node_data[cached_node].tile[c];
+			return cached_leaf;
+		}
+
+		const sparse_volume& v;
+		int leaf_origin[3], node_origin[3];
+		int cached_leaf, cached_node;
+		T cached_tile;				// when the cached leaf is missing
+	};
+
+	class accessor : public const_accessor
+	{
+	public:
+		explicit accessor(sparse_volume& v) : const_accessor(v), w(v) {}
+
+		// Sets and activates the cell
+		void set(int x, int y, int z, T value)
+		{
+			int l = this->lookup(x, y, z);
+
+			if (l < 0 || w.is_mapped())
+			{
+				l = w.touch_leaf(x, y, z);
+				this->reset();
+			}
+
+			leaf& f = w.leaves[l];
+			int i = cell_index(x, y, z);
+
+			f.values[i] = value;
+			f.activate(i);
+		}
+
+	private:
+		sparse_volume& w;
+	};
+
+	T background;
+
+private:
+	static uint64_t aligned(uint64_t n) { return (n + VOLUME_ALIGN - 1) & ~(uint64_t)(VOLUME_ALIGN - 1); }
+
+	static bool pad(FILE* fp, uint64_t from, uint64_t to)
+	{
+		static const char zero[VOLUME_ALIGN] = {};
+
+		return fwrite(zero, 1, (size_t)(to - from), fp) == to - from;
+	}
+
+	// 21 bits per axis of the node origin
+	static int64_t node_key(int x, int y, int z)
+	{
+		const int64_t m = (1 << 21) - 1;
+
+		return (((int64_t)(z >> VOLUME_SPAN_LOG2) & m) << 42) | (((int64_t)(y >> VOLUME_SPAN_LOG2) & m) << 21)
+			| ((int64_t)(x >> VOLUME_SPAN_LOG2) & m);
+	}
+
+	static uint32_t slot_of(int64_t key, uint32_t mask)
+	{
+		return (uint32_t)(((uint64_t)key * 0x9e3779b97f4a7c15ull) >> 40) & mask;
+	}
+
+	int find_node(int x, int y, int z) const
+	{
+		int64_t key = node_key(x, y, z);
+
+		for (uint32_t s = slot_of(key, root_mask);; s = (s + 1) & root_mask)
+		{
+			if (root_data[s].key == key)
+				return root_data[s].node;
+			if (root_data[s].key == VOLUME_EMPTY)
+				return -1;
+		}
+	}
+
+	int add_node(int x, int y, int z)
+	{
+		const int m = ~((1 << VOLUME_SPAN_LOG2) - 1);
+
+		// Keep the root at most half full
+		if (2 * (used_slots + 1) > (int)root.size())
+		{
+			std::vector<volume_slot> old(root.size() * 2, volume_slot{ VOLUME_EMPTY, -1, 0 });
+
+			old.swap(root);
+			for (const volume_slot& s : old)
+				if (s.key != VOLUME_EMPTY)
+					insert_slot(s);
+		}
+
+		nodes.emplace_back();
+
+		node& n = nodes.back();
+
+		n.origin[0] = x & m;
+		n.origin[1] = y & m;
+		n.origin[2] = z & m;
+		n.pad = 0;
+		std::fill(n.mask, n.mask + VOLUME_NODE_CHILDREN / 64, (uint64_t)0);
+		std::fill(n.child, n.child + VOLUME_NODE_CHILDREN, -1);
+		std::fill(n.tile, n.tile + VOLUME_NODE_CHILDREN, background);
+		insert_slot(volume_slot{ node_key(x, y, z), (int32_t)nodes.size() - 1, 0 });
+		used_slots++;
+		refresh();
+		return (int)nodes.size() - 1;
+	}
+
+	void insert_slot(const volume_slot& slot)
+	{
+		uint32_t mask = (uint32_t)root.size() - 1;
+		uint32_t s = slot_of(slot.key, mask);
+
+		while (root[s].key != VOLUME_EMPTY)
+			s = (s + 1) & mask;
+		root[s] = slot;
+	}
+
+	bool map_failed()
+	{
+		clear();
+		return false;
+	}
+
+	// Copy a mapped volume into the arrays before changing it
+	void make_writable()
+	{
+		if (!is_mapped())
+			return;
+		root.assign(root_data, root_data + root_mask + 1);
+		nodes.assign(node_data, node_data + node_total);
+		leaves.assign(leaf_data, leaf_data + leaf_total);
+		used_slots = node_total;
+		file.close();
+		refresh();
+	}
+
+	// Point the reads at the arrays
+	void refresh()
+	{
+		root_data = root.data();
+		root_mask = (uint32_t)root.size() - 1;
+		node_data = nodes.data();
+		leaf_data = leaves.data();
+		node_total = (int)nodes.size();
+		leaf_total = (int)leaves.size();
+	}
+
+	std::vector<volume_slot> root;
+	std::vector<node> nodes;
+	std::vector<leaf> leaves;
+	int used_slots;
+	mapped_file file;
+
+	// The arrays or the mapped file
+	const volume_slot* root_data;
+	uint32_t root_mask;
+	const node* node_data;
+	const leaf* leaf_data;
+	int node_total, leaf_total;
+};
+
+#endif
@@ -0,0 +1,1001 @@
+/*****************************************************************************
+ * SPH particle fluid
+ *****************************************************************************/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SPH_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "sph.h"
+
+#define SORT_BITS 11			// key bits per counting sort pass
+#define SORT_CHUNK 32768		// particles per sort job
+#define PARTICLE_CHUNK 4096		// particles per job of the element passes
+#define CELL_CHUNK 32			// cells per job of the kernel passes
+#define WALL_TABLE 128			// entries of the wall tables over [0, h]
+#define PAD 3					// particles the arrays hold past the last
+#define RELAXATION 0.5f			// of the pressure correction
+#define FALL_STEP 0.05f			// longest substep, in units of sqrt(h / g)
+#define DAM_VOLUME 0.288f		// of the initial liquid, see dam_break
+#define SURFACE_RADIUS 0.5f		// of a particle, in spacings
+
+static const float pi = 3.14159265f;
+
+static double seconds_since(std::chrono::steady_clock::time_point t0)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+static bool dam_break(float x, float y)
+{
+	return (x < 0.35f && y < 0.6f) || y < 0.12f;
+}
+
+//========================================================================
+// Morton codes
+//========================================================================
+
+// 10 bits of v, two zeros after each
+static uint32_t spread_bits(uint32_t v)
+{
+	v &= 0x3ff;
+	v = (v | v << 16) & 0x030000ff;
+	v = (v | v << 8) & 0x0300f00f;
+	v = (v | v << 4) & 0x030c30c3;
+	v = (v | v << 2) & 0x09249249;
+	return v;
+}
+
+static uint32_t compact_bits(uint32_t v)
+{
+	v &= 0x09249249;
+	v = (v | v >> 2) & 0x030c30c3;
+	v = (v | v >> 4) & 0x0300f00f;
+	v = (v | v >> 8) & 0x030000ff;
+	v = (v | v >> 16) & 0x3ff;
+	return v;
+}
+
+static uint32_t morton(int x, int y, int z)
+{
+	return spread_bits(x) | spread_bits(y) << 1 | spread_bits(z) << 2;
+}
+
+// Mirrored back into [0, 1], so that particles pressed into a wall or a
+// corner do not land on the same point
+static float reflect(float x)
+{
+	return std::min(std::max(x < 0.f ? -x : x > 1.f ? 2.f - x : x, 0.f), 1.f);
+}
+
+static uint32_t hash_key(uint32_t key)
+{
+	return key * 2654435761u;
+}
+
+//========================================================================
+// Kernel
+//========================================================================
+
+/* The cubic spline of support h at q = r / h is
+ *
+ *   W = 16 / (pi h^3) (a^3 - 4 b^3),  a = max(1 - q, 0),  b = max(1/2 - q, 0)
+ *
+ * and dW/dr = 48 / (pi h^4) (4 b^2 - a^2), which is 0 at r = 0, so a
+ * particle may meet itself in the sums.  The pressure force takes the
+ * slope of the spiky kernel instead, -45 / (pi h^4) a^2, which does not
+ * vanish as two particles close in and so keeps them from pairing up
+ * under pressure (Muller et al. 2003).  Without branches, the same code
+ * runs four pairs at once.
+ */
+static float spline(float q)
+{
+	float a = std::max(1.f - q, 0.f);
+	float b = std::max(0.5f - q, 0.f);
+
+	return a * a * a - 4.f * b * b * b;
+}
+
+static float spiky_slope(float q)
+{
+	float a = std::max(1.f - q, 0.f);
+
+	return -a * a;
+}
+
+#ifndef SPH_SSE2
+
+static float spline_slope(float q)
+{
+	float a = std::max(1.f - q, 0.f);
+	float b = std::max(0.5f - q, 0.f);
+
+	return 4.f * b * b - a * a;
+}
+
+#endif
+
+#ifdef SPH_SSE2
+
+static inline float hsum_ps(__m128 v)
+{
+	v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+	v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+	return _mm_cvtss_f32(v);
+}
+
+// 1 / sqrt(x) to about 23 bits: the estimate and one Newton step
+static inline __m128 rsqrt_ps(__m128 x)
+{
+	__m128 y = _mm_rsqrt_ps(x);
+	__m128 yy = _mm_mul_ps(y, y);
+
+	return _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), y), _mm_sub_ps(_mm_set1_ps(3.f), _mm_mul_ps(x, yy)));
+}
+
+// Lanes of j, j + 1, j + 2, j + 3 that are below end
+static inline __m128 lanes_below(int j, int end)
+{
+	__m128i lane = _mm_add_epi32(_mm_set1_epi32(j), _mm_setr_epi32(0, 1, 2, 3));
+
+	return _mm_castsi128_ps(_mm_cmplt_epi32(lane, _mm_set1_epi32(end)));
+}
+
+#endif
+
+/* The sums below run over the particles of ranges [r[2 k], r[2 k + 1]) of
+ * the arrays b, b[0 .. 2] being the positions.  With SSE the last group of
+ * a range reads up to 3 particles past its end, which the arrays are
+ * padded for, and masks them out.
+ */
+
+// Sum of spline(|x - x_j| / h)
+static float density_sum(const float* x, float inv_h, float eps, const int* r, int ranges, const float* const* b)
+{
+	float acc = 0.f;
+
+#ifdef SPH_SSE2
+	const __m128 px = _mm_set1_ps(x[0]), py = _mm_set1_ps(x[1]), pz = _mm_set1_ps(x[2]);
+	const __m128 vh = _mm_set1_ps(inv_h), veps = _mm_set1_ps(eps), one = _mm_set1_ps(1.f), half = _mm_set1_ps(0.5f);
+	const __m128 four = _mm_set1_ps(4.f), zero = _mm_setzero_ps();
+	__m128 sum = zero;
+
+	for (int k = 0; k < ranges; k++)
+		for (int j = r[2 * k]; j < r[2 * k + 1]; j += 4)
+		{
+			__m128 dx = _mm_sub_ps(px, _mm_loadu_ps(b[0] + j));
+			__m128 dy = _mm_sub_ps(py, _mm_loadu_ps(b[1] + j));
+			__m128 dz = _mm_sub_ps(pz, _mm_loadu_ps(b[2] + j));
+			__m128 r2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+			r2 = _mm_max_ps(r2, veps);
+			__m128 q = _mm_mul_ps(_mm_mul_ps(r2, rsqrt_ps(r2)), vh);
+			__m128 a = _mm_max_ps(_mm_sub_ps(one, q), zero);
+			__m128 c = _mm_max_ps(_mm_sub_ps(half, q), zero);
+			__m128 w = _mm_sub_ps(_mm_mul_ps(a, _mm_mul_ps(a, a)), _mm_mul_ps(four, _mm_mul_ps(c, _mm_mul_ps(c, c))));
+
+			sum = _mm_add_ps(sum, _mm_and_ps(w, lanes_below(j, r[2 * k + 1])));
+		}
+	acc = hsum_ps(sum);
+#else
+	for (int k = 0; k < ranges; k++)
+		for (int j = r[2 * k]; j < r[2 * k + 1]; j++)
+		{
+			float dx = x[0] - b[0][j], dy = x[1] - b[1][j], dz = x[2] - b[2][j];
+
+			acc += spline(std::sqrt(std::max(dx * dx + dy * dy + dz * dz, eps)) * inv_h);
+		}
+#endif
+	return acc;
+}
+
+// Sum of (p + p_j) spiky_slope / r (x - x_j), b[3] holding the pressures.
+// r is kept above eps so that a particle meeting itself adds 0.
+static void pressure_sum(const float* x, float p, float inv_h, float eps, const int* r, int ranges,
+	const float* const* b, float* out)
+{
+	float ax = 0.f, ay = 0.f, az = 0.f;
+
+#ifdef SPH_SSE2
+	const __m128 px = _mm_set1_ps(x[0]), py = _mm_set1_ps(x[1]), pz = _mm_set1_ps(x[2]), pp = _mm_set1_ps(p);
+	const __m128 vh = _mm_set1_ps(inv_h), veps = _mm_set1_ps(eps), one = _mm_set1_ps(1.f), zero = _mm_setzero_ps();
+	__m128 sx = zero, sy = zero, sz = zero;
+
+	for (int k = 0; k < ranges; k++)
+		for (int j = r[2 * k]; j < r[2 * k + 1]; j += 4)
+		{
+			__m128 dx = _mm_sub_ps(px, _mm_loadu_ps(b[0] + j));
+			__m128 dy = _mm_sub_ps(py, _mm_loadu_ps(b[1] + j));
+			__m128 dz = _mm_sub_ps(pz, _mm_loadu_ps(b[2] + j));
+			__m128 r2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+			r2 = _mm_max_ps(r2, veps);
+			__m128 inv = rsqrt_ps(r2);
+			__m128 q = _mm_mul_ps(_mm_mul_ps(r2, inv), vh);
+			__m128 a = _mm_max_ps(_mm_sub_ps(one, q), zero);
+			__m128 g = _mm_sub_ps(zero, _mm_mul_ps(a, a));
+
+			g = _mm_mul_ps(_mm_mul_ps(g, _mm_add_ps(pp, _mm_loadu_ps(b[3] + j))), inv);
+			g = _mm_and_ps(g, lanes_below(j, r[2 * k + 1]));
+			sx = _mm_add_ps(sx, _mm_mul_ps(g, dx));
+			sy = _mm_add_ps(sy, _mm_mul_ps(g, dy));
+			sz = _mm_add_ps(sz, _mm_mul_ps(g, dz));
+		}
+	ax = hsum_ps(sx);
+	ay = hsum_ps(sy);
+	az = hsum_ps(sz);
+#else
+	for (int k = 0; k < ranges; k++)
+		for (int j = r[2 * k]; j < r[2 * k + 1]; j++)
+		{
+			float dx = x[0] - b[0][j], dy = x[1] - b[1][j], dz = x[2] - b[2][j];
+			float d = std::sqrt(std::max(dx * dx + dy * dy + dz * dz, eps));
+			float g = spiky_slope(d * inv_h) * (p + b[3][j]) / d;
+
+			ax += g * dx;
+			ay += g * dy;
+			az += g * dz;
+		}
+#endif
+	out[0] = ax;
+	out[1] = ay;
+	out[2] = az;
+}
+
+// Sum of spline_slope / r (v - v_j) . (x - x_j) / ((r^2 + eps) rho_j) (x - x_j),
+// b[3 .. 5] holding the velocities and b[6] the densities
+static void viscosity_sum(const float* x, const float* v, float inv_h, float eps, const int* r, int ranges,
+	const float* const* b, float* out)
+{
+	float ax = 0.f, ay = 0.f, az = 0.f;
+
+#ifdef SPH_SSE2
+	const __m128 px = _mm_set1_ps(x[0]), py = _mm_set1_ps(x[1]), pz = _mm_set1_ps(x[2]);
+	const __m128 vx = _mm_set1_ps(v[0]), vy = _mm_set1_ps(v[1]), vz = _mm_set1_ps(v[2]);
+	const __m128 vh = _mm_set1_ps(inv_h), veps = _mm_set1_ps(eps), tiny = _mm_set1_ps(1e-6f * eps);
+	const __m128 one = _mm_set1_ps(1.f), half = _mm_set1_ps(0.5f), four = _mm_set1_ps(4.f), zero = _mm_setzero_ps();
+	__m128 sx = zero, sy = zero, sz = zero;
+
+	for (int k = 0; k < ranges; k++)
+		for (int j = r[2 * k]; j < r[2 * k + 1]; j += 4)
+		{
+			__m128 dx = _mm_sub_ps(px, _mm_loadu_ps(b[0] + j));
+			__m128 dy = _mm_sub_ps(py, _mm_loadu_ps(b[1] + j));
+			__m128 dz = _mm_sub_ps(pz, _mm_loadu_ps(b[2] + j));
+			__m128 dot = _mm_mul_ps(_mm_sub_ps(vx, _mm_loadu_ps(b[3] + j)), dx);
+			dot = _mm_add_ps(dot, _mm_mul_ps(_mm_sub_ps(vy, _mm_loadu_ps(b[4] + j)), dy));
+			dot = _mm_add_ps(dot, _mm_mul_ps(_mm_sub_ps(vz, _mm_loadu_ps(b[5] + j)), dz));
+			__m128 r2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+			__m128 inv = rsqrt_ps(_mm_max_ps(r2, tiny));
+			__m128 q = _mm_mul_ps(_mm_mul_ps(r2, inv), vh);
+			__m128 a = _mm_max_ps(_mm_sub_ps(one, q), zero);
+			__m128 c = _mm_max_ps(_mm_sub_ps(half, q), zero);
+			__m128 g = _mm_sub_ps(_mm_mul_ps(four, _mm_mul_ps(c, c)), _mm_mul_ps(a, a));
+
+			g = _mm_div_ps(_mm_mul_ps(_mm_mul_ps(g, dot), inv), _mm_mul_ps(_mm_add_ps(r2, veps), _mm_loadu_ps(b[6] + j)));
+			g = _mm_and_ps(g, lanes_below(j, r[2 * k + 1]));
+			sx = _mm_add_ps(sx, _mm_mul_ps(g, dx));
+			sy = _mm_add_ps(sy, _mm_mul_ps(g, dy));
+			sz = _mm_add_ps(sz, _mm_mul_ps(g, dz));
+		}
+	ax = hsum_ps(sx);
+	ay = hsum_ps(sy);
+	az = hsum_ps(sz);
+#else
+	for (int k = 0; k < ranges; k++)
+		for (int j = r[2 * k]; j < r[2 * k + 1]; j++)
+		{
+			float dx = x[0] - b[0][j], dy = x[1] - b[1][j], dz = x[2] - b[2][j];
+			float dot = (v[0] - b[3][j]) * dx + (v[1] - b[4][j]) * dy + (v[2] - b[5][j]) * dz;
+			float r2 = dx * dx + dy * dy + dz * dz;
+			float d = std::sqrt(std::max(r2, 1e-6f * eps));
+			float g = spline_slope(d * inv_h) * dot / (d * (r2 + eps) * b[6][j]);
+
+			ax += g * dx;
+			ay += g * dy;
+			az += g * dz;
+		}
+#endif
+	out[0] = ax;
+	out[1] = ay;
+	out[2] = az;
+}
+
+//========================================================================
+// Setup
+//========================================================================
+
+sph::sph(const sph_options& opt, tile_executor& exec)
+	: opt(opt), exec(exec), mc(exec)
+{
+	dx = std::cbrt(DAM_VOLUME / (float)std::max(opt.particles, 1));
+	h = 2.5f * dx;
+	cell = std::max(h, 1.f / 1024.f);
+	grid = std::min((int)std::ceil(1.f / cell), 1024);
+	key_bits = 0;
+	while ((1 << key_bits) < grid)
+		key_bits++;
+	key_bits = 3 * std::max(key_bits, 1);
+
+	// The mass puts a full lattice of spacing dx at the rest density, which
+	// the cubic spline at h = 2.5 dx misses by a few percent otherwise
+	float kw = 16.f / (pi * h * h * h), kg = 45.f / (pi * h * h * h * h);
+	double sum_w = 0.0, sum_g = 0.0;
+
+	for (int k = -3; k <= 3; k++)
+		for (int j = -3; j <= 3; j++)
+			for (int i = -3; i <= 3; i++)
+			{
+				float q = dx * std::sqrt((float)(i * i + j * j + k * k)) / h;
+				float g = (i | j | k) ? kg * spiky_slope(q) : 0.f;
+
+				sum_w += kw * spline(q);
+				sum_g += g * g;
+			}
+	mass = opt.rest_density / (float)sum_w;
+	sum_grad2 = (float)sum_g;
+
+	/* The liquid behind a wall at distance d is taken as the layers of the
+	 * same lattice at d + dx / 2, d + 3 dx / 2, ...  Their share of the
+	 * density and the normal component of their summed kernel gradient
+	 * make the tables, so a lattice at rest against a wall is at the rest
+	 * density too.  The gradient weighted by the depth of each layer gives
+	 * the hydrostatic part of their pressure.
+	 */
+	wall_density.resize(WALL_TABLE);
+	wall_gradient.resize(WALL_TABLE);
+	wall_depth.resize(WALL_TABLE);
+	for (int t = 0; t < WALL_TABLE; t++)
+	{
+		float d = h * (float)t / (float)(WALL_TABLE - 1);
+		double w = 0.0, g = 0.0, gz = 0.0;
+
+		for (float z = d + 0.5f * dx; z < h; z += dx)
+			for (int j = -3; j <= 3; j++)
+				for (int i = -3; i <= 3; i++)
+				{
+					float r = std::sqrt(dx * dx * (float)(i * i + j * j) + z * z);
+					float q = r / h;
+
+					w += kw * spline(q);
+					g -= kg * spiky_slope(q) * z / r;
+					gz -= kg * spiky_slope(q) * z * z / r;
+				}
+		wall_density[t] = (float)(mass * w);
+		wall_gradient[t] = (float)(mass * g);
+		wall_depth[t] = (float)(mass * gz);
+	}
+
+	reset();
+}
+
+void sph::reset()
+{
+	int n = (int)(1.f / dx);
+
+	for (int a = 0; a < 3; a++)
+	{
+		pos[a].clear();
+		vel[a].clear();
+	}
+	for (int z = 0; z < n; z++)
+		for (int y = 0; y < n; y++)
+			for (int x = 0; x < n; x++)
+			{
+				float px = ((float)x + 0.5f) * dx, py = ((float)y + 0.5f) * dx, pz = ((float)z + 0.5f) * dx;
+
+				if (!dam_break(px, py))
+					continue;
+				pos[0].push_back(px);
+				pos[1].push_back(py);
+				pos[2].push_back(pz);
+			}
+
+	count = (int)pos[0].size();
+	for (int a = 0; a < 3; a++)
+	{
+		pos[a].resize(count + PAD, 0.f);
+		vel[a].assign(count + PAD, 0.f);
+		pred[a].assign(count + PAD, 0.f);
+		force[a].resize(count);
+		pforce[a].resize(count);
+	}
+	density.assign(count + PAD, 1.f);
+	pressure.assign(count + PAD, 0.f);
+}
+
+size_t sph::bytes() const
+{
+	size_t total = 0;
+
+	for (int a = 0; a < 3; a++)
+		total += (pos[a].capacity() + vel[a].capacity() + pred[a].capacity() + force[a].capacity()
+			+ pforce[a].capacity()) * sizeof(float);
+	total += (density.capacity() + pressure.capacity() + scratch.capacity()) * sizeof(float);
+	total += (keys.capacity() + keys1.capacity() + cell_keys.capacity()) * sizeof(uint32_t);
+	total += (order.capacity() + order1.capacity() + histogram.capacity() + cell_start.capacity()
+		+ neighbours.capacity() + hash.capacity()) * sizeof(int);
+	return total;
+}
+
+//========================================================================
+// Sort and cells
+//========================================================================
+
+void sph::sort()
+{
+	int n = particle_count();
+	int chunks = (n + SORT_CHUNK - 1) / SORT_CHUNK;
+	float inv = 1.f / cell;
+
+	keys.resize(n);
+	keys1.resize(n);
+	order.resize(n);
+	order1.resize(n);
+
+	exec.for_each(chunks, [&](int k)
+	{
+		for (int i = k * SORT_CHUNK; i < std::min((k + 1) * SORT_CHUNK, n); i++)
+		{
+			int c[3];
+
+			for (int a = 0; a < 3; a++)
+				c[a] = std::min(std::max((int)(pos[a][i] * inv), 0), grid - 1);
+			keys[i] = morton(c[0], c[1], c[2]);
+			order[i] = i;
+		}
+	});
+
+	// Least significant digit first; each pass counts the digits of every
+	// chunk, then each chunk scatters its particles after those of smaller
+	// digits and of the same digit in earlier chunks, which keeps it stable
+	const int bins = 1 << SORT_BITS;
+
+	histogram.resize((size_t)chunks * bins);
+	for (int shift = 0; shift < key_bits; shift += SORT_BITS)
+	{
+		exec.for_each(chunks, [&](int k)
+		{
+			int* count = histogram.data() + (size_t)k * bins;
+
+			std::fill(count, count + bins, 0);
+			for (int i = k * SORT_CHUNK; i < std::min((k + 1) * SORT_CHUNK, n); i++)
+				count[(keys[i] >> shift) & (bins - 1)]++;
+		});
+
+		int total = 0;
+		for (int d = 0; d < bins; d++)
+			for (int k = 0; k < chunks; k++)
+			{
+				int c = histogram[(size_t)k * bins + d];
+
+				histogram[(size_t)k * bins + d] = total;
+				total += c;
+			}
+
+		exec.for_each(chunks, [&](int k)
+		{
+			int* next = histogram.data() + (size_t)k * bins;
+
+			for (int i = k * SORT_CHUNK; i < std::min((k + 1) * SORT_CHUNK, n); i++)
+			{
+				int to = next[(keys[i] >> shift) & (bins - 1)]++;
+
+				keys1[to] = keys[i];
+				order1[to] = order[i];
+			}
+		});
+		keys.swap(keys1);
+		order.swap(order1);
+	}
+
+	scratch.resize(n + PAD, 0.f);
+	for (std::vector<float>* field : { pos, pos + 1, pos + 2, vel, vel + 1, vel + 2 })
+	{
+		const float* from = field->data();
+
+		exec.for_each(chunks, [&](int k)
+		{
+			for (int i = k * SORT_CHUNK; i < std::min((k + 1) * SORT_CHUNK, n); i++)
+				scratch[i] = from[order[i]];
+		});
+		field->swap(scratch);
+	}
+
+	build_cells();
+}
+
+void sph::build_cells()
+{
+	int n = particle_count();
+	int chunks = (n + SORT_CHUNK - 1) / SORT_CHUNK;
+	std::vector<int> first(chunks + 1, 0);
+
+	// Cells start where the key changes
+	exec.for_each(chunks, [&](int k)
+	{
+		int count = 0;
+
+		for (int i = k * SORT_CHUNK; i < std::min((k + 1) * SORT_CHUNK, n); i++)
+			count += i == 0 || keys[i] != keys[i - 1];
+		first[k + 1] = count;
+	});
+	for (int k = 0; k < chunks; k++)
+		first[k + 1] += first[k];
+
+	int cells = first[chunks];
+	cell_keys.resize(cells);
+	cell_start.resize(cells + 1);
+	cell_start[cells] = n;
+	exec.for_each(chunks, [&](int k)
+	{
+		int c = first[k];
+
+		for (int i = k * SORT_CHUNK; i < std::min((k + 1) * SORT_CHUNK, n); i++)
+			if (i == 0 || keys[i] != keys[i - 1])
+			{
+				cell_keys[c] = keys[i];
+				cell_start[c++] = i;
+			}
+	});
+
+	// At most half full; one thread inserts, which is cheap next to a
+	// kernel pass
+	size_t size = 16;
+	while (size < 2 * (size_t)cells)
+		size *= 2;
+	hash.assign(size, -1);
+	hash_mask = (uint32_t)size - 1;
+	for (int c = 0; c < cells; c++)
+	{
+		uint32_t slot = hash_key(cell_keys[c]) & hash_mask;
+
+		while (hash[slot] >= 0)
+			slot = (slot + 1) & hash_mask;
+		hash[slot] = c;
+	}
+
+	neighbours.resize((size_t)27 * cells);
+	exec.for_each((cells + CELL_CHUNK - 1) / CELL_CHUNK, [&](int k)
+	{
+		for (int c = k * CELL_CHUNK; c < std::min((k + 1) * CELL_CHUNK, cells); c++)
+		{
+			int x = (int)compact_bits(cell_keys[c]);
+			int y = (int)compact_bits(cell_keys[c] >> 1);
+			int z = (int)compact_bits(cell_keys[c] >> 2);
+			int* out = neighbours.data() + (size_t)27 * c;
+
+			for (int dz = -1; dz <= 1; dz++)
+				for (int dy = -1; dy <= 1; dy++)
+					for (int dx = -1; dx <= 1; dx++)
+						*out++ = find_cell(x + dx, y + dy, z + dz);
+		}
+	});
+}
+
+int sph::find_cell(int x, int y, int z) const
+{
+	if ((unsigned)x >= (unsigned)grid || (unsigned)y >= (unsigned)grid || (unsigned)z >= (unsigned)grid)
+		return -1;
+
+	uint32_t key = morton(x, y, z);
+	uint32_t slot = hash_key(key) & hash_mask;
+
+	for (; hash[slot] >= 0; slot = (slot + 1) & hash_mask)
+		if (cell_keys[hash[slot]] == key)
+			return hash[slot];
+	return -1;
+}
+
+// Particles of the 27 cells around cell c as ranges of the sorted
+// arrays, in ascending order and merged where they touch; returns the count
+int sph::ranges(int c, int* out) const
+{
+	const int* around = neighbours.data() + (size_t)27 * c;
+	int n = 0;
+
+	for (int k = 0; k < 27; k++)
+	{
+		if (around[k] < 0)
+			continue;
+
+		int s = cell_start[around[k]], e = cell_start[around[k] + 1], i = n;
+
+		for (; i > 0 && out[2 * i - 2] > s; i--)
+		{
+			out[2 * i] = out[2 * i - 2];
+			out[2 * i + 1] = out[2 * i - 1];
+		}
+		out[2 * i] = s;
+		out[2 * i + 1] = e;
+		n++;
+	}
+
+	int m = 0;
+	for (int k = 1; k < n; k++)
+	{
+		if (out[2 * k] == out[2 * m + 1])
+			out[2 * m + 1] = out[2 * k + 1];
+		else
+		{
+			m++;
+			out[2 * m] = out[2 * k];
+			out[2 * m + 1] = out[2 * k + 1];
+		}
+	}
+	return n > 0 ? m + 1 : 0;
+}
+
+//========================================================================
+// Kernel passes
+//========================================================================
+
+float sph::wall(const std::vector<float>& table, float d) const
+{
+	if (d >= h)
+		return 0.f;
+
+	float t = std::max(d, 0.f) / h * (float)(WALL_TABLE - 1);
+	int i = std::min((int)t, WALL_TABLE - 2);
+
+	t -= (float)i;
+	return table[i] + (table[i + 1] - table[i]) * t;
+}
+
+/* Density the walls lack along each axis, as a fraction of the rest
+ * density.  Near an edge or a corner the fractions are combined as if the
+ * kernel were separable, so the liquid behind two walls is not counted
+ * twice: the walls add 1 - (1 - f0) (1 - f1) (1 - f2) of the rest density.
+ */
+void sph::walls(const float* x, float* f) const
+{
+	for (int a = 0; a < 3; a++)
+		f[a] = (wall(wall_density, x[a]) + wall(wall_density, 1.f - x[a])) / opt.rest_density;
+}
+
+void sph::compute_density(const float* const* p, float* out)
+{
+	int cells = (int)cell_keys.size();
+	float scale = mass * 16.f / (pi * h * h * h);
+	float inv_h = 1.f / h, eps = 1e-12f * h * h;
+
+	exec.for_each((cells + CELL_CHUNK - 1) / CELL_CHUNK, [&](int k)
+	{
+		int r[54];
+
+		for (int c = k * CELL_CHUNK; c < std::min((k + 1) * CELL_CHUNK, cells); c++)
+		{
+			int n = ranges(c, r);
+
+			for (int i = cell_start[c]; i < cell_start[c + 1]; i++)
+			{
+				float x[3] = { p[0][i], p[1][i], p[2][i] };
+				float f[3];
+
+				walls(x, f);
+				out[i] = scale * density_sum(x, inv_h, eps, r, n, p) + opt.rest_density * (1.f - (1.f - f[0]) * (1.f - f[1]) * (1.f - f[2]));
+			}
+		}
+	});
+}
+
+// Gravity and viscosity (Monaghan 1992, as written by Becker and Teschner)
+void sph::compute_forces()
+{
+	int cells = (int)cell_keys.size();
+	float scale = 10.f * opt.viscosity * mass * 48.f / (pi * h * h * h * h);
+	float inv_h = 1.f / h, eps = 0.01f * h * h;
+	const float* src[7] = { pos[0].data(), pos[1].data(), pos[2].data(), vel[0].data(), vel[1].data(), vel[2].data(), density.data() };
+
+	exec.for_each((cells + CELL_CHUNK - 1) / CELL_CHUNK, [&](int k)
+	{
+		int r[54];
+
+		for (int c = k * CELL_CHUNK; c < std::min((k + 1) * CELL_CHUNK, cells); c++)
+		{
+			int n = ranges(c, r);
+
+			for (int i = cell_start[c]; i < cell_start[c + 1]; i++)
+			{
+				float x[3] = { pos[0][i], pos[1][i], pos[2][i] };
+				float v[3] = { vel[0][i], vel[1][i], vel[2][i] };
+				float a[3];
+
+				viscosity_sum(x, v, inv_h, eps, r, n, src, a);
+				force[0][i] = scale * a[0];
+				force[1][i] = scale * a[1] + opt.gravity;
+				force[2][i] = scale * a[2];
+			}
+		}
+	});
+}
+
+// Symmetric pressure force on the predicted positions, the rest density
+// standing in for the particles' own
+void sph::compute_pressure_forces()
+{
+	int cells = (int)cell_keys.size();
+	float inv_rho2 = 1.f / (opt.rest_density * opt.rest_density);
+	float scale = -mass * inv_rho2 * 45.f / (pi * h * h * h * h);
+	float inv_h = 1.f / h, eps = 1e-12f * h * h;
+	float lift = -opt.gravity / opt.rest_density;
+	const float* src[4] = { pred[0].data(), pred[1].data(), pred[2].data(), pressure.data() };
+
+	exec.for_each((cells + CELL_CHUNK - 1) / CELL_CHUNK, [&](int k)
+	{
+		int r[54];
+
+		for (int c = k * CELL_CHUNK; c < std::min((k + 1) * CELL_CHUNK, cells); c++)
+		{
+			int n = ranges(c, r);
+
+			for (int i = cell_start[c]; i < cell_start[c + 1]; i++)
+			{
+				float x[3] = { pred[0][i], pred[1][i], pred[2][i] };
+				float w = 2.f * pressure[i] * inv_rho2;
+				float a[3], f[3];
+
+				pressure_sum(x, pressure[i], inv_h, eps, r, n, src, a);
+				walls(x, f);
+				for (int d = 0; d < 3; d++)
+				{
+					float push = w * (wall(wall_gradient, x[d]) - wall(wall_gradient, 1.f - x[d]));
+
+					// The liquid below the floor is deeper, so it pushes
+					// back harder by the weight of the layers between
+					if (d == 1)
+						push += lift * wall(wall_depth, x[1]);
+					pforce[d][i] = scale * a[d] + push * (1.f - f[(d + 1) % 3]) * (1.f - f[(d + 2) % 3]);
+				}
+			}
+		}
+	});
+}
+
+//========================================================================
+// Stepping
+//========================================================================
+
+float sph::max_speed()
+{
+	int n = particle_count();
+	int chunks = (n + PARTICLE_CHUNK - 1) / PARTICLE_CHUNK;
+	std::vector<float> top(chunks, 0.f);
+
+	exec.for_each(chunks, [&](int k)
+	{
+		float m = 0.f;
+
+		for (int i = k * PARTICLE_CHUNK; i < std::min((k + 1) * PARTICLE_CHUNK, n); i++)
+			m = std::max(m, vel[0][i] * vel[0][i] + vel[1][i] * vel[1][i] + vel[2][i] * vel[2][i]);
+		top[k] = m;
+	});
+
+	float m = 0.f;
+	for (float t : top)
+		m = std::max(m, t);
+	return std::sqrt(m) + std::sqrt(h * std::fabs(opt.gravity));
+}
+
+void sph::substep(float dt, sph_timing* timing, sph_stats* stats)
+{
+	int n = particle_count();
+	int chunks = (n + PARTICLE_CHUNK - 1) / PARTICLE_CHUNK;
+	sph_timing t;
+
+	auto t0 = std::chrono::steady_clock::now();
+	sort();
+	t.sort = seconds_since(t0);
+
+	t0 = std::chrono::steady_clock::now();
+	const float* p[3] = { pos[0].data(), pos[1].data(), pos[2].data() };
+	compute_density(p, density.data());
+	compute_forces();
+	t.density = seconds_since(t0);
+
+	/* Each correction predicts the positions under the pressure so far,
+	 * raises the pressure of compressed particles by delta times their
+	 * compression and recomputes the pressure force.  delta is that of a
+	 * particle with a full neighbourhood (Solenthaler and Pajarola), under
+	 * relaxed: in full it overshoots where neighbours push back at once,
+	 * and the corrections then grow rather than settle.
+	 */
+	t0 = std::chrono::steady_clock::now();
+	float k = dt * mass / opt.rest_density;
+	float delta = RELAXATION / (2.f * k * k * sum_grad2);
+	const float* q[3] = { pred[0].data(), pred[1].data(), pred[2].data() };
+	double error = 0.0;
+	int iterations = 0;
+
+	std::fill(pressure.begin(), pressure.end(), 0.f);
+	for (int a = 0; a < 3; a++)
+		std::fill(pforce[a].begin(), pforce[a].end(), 0.f);
+	for (;;)
+	{
+		exec.for_each(chunks, [&](int c)
+		{
+			for (int i = c * PARTICLE_CHUNK; i < std::min((c + 1) * PARTICLE_CHUNK, n); i++)
+				for (int a = 0; a < 3; a++)
+				{
+					float v = vel[a][i] + dt * (force[a][i] + pforce[a][i]);
+
+					pred[a][i] = reflect(pos[a][i] + dt * v);
+				}
+		});
+		compute_density(q, density.data());
+
+		error = exec.sum(chunks, [&](int c)
+		{
+			double sum = 0.0;
+
+			for (int i = c * PARTICLE_CHUNK; i < std::min((c + 1) * PARTICLE_CHUNK, n); i++)
+			{
+				float e = density[i] - opt.rest_density;
+
+				pressure[i] = std::max(pressure[i] + delta * e, 0.f);
+				sum += std::max(e, 0.f);
+			}
+			return sum;
+		}) / ((double)n * opt.rest_density);
+
+		compute_pressure_forces();
+		iterations++;
+		if ((iterations >= opt.min_iterations && error < opt.density_error) || iterations >= opt.max_iterations)
+			break;
+	}
+	t.pressure = seconds_since(t0);
+
+	// Symplectic Euler, mirrored at the walls
+	t0 = std::chrono::steady_clock::now();
+	exec.for_each(chunks, [&](int c)
+	{
+		for (int i = c * PARTICLE_CHUNK; i < std::min((c + 1) * PARTICLE_CHUNK, n); i++)
+			for (int a = 0; a < 3; a++)
+			{
+				float v = vel[a][i] + dt * (force[a][i] + pforce[a][i]);
+				float x = pos[a][i] + dt * v;
+
+				if (x < 0.f)
+					v = std::max(v, 0.f);
+				else if (x > 1.f)
+					v = std::min(v, 0.f);
+				vel[a][i] = v;
+				pos[a][i] = reflect(x);
+			}
+	});
+	t.integrate = seconds_since(t0);
+
+	if (timing)
+	{
+		timing->sort += t.sort;
+		timing->density += t.density;
+		timing->pressure += t.pressure;
+		timing->integrate += t.integrate;
+	}
+	if (stats)
+	{
+		stats->substeps++;
+		stats->iterations += iterations;
+		stats->density_error = std::max(stats->density_error, error);
+		stats->cells += (int64_t)cell_keys.size();
+	}
+}
+
+void sph::step_frame(sph_timing* timing, sph_stats* stats)
+{
+	float t = 0.f;
+	float limit = std::min(FALL_STEP * std::sqrt(h / std::fabs(opt.gravity)), 0.125f * h * h / opt.viscosity);
+	bool last = false;
+
+	// The last substep ends the frame by flag rather than by comparing
+	// times, as rounding could leave a step too short for delta
+	while (!last)
+	{
+		float dt = std::min(opt.cfl * h / max_speed(), limit);
+
+		// Split what is left evenly rather than leave a sliver
+		if (t + dt >= opt.frame_dt)
+		{
+			dt = opt.frame_dt - t;
+			last = true;
+		}
+		else if (t + 2.f * dt > opt.frame_dt)
+			dt = 0.5f * (opt.frame_dt - t);
+		substep(dt, timing, stats);
+		t += dt;
+	}
+}
+
+//========================================================================
+// Surface
+//========================================================================
+
+void sph::surface(mesh& out)
+{
+	sort();
+
+	int n = (int)std::ceil(1.f / dx);
+	float hf = 1.f / (float)n;
+	float radius = h, r = SURFACE_RADIUS * dx;
+	brick_grid<float> f(n, n, n, radius);
+	std::vector<int> bricks;
+
+	// Bricks within reach of a non-empty cell
+	for (uint32_t key : cell_keys)
+	{
+		int c[3] = { (int)compact_bits(key), (int)compact_bits(key >> 1), (int)compact_bits(key >> 2) };
+		int lo[3], hi[3];
+
+		for (int a = 0; a < 3; a++)
+		{
+			lo[a] = std::max((int)std::floor(((float)c[a] * cell - radius) / hf), 0) >> BRICK_LOG2;
+			hi[a] = std::min((int)std::floor(((float)(c[a] + 1) * cell + radius) / hf), n - 1) >> BRICK_LOG2;
+		}
+		for (int z = lo[2]; z <= hi[2]; z++)
+			for (int y = lo[1]; y <= hi[1]; y++)
+				for (int x = lo[0]; x <= hi[0]; x++)
+					f.allocate((z * f.by + y) * f.bx + x);
+	}
+	for (int b = 0; b < f.brick_count(); b++)
+		if (f.allocated(b))
+			bricks.push_back(b);
+
+	// phi = |x - mean of nearby particles| - r, the weights being
+	// (1 - d^2 / radius^2)^3
+	float inv_r2 = 1.f / (radius * radius);
+	exec.for_each((int)bricks.size(), [&](int k)
+	{
+		int b = bricks[k], x0, y0, z0;
+		float* v = f.brick(b);
+
+		f.brick_origin(b, x0, y0, z0);
+		for (int z = z0; z < std::min(z0 + BRICK_SIZE, n); z++)
+			for (int y = y0; y < std::min(y0 + BRICK_SIZE, n); y++)
+				for (int x = x0; x < std::min(x0 + BRICK_SIZE, n); x++)
+				{
+					float p[3] = { ((float)x + 0.5f) * hf, ((float)y + 0.5f) * hf, ((float)z + 0.5f) * hf };
+					int c[3];
+					double sum = 0.0, mean[3] = { 0.0, 0.0, 0.0 };
+
+					for (int a = 0; a < 3; a++)
+						c[a] = std::min((int)(p[a] / cell), grid - 1);
+					for (int dz = -1; dz <= 1; dz++)
+						for (int dy = -1; dy <= 1; dy++)
+							for (int dx = -1; dx <= 1; dx++)
+							{
+								int nc = find_cell(c[0] + dx, c[1] + dy, c[2] + dz);
+
+								if (nc < 0)
+									continue;
+								for (int j = cell_start[nc]; j < cell_start[nc + 1]; j++)
+								{
+									float ex = pos[0][j] - p[0], ey = pos[1][j] - p[1], ez = pos[2][j] - p[2];
+									float s = 1.f - (ex * ex + ey * ey + ez * ez) * inv_r2;
+
+									if (s <= 0.f)
+										continue;
+									s = s * s * s;
+									sum += s;
+									mean[0] += s * pos[0][j];
+									mean[1] += s * pos[1][j];
+									mean[2] += s * pos[2][j];
+								}
+							}
+
+					float d = radius;
+					if (sum > 0.0)
+					{
+						float ex = (float)(mean[0] / sum) - p[0], ey = (float)(mean[1] / sum) - p[1], ez = (float)(mean[2] / sum) - p[2];
+
+						d = std::min(std::sqrt(ex * ex + ey * ey + ez * ez) - r, radius);
+					}
+					v[f.cell_index(x, y, z)] = d;
+				}
+	});
+
+	mc.extract(f, 0.f, hf, out);
+}
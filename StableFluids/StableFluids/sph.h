@@ -0,0 +1,151 @@
+/*****************************************************************************
+ * SPH particle fluid
+ *
+ * Predictive-corrective incompressible SPH (Solenthaler and Pajarola 2009)
+ * in the unit cube, with the cubic spline kernel for density and viscosity
+ * and the spiky kernel's slope for pressure:
+ *
+ *   sort -> density, gravity and viscosity
+ *        -> predict, correct pressure until the compression is small
+ *        -> integrate
+ *
+ * Positions and velocities are kept as one array per component, sorted
+ * every substep by the Morton code of the particle's cell, so the
+ * particles of a cell and of the cells around it sit close in memory.
+ * Cells are as wide as the kernel support.  The sort is a radix sort whose
+ * passes are parallel counting sorts over chunks of particles; the
+ * non-empty cells are then found through an open addressing hash rather
+ * than a table over the whole box, so memory follows the particles.
+ *
+ * The kernel passes run per chunk of cells on a tile_executor.  The 27
+ * cells around a cell make a few runs of the sorted arrays, as cells next
+ * in Morton order are next in memory, and each particle of the cell runs
+ * over them four at a time with SSE.  The walls act through tables of the
+ * kernel summed over the space behind them, as if filled with liquid at
+ * rest, hydrostatic pressure included below the floor.
+ *****************************************************************************/
+
+#ifndef SPHH
+#define SPHH
+
+#include <cstdint>
+#include <vector>
+
+#include "marching_cubes.h"
+#include "mesh.h"
+#include "tile_executor.h"
+
+struct sph_options
+{
+	int particles = 1 << 20;			// about, in the initial dam break
+	float rest_density = 1000.f;
+	float viscosity = 1e-3f;			// kinematic, box sizes^2 per second
+	float gravity = -9.81f;				// along y, box sizes per second^2
+	float frame_dt = 1.f / 30.f;
+	float cfl = 0.25f;					// support a particle may travel in one substep
+	float density_error = 0.01f;		// mean compression to stop at, relative
+	int min_iterations = 3;				// pressure corrections per substep
+	int max_iterations = 50;
+};
+
+// Seconds spent in each stage, accumulated over substeps
+struct sph_timing
+{
+	double sort = 0.0;
+	double density = 0.0;		// density, gravity and viscosity
+	double pressure = 0.0;
+	double integrate = 0.0;
+};
+
+struct sph_stats
+{
+	int substeps = 0;
+	int iterations = 0;				// pressure corrections, summed over substeps
+	double density_error = 0.0;		// worst mean compression after correction
+	int64_t cells = 0;				// non-empty cells, summed over substeps
+};
+
+class sph
+{
+public:
+	sph(const sph_options& opt, tile_executor& exec);
+
+	// Dam break: a column of liquid against the x = 0 wall over a shallow
+	// pool, on a lattice of spacing()
+	void reset();
+
+	// Advance one frame in CFL limited substeps
+	void step_frame(sph_timing* timing = nullptr, sph_stats* stats = nullptr);
+
+	// Surface around the particles as a mesh in box units, from the
+	// distance to the weighted mean of nearby particles (Zhu and Bridson
+	// 2005) on a grid of spacing() cells
+	void surface(mesh& out);
+
+	int particle_count() const { return count; }
+	float spacing() const { return dx; }
+	float support() const { return h; }
+
+	// Component axis of the positions or velocities, in sorted order
+	const float* position(int axis) const { return pos[axis].data(); }
+	const float* velocity(int axis) const { return vel[axis].data(); }
+
+	// Bytes held by the particle arrays, the sort and the cells
+	size_t bytes() const;
+
+	sph_options opt;
+
+private:
+	void substep(float dt, sph_timing* timing, sph_stats* stats);
+	float max_speed();
+	void sort();
+	void build_cells();
+	int find_cell(int x, int y, int z) const;
+	int ranges(int c, int* out) const;
+	void compute_density(const float* const* p, float* out);
+	void compute_forces();
+	void compute_pressure_forces();
+	float wall(const std::vector<float>& table, float d) const;
+	void walls(const float* x, float* f) const;
+
+	tile_executor& exec;
+	float dx;					// initial spacing
+	float h;					// kernel support
+	float mass;
+	float cell;					// cell width, at least h
+	int grid;					// cells along a side
+	int key_bits;				// of the Morton codes
+	int count;					// particles
+
+	// PAD particles longer than count, for the SSE loops
+	std::vector<float> pos[3], vel[3];
+	std::vector<float> pred[3];			// predicted positions
+	std::vector<float> force[3];		// gravity and viscosity, per unit mass
+	std::vector<float> pforce[3];		// pressure, per unit mass
+	std::vector<float> density, pressure;
+
+	// Sort: keys and source indices, one histogram row per chunk
+	std::vector<uint32_t> keys, keys1;
+	std::vector<int> order, order1;
+	std::vector<int> histogram;
+	std::vector<float> scratch;
+
+	// Non-empty cells in Morton order, their particles being
+	// [cell_start[c], cell_start[c + 1]), and the 27 cells around each,
+	// -1 where empty
+	std::vector<uint32_t> cell_keys;
+	std::vector<int> cell_start;
+	std::vector<int> neighbours;
+	std::vector<int> hash;				// cell of each slot, -1 if free
+	uint32_t hash_mask;
+
+	// Density and pressure gradient of the liquid behind a wall, against
+	// the distance to it over [0, h]
+	std::vector<float> wall_density, wall_gradient;
+	std::vector<float> wall_depth;		// the gradient weighted by the depth
+	float sum_grad2;					// sum of |grad W|^2 over a full lattice
+
+	marching_cubes mc;
+};
+
+#endif
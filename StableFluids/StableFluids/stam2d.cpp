@@ -0,0 +1,763 @@
+/*****************************************************************************
+ * 2-D stable fluids (Jos Stam) on the CPU
+ *****************************************************************************/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define STAM2D_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "stam2d.h"
+
+static double seconds_since(std::chrono::steady_clock::time_point t0)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// step(1.0, mod(floor((x + 1.0) / 0.2) + floor((y + 1.0) / 0.2), 2.0))
+static float checkerboard(float x, float y)
+{
+	float s = std::floor((x + 1.f) / 0.2f) + std::floor((y + 1.f) / 0.2f);
+
+	return s - 2.f * std::floor(s / 2.f) >= 1.f ? 1.f : 0.f;
+}
+
+//========================================================================
+// Traces
+//========================================================================
+
+// A rectangle of texels of the periodic grid, stored row major with the
+// channels interleaved.  Texel (x, y) of the grid is texel
+// ((x - x0) mod W, (y - y0) mod H) of the window.
+struct window
+{
+	int x0, y0, w, h;
+};
+
+// The tile [x0, x1) x [y0, y1) grown by hx and hy, or the whole axis where
+// it would wrap onto itself
+static window grow(int x0, int y0, int x1, int y1, int hx, int hy, int W, int H)
+{
+	window r;
+
+	if (x1 - x0 + 2 * hx >= W)
+		r.x0 = 0, r.w = W;
+	else
+		r.x0 = x0 - hx, r.w = x1 - x0 + 2 * hx;
+	if (y1 - y0 + 2 * hy >= H)
+		r.y0 = 0, r.h = H;
+	else
+		r.y0 = y0 - hy, r.h = y1 - y0 + 2 * hy;
+	return r;
+}
+
+static inline int wrap_index(int i, int n)
+{
+	return i < 0 ? i + n : (i >= n ? i - n : i);
+}
+
+// Texel (x, y) of the grid, traced back by step times its velocity to
+// texture coordinates wrapped with fract, as the advect shader does, then
+// sampled from src as field::sample does.  lo and hi, if given, get the
+// range of the four texels read.
+static inline void trace(const float* src, const window& win, int c, const field& vel, float step,
+	int x, int y, float* out, float* lo, float* hi)
+{
+	int W = vel.w, H = vel.h;
+	const float* vu = vel.at(x, y);
+	float pu = ((float)x + 0.5f) / (float)W - step * vu[0];
+	float pv = ((float)y + 0.5f) / (float)H - step * vu[1];
+	float sx = (pu - std::floor(pu)) * (float)W - 0.5f;
+	float sy = (pv - std::floor(pv)) * (float)H - 0.5f;
+	float fx0 = std::floor(sx), fy0 = std::floor(sy);
+	float fx = sx - fx0, fy = sy - fy0;
+	int x0 = std::min(std::max((int)fx0, 0), W - 1), x1 = std::min(std::max((int)fx0 + 1, 0), W - 1);
+	int y0 = std::min(std::max((int)fy0, 0), H - 1), y1 = std::min(std::max((int)fy0 + 1, 0), H - 1);
+
+	x0 = wrap_index(x0 - win.x0, W);
+	x1 = wrap_index(x1 - win.x0, W);
+	y0 = wrap_index(y0 - win.y0, H);
+	y1 = wrap_index(y1 - win.y0, H);
+
+	const float* a = src + ((size_t)y0 * win.w + x0) * c;
+	const float* b = src + ((size_t)y0 * win.w + x1) * c;
+	const float* d = src + ((size_t)y1 * win.w + x0) * c;
+	const float* e = src + ((size_t)y1 * win.w + x1) * c;
+
+	for (int k = 0; k < c; k++)
+	{
+		out[k] = (a[k] * (1.f - fx) + b[k] * fx) * (1.f - fy) + (d[k] * (1.f - fx) + e[k] * fx) * fy;
+		if (lo)
+		{
+			lo[k] = std::min(std::min(a[k], b[k]), std::min(d[k], e[k]));
+			hi[k] = std::max(std::max(a[k], b[k]), std::max(d[k], e[k]));
+		}
+	}
+}
+
+#ifdef STAM2D_SSE2
+
+// floor() of floats within the range of int
+static inline __m128 floor4(__m128 x)
+{
+	__m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+
+	return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, x), _mm_set1_ps(1.f)));
+}
+
+// min(max(i, 0), n - 1)
+static inline __m128i clamp4(__m128i i, int n)
+{
+	__m128i last = _mm_set1_epi32(n - 1);
+	__m128i over = _mm_cmpgt_epi32(i, last);
+
+	i = _mm_andnot_si128(_mm_cmplt_epi32(i, _mm_setzero_si128()), i);
+	return _mm_or_si128(_mm_andnot_si128(over, i), _mm_and_si128(over, last));
+}
+
+// (i - origin) mod n for i - origin within (-n, 2n)
+static inline __m128i wrap4(__m128i i, int origin, int n)
+{
+	__m128i nn = _mm_set1_epi32(n);
+
+	i = _mm_sub_epi32(i, _mm_set1_epi32(origin));
+	i = _mm_add_epi32(i, _mm_and_si128(_mm_cmplt_epi32(i, _mm_setzero_si128()), nn));
+	return _mm_sub_epi32(i, _mm_and_si128(_mm_cmpgt_epi32(i, _mm_set1_epi32(n - 1)), nn));
+}
+
+#endif
+
+// trace() for the count texels of row y from xa on, both wrapped into the
+// grid; out, lo and hi take c floats per texel.  With SSE the coordinates,
+// weights and blends of four texels go in lanes, only the loads per lane.
+static void trace_row(const float* src, const window& win, int c, const field& vel, float step,
+	int y, int xa, int count, float* out, float* lo, float* hi)
+{
+	int W = vel.w, H = vel.h;
+	int i = 0;
+
+	y = wrap_index(y, H);
+#ifdef STAM2D_SSE2
+	const __m128 one = _mm_set1_ps(1.f), half = _mm_set1_ps(0.5f), s = _mm_set1_ps(step);
+	const __m128 wf = _mm_set1_ps((float)W), hf = _mm_set1_ps((float)H);
+	alignas(16) int ix0[4], ix1[4], iy0[4], iy1[4], gx[4];
+	alignas(16) float r[4], l[4], h[4];
+
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i x = wrap4(_mm_add_epi32(_mm_set1_epi32(xa + i), _mm_setr_epi32(0, 1, 2, 3)), 0, W);
+
+		_mm_store_si128((__m128i*)gx, x);
+
+		const float* v0 = vel.at(gx[0], y);
+		const float* v1 = vel.at(gx[1], y);
+		const float* v2 = vel.at(gx[2], y);
+		const float* v3 = vel.at(gx[3], y);
+		__m128 pu = _mm_sub_ps(_mm_div_ps(_mm_add_ps(_mm_cvtepi32_ps(x), half), wf),
+			_mm_mul_ps(s, _mm_setr_ps(v0[0], v1[0], v2[0], v3[0])));
+		__m128 pv = _mm_sub_ps(_mm_div_ps(_mm_set1_ps((float)y + 0.5f), hf),
+			_mm_mul_ps(s, _mm_setr_ps(v0[1], v1[1], v2[1], v3[1])));
+		__m128 sx = _mm_sub_ps(_mm_mul_ps(_mm_sub_ps(pu, floor4(pu)), wf), half);
+		__m128 sy = _mm_sub_ps(_mm_mul_ps(_mm_sub_ps(pv, floor4(pv)), hf), half);
+		__m128 fx0 = floor4(sx), fy0 = floor4(sy);
+		__m128 fx = _mm_sub_ps(sx, fx0), fy = _mm_sub_ps(sy, fy0);
+		__m128 gx1 = _mm_sub_ps(one, fx), gy1 = _mm_sub_ps(one, fy);
+		__m128i tx = _mm_cvttps_epi32(fx0), ty = _mm_cvttps_epi32(fy0);
+		__m128i onei = _mm_set1_epi32(1);
+
+		_mm_store_si128((__m128i*)ix0, wrap4(clamp4(tx, W), win.x0, W));
+		_mm_store_si128((__m128i*)ix1, wrap4(clamp4(_mm_add_epi32(tx, onei), W), win.x0, W));
+		_mm_store_si128((__m128i*)iy0, wrap4(clamp4(ty, H), win.y0, H));
+		_mm_store_si128((__m128i*)iy1, wrap4(clamp4(_mm_add_epi32(ty, onei), H), win.y0, H));
+
+		size_t oa[4], ob[4], od[4], oe[4];
+
+		for (int j = 0; j < 4; j++)
+		{
+			oa[j] = ((size_t)iy0[j] * win.w + ix0[j]) * c;
+			ob[j] = ((size_t)iy0[j] * win.w + ix1[j]) * c;
+			od[j] = ((size_t)iy1[j] * win.w + ix0[j]) * c;
+			oe[j] = ((size_t)iy1[j] * win.w + ix1[j]) * c;
+		}
+
+		for (int k = 0; k < c; k++)
+		{
+			__m128 a = _mm_setr_ps(src[oa[0] + k], src[oa[1] + k], src[oa[2] + k], src[oa[3] + k]);
+			__m128 b = _mm_setr_ps(src[ob[0] + k], src[ob[1] + k], src[ob[2] + k], src[ob[3] + k]);
+			__m128 d = _mm_setr_ps(src[od[0] + k], src[od[1] + k], src[od[2] + k], src[od[3] + k]);
+			__m128 e = _mm_setr_ps(src[oe[0] + k], src[oe[1] + k], src[oe[2] + k], src[oe[3] + k]);
+			__m128 top = _mm_add_ps(_mm_mul_ps(a, gx1), _mm_mul_ps(b, fx));
+			__m128 bottom = _mm_add_ps(_mm_mul_ps(d, gx1), _mm_mul_ps(e, fx));
+
+			_mm_store_ps(r, _mm_add_ps(_mm_mul_ps(top, gy1), _mm_mul_ps(bottom, fy)));
+			for (int j = 0; j < 4; j++)
+				out[(i + j) * c + k] = r[j];
+			if (lo)
+			{
+				_mm_store_ps(l, _mm_min_ps(_mm_min_ps(a, b), _mm_min_ps(d, e)));
+				_mm_store_ps(h, _mm_max_ps(_mm_max_ps(a, b), _mm_max_ps(d, e)));
+				for (int j = 0; j < 4; j++)
+				{
+					lo[(i + j) * c + k] = l[j];
+					hi[(i + j) * c + k] = h[j];
+				}
+			}
+		}
+	}
+#endif
+	for (; i < count; i++)
+		trace(src, win, c, vel, step, wrap_index(xa + i, W), y, out + i * c,
+			lo ? lo + i * c : nullptr, hi ? hi + i * c : nullptr);
+}
+
+//========================================================================
+// Setup
+//========================================================================
+
+stam2d::stam2d(const stam2d_options& opt, tile_executor& exec)
+	: opt(opt), exec(exec), epsilon(1.f / (float)opt.size),
+	velocity0(opt.size, opt.size, 2), velocity1(opt.size, opt.size, 2),
+	color0(opt.size, opt.size, 3), color1(opt.size, opt.size, 3),
+	divergence(opt.size, opt.size, 1),
+	pressure0(opt.size, opt.size, 1), pressure1(opt.size, opt.size, 1)
+{
+	int m = opt.size & 1 ? opt.size : opt.size / 2;
+
+	if (opt.pressure_solver != STAM2D_JACOBI)
+	{
+		if (opt.pressure_solver == STAM2D_MULTIGRID)
+			mg.reset(new multigrid(m, exec));
+		else
+			cg.reset(new pcg(m, exec));
+		sub_b.resize((size_t)m * m);
+		sub_x.resize((size_t)m * m);
+	}
+	reset();
+}
+
+//========================================================================
+// Initial state (initVFn, initCFn)
+//========================================================================
+
+void stam2d::reset()
+{
+	int n = opt.size;
+
+	exec.run(n, n, [&](int x0, int y0, int x1, int y1)
+	{
+		int x, y;
+
+		for (y = y0; y < y1; y++)
+			for (x = x0; x < x1; x++)
+			{
+				float fx = 2.f * ((float)x + 0.5f) / (float)n - 1.f;
+				float fy = 2.f * ((float)y + 0.5f) / (float)n - 1.f;
+				float* v = velocity0.at(x, y);
+				float* c = color0.at(x, y);
+
+				v[0] = std::sin(2.f * 3.1415f * fy);
+				v[1] = std::sin(2.f * 3.1415f * fx);
+				c[0] = c[1] = c[2] = checkerboard(fx, fy);
+			}
+	});
+	pressure0.clear();
+}
+
+//========================================================================
+// Passes
+//========================================================================
+
+void stam2d::advect(const field& in, const field& vel, field& out)
+{
+	float s = 0.5f * opt.dt;
+	window whole = { 0, 0, in.w, in.h };
+
+	if (opt.advection != STAM2D_SEMI_LAGRANGIAN)
+	{
+		advect_corrected(in, vel, out);
+		return;
+	}
+
+	exec.run(in.w, in.h, [&](int x0, int y0, int x1, int y1)
+	{
+		for (int y = y0; y < y1; y++)
+			trace_row(in.data.data(), whole, in.c, vel, s, y, x0, x1 - x0, out.at(x0, y), nullptr, nullptr);
+	});
+}
+
+// MacCormack and BFECC.  Each tile traces forward over itself grown by
+// the furthest a trace reaches, twice that for BFECC, then back and
+// forward again from that, so the intermediate fields never leave the job.
+void stam2d::advect_corrected(const field& in, const field& vel, field& out)
+{
+	float s = 0.5f * opt.dt;
+	int W = in.w, H = in.h, c = in.c;
+	bool bfecc = opt.advection == STAM2D_BFECC;
+	bool limiter = opt.limiter;
+	window whole = { 0, 0, W, H };
+	std::vector<float> fastest((size_t)2 * H);
+
+	exec.for_each(H, [&](int y)
+	{
+		float mx = 0.f, my = 0.f;
+
+		for (int x = 0; x < W; x++)
+		{
+			mx = std::max(mx, std::fabs(vel.at(x, y)[0]));
+			my = std::max(my, std::fabs(vel.at(x, y)[1]));
+		}
+		fastest[2 * y] = mx;
+		fastest[2 * y + 1] = my;
+	});
+
+	// Texels a trace can cross, and one for the bilinear footprint
+	float mx = 0.f, my = 0.f;
+
+	for (int y = 0; y < H; y++)
+	{
+		mx = std::max(mx, fastest[2 * y]);
+		my = std::max(my, fastest[2 * y + 1]);
+	}
+
+	int hx = (int)std::ceil(s * mx * (float)W) + 1;
+	int hy = (int)std::ceil(s * my * (float)H) + 1;
+
+	exec.run(W, H, [&](int x0, int y0, int x1, int y1)
+	{
+		int tw = x1 - x0;
+		window wf = grow(x0, y0, x1, y1, bfecc ? 2 * hx : hx, bfecc ? 2 * hy : hy, W, H);
+		std::vector<float> forward((size_t)wf.w * wf.h * c);
+		std::vector<float> value((size_t)tw * c), lo((size_t)tw * c), hi((size_t)tw * c), back;
+
+		for (int j = 0; j < wf.h; j++)
+			trace_row(in.data.data(), whole, c, vel, s, wf.y0 + j, wf.x0, wf.w,
+				&forward[(size_t)j * wf.w * c], nullptr, nullptr);
+
+		if (!bfecc)
+		{
+			// phi^ + (phi - phi^ traced back) / 2, phi^ being the forward trace
+			back.resize((size_t)tw * c);
+			for (int y = y0; y < y1; y++)
+			{
+				const float* phi = in.at(x0, y);
+				float* o = out.at(x0, y);
+
+				trace_row(in.data.data(), whole, c, vel, s, y, x0, tw, value.data(), lo.data(), hi.data());
+				trace_row(forward.data(), wf, c, vel, -s, y, x0, tw, back.data(), nullptr, nullptr);
+				for (int i = 0; i < tw * c; i++)
+				{
+					float r = value[i] + 0.5f * (phi[i] - back[i]);
+
+					o[i] = limiter ? std::min(std::max(r, lo[i]), hi[i]) : r;
+				}
+			}
+			return;
+		}
+
+		// phi + (phi - phi^ traced back) / 2 over the tile grown by one
+		// reach, then traced forward
+		window wc = grow(x0, y0, x1, y1, hx, hy, W, H);
+		std::vector<float> corrected((size_t)wc.w * wc.h * c);
+
+		back.resize((size_t)wc.w * c);
+		for (int j = 0; j < wc.h; j++)
+		{
+			int y = wrap_index(wc.y0 + j, H);
+			float* o = &corrected[(size_t)j * wc.w * c];
+
+			trace_row(forward.data(), wf, c, vel, -s, y, wc.x0, wc.w, back.data(), nullptr, nullptr);
+			for (int i = 0; i < wc.w; i++)
+			{
+				const float* phi = in.at(wrap_index(wc.x0 + i, W), y);
+
+				for (int k = 0; k < c; k++)
+					o[i * c + k] = phi[k] + 0.5f * (phi[k] - back[i * c + k]);
+			}
+		}
+
+		for (int y = y0; y < y1; y++)
+		{
+			float* o = out.at(x0, y);
+
+			trace_row(corrected.data(), wc, c, vel, s, y, x0, tw, o, nullptr, nullptr);
+			if (!limiter)
+				continue;
+			trace_row(in.data.data(), whole, c, vel, s, y, x0, tw, value.data(), lo.data(), hi.data());
+			for (int i = 0; i < tw * c; i++)
+				o[i] = std::min(std::max(o[i], lo[i]), hi[i]);
+		}
+	});
+}
+
+void stam2d::add_splat(field& f, const float* change, float cx, float cy, float radius)
+{
+	float peak = 0.f, reach;
+	int k, bx0, by0, bx1, by1;
+
+	// Only touch the texels where the splat still changes a float near 1;
+	// further out the shader adds less than 1e-9
+	for (k = 0; k < f.c; k++)
+		peak = std::fabs(change[k]) > peak ? std::fabs(change[k]) : peak;
+	if (peak <= 1e-9f)
+		return;
+	reach = std::sqrt(radius * std::log(peak / 1e-9f));
+
+	bx0 = (int)std::floor((cx - reach) * (float)f.w);
+	bx1 = (int)std::ceil((cx + reach) * (float)f.w) + 1;
+	by0 = (int)std::floor((cy - reach) * (float)f.h);
+	by1 = (int)std::ceil((cy + reach) * (float)f.h) + 1;
+	bx0 = bx0 < 0 ? 0 : bx0;
+	by0 = by0 < 0 ? 0 : by0;
+	bx1 = bx1 > f.w ? f.w : bx1;
+	by1 = by1 > f.h ? f.h : by1;
+	if (bx0 >= bx1 || by0 >= by1)
+		return;
+
+	exec.run(bx1 - bx0, by1 - by0, [&](int x0, int y0, int x1, int y1)
+	{
+		int x, y, k;
+
+		for (y = by0 + y0; y < by0 + y1; y++)
+		{
+			float dy = cy - ((float)y + 0.5f) / (float)f.h;
+			for (x = bx0 + x0; x < bx0 + x1; x++)
+			{
+				float dx = cx - ((float)x + 0.5f) / (float)f.w;
+				float e = std::exp(-(dx * dx + dy * dy) / radius);
+				float* p = f.at(x, y);
+
+				for (k = 0; k < f.c; k++)
+					p[k] += change[k] * e;
+			}
+		}
+	});
+}
+
+void stam2d::calc_divergence(const field& vel, field& div)
+{
+	float scale = -2.f * epsilon * opt.density / opt.dt;
+	int w = vel.w, h = vel.h;
+
+	exec.run(w, h, [&](int x0, int y0, int x1, int y1)
+	{
+		int x, y;
+
+		for (y = y0; y < y1; y++)
+		{
+			const float* row = vel.at(0, y);
+			const float* up = vel.at(0, y + 1 < h ? y + 1 : 0);
+			const float* down = vel.at(0, y > 0 ? y - 1 : h - 1);
+			float* out = div.at(0, y);
+
+			for (x = x0; x < x1; x++)
+			{
+				int xp = x + 1 < w ? x + 1 : 0;
+				int xm = x > 0 ? x - 1 : w - 1;
+
+				out[x] = scale * ((row[2 * xp] - row[2 * xm]) + (up[2 * x + 1] - down[2 * x + 1]));
+			}
+		}
+	});
+}
+
+void stam2d::jacobi_iteration(const field& div, const field& p, field& out)
+{
+	int w = p.w, h = p.h;
+
+	exec.run(w, h, [&](int x0, int y0, int x1, int y1)
+	{
+		int x, y;
+
+		// The demo's Laplacian spans two texels
+		for (y = y0; y < y1; y++)
+		{
+			const float* row = p.at(0, y);
+			const float* up = p.at(0, (y + 2) % h);
+			const float* down = p.at(0, (y - 2 + 2 * h) % h);
+			const float* d = div.at(0, y);
+			float* o = out.at(0, y);
+
+			for (x = x0; x < x1; x++)
+			{
+				int xp = x + 2 < w ? x + 2 : (x + 2) % w;
+				int xm = x >= 2 ? x - 2 : (x - 2 + 2 * w) % w;
+
+				o[x] = 0.25f * (d[x] + row[xp] + row[xm] + up[x] + down[x]);
+			}
+		}
+	});
+}
+
+void stam2d::subtract_pressure_gradient(const field& vel, const field& p, field& out)
+{
+	float scale = opt.dt / (2.f * opt.density * epsilon);
+	int w = vel.w, h = vel.h;
+
+	exec.run(w, h, [&](int x0, int y0, int x1, int y1)
+	{
+		int x, y;
+
+		for (y = y0; y < y1; y++)
+		{
+			const float* row = p.at(0, y);
+			const float* up = p.at(0, y + 1 < h ? y + 1 : 0);
+			const float* down = p.at(0, y > 0 ? y - 1 : h - 1);
+			const float* u = vel.at(0, y);
+			float* o = out.at(0, y);
+
+			for (x = x0; x < x1; x++)
+			{
+				int xp = x + 1 < w ? x + 1 : 0;
+				int xm = x > 0 ? x - 1 : w - 1;
+
+				o[2 * x] = u[2 * x] - scale * (row[xp] - row[xm]);
+				o[2 * x + 1] = u[2 * x + 1] - scale * (up[x] - down[x]);
+			}
+		}
+	});
+}
+
+#ifdef STAM2D_SSE2
+
+// Four texels of a velocity row from p on, split into u and v
+static inline void load_velocity4(const float* p, __m128& u, __m128& v)
+{
+	__m128 a = _mm_loadu_ps(p), b = _mm_loadu_ps(p + 4);
+
+	u = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+	v = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+}
+
+#endif
+
+// Curl from central differences over two texels, as calcDivergence takes
+// the divergence, then the force eps h (N_y w, -N_x w) with N the unit
+// gradient of |w|
+void stam2d::vorticity_confinement(const field& vel, field& out)
+{
+	int w = vel.w, h = vel.h;
+	float scale = 0.5f / epsilon;
+	float strength = opt.dt * opt.vorticity * epsilon;
+
+	exec.run(w, h, [&](int x0, int y0, int x1, int y1)
+	{
+		// Curl of the tile and a ring of one texel, cw texels a row
+		int cw = x1 - x0 + 2, ch = y1 - y0 + 2;
+		std::vector<float> curl((size_t)cw * ch);
+
+		for (int j = 0; j < ch; j++)
+		{
+			int y = wrap_index(y0 - 1 + j, h);
+			const float* row = vel.at(0, y);
+			const float* up = vel.at(0, y + 1 < h ? y + 1 : 0);
+			const float* down = vel.at(0, y > 0 ? y - 1 : h - 1);
+			float* c = &curl[(size_t)j * cw];
+			int i = 0;
+
+			auto curl_at = [&](int i)
+			{
+				int x = wrap_index(x0 - 1 + i, w);
+				int xp = x + 1 < w ? x + 1 : 0;
+				int xm = x > 0 ? x - 1 : w - 1;
+
+				c[i] = scale * ((row[2 * xp + 1] - row[2 * xm + 1]) - (up[2 * x] - down[2 * x]));
+			};
+
+#ifdef STAM2D_SSE2
+			// Where texels x - 1 to x + 4 lie in the row without wrapping
+			const __m128 sc = _mm_set1_ps(scale);
+
+			for (; i < std::min(std::max(0, 2 - x0), cw); i++)
+				curl_at(i);
+			for (; i + 4 <= cw && x0 + i + 3 < w; i += 4)
+			{
+				int x = x0 - 1 + i;
+				__m128 ul, vl, ur, vr, uu, vu, ud, vd;
+
+				load_velocity4(row + 2 * (x - 1), ul, vl);
+				load_velocity4(row + 2 * (x + 1), ur, vr);
+				load_velocity4(up + 2 * x, uu, vu);
+				load_velocity4(down + 2 * x, ud, vd);
+				_mm_storeu_ps(c + i, _mm_mul_ps(sc, _mm_sub_ps(_mm_sub_ps(vr, vl), _mm_sub_ps(uu, ud))));
+			}
+#endif
+			for (; i < cw; i++)
+				curl_at(i);
+		}
+
+		for (int y = y0; y < y1; y++)
+		{
+			const float* c = &curl[(size_t)(y - y0 + 1) * cw + 1];
+			const float* cu = c + cw;
+			const float* cd = c - cw;
+			const float* u = vel.at(x0, y);
+			float* o = out.at(x0, y);
+			int i = 0, n = x1 - x0;
+
+#ifdef STAM2D_SSE2
+			const __m128 sign = _mm_set1_ps(-0.f), tiny = _mm_set1_ps(1e-20f), s = _mm_set1_ps(strength);
+
+			for (; i + 4 <= n; i += 4)
+			{
+				__m128 wc = _mm_loadu_ps(c + i);
+				__m128 gx = _mm_sub_ps(_mm_andnot_ps(sign, _mm_loadu_ps(c + i + 1)), _mm_andnot_ps(sign, _mm_loadu_ps(c + i - 1)));
+				__m128 gy = _mm_sub_ps(_mm_andnot_ps(sign, _mm_loadu_ps(cu + i)), _mm_andnot_ps(sign, _mm_loadu_ps(cd + i)));
+				__m128 k = _mm_div_ps(_mm_mul_ps(s, wc),
+					_mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(gx, gx), _mm_mul_ps(gy, gy)), tiny)));
+				__m128 fu = _mm_mul_ps(k, gy);
+				__m128 fv = _mm_sub_ps(_mm_setzero_ps(), _mm_mul_ps(k, gx));
+
+				_mm_storeu_ps(o + 2 * i, _mm_add_ps(_mm_loadu_ps(u + 2 * i), _mm_unpacklo_ps(fu, fv)));
+				_mm_storeu_ps(o + 2 * i + 4, _mm_add_ps(_mm_loadu_ps(u + 2 * i + 4), _mm_unpackhi_ps(fu, fv)));
+			}
+#endif
+			for (; i < n; i++)
+			{
+				float gx = std::fabs(c[i + 1]) - std::fabs(c[i - 1]);
+				float gy = std::fabs(cu[i]) - std::fabs(cd[i]);
+				float k = strength * c[i] / std::sqrt(gx * gx + gy * gy + 1e-20f);
+
+				o[2 * i] = u[2 * i] + k * gy;
+				o[2 * i + 1] = u[2 * i + 1] - k * gx;
+			}
+		}
+	});
+}
+
+//========================================================================
+// Pressure by multigrid or PCG
+//========================================================================
+
+void stam2d::solve_pressure()
+{
+	int n = opt.size;
+	int m = n & 1 ? n : n / 2;
+	int parities = n & 1 ? 1 : 2;
+	multigrid_options mopt;
+	pcg_options popt;
+	poisson_stats st;
+
+	mopt.gamma = opt.multigrid_gamma;
+	mopt.tolerance = opt.pressure_tolerance;
+	popt.preconditioner = opt.pcg_precond;
+	popt.tolerance = opt.pressure_tolerance;
+	last_pressure = poisson_stats();
+
+	// Sub-problem texel (i, j) is texel ((2i + a) mod n, (2j + b) mod n),
+	// its neighbours are the texels two apart
+	for (int b = 0; b < parities; b++)
+		for (int a = 0; a < parities; a++)
+		{
+			exec.run(m, m, [&](int x0, int y0, int x1, int y1)
+			{
+				for (int j = y0; j < y1; j++)
+					for (int i = x0; i < x1; i++)
+					{
+						int x = (2 * i + a) % n, y = (2 * j + b) % n;
+
+						sub_b[(size_t)j * m + i] = *divergence.at(x, y);
+						sub_x[(size_t)j * m + i] = *pressure0.at(x, y);
+					}
+			});
+
+			if (mg)
+				st = mg->solve(sub_b.data(), sub_x.data(), mopt);
+			else
+				st = cg->solve(sub_b.data(), sub_x.data(), popt);
+			last_pressure.iterations += st.iterations;
+			last_pressure.residual = st.residual > last_pressure.residual ? st.residual : last_pressure.residual;
+			last_pressure.seconds += st.seconds;
+
+			exec.run(m, m, [&](int x0, int y0, int x1, int y1)
+			{
+				for (int j = y0; j < y1; j++)
+					for (int i = x0; i < x1; i++)
+						*pressure0.at((2 * i + a) % n, (2 * j + b) % n) = sub_x[(size_t)j * m + i];
+			});
+		}
+}
+
+//========================================================================
+// Step
+//========================================================================
+
+void stam2d::step(stam2d_timing* timing)
+{
+	stam2d_timing t;
+	std::chrono::steady_clock::time_point t0;
+	int i;
+
+	if (opt.advect_v)
+	{
+		t0 = std::chrono::steady_clock::now();
+		advect(velocity0, velocity0, velocity1);
+		std::swap(velocity0, velocity1);
+		t.advect += seconds_since(t0);
+	}
+
+	if (opt.vorticity > 0.f)
+	{
+		t0 = std::chrono::steady_clock::now();
+		vorticity_confinement(velocity0, velocity1);
+		std::swap(velocity0, velocity1);
+		t.vorticity += seconds_since(t0);
+	}
+
+	if (opt.apply_pressure)
+	{
+		t0 = std::chrono::steady_clock::now();
+		calc_divergence(velocity0, divergence);
+		t.divergence += seconds_since(t0);
+
+		// Warm started from the last step's pressure, as in the demo
+		t0 = std::chrono::steady_clock::now();
+		if (opt.pressure_solver != STAM2D_JACOBI)
+			solve_pressure();
+		else
+			for (i = 0; i < opt.jacobi_iterations; i++)
+			{
+				jacobi_iteration(divergence, pressure0, pressure1);
+				std::swap(pressure0, pressure1);
+			}
+		t.pressure += seconds_since(t0);
+
+		t0 = std::chrono::steady_clock::now();
+		subtract_pressure_gradient(velocity0, pressure0, velocity1);
+		std::swap(velocity0, velocity1);
+		t.gradient += seconds_since(t0);
+	}
+
+	t0 = std::chrono::steady_clock::now();
+	advect(color0, velocity0, color1);
+	std::swap(color0, color1);
+	t.advect += seconds_since(t0);
+
+	if (opt.dye_spots)
+	{
+		static const float red[3] = { 0.004f, -0.002f, -0.002f };
+		static const float blue[3] = { -0.002f, -0.002f, 0.004f };
+		static const float green[3] = { -0.002f, 0.004f, -0.002f };
+
+		t0 = std::chrono::steady_clock::now();
+		add_splat(color0, red, 0.2f, 0.2f, 0.01f);
+		add_splat(color0, blue, 0.5f, 0.9f, 0.01f);
+		add_splat(color0, green, 0.8f, 0.2f, 0.01f);
+		t.splat += seconds_since(t0);
+	}
+
+	if (timing)
+	{
+		timing->advect += t.advect;
+		timing->vorticity += t.vorticity;
+		timing->divergence += t.divergence;
+		timing->pressure += t.pressure;
+		timing->gradient += t.gradient;
+		timing->splat += t.splat;
+	}
+}
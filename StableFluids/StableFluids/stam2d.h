@@ -0,0 +1,139 @@
+/*****************************************************************************
+ * 2-D stable fluids (Jos Stam) on the CPU
+ *
+ * A port of the shader pipeline in 2D-dye/2D-fluidSimulation.js:
+ *
+ *   advect -> calcDivergence -> jacobiIterationForPressure (n times)
+ *          -> subtractPressureGradient -> advect dye -> addSplat
+ *
+ * with the same constants, the same periodic (fract) addressing and the
+ * same bilinear sampling, so a small grid reproduces the browser demo.
+ * Every stage is one pass over the grid, split into tiles on a
+ * tile_executor.
+ *
+ * The pressure can also be solved to a residual tolerance with multigrid or
+ * PCG instead of a fixed number of Jacobi sweeps.  The demo's Laplacian spans
+ * two texels, so on an even grid it splits into four independent problems
+ * on the texels of each (x, y) parity, and on an odd grid it is one problem
+ * on the texels 2i mod n; each is the 5-point problem of poisson.h.
+ *
+ * The advection can be made second order with MacCormack or BFECC (Selle et
+ * al. 2008): a forward trace, a backward trace of its result and a
+ * correction by half the round trip error, clamped to the texels of the
+ * forward sample so no new extrema appear.  The traces of a tile run in
+ * one pass, over the tile grown by the furthest a trace can reach, and
+ * sample four texels at a time with SSE.
+ *
+ * Vorticity confinement (Fedkiw et al. 2001) can follow the velocity
+ * advect, to give back the swirls a coarse grid smooths away: the curl of
+ * a tile and a ring of texels around it goes to a small buffer, and the
+ * force along grad |curl| x curl is added in the same job, four texels at
+ * a time.
+ *****************************************************************************/
+
+#ifndef STAM2DH
+#define STAM2DH
+
+#include <memory>
+#include <vector>
+
+#include "field.h"
+#include "multigrid.h"
+#include "pcg.h"
+#include "tile_executor.h"
+
+enum stam2d_pressure
+{
+	STAM2D_JACOBI,			// opt.jacobi_iterations sweeps, as the demo
+	STAM2D_MULTIGRID,		// cycles until opt.pressure_tolerance
+	STAM2D_PCG				// conjugate gradient until opt.pressure_tolerance
+};
+
+enum stam2d_advection
+{
+	STAM2D_SEMI_LAGRANGIAN,	// one backward trace, as the demo
+	STAM2D_MACCORMACK,		// forward, backward and correction
+	STAM2D_BFECC			// forward, backward, then forward the corrected field
+};
+
+struct stam2d_options
+{
+	int size = 400;					// grid is size x size, EPSILON = 1 / size
+	float dt = 1.f / 120.f;			// DELTA_T
+	float density = 1.f;			// DENSITY
+	int jacobi_iterations = 10;		// JACOBI_ITERATIONS
+	bool advect_v = true;
+	bool apply_pressure = false;
+	bool dye_spots = false;
+
+	stam2d_advection advection = STAM2D_SEMI_LAGRANGIAN;
+	bool limiter = true;				// clamp the second order schemes
+	float vorticity = 0.f;				// confinement strength, 0 for none
+
+	stam2d_pressure pressure_solver = STAM2D_JACOBI;
+	double pressure_tolerance = 1e-5;	// relative residual
+	int multigrid_gamma = 1;			// 1 for V cycles, 2 for W cycles
+	pcg_preconditioner pcg_precond = PCG_MULTIGRID;
+};
+
+// Seconds spent in each stage, accumulated over steps
+struct stam2d_timing
+{
+	double advect = 0.0;
+	double vorticity = 0.0;
+	double divergence = 0.0;
+	double pressure = 0.0;
+	double gradient = 0.0;
+	double splat = 0.0;
+};
+
+class stam2d
+{
+public:
+	stam2d(const stam2d_options& opt, tile_executor& exec);
+
+	// Initial velocity and checkerboard dye of the demo, zero pressure
+	void reset();
+
+	// One gl.onupdate
+	void step(stam2d_timing* timing = nullptr);
+
+	// field += change * exp(-|center - coord|^2 / radius), in place
+	void add_splat(field& f, const float* change, float cx, float cy, float radius);
+
+	// The individual passes, out must not alias the inputs
+	void advect(const field& in, const field& vel, field& out);
+	void calc_divergence(const field& vel, field& div);
+	void jacobi_iteration(const field& div, const field& p, field& out);
+	void subtract_pressure_gradient(const field& vel, const field& p, field& out);
+	void vorticity_confinement(const field& vel, field& out);
+
+	const field& velocity() const { return velocity0; }
+	const field& color() const { return color0; }
+	const field& pressure() const { return pressure0; }
+
+	// Iterations and residual of the last multigrid or PCG pressure solve,
+	// summed and maxed over the sub-problems
+	const poisson_stats& pressure_stats() const { return last_pressure; }
+
+	stam2d_options opt;
+
+private:
+	void solve_pressure();
+	void advect_corrected(const field& in, const field& vel, field& out);
+
+	tile_executor& exec;
+	float epsilon;
+
+	field velocity0, velocity1;
+	field color0, color1;
+	field divergence;
+	field pressure0, pressure1;
+
+	std::unique_ptr<multigrid> mg;
+	std::unique_ptr<pcg> cg;
+	std::vector<float> sub_b, sub_x;
+	poisson_stats last_pressure;
+};
+
+#endif
@@ -0,0 +1,818 @@
+/*****************************************************************************
+ * 3-D stable fluids with a free surface
+ *****************************************************************************/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <utility>
+
+#include "stam3d.h"
+
+#define SYSTEM_CHUNK 4096		// pressure rows per job
+#define MIN_THETA 0.01f			// ghost fluid distance to the surface, in cells
+#define UNSET 255				// face without a velocity yet
+#define WALL 254				// face on a wall, always zero
+
+static double seconds_since(std::chrono::steady_clock::time_point t0)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// Liquid cell fraction of the way to an air neighbour
+static float theta(float liquid, float air)
+{
+	float t = liquid / (liquid - air);
+	return t < MIN_THETA ? MIN_THETA : t;
+}
+
+stam3d::stam3d(const stam3d_options& opt, tile_executor& exec)
+	: opt(opt), exec(exec), n(opt.size), h(1.f / (float)opt.size), mc(exec)
+{
+	reset();
+}
+
+//========================================================================
+// Bricks
+//========================================================================
+
+// The initial signed distance in cells: a column of liquid against x = 0
+// and a pool along the floor
+static float dam_break(int x, int y, int z, float h, float band)
+{
+	float px = ((float)x + 0.5f) * h;
+	float py = ((float)y + 0.5f) * h;
+	float column = std::max(px - 0.35f, py - 0.6f) / h;
+	float pool = (py - 0.12f) / h;
+	float d = std::min(column, pool);
+
+	(void)z;
+	return d < -band ? -band : (d > band ? band : d);
+}
+
+void stam3d::reset()
+{
+	phi = brick_grid<float>(n, n, n, opt.band);
+	phi1 = brick_grid<float>(n, n, n, opt.band);
+	for (int a = 0; a < 3; a++)
+	{
+		vel[a] = brick_grid<float>(n, n, n, 0.f);
+		vel1[a] = brick_grid<float>(n, n, n, 0.f);
+	}
+	pressure = brick_grid<float>(n, n, n, 0.f);
+	index = brick_grid<int>(n, n, n, -1);
+	mark0 = brick_grid<unsigned char>(n, n, n, UNSET);
+	mark1 = brick_grid<unsigned char>(n, n, n, UNSET);
+	bricks.clear();
+
+	std::vector<char> need(phi.brick_count(), 0);
+	float limit = opt.band - 0.5f;
+
+	exec.for_each(phi.brick_count(), [&](int b)
+	{
+		int x0, y0, z0;
+
+		phi.brick_origin(b, x0, y0, z0);
+		for (int z = z0; z < std::min(z0 + BRICK_SIZE, n); z++)
+			for (int y = y0; y < std::min(y0 + BRICK_SIZE, n); y++)
+				for (int x = x0; x < std::min(x0 + BRICK_SIZE, n); x++)
+					if (dam_break(x, y, z, h, opt.band) < limit)
+					{
+						need[b] = 1;
+						return;
+					}
+	});
+	set_live(need);
+
+	exec.for_each((int)bricks.size(), [&](int k)
+	{
+		int b = bricks[k], x0, y0, z0;
+		float* p = phi.brick(b);
+
+		phi.brick_origin(b, x0, y0, z0);
+		for (int z = z0; z < std::min(z0 + BRICK_SIZE, n); z++)
+			for (int y = y0; y < std::min(y0 + BRICK_SIZE, n); y++)
+				for (int x = x0; x < std::min(x0 + BRICK_SIZE, n); x++)
+					p[phi.cell_index(x, y, z)] = dam_break(x, y, z, h, opt.band);
+	});
+}
+
+// Keep the bricks that need it and their 26 neighbours, release the rest
+void stam3d::set_live(const std::vector<char>& need)
+{
+	std::vector<char> live(need.size(), 0);
+	int b, x, y, z, dx, dy, dz;
+
+	for (z = 0; z < phi.bz; z++)
+		for (y = 0; y < phi.by; y++)
+			for (x = 0; x < phi.bx; x++)
+			{
+				if (!need[(z * phi.by + y) * phi.bx + x])
+					continue;
+				for (dz = std::max(z - 1, 0); dz <= std::min(z + 1, phi.bz - 1); dz++)
+					for (dy = std::max(y - 1, 0); dy <= std::min(y + 1, phi.by - 1); dy++)
+						for (dx = std::max(x - 1, 0); dx <= std::min(x + 1, phi.bx - 1); dx++)
+							live[(dz * phi.by + dy) * phi.bx + dx] = 1;
+			}
+
+	bricks.clear();
+	for (b = 0; b < (int)live.size(); b++)
+	{
+		if (live[b])
+		{
+			if (!phi.allocated(b))
+			{
+				phi.allocate(b);
+				phi1.allocate(b);
+				for (int a = 0; a < 3; a++)
+				{
+					vel[a].allocate(b);
+					vel1[a].allocate(b);
+				}
+				pressure.allocate(b);
+				index.allocate(b);
+				mark0.allocate(b);
+				mark1.allocate(b);
+			}
+			bricks.push_back(b);
+		}
+		else if (phi.allocated(b))
+		{
+			phi.release(b);
+			phi1.release(b);
+			for (int a = 0; a < 3; a++)
+			{
+				vel[a].release(b);
+				vel1[a].release(b);
+			}
+			pressure.release(b);
+			index.release(b);
+			mark0.release(b);
+			mark1.release(b);
+		}
+	}
+}
+
+// A brick is needed while some of its cells are inside the band
+void stam3d::update_bricks()
+{
+	std::vector<char> need(phi.brick_count(), 0);
+	float limit = opt.band - 0.5f;
+
+	exec.for_each((int)bricks.size(), [&](int k)
+	{
+		const float* p = phi.brick(bricks[k]);
+
+		for (int i = 0; i < BRICK_CELLS; i++)
+			if (p[i] < limit)
+			{
+				need[bricks[k]] = 1;
+				break;
+			}
+	});
+	set_live(need);
+}
+
+size_t stam3d::system_bytes() const
+{
+	return (cells.capacity() + neighbours.capacity()) * sizeof(int)
+		+ (diag.capacity() + rhs.capacity() + x.capacity() + r.capacity() + z.capacity() + p.capacity() + q.capacity()) * sizeof(float);
+}
+
+size_t stam3d::bytes() const
+{
+	size_t total = phi.bytes() + phi1.bytes() + pressure.bytes() + index.bytes() + mark0.bytes() + mark1.bytes();
+
+	for (int a = 0; a < 3; a++)
+		total += vel[a].bytes() + vel1[a].bytes();
+	return total + system_bytes();
+}
+
+// 9 float fields, the index and two marks per cell, and the same system
+size_t stam3d::dense_bytes() const
+{
+	return (size_t)n * n * n * (9 * sizeof(float) + sizeof(int) + 2) + system_bytes();
+}
+
+//========================================================================
+// Advection
+//========================================================================
+
+void stam3d::advect(float dt)
+{
+	float s = dt / h;
+	float g = opt.gravity * dt;
+
+	// Velocity at cell centres and faces, averaged from the nearest faces
+	auto centre = [&](int x, int y, int z, float* v)
+	{
+		v[0] = 0.5f * (vel[0].get(x, y, z) + vel[0].get(x + 1, y, z));
+		v[1] = 0.5f * (vel[1].get(x, y, z) + vel[1].get(x, y + 1, z));
+		v[2] = 0.5f * (vel[2].get(x, y, z) + vel[2].get(x, y, z + 1));
+	};
+	auto face = [&](int axis, int x, int y, int z, float* v)
+	{
+		int lo[3] = { x, y, z };
+
+		lo[axis]--;
+		for (int a = 0; a < 3; a++)
+		{
+			const brick_grid<float>& u = vel[a];
+			int up[3] = { a == 0, a == 1, a == 2 };
+
+			if (a == axis)
+				v[a] = u.get(x, y, z);
+			else
+				v[a] = 0.25f * (u.get(x, y, z) + u.get(x + up[0], y + up[1], z + up[2])
+					+ u.get(lo[0], lo[1], lo[2]) + u.get(lo[0] + up[0], lo[1] + up[1], lo[2] + up[2]));
+		}
+	};
+
+	exec.for_each((int)bricks.size(), [&](int k)
+	{
+		int b = bricks[k], x0, y0, z0;
+		float* dphi = phi1.brick(b);
+		float* du[3] = { vel1[0].brick(b), vel1[1].brick(b), vel1[2].brick(b) };
+		float v[3];
+
+		phi.brick_origin(b, x0, y0, z0);
+		for (int z = z0; z < std::min(z0 + BRICK_SIZE, n); z++)
+			for (int y = y0; y < std::min(y0 + BRICK_SIZE, n); y++)
+				for (int x = x0; x < std::min(x0 + BRICK_SIZE, n); x++)
+				{
+					int c = phi.cell_index(x, y, z);
+					float fx = (float)x, fy = (float)y, fz = (float)z;
+
+					// The cell centre, then the faces on its low sides
+					centre(x, y, z, v);
+					dphi[c] = phi.sample(fx - s * v[0], fy - s * v[1], fz - s * v[2]);
+
+					// A face grid is offset by half a cell, so in its own
+					// units the foot of the trace is (x, y, z) - s v
+					du[0][c] = du[1][c] = du[2][c] = 0.f;
+					if (x > 0)
+					{
+						face(0, x, y, z, v);
+						du[0][c] = vel[0].sample(fx - s * v[0], fy - s * v[1], fz - s * v[2]);
+					}
+					if (y > 0)
+					{
+						face(1, x, y, z, v);
+						du[1][c] = vel[1].sample(fx - s * v[0], fy - s * v[1], fz - s * v[2]) + g;
+					}
+					if (z > 0)
+					{
+						face(2, x, y, z, v);
+						du[2][c] = vel[2].sample(fx - s * v[0], fy - s * v[1], fz - s * v[2]);
+					}
+				}
+	});
+
+	std::swap(phi, phi1);
+	for (int a = 0; a < 3; a++)
+		std::swap(vel[a], vel1[a]);
+}
+
+//========================================================================
+// Redistancing
+//========================================================================
+
+/* A few Jacobi iterations of phi_t = sign(phi) (1 - |grad phi|) with
+ * Godunov upwinding, from the cells next to the surface outwards.  Those
+ * cells are rescaled once by their gradient and then held, so the surface
+ * does not move.
+ */
+void stam3d::redistance()
+{
+	float band = opt.band;
+
+	auto pass = [&](bool first)
+	{
+		exec.for_each((int)bricks.size(), [&](int k)
+		{
+			int b = bricks[k], x0, y0, z0;
+			float* out = phi1.brick(b);
+
+			phi.brick_origin(b, x0, y0, z0);
+			for (int z = z0; z < std::min(z0 + BRICK_SIZE, n); z++)
+				for (int y = y0; y < std::min(y0 + BRICK_SIZE, n); y++)
+					for (int x = x0; x < std::min(x0 + BRICK_SIZE, n); x++)
+					{
+						int c = phi.cell_index(x, y, z);
+						float f = phi.brick(b)[c];
+						float nb[6] =
+						{
+							phi.clamped(x - 1, y, z), phi.clamped(x + 1, y, z),
+							phi.clamped(x, y - 1, z), phi.clamped(x, y + 1, z),
+							phi.clamped(x, y, z - 1), phi.clamped(x, y, z + 1)
+						};
+						bool surface = false;
+						float g2 = 0.f;
+
+						for (int i = 0; i < 6; i++)
+							surface |= (nb[i] < 0.f) != (f < 0.f);
+
+						if (surface)
+						{
+							if (first)
+							{
+								// Largest one sided or central difference per axis
+								for (int a = 0; a < 3; a++)
+								{
+									float d = std::max(std::fabs(nb[2 * a + 1] - nb[2 * a]) * 0.5f,
+										std::max(std::fabs(nb[2 * a + 1] - f), std::fabs(f - nb[2 * a])));
+									g2 += d * d;
+								}
+								f = g2 > 1e-12f ? f / std::sqrt(g2) : f;
+							}
+							out[c] = f;
+							continue;
+						}
+
+						for (int a = 0; a < 3; a++)
+						{
+							float dm = f - nb[2 * a];
+							float dp = nb[2 * a + 1] - f;
+							float d = f > 0.f ? std::max(std::max(dm, 0.f), -std::min(dp, 0.f))
+								: std::max(-std::min(dm, 0.f), std::max(dp, 0.f));
+							g2 += d * d;
+						}
+						f -= 0.5f * f / std::sqrt(f * f + 1.f) * (std::sqrt(g2) - 1.f);
+						out[c] = f < -band ? -band : (f > band ? band : f);
+					}
+		});
+		std::swap(phi, phi1);
+	};
+
+	for (int i = 0; i < opt.redistance_iterations; i++)
+		pass(i == 0);
+}
+
+//========================================================================
+// Pressure projection
+//========================================================================
+
+void stam3d::build_system()
+{
+	std::vector<int> offset(bricks.size() + 1, 0);
+
+	// Number the liquid cells brick by brick
+	exec.for_each((int)bricks.size(), [&](int k)
+	{
+		const float* f = phi.brick(bricks[k]);
+		int count = 0;
+
+		for (int i = 0; i < BRICK_CELLS; i++)
+			count += f[i] < 0.f;
+		offset[k + 1] = count;
+	});
+	for (size_t k = 0; k < bricks.size(); k++)
+		offset[k + 1] += offset[k];
+
+	int m = offset.back();
+	cells.resize(m);
+	neighbours.resize((size_t)6 * m);
+	diag.resize(m);
+	rhs.resize(m);
+	x.resize(m);
+	r.resize(m);
+	z.resize(m);
+	p.resize(m);
+	q.resize(m);
+
+	exec.for_each((int)bricks.size(), [&](int k)
+	{
+		int b = bricks[k], x0, y0, z0, i = offset[k];
+		const float* f = phi.brick(b);
+		int* id = index.brick(b);
+
+		std::fill(id, id + BRICK_CELLS, -1);
+		phi.brick_origin(b, x0, y0, z0);
+		for (int cz = z0; cz < std::min(z0 + BRICK_SIZE, n); cz++)
+			for (int cy = y0; cy < std::min(y0 + BRICK_SIZE, n); cy++)
+				for (int cx = x0; cx < std::min(x0 + BRICK_SIZE, n); cx++)
+				{
+					int c = phi.cell_index(cx, cy, cz);
+					if (f[c] < 0.f)
+					{
+						id[c] = i;
+						cells[i++] = cx + n * (cy + n * cz);
+					}
+				}
+	});
+
+	// Rows: 1 per liquid or air neighbour, 1 / theta for air at the surface,
+	// nothing across a wall; the right hand side is minus the divergence
+	exec.for_each((m + SYSTEM_CHUNK - 1) / SYSTEM_CHUNK, [&](int chunk)
+	{
+		static const int step[6][3] = { { -1, 0, 0 }, { 1, 0, 0 }, { 0, -1, 0 }, { 0, 1, 0 }, { 0, 0, -1 }, { 0, 0, 1 } };
+
+		for (int i = chunk * SYSTEM_CHUNK; i < std::min((chunk + 1) * SYSTEM_CHUNK, m); i++)
+		{
+			int cx = cells[i] % n, cy = cells[i] / n % n, cz = cells[i] / n / n;
+			float f = phi.get(cx, cy, cz);
+			float d = 0.f;
+
+			for (int j = 0; j < 6; j++)
+			{
+				int nx = cx + step[j][0], ny = cy + step[j][1], nz = cz + step[j][2];
+				int* nb = &neighbours[(size_t)6 * i + j];
+
+				*nb = -1;
+				if ((unsigned)nx >= (unsigned)n || (unsigned)ny >= (unsigned)n || (unsigned)nz >= (unsigned)n)
+					continue;
+				float g = phi.get(nx, ny, nz);
+				if (g < 0.f)
+				{
+					*nb = index.get(nx, ny, nz);
+					d += 1.f;
+				}
+				else
+					d += 1.f / theta(f, g);
+			}
+			diag[i] = d;
+			rhs[i] = -(vel[0].get(cx + 1, cy, cz) - vel[0].get(cx, cy, cz)
+				+ vel[1].get(cx, cy + 1, cz) - vel[1].get(cx, cy, cz)
+				+ vel[2].get(cx, cy, cz + 1) - vel[2].get(cx, cy, cz));
+			x[i] = pressure.get(cx, cy, cz);
+		}
+	});
+}
+
+// Conjugate gradient with a diagonal preconditioner, from the pressure of
+// the last substep
+double stam3d::solve_pressure(int& iterations)
+{
+	int m = (int)cells.size();
+	int chunks = (m + SYSTEM_CHUNK - 1) / SYSTEM_CHUNK;
+	double bnorm, rr, rz, rz_old, pq, alpha, beta;
+
+	auto range = [&](int chunk, int& i0, int& i1)
+	{
+		i0 = chunk * SYSTEM_CHUNK;
+		i1 = std::min(i0 + SYSTEM_CHUNK, m);
+	};
+	auto apply = [&](const float* v, int i)
+	{
+		const int* nb = &neighbours[(size_t)6 * i];
+		float s = diag[i] * v[i];
+
+		for (int j = 0; j < 6; j++)
+			if (nb[j] >= 0)
+				s -= v[nb[j]];
+		return s;
+	};
+
+	iterations = 0;
+	if (m == 0)
+		return 0.0;
+
+	bnorm = std::sqrt(exec.sum(chunks, [&](int chunk)
+	{
+		int i0, i1;
+		double s = 0.0;
+
+		range(chunk, i0, i1);
+		for (int i = i0; i < i1; i++)
+			s += (double)rhs[i] * rhs[i];
+		return s;
+	}));
+	if (bnorm == 0.0)
+	{
+		std::fill(x.begin(), x.end(), 0.f);
+		return 0.0;
+	}
+
+	// r = b - Ax, z = p = r / diag
+	rr = exec.sum(chunks, [&](int chunk)
+	{
+		int i0, i1;
+		double s = 0.0;
+
+		range(chunk, i0, i1);
+		for (int i = i0; i < i1; i++)
+		{
+			r[i] = rhs[i] - apply(x.data(), i);
+			s += (double)r[i] * r[i];
+		}
+		return s;
+	});
+	rz = exec.sum(chunks, [&](int chunk)
+	{
+		int i0, i1;
+		double s = 0.0;
+
+		range(chunk, i0, i1);
+		for (int i = i0; i < i1; i++)
+		{
+			z[i] = r[i] / diag[i];
+			p[i] = z[i];
+			s += (double)r[i] * z[i];
+		}
+		return s;
+	});
+
+	while (std::sqrt(rr) / bnorm >= opt.pressure_tolerance && iterations < opt.max_pressure_iterations)
+	{
+		pq = exec.sum(chunks, [&](int chunk)
+		{
+			int i0, i1;
+			double s = 0.0;
+
+			range(chunk, i0, i1);
+			for (int i = i0; i < i1; i++)
+			{
+				q[i] = apply(p.data(), i);
+				s += (double)p[i] * q[i];
+			}
+			return s;
+		});
+		if (pq <= 0.0)
+			break;
+		alpha = rz / pq;
+
+		rr = exec.sum(chunks, [&](int chunk)
+		{
+			int i0, i1;
+			double s = 0.0;
+			float a = (float)alpha;
+
+			range(chunk, i0, i1);
+			for (int i = i0; i < i1; i++)
+			{
+				x[i] += a * p[i];
+				r[i] -= a * q[i];
+				s += (double)r[i] * r[i];
+			}
+			return s;
+		});
+		iterations++;
+		if (std::sqrt(rr) / bnorm < opt.pressure_tolerance)
+			break;
+
+		rz_old = rz;
+		rz = exec.sum(chunks, [&](int chunk)
+		{
+			int i0, i1;
+			double s = 0.0;
+
+			range(chunk, i0, i1);
+			for (int i = i0; i < i1; i++)
+			{
+				z[i] = r[i] / diag[i];
+				s += (double)r[i] * z[i];
+			}
+			return s;
+		});
+		beta = rz / rz_old;
+
+		exec.for_each(chunks, [&](int chunk)
+		{
+			int i0, i1;
+			float bt = (float)beta;
+
+			range(chunk, i0, i1);
+			for (int i = i0; i < i1; i++)
+				p[i] = z[i] + bt * p[i];
+		});
+	}
+
+	return std::sqrt(rr) / bnorm;
+}
+
+// u -= grad p on the faces next to liquid, with the ghost pressure
+// p_liquid (theta - 1) / theta on the air side.  Marks those faces valid
+// for the extrapolation, walls as fixed and the rest as unset.
+void stam3d::subtract_gradient(int axis)
+{
+	exec.for_each((int)bricks.size(), [&](int k)
+	{
+		int b = bricks[k], x0, y0, z0;
+		float* u = vel[axis].brick(b);
+		unsigned char* mark = mark0.brick(b);
+
+		phi.brick_origin(b, x0, y0, z0);
+		for (int cz = z0; cz < std::min(z0 + BRICK_SIZE, n); cz++)
+			for (int cy = y0; cy < std::min(y0 + BRICK_SIZE, n); cy++)
+				for (int cx = x0; cx < std::min(x0 + BRICK_SIZE, n); cx++)
+				{
+					int c = phi.cell_index(cx, cy, cz);
+					int lo[3] = { cx, cy, cz };
+
+					lo[axis]--;
+					if (lo[axis] < 0)
+					{
+						u[c] = 0.f;
+						mark[c] = WALL;
+						continue;
+					}
+
+					float f0 = phi.get(lo[0], lo[1], lo[2]);
+					float f1 = phi.brick(b)[c];
+					if (f0 >= 0.f && f1 >= 0.f)
+					{
+						mark[c] = UNSET;
+						continue;
+					}
+
+					float p0 = f0 < 0.f ? pressure.get(lo[0], lo[1], lo[2]) : 0.f;
+					float p1 = f1 < 0.f ? pressure.brick(b)[c] : 0.f;
+					if (f0 >= 0.f)
+					{
+						float t = theta(f1, f0);
+						p0 = p1 * (t - 1.f) / t;
+					}
+					else if (f1 >= 0.f)
+					{
+						float t = theta(f0, f1);
+						p1 = p0 * (t - 1.f) / t;
+					}
+					u[c] -= p1 - p0;
+					mark[c] = 0;
+				}
+	});
+}
+
+void stam3d::project(stam3d_stats* stats)
+{
+	int iterations;
+	double residual;
+
+	build_system();
+	residual = solve_pressure(iterations);
+
+	exec.for_each((int)cells.size() / SYSTEM_CHUNK + 1, [&](int chunk)
+	{
+		int m = (int)cells.size();
+
+		for (int i = chunk * SYSTEM_CHUNK; i < std::min((chunk + 1) * SYSTEM_CHUNK, m); i++)
+			pressure.at(cells[i] % n, cells[i] / n % n, cells[i] / n / n) = x[i];
+	});
+
+	if (stats)
+	{
+		stats->liquid_cells += (int64_t)cells.size();
+		stats->pressure_iterations += iterations;
+		stats->pressure_residual = std::max(stats->pressure_residual, residual);
+	}
+}
+
+//========================================================================
+// Velocity extrapolation
+//========================================================================
+
+/* Layer k gives every unset face next to a face of an earlier layer the
+ * mean of those neighbours.  Enough layers cover the distance the surface
+ * and the air faces sample from in the next substep; faces still unset
+ * after that are zeroed.
+ */
+void stam3d::extrapolate(int axis)
+{
+	int layers = (int)std::ceil(opt.cfl) + 2;
+	brick_grid<float>& u = vel[axis];
+
+	for (int layer = 1; layer <= layers; layer++)
+	{
+		exec.for_each((int)bricks.size(), [&](int k)
+		{
+			int b = bricks[k], x0, y0, z0;
+			const unsigned char* in = mark0.brick(b);
+			unsigned char* out = mark1.brick(b);
+			float* v = u.brick(b);
+
+			phi.brick_origin(b, x0, y0, z0);
+			for (int cz = z0; cz < std::min(z0 + BRICK_SIZE, n); cz++)
+				for (int cy = y0; cy < std::min(y0 + BRICK_SIZE, n); cy++)
+					for (int cx = x0; cx < std::min(x0 + BRICK_SIZE, n); cx++)
+					{
+						static const int step[6][3] = { { -1, 0, 0 }, { 1, 0, 0 }, { 0, -1, 0 }, { 0, 1, 0 }, { 0, 0, -1 }, { 0, 0, 1 } };
+						int c = phi.cell_index(cx, cy, cz);
+						float sum = 0.f;
+						int count = 0;
+
+						out[c] = in[c];
+						if (in[c] != UNSET)
+							continue;
+
+						for (int j = 0; j < 6; j++)
+						{
+							int nx = cx + step[j][0], ny = cy + step[j][1], nz = cz + step[j][2];
+
+							if (mark0.get(nx, ny, nz) < layer)
+							{
+								sum += u.get(nx, ny, nz);
+								count++;
+							}
+						}
+						if (count)
+						{
+							v[c] = sum / (float)count;
+							out[c] = (unsigned char)layer;
+						}
+					}
+		});
+		std::swap(mark0, mark1);
+	}
+
+	exec.for_each((int)bricks.size(), [&](int k)
+	{
+		int b = bricks[k];
+		const unsigned char* mark = mark0.brick(b);
+		float* v = u.brick(b);
+
+		for (int c = 0; c < BRICK_CELLS; c++)
+			if (mark[c] >= WALL)
+				v[c] = 0.f;
+	});
+}
+
+//========================================================================
+// Steps
+//========================================================================
+
+// Fastest face, plus the speed gravity adds over a few cells
+float stam3d::max_speed()
+{
+	std::vector<float> top(bricks.size(), 0.f);
+
+	exec.for_each((int)bricks.size(), [&](int k)
+	{
+		float m = 0.f;
+
+		for (int a = 0; a < 3; a++)
+		{
+			const float* v = vel[a].brick(bricks[k]);
+			for (int c = 0; c < BRICK_CELLS; c++)
+				m = std::max(m, std::fabs(v[c]));
+		}
+		top[k] = m;
+	});
+
+	float m = 0.f;
+	for (float t : top)
+		m = std::max(m, t);
+	return m + std::sqrt(5.f * h * std::fabs(opt.gravity));
+}
+
+void stam3d::substep(float dt, stam3d_timing* timing, stam3d_stats* stats)
+{
+	stam3d_timing t;
+
+	auto t0 = std::chrono::steady_clock::now();
+	update_bricks();
+	t.bricks = seconds_since(t0);
+
+	t0 = std::chrono::steady_clock::now();
+	advect(dt);
+	t.advect = seconds_since(t0);
+
+	t0 = std::chrono::steady_clock::now();
+	redistance();
+	t.redistance = seconds_since(t0);
+
+	t0 = std::chrono::steady_clock::now();
+	project(stats);
+	t.pressure = seconds_since(t0);
+
+	t0 = std::chrono::steady_clock::now();
+	for (int a = 0; a < 3; a++)
+	{
+		subtract_gradient(a);
+		extrapolate(a);
+	}
+	t.extrapolate = seconds_since(t0);
+
+	if (timing)
+	{
+		timing->bricks += t.bricks;
+		timing->advect += t.advect;
+		timing->redistance += t.redistance;
+		timing->pressure += t.pressure;
+		timing->extrapolate += t.extrapolate;
+	}
+	if (stats)
+		stats->substeps++;
+}
+
+void stam3d::step_frame(stam3d_timing* timing, stam3d_stats* stats)
+{
+	float t = 0.f;
+
+	while (t < opt.frame_dt)
+	{
+		float dt = opt.cfl * h / max_speed();
+
+		// Split what is left evenly rather than leave a sliver
+		if (t + dt >= opt.frame_dt)
+			dt = opt.frame_dt - t;
+		else if (t + 2.f * dt > opt.frame_dt)
+			dt = 0.5f * (opt.frame_dt - t);
+		substep(dt, timing, stats);
+		t += dt;
+	}
+}
+
+void stam3d::surface(mesh& out)
+{
+	mc.extract(phi, 0.f, h, out);
+}
@@ -0,0 +1,124 @@
+/*****************************************************************************
+ * 3-D stable fluids with a free surface
+ *
+ * Liquid in a closed box, the unit cube split into size^3 cells:
+ *
+ *   update bricks -> advect level set and velocity, add gravity
+ *                 -> redistance -> pressure projection -> extrapolate velocity
+ *
+ * The velocity lives on a MAC grid, u(i, j, k) on the face between cells
+ * i - 1 and i, the faces on the far walls being implicit zeros.  The
+ * surface is the zero level of phi, a signed distance in cells, negative in
+ * the liquid and clamped to +-band.  Advection is semi-Lagrangian as in
+ * stam2d.  The pressure is solved on the liquid cells only, with p = 0 at
+ * the surface placed by the ghost fluid method, by conjugate gradient with
+ * a diagonal preconditioner.
+ *
+ * Every field is a brick_grid.  Bricks are kept where phi is below the
+ * band and one brick around them, so the air far from the liquid costs
+ * nothing.  Passes run over the list of live bricks on a tile_executor.
+ *****************************************************************************/
+
+#ifndef STAM3DH
+#define STAM3DH
+
+#include <cstdint>
+#include <vector>
+
+#include "brick_grid.h"
+#include "marching_cubes.h"
+#include "mesh.h"
+#include "tile_executor.h"
+
+struct stam3d_options
+{
+	int size = 128;						// cells along each side of the unit cube
+	float frame_dt = 1.f / 30.f;
+	float cfl = 2.f;					// cells a sample may travel in one substep
+	float gravity = -9.81f;				// along y, in box sizes per second^2
+	float band = 5.f;					// |phi| clamp, cells
+	int redistance_iterations = 2;		// per substep
+	double pressure_tolerance = 1e-4;	// relative residual
+	int max_pressure_iterations = 500;
+};
+
+// Seconds spent in each stage, accumulated over substeps
+struct stam3d_timing
+{
+	double bricks = 0.0;
+	double advect = 0.0;
+	double redistance = 0.0;
+	double pressure = 0.0;
+	double extrapolate = 0.0;
+};
+
+struct stam3d_stats
+{
+	int substeps = 0;
+	int64_t liquid_cells = 0;		// summed over substeps
+	int pressure_iterations = 0;	// summed over substeps
+	double pressure_residual = 0.0;	// worst relative residual
+};
+
+class stam3d
+{
+public:
+	stam3d(const stam3d_options& opt, tile_executor& exec);
+
+	// Dam break: a column of liquid against the x = 0 wall over a shallow pool
+	void reset();
+
+	// Advance one frame in CFL limited substeps
+	void step_frame(stam3d_timing* timing = nullptr, stam3d_stats* stats = nullptr);
+
+	// Zero level of phi as a mesh in box units
+	void surface(mesh& out);
+
+	const brick_grid<float>& level_set() const { return phi; }
+
+	int live_bricks() const { return (int)bricks.size(); }
+
+	// Bytes held by the bricks and the pressure system, and what the same
+	// fields would take as dense arrays
+	size_t bytes() const;
+	size_t dense_bytes() const;
+
+	stam3d_options opt;
+
+private:
+	void substep(float dt, stam3d_timing* timing, stam3d_stats* stats);
+	float max_speed();
+	void update_bricks();
+	void advect(float dt);
+	void redistance();
+	void project(stam3d_stats* stats);
+	void build_system();
+	double solve_pressure(int& iterations);
+	void subtract_gradient(int axis);
+	void extrapolate(int axis);
+	void set_live(const std::vector<char>& need);
+	size_t system_bytes() const;
+
+	bool liquid(int x, int y, int z) const { return phi.clamped(x, y, z) < 0.f; }
+
+	tile_executor& exec;
+	int n;
+	float h;
+
+	brick_grid<float> phi, phi1;
+	brick_grid<float> vel[3], vel1[3];
+	brick_grid<float> pressure;
+	brick_grid<int> index;						// of liquid cells in the system, -1 elsewhere
+	brick_grid<unsigned char> mark0, mark1;		// extrapolation layer of each face
+	std::vector<int> bricks;					// live bricks, ascending
+
+	// Pressure system over the liquid cells, row i couples cell i with
+	// neighbours[6 i ...], -1 for air or wall
+	std::vector<int> cells;						// x + n (y + n z)
+	std::vector<int> neighbours;
+	std::vector<float> diag, rhs, x, r, z, p, q;
+
+	marching_cubes mc;
+};
+
+#endif
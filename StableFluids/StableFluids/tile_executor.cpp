@@ -0,0 +1,122 @@
+/*****************************************************************************
+ * Tile executor
+ *****************************************************************************/
+
+#include "tile_executor.h"
+
+tile_executor::tile_executor(int threads, int tile)
+	: tile(tile > 0 ? tile : 64), job(nullptr), job_size(0), next(0), active(0), generation(0), quit(false)
+{
+	int i;
+
+	if (threads <= 0)
+		threads = (int)std::thread::hardware_concurrency();
+	if (threads <= 0)
+		threads = 1;
+
+	for (i = 1; i < threads; i++)
+		workers.emplace_back(&tile_executor::worker_loop, this);
+}
+
+tile_executor::~tile_executor()
+{
+	{
+		std::lock_guard<std::mutex> l(lock);
+		quit = true;
+	}
+	wake.notify_all();
+	for (auto& t : workers)
+		t.join();
+}
+
+//========================================================================
+// Jobs
+//========================================================================
+
+void tile_executor::drain()
+{
+	int i;
+
+	while ((i = next.fetch_add(1)) < job_size)
+		(*job)(i);
+}
+
+void tile_executor::worker_loop()
+{
+	unsigned seen = 0;
+	std::unique_lock<std::mutex> l(lock);
+
+	for (;;)
+	{
+		wake.wait(l, [&] { return quit || generation != seen; });
+		if (quit)
+			return;
+		seen = generation;
+
+		l.unlock();
+		drain();
+		l.lock();
+
+		if (--active == 0)
+			done.notify_one();
+	}
+}
+
+void tile_executor::for_each(int n, const std::function<void(int)>& fn)
+{
+	int i;
+
+	if (n <= 0)
+		return;
+
+	// Not worth waking anybody
+	if (workers.empty() || n == 1)
+	{
+		for (i = 0; i < n; i++)
+			fn(i);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> l(lock);
+		job = &fn;
+		job_size = n;
+		next = 0;
+		active = (int)workers.size();
+		generation++;
+	}
+	wake.notify_all();
+
+	drain();
+
+	std::unique_lock<std::mutex> l(lock);
+	done.wait(l, [&] { return active == 0; });
+	job = nullptr;
+}
+
+void tile_executor::run(int w, int h, const std::function<void(int, int, int, int)>& fn)
+{
+	int tw = (w + tile - 1) / tile;
+	int th = (h + tile - 1) / tile;
+	int t = tile;
+
+	for_each(tw * th, [&](int i)
+	{
+		int x0 = (i % tw) * t;
+		int y0 = (i / tw) * t;
+
+		fn(x0, y0, x0 + t < w ? x0 + t : w, y0 + t < h ? y0 + t : h);
+	});
+}
+
+double tile_executor::sum(int n, const std::function<double(int)>& fn)
+{
+	std::vector<double> part(n > 0 ? n : 0);
+	double total = 0.0;
+	int i;
+
+	for_each(n, [&](int k) { part[k] = fn(k); });
+	for (i = 0; i < n; i++)
+		total += part[i];
+	return total;
+}
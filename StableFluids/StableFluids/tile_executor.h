@@ -0,0 +1,63 @@
+/*****************************************************************************
+ * Tile executor
+ *
+ * A fixed pool of worker threads that splits a grid pass into square tiles
+ * and hands them out through a shared counter, so a thread that finishes
+ * early simply takes the next tile.  The calling thread works as well and
+ * run() returns once every tile is done, which makes each call a barrier
+ * between solver stages.
+ *
+ * Calls must not be nested: a job may not start another job on the same
+ * executor.
+ *****************************************************************************/
+
+#ifndef TILE_EXECUTORH
+#define TILE_EXECUTORH
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class tile_executor
+{
+public:
+	// threads <= 0 uses every hardware thread
+	explicit tile_executor(int threads = 0, int tile = 64);
+	~tile_executor();
+
+	int thread_count() const { return (int)workers.size() + 1; }
+	int tile_size() const { return tile; }
+
+	// Call fn(i) for every i in [0, n)
+	void for_each(int n, const std::function<void(int)>& fn);
+
+	// Call fn(x0, y0, x1, y1) for every tile of a w x h grid, the ranges are
+	// half open
+	void run(int w, int h, const std::function<void(int, int, int, int)>& fn);
+
+	// Sum of fn(i) over [0, n), added up in index order so the result does
+	// not depend on the thread count
+	double sum(int n, const std::function<double(int)>& fn);
+
+private:
+	void worker_loop();
+	void drain();
+
+	int tile;
+	std::vector<std::thread> workers;
+
+	std::mutex lock;
+	std::condition_variable wake;
+	std::condition_variable done;
+	const std::function<void(int)>* job;
+	int job_size;
+	std::atomic<int> next;
+	int active;				// workers that have not finished the current job
+	unsigned generation;	// bumped for every job
+	bool quit;
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef AABBH
+#define AABBH
+
+#include <float.h>
+
+#include "ray.h"
+
+// Axis aligned box; an empty box has lo above hi
+class aabb {
+    public:
+        __host__ __device__ aabb() : lo(FLT_MAX, FLT_MAX, FLT_MAX), hi(-FLT_MAX, -FLT_MAX, -FLT_MAX) {}
+        __host__ __device__ aabb(const vec3& a, const vec3& b) : lo(a), hi(b) {}
+
+        // Comparisons rather than fminf/fmaxf, which the host compiles to
+        // library calls for their NaN rules
+        __host__ __device__ void grow(const vec3& p) {
+            for (int i = 0; i < 3; i++) {
+                lo[i] = p[i] < lo[i] ? p[i] : lo[i];
+                hi[i] = p[i] > hi[i] ? p[i] : hi[i];
+            }
+        }
+        // An empty b leaves the box as it is
+        __host__ __device__ void grow(const aabb& b) {
+            for (int i = 0; i < 3; i++) {
+                lo[i] = b.lo[i] < lo[i] ? b.lo[i] : lo[i];
+                hi[i] = b.hi[i] > hi[i] ? b.hi[i] : hi[i];
+            }
+        }
+        __host__ __device__ vec3 centroid() const { return 0.5f * (lo + hi); }
+
+        // Half the surface area, for the SAH
+        __host__ __device__ float half_area() const {
+            vec3 d = hi - lo;
+            return d[0] < 0.f ? 0.f : d[0] * d[1] + d[1] * d[2] + d[2] * d[0];
+        }
+
+        vec3 lo;
+        vec3 hi;
+};
+
+// Slab test of the box lo..hi against a ray given by its origin and the
+// inverse of its direction; t_enter is where it enters within t_min..t_max.
+// A ray along a face of the box gives 0 * inf = NaN for that slab, which
+// the comparisons ignore, where fminf/fmaxf would take the other bound.
+__host__ __device__ inline bool hit_slabs(const float *lo, const float *hi, const vec3& origin, const vec3& inv,
+	float t_min, float t_max, float& t_enter) {
+	for (int i = 0; i < 3; i++) {
+		float t0 = (lo[i] - origin[i]) * inv[i];
+		float t1 = (hi[i] - origin[i]) * inv[i];
+		if (t0 > t1) {
+			float s = t0;
+			t0 = t1;
+			t1 = s;
+		}
+		t_min = t0 > t_min ? t0 : t_min;
+		t_max = t1 < t_max ? t1 : t_max;
+	}
+	t_enter = t_min;
+	return t_min <= t_max;
+}
+
+#endif
@@ -0,0 +1,375 @@
+#ifndef BVHH
+#define BVHH
+
+// Bounding volume hierarchy over the primitives of a scene, in place of the
+// linear scan of hitable_list.
+//
+// A node is 32 bytes: its box, and either the first of its two children,
+// which sit next to each other, or the first of a leaf's primitives and
+// their count.  The tree is built on the host by binned SAH, BVH_BINS bins
+// along each axis of the centroid bounds, with subtrees of more than
+// BVH_PARALLEL_MIN primitives handed to threads of their own.  Traversal
+// keeps a stack of node indices and enters the nearer child first, so the
+// farther one is often skipped by the hit found in the meantime.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "hitable.h"
+
+#define BVH_BINS 16
+#define BVH_MAX_LEAF 8				// primitives of a leaf that no split pays for
+#define BVH_STACK 64
+#define BVH_MAX_DEPTH (BVH_STACK - 4)
+#define BVH_PARALLEL_MIN 4096		// primitives of a subtree worth a thread
+#define BVH_TRAVERSAL_COST 1.f		// of a node, against 1 for a primitive
+
+struct bvh_node {
+	float lo[3];
+	int first;		// left child, the right one after it; first primitive of a leaf
+	float hi[3];
+	int count;		// primitives of a leaf, 0 inside
+};
+
+struct bvh_build_stats {
+	double seconds;
+	int nodes;
+	int leaves;
+	int depth;
+	float sah_cost;		// expected node and primitive tests per ray through the root
+};
+
+// Box of the tree under nodes[0]
+__host__ __device__ inline aabb bvh_bounds(const bvh_node *nodes, int node_count) {
+	if (node_count == 0)
+		return aabb();
+	return aabb(vec3(nodes[0].lo[0], nodes[0].lo[1], nodes[0].lo[2]), vec3(nodes[0].hi[0], nodes[0].hi[1], nodes[0].hi[2]));
+}
+
+class bvh : public hitable {
+public:
+	__host__ __device__ bvh() : nodes(0), node_count(0), prims(0), prim_count(0) {}
+	__host__ __device__ bvh(bvh_node *n, int nn, hitable **p, int np) : nodes(n), node_count(nn), prims(p), prim_count(np) {}
+	__host__ __device__ virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+	__host__ __device__ virtual aabb bounding_box() const { return bvh_bounds(nodes, node_count); }
+
+	bvh_node *nodes;
+	int node_count;
+	hitable **prims;		// in leaf order
+	int prim_count;
+};
+
+// Nearest hit of r among the primitives in the leaves of nodes, which
+// prims.hit(i, r, t_min, t_max, rec) tests by their index in leaf order
+template<class Prims>
+__host__ __device__ bool bvh_traverse(const bvh_node *nodes, int node_count, const Prims& prims,
+	const ray& r, float t_min, float t_max, hit_record& rec) {
+	vec3 origin = r.origin(), d = r.direction();
+	vec3 inv(1.0f / d[0], 1.0f / d[1], 1.0f / d[2]);
+	int stack[BVH_STACK];
+	float enter[BVH_STACK];
+	int top = 0, n = 0;
+	float closest = t_max, t0, t1;
+	bool hit_anything = false;
+	hit_record temp_rec;
+
+	if (node_count == 0 || !hit_slabs(nodes[0].lo, nodes[0].hi, origin, inv, t_min, closest, t0))
+		return false;
+
+	for (;;) {
+		const bvh_node& node = nodes[n];
+
+		if (node.count > 0) {
+			for (int i = node.first; i < node.first + node.count; i++) {
+				if (prims.hit(i, r, t_min, closest, temp_rec)) {
+					hit_anything = true;
+					closest = temp_rec.t;
+					rec = temp_rec;
+				}
+			}
+		}
+		else {
+			bool h0 = hit_slabs(nodes[node.first].lo, nodes[node.first].hi, origin, inv, t_min, closest, t0);
+			bool h1 = hit_slabs(nodes[node.first + 1].lo, nodes[node.first + 1].hi, origin, inv, t_min, closest, t1);
+
+			if (h0 && h1) {
+				bool left_first = t0 <= t1;
+				stack[top] = left_first ? node.first + 1 : node.first;
+				enter[top++] = left_first ? t1 : t0;
+				n = left_first ? node.first : node.first + 1;
+				continue;
+			}
+			if (h0 || h1) {
+				n = h0 ? node.first : node.first + 1;
+				continue;
+			}
+		}
+
+		// Next node on the stack that a closer hit has not ruled out
+		while (top > 0 && enter[top - 1] > closest)
+			top--;
+		if (top == 0)
+			break;
+		n = stack[--top];
+	}
+	return hit_anything;
+}
+
+// Primitives of a bvh reached through hitable pointers
+struct bvh_hitables {
+	hitable **prims;
+
+	__host__ __device__ bool hit(int i, const ray& r, float t_min, float t_max, hit_record& rec) const {
+		return prims[i]->hit(r, t_min, t_max, rec);
+	}
+
+	__host__ __device__ aabb bounding_box(int i) const { return prims[i]->bounding_box(); }
+};
+
+__host__ __device__ inline bool bvh::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+	bvh_hitables p = { prims };
+	return bvh_traverse(nodes, node_count, p, r, t_min, t_max, rec);
+}
+
+// A primitive as the builder moves it around
+struct bvh_prim {
+	aabb box;
+	vec3 centre;
+	int index;		// in the boxes given
+};
+
+// Bins per unit of an extent cut into bins, 0 where the extent is too
+// small for the division to stay finite, as it is where centroids differ
+// only by a denormal
+inline float bvh_bin_scale(float bins, float extent) {
+	return extent > 0.f && bins / extent < FLT_MAX ? bins / extent : 0.f;
+}
+
+// Threads to use when threads asks for all cores
+inline int bvh_threads(int threads) {
+	return threads > 0 ? threads : std::max(1, (int)std::thread::hardware_concurrency());
+}
+
+// Host side construction
+class bvh_builder {
+public:
+	bvh_builder(const aabb *boxes, int n, int threads) : prims(n), nodes(std::max(1, 2 * n - 1)), used(1) {
+		spare = bvh_threads(threads) - 1;
+		for (int i = 0; i < n; i++) {
+			prims[i].box = boxes[i];
+			prims[i].centre = prims[i].box.centroid();
+			prims[i].index = i;
+		}
+	}
+
+	// Bounds of prims[first, first + count) and of their centroids
+	void bounds(int first, int count, aabb& box, aabb& centres) const {
+		box = aabb();
+		centres = aabb();
+		for (int i = first; i < first + count; i++) {
+			box.grow(prims[i].box);
+			centres.grow(prims[i].centre);
+		}
+	}
+
+	// Node over prims[first, first + count), which box and centres bound
+	void build(int node, int first, int count, int depth, const aabb& box, const aabb& centres) {
+		for (int a = 0; a < 3; a++) {
+			nodes[node].lo[a] = box.lo[a];
+			nodes[node].hi[a] = box.hi[a];
+		}
+		nodes[node].first = first;
+		nodes[node].count = count;
+		if (count <= 1 || depth >= BVH_MAX_DEPTH)
+			return;
+
+		// Bin along the three axes in one pass, keeping the bounds of the
+		// boxes and centroids in each bin for the children
+		int bin_count[3][BVH_BINS] = {};
+		aabb bin_box[3][BVH_BINS], bin_centres[3][BVH_BINS];
+		float scale[3];
+		for (int a = 0; a < 3; a++) {
+			scale[a] = bvh_bin_scale((float)BVH_BINS, centres.hi[a] - centres.lo[a]);
+		}
+		for (int i = first; i < first + count; i++) {
+			const bvh_prim& p = prims[i];
+			for (int a = 0; a < 3; a++) {
+				int b = bin_of(p.centre[a], centres.lo[a], scale[a]);
+				bin_count[a][b]++;
+				bin_box[a][b].grow(p.box);
+				bin_centres[a][b].grow(p.centre);
+			}
+		}
+
+		// Cheapest plane between bins, by the area of each side times its
+		// primitives
+		int best_axis = -1, best_split = 0;
+		float best_cost = FLT_MAX;
+		for (int a = 0; a < 3; a++) {
+			if (scale[a] == 0.f)
+				continue;
+
+			float right_area[BVH_BINS];
+			int right_count[BVH_BINS];
+			aabb right, left;
+			int nr = 0, nl = 0;
+			for (int b = BVH_BINS - 1; b > 0; b--) {
+				right.grow(bin_box[a][b]);
+				nr += bin_count[a][b];
+				right_area[b] = right.half_area();
+				right_count[b] = nr;
+			}
+			for (int b = 0; b < BVH_BINS - 1; b++) {
+				left.grow(bin_box[a][b]);
+				nl += bin_count[a][b];
+				if (nl == 0 || right_count[b + 1] == 0)
+					continue;
+				float cost = left.half_area() * nl + right_area[b + 1] * right_count[b + 1];
+				if (cost < best_cost) {
+					best_cost = cost;
+					best_axis = a;
+					best_split = b + 1;
+				}
+			}
+		}
+
+		int mid;
+		aabb box_l, box_r, centres_l, centres_r;
+		if (best_axis < 0) {
+			// Centroids all in one place
+			if (count <= BVH_MAX_LEAF)
+				return;
+			mid = first + count / 2;
+			bounds(first, mid - first, box_l, centres_l);
+			bounds(mid, first + count - mid, box_r, centres_r);
+		}
+		else {
+			float area = box.half_area();
+			float split_cost = BVH_TRAVERSAL_COST + (area > 0.f ? best_cost / area : (float)count);
+			if (split_cost >= (float)count && count <= BVH_MAX_LEAF)
+				return;
+
+			int a = best_axis;
+			float lo = centres.lo[a], s = scale[a];
+			bvh_prim *split = std::partition(&prims[first], &prims[first] + count, [&](const bvh_prim& p) {
+				return bin_of(p.centre[a], lo, s) < best_split;
+			});
+			mid = (int)(split - &prims[0]);
+			for (int b = 0; b < BVH_BINS; b++) {
+				(b < best_split ? box_l : box_r).grow(bin_box[a][b]);
+				(b < best_split ? centres_l : centres_r).grow(bin_centres[a][b]);
+			}
+		}
+
+		int left = used.fetch_add(2);
+		nodes[node].first = left;
+		nodes[node].count = 0;
+
+		int nl = mid - first, nr = count - nl;
+		if (std::min(nl, nr) >= BVH_PARALLEL_MIN && take_thread()) {
+			std::thread t([=]() { build(left, first, nl, depth + 1, box_l, centres_l); });
+			build(left + 1, mid, nr, depth + 1, box_r, centres_r);
+			t.join();
+			spare++;
+		}
+		else {
+			build(left, first, nl, depth + 1, box_l, centres_l);
+			build(left + 1, mid, nr, depth + 1, box_r, centres_r);
+		}
+	}
+
+	std::vector<bvh_prim> prims;
+	std::vector<bvh_node> nodes;
+	std::atomic<int> used;
+
+private:
+	static int bin_of(float c, float lo, float scale) {
+		return std::min(BVH_BINS - 1, (int)((c - lo) * scale));
+	}
+
+	bool take_thread() {
+		int s = spare.load();
+		while (s > 0)
+			if (spare.compare_exchange_weak(s, s - 1))
+				return true;
+		return false;
+	}
+
+	std::atomic<int> spare;
+};
+
+// Nodes, leaves, depth and SAH cost of the subtree at n
+inline void bvh_measure(const bvh_node *nodes, int n, int depth, float root_area, bvh_build_stats& st) {
+	const bvh_node& node = nodes[n];
+	aabb box(vec3(node.lo[0], node.lo[1], node.lo[2]), vec3(node.hi[0], node.hi[1], node.hi[2]));
+	float p = root_area > 0.f ? box.half_area() / root_area : 1.f;
+
+	st.nodes++;
+	st.depth = std::max(st.depth, depth);
+	if (node.count > 0) {
+		st.leaves++;
+		st.sah_cost += p * node.count;
+		return;
+	}
+	st.sah_cost += p * BVH_TRAVERSAL_COST;
+	bvh_measure(nodes, node.first, depth + 1, root_area, st);
+	bvh_measure(nodes, node.first + 1, depth + 1, root_area, st);
+}
+
+// Nodes over boxes[0..n) on up to threads threads, all cores for 0, as a
+// new[] array of count; order receives the primitives in leaf order
+inline bvh_node *build_bvh_nodes(const aabb *boxes, int n, int threads, int *order, int& count) {
+	bvh_builder b(boxes, n, threads);
+	if (n > 0) {
+		aabb box, centres;
+		b.bounds(0, n, box, centres);
+		b.build(0, 0, n, 0, box, centres);
+	}
+
+	count = n > 0 ? b.used.load() : 0;
+	bvh_node *nodes = new bvh_node[std::max(count, 1)];
+	std::copy(b.nodes.begin(), b.nodes.begin() + count, nodes);
+	for (int i = 0; i < n; i++)
+		order[i] = b.prims[i].index;
+	return nodes;
+}
+
+// Statistics of a tree whose build started at t0
+inline void bvh_fill_stats(const bvh_node *nodes, int count, std::chrono::steady_clock::time_point t0, bvh_build_stats *stats) {
+	if (!stats)
+		return;
+	*stats = bvh_build_stats();
+	stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	if (count > 0)
+		bvh_measure(nodes, 0, 1, bvh_bounds(nodes, count).half_area(), *stats);
+}
+
+// Tree over list[0..n) on up to threads threads, all cores for 0.  The
+// nodes and the reordered primitives are new[] arrays, released by
+// free_bvh(); the primitives themselves stay with the caller.
+inline bvh *build_bvh(hitable **list, int n, int threads = 0, bvh_build_stats *stats = nullptr) {
+	auto t0 = std::chrono::steady_clock::now();
+	std::vector<aabb> boxes(n);
+	std::vector<int> order(n);
+	for (int i = 0; i < n; i++)
+		boxes[i] = list[i]->bounding_box();
+
+	int count;
+	bvh_node *nodes = build_bvh_nodes(boxes.data(), n, threads, order.data(), count);
+	hitable **prims = new hitable *[std::max(n, 1)];
+	for (int i = 0; i < n; i++)
+		prims[i] = list[order[i]];
+	bvh_fill_stats(nodes, count, t0, stats);
+	return new bvh(nodes, count, prims, n);
+}
+
+inline void free_bvh(bvh *tree) {
+	delete[] tree->nodes;
+	delete[] tree->prims;
+	delete tree;
+}
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef BVH_REFITH
+#define BVH_REFITH
+
+// Refitting a tree to primitives that have moved without changing which
+// ones there are: fluid frames of the same connectivity, or a heightfield
+// whose vertices move up and down.
+//
+// A refit keeps the tree and recomputes the boxes after the children's,
+// the top of the tree split across threads.  It costs a pass over the
+// nodes, but the tree fits the motion less and less well, so dynamic_bvh
+// measures the SAH cost on the way and builds a new tree once that cost
+// passes max_degradation times what it was just after the last build.
+// The node pass is the same for every layout, over whatever gives the box
+// of the i-th primitive in leaf order; mesh_bvh and scene refit through
+// it as well, after working out the edges of their moved triangles.
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include "bvh.h"
+#include "lbvh.h"
+
+#define BVH_REFIT_MAX_DEGRADATION 1.3f		// of the SAH cost before a rebuild
+
+// Refits the subtree at n of nodes over prims, the primitives in leaf
+// order, and returns the sum of its node areas weighted by their costs,
+// the SAH cost times the area of the root.  Both children of a node above
+// depth split go to threads of their own.
+template<class Prims>
+inline float bvh_refit_node(bvh_node *nodes, const Prims& prims, int n, int depth, int split) {
+	bvh_node& node = nodes[n];
+	aabb box;
+	float cost;
+
+	if (node.count > 0) {
+		for (int i = node.first; i < node.first + node.count; i++)
+			box.grow(prims.bounding_box(i));
+		cost = box.half_area() * node.count;
+	}
+	else {
+		int c = node.first;
+		float left;
+		if (depth < split) {
+			std::thread t([&]() { left = bvh_refit_node(nodes, prims, c, depth + 1, split); });
+			cost = bvh_refit_node(nodes, prims, c + 1, depth + 1, split);
+			t.join();
+		}
+		else {
+			left = bvh_refit_node(nodes, prims, c, depth + 1, split);
+			cost = bvh_refit_node(nodes, prims, c + 1, depth + 1, split);
+		}
+		cost += left;
+
+		const bvh_node& l = nodes[c];
+		const bvh_node& r = nodes[c + 1];
+		box = aabb(vec3(std::min(l.lo[0], r.lo[0]), std::min(l.lo[1], r.lo[1]), std::min(l.lo[2], r.lo[2])),
+			vec3(std::max(l.hi[0], r.hi[0]), std::max(l.hi[1], r.hi[1]), std::max(l.hi[2], r.hi[2])));
+		cost += box.half_area() * BVH_TRAVERSAL_COST;
+	}
+
+	for (int a = 0; a < 3; a++) {
+		node.lo[a] = box.lo[a];
+		node.hi[a] = box.hi[a];
+	}
+	return cost;
+}
+
+// Refits nodes over prims on up to threads threads, all cores for 0, and
+// returns the SAH cost as bvh_build_stats counts it
+template<class Prims>
+inline float refit_bvh_nodes(bvh_node *nodes, int node_count, const Prims& prims, int threads = 0) {
+	if (node_count == 0)
+		return 0.f;
+	if (threads <= 0)
+		threads = std::max(1, (int)std::thread::hardware_concurrency());
+	int split = 0;
+	while ((1 << split) < threads)
+		split++;
+
+	float cost = bvh_refit_node(nodes, prims, 0, 0, split);
+	float area = bvh_bounds(nodes, node_count).half_area();
+	return area > 0.f ? cost / area : 0.f;
+}
+
+inline float refit_bvh(bvh *tree, int threads = 0) {
+	bvh_hitables prims = { tree->prims };
+	return refit_bvh_nodes(tree->nodes, tree->node_count, prims, threads);
+}
+
+// A tree over the caller's primitives that follows them as they move
+class dynamic_bvh {
+public:
+	// Over list[0..n), which must stay valid and keep its primitives;
+	// rebuilt as a linear BVH if lbvh, else by binned SAH
+	dynamic_bvh(hitable **list, int n, int threads = 0, bool lbvh = false,
+		float max_degradation = BVH_REFIT_MAX_DEGRADATION)
+		: list(list), n(n), threads(threads), lbvh(lbvh), max_degradation(max_degradation),
+		tree(nullptr), rebuilds(0), refits(0), seconds(0.0) {
+		build();
+	}
+
+	~dynamic_bvh() { free_bvh(tree); }
+
+	// After the primitives have moved: refits the tree, or builds a new one
+	// if the refit left it too slow.  Returns whether it rebuilt.
+	bool update() {
+		auto t0 = std::chrono::steady_clock::now();
+		cost = refit_bvh(tree, threads);
+		refits++;
+		bool rebuild = cost > max_degradation * built.sah_cost;
+		if (rebuild) {
+			free_bvh(tree);
+			build();
+		}
+		seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+		return rebuild;
+	}
+
+	bvh *get() const { return tree; }
+
+	hitable **list;
+	int n;
+	int threads;
+	bool lbvh;
+	float max_degradation;
+
+	bvh *tree;
+	bvh_build_stats built;	// of the last build
+	float cost;				// SAH cost now
+	int rebuilds;			// since construction, the first build not counted
+	int refits;
+	double seconds;			// of the last update
+
+private:
+	void build() {
+		tree = lbvh ? build_lbvh(list, n, threads, &built) : build_bvh(list, n, threads, &built);
+		if (refits > 0)
+			rebuilds++;
+		cost = built.sah_cost;
+	}
+};
+
+#endif
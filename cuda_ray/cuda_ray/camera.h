@@ -5,13 +5,13 @@
 
 class camera {
     public:
-        __device__ camera() {
+        __host__ __device__ camera() {
             lower_left_corner = vec3(-1.0, -1.0, -1.0);
             horizontal = vec3(2.0, 0.0, 0.0);
             vertical = vec3(0.0, 2.0, 0.0);
             origin = vec3(0.0, 0.0, 2.0);
         }
-        __device__ ray get_ray(float u, float v) { return ray(origin, lower_left_corner + u*horizontal + v*vertical - origin); }
+        __host__ __device__ ray get_ray(float u, float v) const { return ray(origin, lower_left_corner + u*horizontal + v*vertical - origin); }
 
         vec3 origin;
         vec3 lower_left_corner;
@@ -1,7 +1,7 @@
 #ifndef HITABLEH
 #define HITABLEH
 
-#include "ray.h"
+#include "aabb.h"
 
 struct hit_record
 {
@@ -12,7 +12,9 @@ struct hit_record
 
 class hitable  {
     public:
-        __device__ virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const = 0;
+        __host__ __device__ virtual ~hitable() {}
+        __host__ __device__ virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const = 0;
+        __host__ __device__ virtual aabb bounding_box() const = 0;
 };
 
 #endif
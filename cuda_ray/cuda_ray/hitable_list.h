@@ -5,14 +5,20 @@
 
 class hitable_list: public hitable  {
     public:
-        __device__ hitable_list() {}
-        __device__ hitable_list(hitable **l, int n) {list = l; list_size = n; }
-        __device__ virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
+        __host__ __device__ hitable_list() {}
+        __host__ __device__ hitable_list(hitable **l, int n) {list = l; list_size = n; }
+        __host__ __device__ virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
+        __host__ __device__ virtual aabb bounding_box() const {
+            aabb box;
+            for (int i = 0; i < list_size; i++)
+                box.grow(list[i]->bounding_box());
+            return box;
+        }
         hitable **list;
         int list_size;
 };
 
-__device__ bool hitable_list::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+__host__ __device__ bool hitable_list::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
         hit_record temp_rec;
         bool hit_anything = false;
         float closest_so_far = t_max;
@@ -0,0 +1,12 @@
+#ifndef HOST_DEVICEH
+#define HOST_DEVICEH
+
+// Without nvcc the CUDA qualifiers expand to nothing, so the scene, camera
+// and shading headers compile as plain C++ for the host backend
+#ifndef __CUDACC__
+#define __host__
+#define __device__
+#define __global__
+#endif
+
+#endif
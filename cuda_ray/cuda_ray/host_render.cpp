@@ -0,0 +1,433 @@
+// Host backend: renders the scene of kernel.cu on the CPU, for render nodes
+// without an NVIDIA GPU.  The scene, camera and shading headers compile as
+// plain C++ through host_device.h, so no CUDA toolkit is needed:
+//
+//   g++ -std=c++14 -O2 -march=native -pthread host_render.cpp ../../FluidWave/FluidWave/wave_solver.c -o ray_host
+//   ray_host [mesh.obj] [threads] [bvh|lbvh|mesh|mesh-lbvh|scene|scene-cache|heightfield|simd|list] [frames]
+//
+// The image is cut into 16x16 tiles that threads take from a shared counter
+// as they finish, so tiles covering most of the mesh do not hold up the
+// rest.  The result is written to test.ppm as the CUDA build does.  The
+// triangles go into an SAH BVH, or a linear one for lbvh, unless list is
+// given, which keeps the linear scan of hitable_list for comparison.  mesh
+// and mesh-lbvh keep the triangles in a flat triangle_mesh instead of one
+// object each, and scene puts them in a scene of tagged primitives with the
+// sphere of kernel.cu's create_world.  scene-cache maps that scene from
+// mesh.obj.scene when the file is a cache of the mesh as it is now, and
+// otherwise builds it and writes the cache, reporting the startup time
+// either way.  heightfield ignores the mesh and builds the scene straight
+// from the grid of FluidWave's solver through a heightfield_view.  simd
+// tests the triangles of a leaf SIMD_WIDTH at a time, as wide as -march
+// allows, and times the same tree with one triangle at a time and with
+// packets of coherent rays as well.  The load rate of the OBJ file, storage
+// per triangle, build time, SAH cost and rays per second are reported.
+// With frames, a wave then runs through the mesh for that many more frames,
+// the tree refitted to each and rebuilt when it has degraded too far, or
+// for mesh and mesh-lbvh only refitted.  For heightfield the solver is
+// stepped instead and the scene refitted to its grid the same way, and the
+// last grid is written to wave.obj so the image can be checked against the
+// mesh path.
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "vec3.h"
+#include "ray.h"
+#include "sphere.h"
+#include "triangle.h"
+#include "hitable_list.h"
+#include "bvh.h"
+#include "lbvh.h"
+#include "bvh_refit.h"
+#include "mesh_bvh.h"
+#include "scene.h"
+#include "scene_cache.h"
+#include "simd_bvh.h"
+#include "camera.h"
+#include "obj_file.h"
+#include "render.h"
+#include "../../FluidWave/FluidWave/wave_solver.h"
+
+#define TILE 16
+#define WAVE_HEIGHT 0.02f
+#define WAVE_NUMBER 12.f
+#define WAVE_SPEED 0.4f		// radians per frame
+#define WAVE_STEPS 2		// calc_grid() steps per frame, as wave.c at 60 Hz
+#define PACKET_X (SIMD_WIDTH >= 8 ? 4 : 2)		// pixels of a ray packet
+#define PACKET_Y (SIMD_WIDTH / PACKET_X)
+
+// Corners of face i; OBJ indices count from 1, false if out of range
+static bool face_corners(float **vertex, int **face, int VN, int i, vec3 *v) {
+	for (int k = 0; k < 3; k++) {
+		int idx = face[k][i] - 1;
+		if (idx < 0 || idx >= VN)
+			return false;
+		v[k] = vec3(vertex[0][idx], vertex[1][idx], vertex[2][idx]);
+	}
+	return true;
+}
+
+// One triangle per face, faces out of range dropped
+static void create_triangles(float **vertex, int **face, int VN, int FN, std::vector<hitable *>& list) {
+	for (int i = 0; i < FN; i++) {
+		vec3 v[3], n(0, 0, 1);
+		if (face_corners(vertex, face, VN, i, v))
+			list.push_back(new triangle(v[0], v[1], v[2], n, 1));
+	}
+}
+
+// The triangles of create_triangles() with every vertex lifted by a wave
+// along x at phase
+static void wave_triangles(float **vertex, int **face, int VN, int FN, float phase, std::vector<hitable *>& list) {
+	size_t k = 0;
+	for (int i = 0; i < FN; i++) {
+		vec3 v[3], n(0, 0, 1);
+		if (!face_corners(vertex, face, VN, i, v))
+			continue;
+		for (int j = 0; j < 3; j++)
+			v[j][1] += WAVE_HEIGHT * sinf(WAVE_NUMBER * v[j][0] + phase);
+		*static_cast<triangle *>(list[k++]) = triangle(v[0], v[1], v[2], n, 1);
+	}
+}
+
+// The grid of view as an OBJ file, vertices and triangles in view order
+static bool write_heightfield_obj(const char *path, const heightfield_view& view) {
+	FILE *fp = fopen(path, "w");
+	if (!fp)
+		return false;
+	for (int i = 0; i < heightfield_vertex_count(&view); i++) {
+		float v[3];
+		heightfield_vertex(&view, i, v);
+		fprintf(fp, "v %.9g %.9g %.9g\n", v[0], v[1], v[2]);
+	}
+	for (int t = 0; t < heightfield_triangle_count(&view); t++) {
+		int idx[3];
+		heightfield_triangle(&view, t, idx);
+		fprintf(fp, "f %d %d %d\n", idx[0] + 1, idx[1] + 1, idx[2] + 1);
+	}
+	return fclose(fp) == 0;
+}
+
+static void print_load(const obj_load_stats& load) {
+	std::cerr << "Read " << load.vertices << " vertices and " << load.triangles << " triangles in " << 1000.0 * load.seconds;
+	std::cerr << " ms on " << load.threads << " threads, " << load.bytes / std::max(load.seconds, 1e-9) * 1e-9 << " GB/s.\n";
+}
+
+static void print_build(const char *name, const bvh_build_stats& st) {
+	std::cerr << name << " of " << st.nodes << " nodes, " << st.leaves << " leaves, depth " << st.depth;
+	std::cerr << ", SAH cost " << st.sah_cost << ", built in " << 1000.0 * st.seconds << " ms.\n";
+}
+
+// Calls f(x0, y0, x1, y1) for each tile of the image on threads threads
+template<class F>
+static void for_tiles(int nx, int ny, int threads, const F& f) {
+	int tiles_x = (nx + TILE - 1) / TILE, tiles_y = (ny + TILE - 1) / TILE;
+	std::atomic<int> next(0);
+
+	auto work = [&]() {
+		for (int t = next++; t < tiles_x * tiles_y; t = next++) {
+			int x0 = t % tiles_x * TILE, y0 = t / tiles_x * TILE;
+			f(x0, y0, std::min(x0 + TILE, nx), std::min(y0 + TILE, ny));
+		}
+	};
+
+	std::vector<std::thread> pool;
+	for (int i = 1; i < threads; i++)
+		pool.emplace_back(work);
+	work();
+	for (std::thread& t : pool)
+		t.join();
+}
+
+template<class World>
+static void render_tiles(vec3 *fb, int nx, int ny, const camera& cam, const World *world, int threads) {
+	for_tiles(nx, ny, threads, [&](int x0, int y0, int x1, int y1) {
+		for (int j = y0; j < y1; j++)
+			for (int i = x0; i < x1; i++)
+				fb[j * nx + i] = render_pixel(i, j, nx, ny, cam, world);
+	});
+}
+
+// As render_tiles(), PACKET_X x PACKET_Y pixels at a time
+static void render_packets(vec3 *fb, int nx, int ny, const camera& cam, const simd_bvh *world, int threads) {
+	for_tiles(nx, ny, threads, [&](int x0, int y0, int x1, int y1) {
+		ray rays[SIMD_WIDTH];
+		bool hit[SIMD_WIDTH];
+		hit_record rec[SIMD_WIDTH];
+		for (int y = y0; y < y1; y += PACKET_Y)
+			for (int x = x0; x < x1; x += PACKET_X) {
+				// Pixels past the edge repeat the last one
+				for (int k = 0; k < SIMD_WIDTH; k++) {
+					int i = std::min(x + k % PACKET_X, x1 - 1), j = std::min(y + k / PACKET_X, y1 - 1);
+					rays[k] = cam.get_ray(float(i) / float(nx), float(j) / float(ny));
+				}
+				world->hit_packet(rays, 0.0, FLT_MAX, hit, rec);
+				for (int k = 0; k < SIMD_WIDTH; k++) {
+					int i = x + k % PACKET_X, j = y + k / PACKET_X;
+					if (i < x1 && j < y1)
+						fb[j * nx + i] = shade(rays[k], hit[k], rec[k]);
+				}
+			}
+	});
+}
+
+// A simd_bvh tested one triangle at a time, for comparison
+struct simd_bvh_scalar {
+	const simd_bvh *tree;
+
+	bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+		return tree->hit_scalar(r, t_min, t_max, rec);
+	}
+};
+
+static double mrays(int nx, int ny, std::chrono::steady_clock::time_point start) {
+	return nx * ny / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1e-6;
+}
+
+int main(int argc, char *argv[]) {
+	int nx = 512;
+	int ny = 512;
+	const char *path = argc > 1 ? argv[1] : "G:\\outputFile\\data_part77.obj";
+	int threads = argc > 2 ? atoi(argv[2]) : 0;
+	const char *accel = argc > 3 ? argv[3] : "bvh";
+	bool linear = strcmp(accel, "list") == 0;
+	bool flat = strncmp(accel, "mesh", 4) == 0;
+	bool cached = strcmp(accel, "scene-cache") == 0;
+	bool field = strcmp(accel, "heightfield") == 0;
+	bool tagged = strcmp(accel, "scene") == 0 || cached || field;
+	bool wide = strcmp(accel, "simd") == 0;
+	int frames = argc > 4 ? atoi(argv[4]) : 0;
+
+	if (threads <= 0)
+		threads = std::max(1, (int)std::thread::hardware_concurrency());
+	std::cerr << "Rendering a " << nx << "x" << ny << " image on " << threads << " threads ";
+	std::cerr << "in " << TILE << "x" << TILE << " tiles.\n";
+
+	// A cache hit needs no parsing; the flat layouts parse straight into a
+	// triangle_mesh, and a scene straight into its builder
+	auto startup = std::chrono::steady_clock::now();
+	std::string cache_path = std::string(path) + ".scene";
+	mapped_file cache;
+	scene sc = scene();
+	bool warm = cached && open_scene_cache(cache_path.c_str(), path, cache, sc);
+
+	float **VertexK = new float *[3]();
+	int **FaceK = new int*[3]();
+	int VN = 0, FN = 0;
+	triangle_mesh mesh = triangle_mesh();
+	obj_load_stats load = obj_load_stats();
+	if (!tagged) {
+		// ReadOBJFile() reports its own failure
+		bool read;
+		if (flat || wide) {
+			read = load_triangle_mesh(path, mesh, threads, &load);
+			if (!read)
+				std::cerr << "Failure opening file at \"" << path << "\".\n";
+		}
+		else
+			read = ReadOBJFile(path, VertexK, FaceK, VN, FN, threads, &load);
+		if (!read)
+			return EXIT_FAILURE;
+		print_load(load);
+	}
+
+	std::vector<hitable *> list;
+	hitable *world = nullptr;
+	dynamic_bvh *tree = nullptr;
+	mesh_bvh *flat_tree = nullptr;
+	simd_bvh *wide_tree = nullptr;
+	bvh_build_stats built = bvh_build_stats();
+	int field_first = 0;
+	if (warm) {
+		std::cerr << "Mapped a scene of " << sc.triangles.triangle_count << " triangles and " << sc.spheres.count;
+		std::cerr << " spheres, " << sc.bytes << " bytes, from " << cache_path << ".\n";
+	}
+	else if (tagged) {
+		scene_builder b;
+		bvh_build_stats st;
+		if (field) {
+			// The live grid, stepped below for each frame
+			heightfield_view view;
+			init_grid();
+			dt = MAX_DELTA_T;
+			wave_heightfield(&view);
+			field_first = b.add_heightfield(view, threads);
+		}
+		else {
+			if (!b.add_obj(path, threads, &load)) {
+				std::cerr << "Failure opening file at \"" << path << "\".\n";
+				return EXIT_FAILURE;
+			}
+			print_load(load);
+			b.add_sphere(vec3(0, 0, -1), 0.5);
+		}
+		b.build(sc, threads, false, &st);
+		std::cerr << "Scene of " << b.triangle_count() << " triangles and " << b.sphere_count() << " spheres in one block of " << sc.bytes << " bytes.\n";
+		print_build("BVH", st);
+		built = st;
+		if (cached && !save_scene_cache(cache_path.c_str(), path, sc))
+			std::cerr << "Failure writing " << cache_path << "\n";
+	}
+	else if (wide) {
+		bvh_build_stats st;
+		wide_tree = build_simd_bvh(mesh, threads, false, &st);
+		world = wide_tree;
+		free_triangle_mesh(mesh);
+		size_t bytes = wide_tree->groups.size() * sizeof(simd_group);
+		std::cerr << SIMD_WIDTH << " wide groups of " << bytes << " bytes, " << (double)bytes / std::max(wide_tree->triangle_count, 1) << " per triangle.\n";
+		print_build("BVH", st);
+	}
+	else if (flat) {
+		size_t bytes = triangle_mesh_bytes(mesh);
+		std::cerr << "Flat mesh of " << bytes << " bytes, " << (double)bytes / std::max(mesh.triangle_count, 1) << " per triangle.\n";
+
+		bvh_build_stats st;
+		flat_tree = build_mesh_bvh(mesh, threads, strcmp(accel, "mesh-lbvh") == 0, &st);
+		world = flat_tree;
+		print_build(strcmp(accel, "mesh-lbvh") == 0 ? "LBVH" : "BVH", st);
+	}
+	else {
+		create_triangles(VertexK, FaceK, VN, FN, list);
+		size_t bytes = list.size() * (sizeof(triangle) + sizeof(hitable *));
+		std::cerr << "Triangle objects of " << bytes << " bytes, " << (double)bytes / std::max(list.size(), (size_t)1);
+		std::cerr << " per triangle before heap overhead.\n";
+	}
+
+	if (linear) {
+		world = new hitable_list(list.data(), (int)list.size());
+	}
+	else if (!flat && !tagged && !wide) {
+		tree = new dynamic_bvh(list.data(), (int)list.size(), threads, strcmp(accel, "lbvh") == 0);
+		world = tree->get();
+		print_build(tree->lbvh ? "LBVH" : "BVH", tree->built);
+	}
+	if (cached) {
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startup).count();
+		std::cerr << (warm ? "Warm" : "Cold") << " startup in " << 1000.0 * seconds << " ms.\n";
+	}
+	camera cam;
+	std::vector<vec3> fb((size_t)nx * ny);
+
+	auto start = std::chrono::steady_clock::now();
+	if (tagged)
+		render_tiles(fb.data(), nx, ny, cam, &sc, threads);
+	else
+		render_tiles(fb.data(), nx, ny, cam, world, threads);
+	double timer_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cerr << "took " << timer_seconds << " seconds, " << nx * ny / timer_seconds * 1e-6 << " Mrays/s.\n";
+
+	if (wide) {
+		// The same tree one triangle at a time, then in packets
+		std::vector<vec3> other((size_t)nx * ny);
+		simd_bvh_scalar scalar = { wide_tree };
+		start = std::chrono::steady_clock::now();
+		render_tiles(other.data(), nx, ny, cam, &scalar, threads);
+		std::cerr << "scalar: " << mrays(nx, ny, start) << " Mrays/s.\n";
+		start = std::chrono::steady_clock::now();
+		render_packets(other.data(), nx, ny, cam, wide_tree, threads);
+		std::cerr << PACKET_X << "x" << PACKET_Y << " packets: " << mrays(nx, ny, start) << " Mrays/s.\n";
+	}
+
+	for (int f = 1; f <= frames && tree; f++) {
+		wave_triangles(VertexK, FaceK, VN, FN, WAVE_SPEED * f, list);
+		bool rebuilt = tree->update();
+		world = tree->get();
+
+		start = std::chrono::steady_clock::now();
+		render_tiles(fb.data(), nx, ny, cam, world, threads);
+		timer_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::cerr << "frame " << f << ": " << (rebuilt ? "rebuilt" : "refitted") << " in " << 1000.0 * tree->seconds << " ms, ";
+		std::cerr << "SAH cost " << tree->cost << ", " << nx * ny / timer_seconds * 1e-6 << " Mrays/s.\n";
+	}
+	if (tree && frames > 0)
+		std::cerr << tree->refits << " refits, " << tree->rebuilds << " rebuilds.\n";
+
+	// The same wave through a flat mesh, its vertices moved in place
+	std::vector<float> rest_y;
+	if (flat_tree && frames > 0)
+		rest_y.assign(flat_tree->mesh.vy, flat_tree->mesh.vy + flat_tree->mesh.vertex_count);
+	for (int f = 1; f <= frames && flat_tree; f++) {
+		triangle_mesh& m = flat_tree->mesh;
+		for (int i = 0; i < m.vertex_count; i++)
+			m.vy[i] = rest_y[i] + WAVE_HEIGHT * sinf(WAVE_NUMBER * m.vx[i] + WAVE_SPEED * f);
+		auto t0 = std::chrono::steady_clock::now();
+		float cost = refit_mesh_bvh(flat_tree, threads);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+		start = std::chrono::steady_clock::now();
+		render_tiles(fb.data(), nx, ny, cam, world, threads);
+		std::cerr << "frame " << f << ": refitted in " << 1000.0 * seconds << " ms, SAH cost " << cost << ", ";
+		std::cerr << mrays(nx, ny, start) << " Mrays/s.\n";
+	}
+
+	// The solver stepped for each frame and the scene refitted to its grid,
+	// or rebuilt once the refits have degraded it too far, as dynamic_bvh does
+	int refits = 0, rebuilds = 0;
+	for (int f = 1; f <= frames && field; f++) {
+		for (int k = 0; k < WAVE_STEPS; k++)
+			calc_grid();
+		auto t0 = std::chrono::steady_clock::now();
+		heightfield_view view;
+		wave_heightfield(&view);
+		set_heightfield(sc, view, field_first, threads);
+		float cost = refit_scene(sc, threads);
+		refits++;
+		bool rebuilt = cost > BVH_REFIT_MAX_DEGRADATION * built.sah_cost;
+		if (rebuilt) {
+			scene_builder b;
+			field_first = b.add_heightfield(view, threads);
+			free_scene(sc);
+			b.build(sc, threads, false, &built);
+			cost = built.sah_cost;
+			rebuilds++;
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+		start = std::chrono::steady_clock::now();
+		render_tiles(fb.data(), nx, ny, cam, &sc, threads);
+		std::cerr << "frame " << f << ": " << (rebuilt ? "rebuilt" : "refitted") << " in " << 1000.0 * seconds << " ms, ";
+		std::cerr << "SAH cost " << cost << ", " << mrays(nx, ny, start) << " Mrays/s.\n";
+	}
+	if (field && frames > 0)
+		std::cerr << refits << " refits, " << rebuilds << " rebuilds.\n";
+	if (field) {
+		heightfield_view view;
+		wave_heightfield(&view);
+		if (!write_heightfield_obj("wave.obj", view))
+			std::cerr << "Failure writing wave.obj\n";
+	}
+
+	bool written = write_ppm("test.ppm", fb.data(), nx, ny);
+	if (!written)
+		std::cerr << "Failure writing test.ppm\n";
+
+	// clean up
+	for (hitable *h : list)
+		delete h;
+	if (tree)
+		delete tree;
+	else if (flat_tree)
+		free_mesh_bvh(flat_tree);
+	else if (wide_tree)
+		delete wide_tree;
+	else if (tagged) {
+		if (!warm)
+			free_scene(sc);		// a mapped scene goes with the mapping
+	}
+	else
+		delete world;
+	for (int i = 0; i < 3; ++i) {
+		delete[] VertexK[i];
+		delete[] FaceK[i];
+	}
+	delete[] VertexK;
+	delete[] FaceK;
+	return written ? EXIT_SUCCESS : EXIT_FAILURE;
+}
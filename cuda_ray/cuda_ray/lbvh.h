@@ -0,0 +1,354 @@
+#ifndef LBVHH
+#define LBVHH
+
+// Linear BVH (Karras 2012), for meshes rebuilt every frame where the SAH
+// build of bvh.h would take longer than the render.
+//
+// The primitives are sorted by the 30-bit Morton code of their centroids
+// with an LSD radix sort, and every inner node of the binary radix tree
+// over the sorted codes finds its own range and split independently of
+// the others.  The split between sorted primitives g and g + 1 belongs to
+// exactly one inner node, so that node's children go to slots 2g + 1 and
+// 2g + 2 of the bvh_node array, next to each other as bvh traversal
+// expects, without a pass over the tree.  Bounds are then filled in from
+// the leaves up, the second thread to reach a node going on to its parent.
+// On the way a subtree of at most BVH_MAX_LEAF primitives whose SAH cost
+// as a single leaf is no worse collapses into one, leaving its nodes
+// unreferenced in the array.
+//
+// Every stage is spread over the threads given; the result is a bvh like
+// build_bvh() returns, released by free_bvh().
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "bvh.h"
+
+#define LBVH_MORTON_BITS 10			// per axis
+#define LBVH_RADIX_BITS 8
+#define LBVH_PARALLEL_MIN 16384		// primitives worth more than one thread
+
+// Leading zeros of x, which is not 0
+inline int lbvh_clz(unsigned int x) {
+#ifdef _MSC_VER
+	unsigned long i;
+	_BitScanReverse(&i, x);
+	return 31 - (int)i;
+#else
+	return __builtin_clz(x);
+#endif
+}
+
+// The bits of v, below 1024, spread to every third bit
+inline unsigned int lbvh_spread(unsigned int v) {
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+
+// Runs f(t, begin, end) for the t-th of threads even parts of [0, n)
+template<class F>
+void lbvh_for(int n, int threads, F f) {
+	if (threads <= 1) {
+		f(0, 0, n);
+		return;
+	}
+	std::vector<std::thread> pool;
+	for (int t = 1; t < threads; t++)
+		pool.emplace_back(f, t, (int)((long long)n * t / threads), (int)((long long)n * (t + 1) / threads));
+	f(0, 0, (int)((long long)n / threads));
+	for (std::thread& th : pool)
+		th.join();
+}
+
+// An inner node of the radix tree
+struct lbvh_inner {
+	int first, last;	// its range of sorted primitives
+	int split;			// the last of them left of the split
+	int slot;			// in the bvh_node array
+};
+
+// Threads worth using on n primitives when threads are given
+inline int lbvh_threads(int n, int threads) {
+	return n < LBVH_PARALLEL_MIN ? 1 : bvh_threads(threads);
+}
+
+class lbvh_builder {
+public:
+	// The node array is the new[] one the tree keeps; nothing else is
+	// initialised before the stage that writes it, as touching memory
+	// twice costs about as much as the build itself
+	lbvh_builder(const aabb *boxes, int n, int threads) : boxes(boxes), n(n), order(n), codes(n) {
+		this->threads = lbvh_threads(n, threads);
+		node_count = std::max(1, 2 * n - 1);
+		nodes = new bvh_node[node_count];
+	}
+
+	void build() {
+		morton();
+		sort();
+		hierarchy();
+		bounds();
+	}
+
+	const aabb *boxes;
+	int n;
+	bvh_node *nodes;
+	int node_count;
+	std::vector<int> order;		// of the primitives by code
+
+private:
+	// Codes of the centroids of the boxes
+	void morton() {
+		std::vector<aabb> part(threads);
+		lbvh_for(n, threads, [&](int t, int begin, int end) {
+			aabb c;
+			for (int i = begin; i < end; i++)
+				c.grow(boxes[i].centroid());
+			part[t] = c;
+		});
+		aabb centres;
+		for (const aabb& c : part)
+			centres.grow(c);
+
+		float scale[3];
+		for (int a = 0; a < 3; a++)
+			scale[a] = bvh_bin_scale((float)((1 << LBVH_MORTON_BITS) - 1), centres.hi[a] - centres.lo[a]);
+		lbvh_for(n, threads, [&](int, int begin, int end) {
+			for (int i = begin; i < end; i++) {
+				vec3 c = boxes[i].centroid();
+				unsigned int code = 0;
+				for (int a = 0; a < 3; a++)
+					code |= lbvh_spread((unsigned int)((c[a] - centres.lo[a]) * scale[a])) << (2 - a);
+				codes[i] = code;
+				order[i] = i;
+			}
+		});
+	}
+
+	// LSD radix sort of codes and order together: each thread counts the
+	// digits of its part, the counts are summed digit by digit across the
+	// threads, and each thread scatters its part from its own offsets
+	void sort() {
+		const int radix = 1 << LBVH_RADIX_BITS;
+		std::vector<unsigned int> codes_out(n);
+		std::vector<int> order_out(n);
+		std::vector<int> count((size_t)threads * radix);
+
+		for (int shift = 0; shift < 3 * LBVH_MORTON_BITS; shift += LBVH_RADIX_BITS) {
+			lbvh_for(n, threads, [&](int t, int begin, int end) {
+				int *c = &count[(size_t)t * radix];
+				std::fill(c, c + radix, 0);
+				for (int i = begin; i < end; i++)
+					c[(codes[i] >> shift) & (radix - 1)]++;
+			});
+			int sum = 0;
+			for (int d = 0; d < radix; d++)
+				for (int t = 0; t < threads; t++) {
+					int c = count[(size_t)t * radix + d];
+					count[(size_t)t * radix + d] = sum;
+					sum += c;
+				}
+			lbvh_for(n, threads, [&](int t, int begin, int end) {
+				int *c = &count[(size_t)t * radix];
+				for (int i = begin; i < end; i++) {
+					int k = c[(codes[i] >> shift) & (radix - 1)]++;
+					codes_out[k] = codes[i];
+					order_out[k] = order[i];
+				}
+			});
+			codes.swap(codes_out);
+			order.swap(order_out);
+		}
+	}
+
+	// Length of the common prefix of sorted keys i and j, the code followed
+	// by the position so that every key is distinct; -1 off the ends
+	int delta(int i, int j) const {
+		if (j < 0 || j >= n)
+			return -1;
+		if (codes[i] == codes[j])
+			return 32 + lbvh_clz((unsigned int)(i ^ j));
+		return lbvh_clz(codes[i] ^ codes[j]);
+	}
+
+	// Range and split of every inner node, and where it and the leaves go
+	void hierarchy() {
+		inner.reset(new lbvh_inner[std::max(1, n - 1)]);
+		arrived.reset(new std::atomic<int>[std::max(1, n - 1)]);
+		leaf_slot.reset(new int[n]);
+		parent.reset(new int[node_count]);
+		cost.reset(new float[node_count]);
+
+		// Every other slot is a child of the inner node that splits there
+		parent[0] = -1;
+		if (n == 1) {
+			leaf_slot[0] = 0;
+			return;
+		}
+		inner[0].slot = 0;
+		lbvh_for(n - 1, threads, [&](int, int begin, int end) {
+			for (int i = begin; i < end; i++) {
+				// Direction of the range from the longer prefix, then its
+				// far end by doubling and halving
+				int d = delta(i, i + 1) > delta(i, i - 1) ? 1 : -1;
+				int d_min = delta(i, i - d);
+				int l_max = 2;
+				while (delta(i, i + l_max * d) > d_min)
+					l_max *= 2;
+				int l = 0;
+				for (int t = l_max / 2; t >= 1; t /= 2)
+					if (delta(i, i + (l + t) * d) > d_min)
+						l += t;
+				int j = i + l * d;
+
+				// Split where the prefix of the range ends
+				int d_node = delta(i, j);
+				int s = 0, t = l;
+				do {
+					t = (t + 1) / 2;
+					if (delta(i, i + (s + t) * d) > d_node)
+						s += t;
+				} while (t > 1);
+				int g = i + s * d + std::min(d, 0);
+
+				inner[i].first = std::min(i, j);
+				inner[i].last = std::max(i, j);
+				inner[i].split = g;
+				arrived[i] = 0;
+
+				// Children: g and g + 1, leaves at the ends of the range
+				if (inner[i].first == g)
+					leaf_slot[g] = 2 * g + 1;
+				else
+					inner[g].slot = 2 * g + 1;
+				if (inner[i].last == g + 1)
+					leaf_slot[g + 1] = 2 * g + 2;
+				else
+					inner[g + 1].slot = 2 * g + 2;
+				parent[2 * g + 1] = i;
+				parent[2 * g + 2] = i;
+			}
+		});
+	}
+
+	// Boxes from the leaves up; the first thread to arrive at a node stops,
+	// the second has both children and goes on
+	void bounds() {
+		lbvh_for(n, threads, [&](int, int begin, int end) {
+			for (int j = begin; j < end; j++) {
+				int s = leaf_slot[j];
+				set_box(nodes[s], boxes[order[j]]);
+				nodes[s].first = j;
+				nodes[s].count = 1;
+				cost[s] = 1.f;
+
+				for (int i = parent[s]; i >= 0; i = parent[s]) {
+					if (arrived[i].fetch_add(1) == 0)
+						break;
+					const lbvh_inner& in = inner[i];
+					s = in.slot;
+					join(s, 2 * in.split + 1, in.first, in.last - in.first + 1);
+				}
+			}
+		});
+	}
+
+	// Node s over the children at c and c + 1, or a leaf of its count
+	// primitives from begin when that costs no more
+	void join(int s, int c, int begin, int count) {
+		const bvh_node& l = nodes[c];
+		const bvh_node& r = nodes[c + 1];
+		bvh_node& node = nodes[s];
+		for (int a = 0; a < 3; a++) {
+			node.lo[a] = std::min(l.lo[a], r.lo[a]);
+			node.hi[a] = std::max(l.hi[a], r.hi[a]);
+		}
+
+		float area = half_area(node), split_cost;
+		if (area > 0.f)
+			split_cost = BVH_TRAVERSAL_COST + (half_area(l) * cost[c] + half_area(r) * cost[c + 1]) / area;
+		else
+			split_cost = BVH_TRAVERSAL_COST + cost[c] + cost[c + 1];
+
+		if (count <= BVH_MAX_LEAF && (float)count <= split_cost) {
+			node.first = begin;
+			node.count = count;
+			cost[s] = (float)count;
+		}
+		else {
+			node.first = c;
+			node.count = 0;
+			cost[s] = split_cost;
+		}
+	}
+
+	static void set_box(bvh_node& node, const aabb& box) {
+		for (int a = 0; a < 3; a++) {
+			node.lo[a] = box.lo[a];
+			node.hi[a] = box.hi[a];
+		}
+	}
+
+	static float half_area(const bvh_node& node) {
+		float dx = node.hi[0] - node.lo[0], dy = node.hi[1] - node.lo[1], dz = node.hi[2] - node.lo[2];
+		return dx * dy + dy * dz + dz * dx;
+	}
+
+	int threads;
+	std::vector<unsigned int> codes;
+
+	// Per inner node, by the position it starts from, and how many of its
+	// children have reached it from below
+	std::unique_ptr<lbvh_inner[]> inner;
+	std::unique_ptr<std::atomic<int>[]> arrived;
+	std::unique_ptr<int[]> leaf_slot;
+
+	// Per slot: the inner node above it and the SAH cost of the subtree
+	// under it, relative to its own area
+	std::unique_ptr<int[]> parent;
+	std::unique_ptr<float[]> cost;
+};
+
+// Linear BVH nodes over boxes[0..n), as build_bvh_nodes() gives them
+inline bvh_node *build_lbvh_nodes(const aabb *boxes, int n, int threads, int *order, int& count) {
+	lbvh_builder b(boxes, n, threads);
+	if (n > 0)
+		b.build();
+	count = n > 0 ? b.node_count : 0;
+	std::copy(b.order.begin(), b.order.end(), order);
+	return b.nodes;
+}
+
+// Linear BVH over list[0..n) on up to threads threads, all cores for 0
+inline bvh *build_lbvh(hitable **list, int n, int threads = 0, bvh_build_stats *stats = nullptr) {
+	auto t0 = std::chrono::steady_clock::now();
+	std::unique_ptr<aabb[]> boxes(new aabb[std::max(n, 1)]);
+	std::unique_ptr<int[]> order(new int[std::max(n, 1)]);
+	lbvh_for(n, lbvh_threads(n, threads), [&](int, int begin, int end) {
+		for (int i = begin; i < end; i++)
+			boxes[i] = list[i]->bounding_box();
+	});
+
+	int count;
+	bvh_node *nodes = build_lbvh_nodes(boxes.get(), n, threads, order.get(), count);
+	hitable **prims = new hitable *[std::max(n, 1)];
+	lbvh_for(n, lbvh_threads(n, threads), [&](int, int begin, int end) {
+		for (int i = begin; i < end; i++)
+			prims[i] = list[order[i]];
+	});
+	bvh_fill_stats(nodes, count, t0, stats);
+	return new bvh(nodes, count, prims, n);
+}
+
+#endif
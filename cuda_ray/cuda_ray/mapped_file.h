@@ -0,0 +1,117 @@
+#ifndef MAPPED_FILEH
+#define MAPPED_FILEH
+
+// Read-only mapping of a whole file, MapViewOfFile on Windows and mmap
+// elsewhere, so a mesh is paged in as it is parsed instead of being read
+// into a buffer first.  Header only, like the rest of cuda_ray.
+
+#include <stddef.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+class mapped_file {
+public:
+	mapped_file() : base(nullptr), length(0), handle(nullptr) {}
+	~mapped_file() { close(); }
+
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	// False if the file cannot be opened or mapped, or is empty
+	bool open(const char *path);
+	void close();
+
+	const char *data() const { return (const char *)base; }
+	size_t size() const { return length; }
+
+private:
+	void *base;
+	size_t length;
+	void *handle;		// of the mapping object on Windows
+};
+
+#ifdef _WIN32
+
+inline bool mapped_file::open(const char *path) {
+	close();
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER n;
+	if (!GetFileSizeEx(file, &n) || n.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+
+	// The view keeps the file open
+	handle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(file);
+	if (!handle)
+		return false;
+	base = MapViewOfFile(handle, FILE_MAP_READ, 0, 0, 0);
+	if (!base) {
+		CloseHandle(handle);
+		handle = nullptr;
+		return false;
+	}
+	length = (size_t)n.QuadPart;
+	return true;
+}
+
+inline void mapped_file::close() {
+	if (base)
+		UnmapViewOfFile(base);
+	if (handle)
+		CloseHandle(handle);
+	base = nullptr;
+	handle = nullptr;
+	length = 0;
+}
+
+#else
+
+inline bool mapped_file::open(const char *path) {
+	close();
+	int fd = ::open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		::close(fd);
+		return false;
+	}
+
+	// The mapping keeps the file open
+	base = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (base == MAP_FAILED) {
+		base = nullptr;
+		return false;
+	}
+	length = (size_t)st.st_size;
+	return true;
+}
+
+inline void mapped_file::close() {
+	if (base)
+		munmap(base, length);
+	base = nullptr;
+	length = 0;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef MESH_BVHH
+#define MESH_BVHH
+
+// BVH over a triangle_mesh.  The triangles are reordered into leaf order,
+// so a leaf is a range of the mesh arrays and the traversal calls
+// triangle_mesh::hit() directly, with no pointer to follow and no virtual
+// call below the root.
+
+#include <chrono>
+#include <memory>
+
+#include "bvh.h"
+#include "bvh_refit.h"
+#include "lbvh.h"
+#include "triangle_mesh.h"
+
+class mesh_bvh : public hitable {
+public:
+	__host__ __device__ mesh_bvh() : nodes(0), node_count(0) {}
+	__host__ __device__ mesh_bvh(bvh_node *n, int nn, const triangle_mesh& m) : nodes(n), node_count(nn), mesh(m) {}
+	__host__ __device__ virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+		return bvh_traverse(nodes, node_count, mesh, r, t_min, t_max, rec);
+	}
+	__host__ __device__ virtual aabb bounding_box() const { return bvh_bounds(nodes, node_count); }
+
+	bvh_node *nodes;
+	int node_count;
+	triangle_mesh mesh;		// in leaf order
+};
+
+// Tree over mesh, by binned SAH or as a linear BVH, on up to threads
+// threads, all cores for 0.  The tree takes the mesh over, reordered, and
+// free_mesh_bvh() releases both.
+inline mesh_bvh *build_mesh_bvh(const triangle_mesh& mesh, int threads = 0, bool lbvh = false, bvh_build_stats *stats = nullptr) {
+	auto t0 = std::chrono::steady_clock::now();
+	int n = mesh.triangle_count;
+	std::unique_ptr<aabb[]> boxes(new aabb[std::max(n, 1)]);
+	std::unique_ptr<int[]> order(new int[std::max(n, 1)]);
+	lbvh_for(n, lbvh_threads(n, threads), [&](int, int begin, int end) {
+		for (int i = begin; i < end; i++)
+			boxes[i] = mesh.bounding_box(i);
+	});
+
+	int count;
+	bvh_node *nodes = lbvh ? build_lbvh_nodes(boxes.get(), n, threads, order.get(), count)
+		: build_bvh_nodes(boxes.get(), n, threads, order.get(), count);
+	mesh_bvh *tree = new mesh_bvh(nodes, count, mesh);
+	reorder_triangle_mesh(tree->mesh, order.get());
+	bvh_fill_stats(nodes, count, t0, stats);
+	return tree;
+}
+
+// After the vertices of tree's mesh have moved: works out the edges of
+// its triangles again and refits the tree on up to threads threads, all
+// cores for 0.  Returns the SAH cost as bvh_build_stats counts it.
+inline float refit_mesh_bvh(mesh_bvh *tree, int threads = 0) {
+	triangle_mesh& m = tree->mesh;
+	lbvh_for(m.triangle_count, lbvh_threads(m.triangle_count, threads), [&](int, int begin, int end) {
+		for (int i = begin; i < end; i++)
+			m.set_edges(i);
+	});
+	return refit_bvh_nodes(tree->nodes, tree->node_count, m, threads);
+}
+
+inline void free_mesh_bvh(mesh_bvh *tree) {
+	delete[] tree->nodes;
+	free_triangle_mesh(tree->mesh);
+	delete tree;
+}
+
+#endif
@@ -0,0 +1,290 @@
+#ifndef OBJ_FILEH
+#define OBJ_FILEH
+
+// OBJ reading, plain C++ so that the CUDA build and the host backend read
+// meshes alike.
+//
+// The file is mapped, not read, and cut at line boundaries into one chunk
+// per thread.  A first pass counts the vertices and triangles of each
+// chunk, which places the chunk's output in the final arrays, and a second
+// parses straight into them with hand-written number scanners, so nothing
+// is copied on the way and no line becomes a string.  Only v and f lines
+// are read.  A face corner may be v, v/vt, v//vn or v/vt/vn, a negative
+// index counts back from the last vertex so far, and a polygon of more than
+// three corners becomes a fan of triangles.
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "mapped_file.h"
+
+#define OBJ_CHUNK_MIN (1 << 20)		// bytes per thread, at least
+
+struct obj_load_stats {
+	double seconds;
+	size_t bytes;
+	int vertices;
+	int triangles;
+	int threads;
+};
+
+// Where parsed vertices and triangles go; indices count from base, and
+// the corners of triangle t are at a, b and c [t * stride]
+struct obj_output {
+	float *x, *y, *z;
+	int *a, *b, *c;
+	int base;
+	int stride;
+};
+
+// Lines [begin, end) of the file
+struct obj_chunk {
+	const char *begin, *end;
+	int vertex_count, triangle_count;
+	int first_vertex, first_triangle;		// in the whole file
+};
+
+// f(begin, end) over [0, n) on up to threads threads, all cores for 0
+template<class F>
+inline void obj_for(int n, int threads, const F& f) {
+	if (threads <= 0)
+		threads = std::max(1, (int)std::thread::hardware_concurrency());
+	threads = std::max(1, std::min(threads, n));
+	std::vector<std::thread> pool;
+	for (int t = 1; t < threads; t++)
+		pool.emplace_back([&, t]() { f((int)((int64_t)n * t / threads), (int)((int64_t)n * (t + 1) / threads)); });
+	f(0, (int)((int64_t)n / threads));
+	for (std::thread& t : pool)
+		t.join();
+}
+
+inline bool obj_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+inline const char *obj_skip_space(const char *p, const char *end) {
+	while (p < end && obj_space(*p))
+		p++;
+	return p;
+}
+
+// Decimal number at p, with optional sign, fraction and exponent, as a
+// float; p is moved past it.  0 if there is none, p left where it was.
+inline float obj_float(const char *&p, const char *end) {
+	static const double pow10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+	const char *s = p;
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+
+	// Up to 19 significant digits, the rest only scale
+	uint64_t m = 0;
+	int digits = 0, any = 0, exponent = 0;
+	for (; p < end && (unsigned)(*p - '0') < 10; p++, any++) {
+		if (digits < 19) {
+			m = m * 10 + (*p - '0');
+			digits += m != 0;
+		}
+		else
+			exponent++;
+	}
+	if (p < end && *p == '.') {
+		for (p++; p < end && (unsigned)(*p - '0') < 10; p++, any++) {
+			if (digits < 19) {
+				m = m * 10 + (*p - '0');
+				digits += m != 0;
+				exponent--;
+			}
+		}
+	}
+	if (!any) {
+		p = s;
+		return 0.f;
+	}
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		const char *q = p + 1;
+		bool down = false;
+		if (q < end && (*q == '-' || *q == '+'))
+			down = *q++ == '-';
+		if (q < end && (unsigned)(*q - '0') < 10) {
+			int e = 0;
+			for (; q < end && (unsigned)(*q - '0') < 10; q++)
+				e = std::min(e * 10 + (*q - '0'), 1000);
+			exponent += down ? -e : e;
+			p = q;
+		}
+	}
+
+	double v = (double)m;
+	for (; exponent < -22; exponent += 22)
+		v /= 1e22;
+	for (; exponent > 22; exponent -= 22)
+		v *= 1e22;
+	v = exponent < 0 ? v / pow10[-exponent] : v * pow10[exponent];
+	return (float)(negative ? -v : v);
+}
+
+// Integer at p, p moved past it; 0 if there is none
+inline int obj_int(const char *&p, const char *end) {
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+	int v = 0;
+	for (; p < end && (unsigned)(*p - '0') < 10; p++)
+		v = v * 10 + (*p - '0');
+	return negative ? -v : v;
+}
+
+// Counts the vertices and triangles of c, or with out, parses them into
+// it from c's first vertex and triangle
+inline void obj_scan(obj_chunk& c, const obj_output *out) {
+	int nv = 0, nt = 0;
+	for (const char *p = c.begin; p < c.end;) {
+		const char *eol = (const char *)memchr(p, '\n', c.end - p);
+		if (!eol)
+			eol = c.end;
+		p = obj_skip_space(p, eol);
+
+		if (eol - p > 1 && p[0] == 'v' && obj_space(p[1])) {
+			if (out) {
+				float v[3];
+				const char *q = p + 1;
+				for (int k = 0; k < 3; k++) {
+					q = obj_skip_space(q, eol);
+					v[k] = obj_float(q, eol);
+				}
+				int i = c.first_vertex + nv;
+				out->x[i] = v[0];
+				out->y[i] = v[1];
+				out->z[i] = v[2];
+			}
+			nv++;
+		}
+		else if (eol - p > 1 && p[0] == 'f' && obj_space(p[1])) {
+			int corners = 0, first = 0, prev = 0;
+			for (const char *q = obj_skip_space(p + 1, eol); q < eol && *q != '#'; q = obj_skip_space(q, eol)) {
+				if (out) {
+					// Only the vertex of v/vt/vn; a missing or zero index is out of range
+					const char *r = q;
+					int i = obj_int(r, eol);
+					int idx = (i > 0 ? i - 1 : i < 0 ? c.first_vertex + nv + i : -1) + out->base;
+					if (corners >= 2) {
+						size_t t = (size_t)(c.first_triangle + nt) * out->stride;
+						out->a[t] = first;
+						out->b[t] = prev;
+						out->c[t] = idx;
+					}
+					if (corners == 0)
+						first = idx;
+					prev = idx;
+				}
+				if (corners >= 2)
+					nt++;
+				corners++;
+				while (q < eol && !obj_space(*q))
+					q++;
+			}
+		}
+		p = eol + 1;
+	}
+	c.vertex_count = nv;
+	c.triangle_count = nt;
+}
+
+// Parses path on up to threads threads, all cores for 0, into the arrays
+// alloc(vertices, triangles) returns as an obj_output.  False if the file
+// cannot be mapped; alloc is then not called.
+template<class Alloc>
+inline bool read_obj(const char *path, int threads, const Alloc& alloc, obj_load_stats *stats = nullptr) {
+	auto t0 = std::chrono::steady_clock::now();
+	mapped_file file;
+	if (!file.open(path))
+		return false;
+
+	// Chunks of about equal size, each from the start of a line
+	const char *data = file.data(), *end = data + file.size();
+	if (threads <= 0)
+		threads = std::max(1, (int)std::thread::hardware_concurrency());
+	int n = (int)std::max((size_t)1, std::min((size_t)threads, file.size() / OBJ_CHUNK_MIN));
+	std::vector<obj_chunk> chunks(n);
+	for (int k = 0; k < n; k++) {
+		const char *p = data + file.size() / n * k;
+		if (k > 0) {
+			const char *eol = (const char *)memchr(p, '\n', end - p);
+			p = eol ? eol + 1 : end;
+		}
+		chunks[k].begin = p;
+		if (k > 0)
+			chunks[k - 1].end = p;
+	}
+	chunks[n - 1].end = end;
+
+	obj_for(n, n, [&](int begin, int last) {
+		for (int k = begin; k < last; k++)
+			obj_scan(chunks[k], nullptr);
+	});
+	int nv = 0, nt = 0;
+	for (obj_chunk& c : chunks) {
+		c.first_vertex = nv;
+		c.first_triangle = nt;
+		nv += c.vertex_count;
+		nt += c.triangle_count;
+	}
+
+	obj_output out = alloc(nv, nt);
+	obj_for(n, n, [&](int begin, int last) {
+		for (int k = begin; k < last; k++)
+			obj_scan(chunks[k], &out);
+	});
+
+	if (stats) {
+		stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+		stats->bytes = file.size();
+		stats->vertices = nv;
+		stats->triangles = nt;
+		stats->threads = n;
+	}
+	return true;
+}
+
+// Vertices and triangles of an OBJ file as three arrays of each, new[]
+// arrays for the caller to delete[]; indices count from 1 as in the file
+inline bool ReadOBJFile(const char filename[], float **vertex, int **face, int& VN, int& FN, int threads = 0, obj_load_stats *stats = nullptr) {
+	VN = FN = 0;
+	bool read = read_obj(filename, threads, [&](int nv, int nt) {
+		VN = nv;
+		FN = nt;
+		obj_output out;
+		for (int i = 0; i < 3; ++i) {
+			vertex[i] = new float[nv];
+			face[i] = new int[nt];
+		}
+		out.x = vertex[0];
+		out.y = vertex[1];
+		out.z = vertex[2];
+		out.a = face[0];
+		out.b = face[1];
+		out.c = face[2];
+		out.base = 1;
+		out.stride = 1;
+		return out;
+	}, stats);
+
+	if (!read) {
+		std::cerr << "Failure opening file at \"" << filename << "\"." << std::endl;
+		for (int i = 0; i < 3; ++i) {
+			vertex[i] = new float[0];
+			face[i] = new int[0];
+		}
+		return false;
+	}
+	std::cout << "This .obj file has " << VN << " vertexs" << std::endl;
+	std::cout << "This .obj file has " << FN << " faces" << std::endl;
+	return true;
+}
+
+#endif
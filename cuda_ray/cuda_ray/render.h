@@ -0,0 +1,62 @@
+#ifndef RENDERH
+#define RENDERH
+
+#include <float.h>
+#include <stdio.h>
+
+#include "camera.h"
+#include "hitable.h"
+
+// Shading and image output shared by the CUDA kernel and the host backend,
+// so both write the same test.ppm
+
+// Normal as colour where the ray hits, the sky gradient elsewhere
+__host__ __device__ inline vec3 shade(const ray& r, bool hit, const hit_record& rec) {
+	if (hit) {
+		return 0.5f*vec3(rec.normal.x() + 1.0f, rec.normal.y() + 1.0f, rec.normal.z() + 1.0f);
+	}
+	else {
+		vec3 unit_direction = unit_vector(r.direction());
+		float t = 0.5f*(unit_direction.y() + 1.0f);
+		return (1.0f - t)*vec3(1.0, 1.0, 1.0) + t * vec3(0.5, 0.7, 1.0);
+	}
+}
+
+// Shade of the nearest hit of r.  world is a hitable, or anything else
+// with its hit(), such as a scene.
+template<class World>
+__host__ __device__ inline vec3 color(const ray& r, const World *world) {
+	hit_record rec;
+	bool hit = world->hit(r, 0.0, FLT_MAX, rec);
+	return shade(r, hit, rec);
+}
+
+// One sample at the corner of pixel (i, j), rows counted from the bottom
+template<class World>
+__host__ __device__ inline vec3 render_pixel(int i, int j, int max_x, int max_y, const camera& cam, const World *world) {
+	float u = float(i) / float(max_x);
+	float v = float(j) / float(max_y);
+	return color(cam.get_ray(u, v), world);
+}
+
+// Binary PPM, top row first; fb holds the bottom row first.  Returns false
+// if the file cannot be written.
+inline bool write_ppm(const char *path, const vec3 *fb, int nx, int ny) {
+	FILE *fp = fopen(path, "wb");
+	if (!fp)
+		return false;
+	fprintf(fp, "P6\n%d %d\n255\n", nx, ny);
+	for (int j = ny - 1; j >= 0; j--) {
+		for (int i = 0; i < nx; i++) {
+			size_t pixel_index = j * nx + i;
+			unsigned char color[3];
+			color[0] = (unsigned char)int(255.99*fb[pixel_index].r());
+			color[1] = (unsigned char)int(255.99*fb[pixel_index].g());
+			color[2] = (unsigned char)int(255.99*fb[pixel_index].b());
+			fwrite(color, 1, 3, fp);
+		}
+	}
+	return fclose(fp) == 0;
+}
+
+#endif
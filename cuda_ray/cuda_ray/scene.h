@@ -0,0 +1,432 @@
+#ifndef SCENEH
+#define SCENEH
+
+// A scene of tagged primitives in place of the hitable hierarchy.
+//
+// Each primitive is a type and an index into the flat arrays of its type:
+// a triangle_mesh for triangles and a sphere_array for spheres.  The leaf
+// test switches on the type, so there is no vtable and nothing needs
+// constructing with new on the device.  scene_builder collects the
+// primitives on the host and lays the tree, the primitive list and every
+// array out in one block of memory, which goes to the device in one copy;
+// scene_at() then points a copy of the scene into the block's new place.
+// The primitives of each type are stored in the order the leaves reach
+// them, so a leaf reads consecutive entries.  Every pass over the
+// primitives runs on all the threads given, as the tree build does.
+
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include "bvh.h"
+#include "bvh_refit.h"
+#include "lbvh.h"
+#include "triangle_mesh.h"
+#include "../../FluidWave/FluidWave/heightfield.h"
+
+#define SCENE_ALIGN 16		// of each array in the block
+
+enum primitive_type {
+	PRIM_TRIANGLE,
+	PRIM_SPHERE
+};
+
+struct primitive {
+	int type;		// primitive_type
+	int index;		// in the arrays of the type
+};
+
+struct sphere_array {
+	int count;
+	float *cx, *cy, *cz;
+	float *radius;
+
+	// As sphere::hit()
+	__host__ __device__ bool hit(int i, const ray& r, float t_min, float t_max, hit_record& rec) const {
+		vec3 center(cx[i], cy[i], cz[i]);
+		vec3 oc = r.origin() - center;
+		float a = dot(r.direction(), r.direction());
+		float b = dot(oc, r.direction());
+		float c = dot(oc, oc) - radius[i] * radius[i];
+		float discriminant = b * b - a * c;
+		if (discriminant > 0) {
+			float temp = (-b - sqrt(discriminant)) / a;
+			if (!(temp < t_max && temp > t_min))
+				temp = (-b + sqrt(discriminant)) / a;
+			if (temp < t_max && temp > t_min) {
+				rec.t = temp;
+				rec.p = r.point_at_parameter(rec.t);
+				rec.normal = (rec.p - center) / radius[i];
+				return true;
+			}
+		}
+		return false;
+	}
+
+	__host__ __device__ aabb bounding_box(int i) const {
+		vec3 d(radius[i], radius[i], radius[i]), center(cx[i], cy[i], cz[i]);
+		return aabb(center - d, center + d);
+	}
+};
+
+struct scene {
+	bvh_node *nodes;
+	int node_count;
+	primitive *prims;		// in leaf order
+	int prim_count;
+	triangle_mesh triangles;
+	sphere_array spheres;
+
+	char *block;			// holding all of the above
+	size_t bytes;
+
+	__host__ __device__ bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+		return bvh_traverse(nodes, node_count, *this, r, t_min, t_max, rec);
+	}
+
+	// Leaf test of primitive i, for bvh_traverse()
+	__host__ __device__ bool hit(int i, const ray& r, float t_min, float t_max, hit_record& rec) const {
+		switch (prims[i].type) {
+		case PRIM_TRIANGLE:
+			return triangles.hit(prims[i].index, r, t_min, t_max, rec);
+		case PRIM_SPHERE:
+			return spheres.hit(prims[i].index, r, t_min, t_max, rec);
+		}
+		return false;
+	}
+
+	__host__ __device__ aabb bounding_box() const { return bvh_bounds(nodes, node_count); }
+
+	// Box of primitive i, for a refit
+	__host__ __device__ aabb bounding_box(int i) const {
+		return prims[i].type == PRIM_TRIANGLE ? triangles.bounding_box(prims[i].index) : spheres.bounding_box(prims[i].index);
+	}
+};
+
+// f(p) on each pointer of s into its block, in a fixed order
+template<class F>
+inline void scene_for_arrays(scene& s, const F& f) {
+	f(s.nodes);
+	f(s.prims);
+	f(s.triangles.vx);
+	f(s.triangles.vy);
+	f(s.triangles.vz);
+	f(s.triangles.v0);
+	f(s.triangles.v1);
+	f(s.triangles.v2);
+	f(s.triangles.e1x);
+	f(s.triangles.e1y);
+	f(s.triangles.e1z);
+	f(s.triangles.e2x);
+	f(s.triangles.e2y);
+	f(s.triangles.e2z);
+	f(s.spheres.cx);
+	f(s.spheres.cy);
+	f(s.spheres.cz);
+	f(s.spheres.radius);
+}
+
+#define SCENE_ARRAYS 18		// pointers scene_for_arrays() visits
+
+// s with its pointers moved to a copy of its block at base, such as the
+// device copy of it
+inline scene scene_at(const scene& s, char *base) {
+	scene t = s;
+	scene_for_arrays(t, [&](auto *&p) {
+		typedef decltype(p + 0) pointer;
+		p = (pointer)(base + ((const char *)p - s.block));
+	});
+	t.block = base;
+	return t;
+}
+
+// After vertices or spheres of s have moved, its own copy and not a
+// mapped one: works out the edges of its triangles again and refits the
+// tree on up to threads threads, all cores for 0.  Returns the SAH cost as
+// bvh_build_stats counts it.
+inline float refit_scene(scene& s, int threads = 0) {
+	triangle_mesh& m = s.triangles;
+	lbvh_for(m.triangle_count, lbvh_threads(m.triangle_count, threads), [&](int, int begin, int end) {
+		for (int i = begin; i < end; i++)
+			m.set_edges(i);
+	});
+	return refit_bvh_nodes(s.nodes, s.node_count, s, threads);
+}
+
+// Moves the vertices of a heightfield that add_heightfield() put at first
+// to where view has them now, on up to threads threads; refit_scene()
+// then brings the tree along
+inline void set_heightfield(scene& s, const heightfield_view& view, int first, int threads = 0) {
+	int nv = std::max(0, std::min(heightfield_vertex_count(&view), s.triangles.vertex_count - first));
+	lbvh_for(nv, lbvh_threads(nv, threads), [&](int, int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			float v[3];
+			heightfield_vertex(&view, i, v);
+			s.triangles.vx[first + i] = v[0];
+			s.triangles.vy[first + i] = v[1];
+			s.triangles.vz[first + i] = v[2];
+		}
+	});
+}
+
+inline void free_scene(scene& s) {
+	delete[] s.block;
+	s = scene();
+}
+
+// Host side collection of the primitives of a scene
+class scene_builder {
+public:
+	// The faces of a mesh as ReadOBJFile() gives it, on up to threads
+	// threads, all cores for 0; OBJ indices count from 1, faces out of range
+	// are dropped
+	void add_mesh(float **vertex, int **face, int VN, int FN, int threads = 0) {
+		int base = (int)vx.size();
+		vx.insert(vx.end(), vertex[0], vertex[0] + VN);
+		vy.insert(vy.end(), vertex[1], vertex[1] + VN);
+		vz.insert(vz.end(), vertex[2], vertex[2] + VN);
+
+		// Faces kept by each thread's range, then written from there
+		auto kept = [&](int i) {
+			int a = face[0][i], b = face[1][i], c = face[2][i];
+			return std::min(a, std::min(b, c)) >= 1 && std::max(a, std::max(b, c)) <= VN;
+		};
+		int nt = lbvh_threads(FN, threads);
+		std::vector<int> first(nt + 1, 0);
+		lbvh_for(FN, nt, [&](int t, int begin, int end) {
+			int k = 0;
+			for (int i = begin; i < end; i++)
+				k += kept(i);
+			first[t + 1] = k;
+		});
+		for (int t = 0; t < nt; t++)
+			first[t + 1] += first[t];
+		size_t at = corners.size();
+		corners.resize(at + 3 * (size_t)first[nt]);
+		lbvh_for(FN, nt, [&](int t, int begin, int end) {
+			int *out = corners.data() + at + 3 * (size_t)first[t];
+			for (int i = begin; i < end; i++) {
+				if (!kept(i))
+					continue;
+				*out++ = base + face[0][i] - 1;
+				*out++ = base + face[1][i] - 1;
+				*out++ = base + face[2][i] - 1;
+			}
+		});
+	}
+
+	// The faces of an OBJ file, parsed straight into the builder's arrays on
+	// up to threads threads, all cores for 0; faces out of range are
+	// dropped.  False if the file cannot be read.
+	bool add_obj(const char *path, int threads = 0, obj_load_stats *stats = nullptr) {
+		int base = (int)vx.size(), nv = 0;
+		size_t at = corners.size();
+		bool read = read_obj(path, threads, [&](int vertices, int triangles) {
+			nv = vertices;
+			vx.resize(base + (size_t)nv);
+			vy.resize(base + (size_t)nv);
+			vz.resize(base + (size_t)nv);
+			corners.resize(at + 3 * (size_t)triangles);
+			int *c = corners.data() + at;
+			obj_output out = { vx.data() + base, vy.data() + base, vz.data() + base, c, c + 1, c + 2, base, 3 };
+			return out;
+		}, stats);
+		if (!read)
+			return false;
+
+		// Faces out of range are rare, so they are only looked for in parallel
+		auto kept = [&](size_t i) {
+			const int *c = &corners[i];
+			return std::min(c[0], std::min(c[1], c[2])) >= base && std::max(c[0], std::max(c[1], c[2])) < base + nv;
+		};
+		int nt = (int)((corners.size() - at) / 3);
+		std::atomic<int> bad(0);
+		obj_for(nt, threads, [&](int begin, int end) {
+			int found = 0;
+			for (int t = begin; t < end; t++)
+				found += !kept(at + 3 * (size_t)t);
+			bad += found;
+		});
+		if (bad) {
+			size_t k = at;
+			for (size_t i = at; i < corners.size(); i += 3) {
+				if (!kept(i))
+					continue;
+				std::copy(&corners[i], &corners[i] + 3, &corners[k]);
+				k += 3;
+			}
+			corners.resize(k);
+		}
+		return true;
+	}
+
+	// The triangles of a heightfield, numbered as heightfield.h numbers
+	// them, read straight from the view on up to threads threads.  Returns
+	// the index of its first vertex, for set_heightfield().
+	int add_heightfield(const heightfield_view& view, int threads = 0) {
+		int base = (int)vx.size();
+		int nv = std::max(heightfield_vertex_count(&view), 0);
+		int nt = view.w > 1 && view.h > 1 ? heightfield_triangle_count(&view) : 0;
+		vx.resize(base + (size_t)nv);
+		vy.resize(base + (size_t)nv);
+		vz.resize(base + (size_t)nv);
+		size_t at = corners.size();
+		corners.resize(at + 3 * (size_t)nt);
+
+		lbvh_for(nv, lbvh_threads(nv, threads), [&](int, int begin, int end) {
+			for (int i = begin; i < end; i++) {
+				float v[3];
+				heightfield_vertex(&view, i, v);
+				vx[base + i] = v[0];
+				vy[base + i] = v[1];
+				vz[base + i] = v[2];
+			}
+		});
+		lbvh_for(nt, lbvh_threads(nt, threads), [&](int, int begin, int end) {
+			for (int t = begin; t < end; t++) {
+				int idx[3];
+				heightfield_triangle(&view, t, idx);
+				for (int k = 0; k < 3; k++)
+					corners[at + 3 * (size_t)t + k] = base + idx[k];
+			}
+		});
+		return base;
+	}
+
+	void add_sphere(const vec3& center, float radius) {
+		spheres.push_back(center[0]);
+		spheres.push_back(center[1]);
+		spheres.push_back(center[2]);
+		spheres.push_back(radius);
+	}
+
+	int triangle_count() const { return (int)corners.size() / 3; }
+	int sphere_count() const { return (int)spheres.size() / 4; }
+
+	// Tree over everything added, by binned SAH or as a linear BVH on up to
+	// threads threads, all cores for 0, laid out in one new[] block that
+	// free_scene() releases
+	void build(scene& s, int threads = 0, bool lbvh = false, bvh_build_stats *stats = nullptr) const {
+		auto t0 = std::chrono::steady_clock::now();
+		int nt = triangle_count(), ns = sphere_count(), n = nt + ns;
+		int nv = (int)vx.size();
+
+		// Triangles first, then spheres
+		std::unique_ptr<aabb[]> boxes(new aabb[std::max(n, 1)]);
+		std::unique_ptr<int[]> order(new int[std::max(n, 1)]);
+		int pass = lbvh_threads(n, threads);
+		lbvh_for(n, pass, [&](int, int begin, int end) {
+			for (int i = begin; i < end; i++) {
+				aabb box;
+				if (i < nt) {
+					for (int k = 0; k < 3; k++) {
+						int v = corners[3 * i + k];
+						box.grow(vec3(vx[v], vy[v], vz[v]));
+					}
+				}
+				else {
+					const float *p = &spheres[4 * (i - nt)];
+					vec3 d(p[3], p[3], p[3]), center(p[0], p[1], p[2]);
+					box = aabb(center - d, center + d);
+				}
+				boxes[i] = box;
+			}
+		});
+		int count;
+		std::unique_ptr<bvh_node[]> nodes(lbvh ? build_lbvh_nodes(boxes.get(), n, threads, order.get(), count)
+			: build_bvh_nodes(boxes.get(), n, threads, order.get(), count));
+
+		// The block, each array aligned within it
+		size_t offset = 0;
+		auto place = [&](size_t bytes) {
+			size_t at = offset;
+			offset += (bytes + SCENE_ALIGN - 1) / SCENE_ALIGN * SCENE_ALIGN;
+			return at;
+		};
+		size_t at_nodes = place(count * sizeof(bvh_node));
+		size_t at_prims = place(n * sizeof(primitive));
+		size_t at_vertices[3], at_corners[3], at_edges[6], at_spheres[4];
+		for (size_t& a : at_vertices)
+			a = place(nv * sizeof(float));
+		for (size_t& a : at_corners)
+			a = place(nt * sizeof(int));
+		for (size_t& a : at_edges)
+			a = place(nt * sizeof(float));
+		for (size_t& a : at_spheres)
+			a = place(ns * sizeof(float));
+
+		s = scene();
+		s.bytes = std::max(offset, (size_t)SCENE_ALIGN);
+		s.block = new char[s.bytes];
+		s.nodes = (bvh_node *)(s.block + at_nodes);
+		s.node_count = count;
+		s.prims = (primitive *)(s.block + at_prims);
+		s.prim_count = n;
+		triangle_mesh& m = s.triangles;
+		m.vertex_count = nv;
+		m.triangle_count = nt;
+		float **vertices[] = { &m.vx, &m.vy, &m.vz };
+		int **corner[] = { &m.v0, &m.v1, &m.v2 };
+		float **edges[] = { &m.e1x, &m.e1y, &m.e1z, &m.e2x, &m.e2y, &m.e2z };
+		float **sphere[] = { &s.spheres.cx, &s.spheres.cy, &s.spheres.cz, &s.spheres.radius };
+		for (int k = 0; k < 3; k++)
+			*vertices[k] = (float *)(s.block + at_vertices[k]);
+		for (int k = 0; k < 3; k++)
+			*corner[k] = (int *)(s.block + at_corners[k]);
+		for (int k = 0; k < 6; k++)
+			*edges[k] = (float *)(s.block + at_edges[k]);
+		for (int k = 0; k < 4; k++)
+			*sphere[k] = (float *)(s.block + at_spheres[k]);
+		s.spheres.count = ns;
+
+		std::copy(nodes.get(), nodes.get() + count, s.nodes);
+		lbvh_for(nv, lbvh_threads(nv, threads), [&](int, int begin, int end) {
+			std::copy(vx.begin() + begin, vx.begin() + end, m.vx + begin);
+			std::copy(vy.begin() + begin, vy.begin() + end, m.vy + begin);
+			std::copy(vz.begin() + begin, vz.begin() + end, m.vz + begin);
+		});
+
+		// Primitives in leaf order, each type numbered as the leaves reach
+		// it: each thread counts the triangles of its range, so it knows
+		// where its own of each type start
+		std::vector<int> before(pass + 1, 0);
+		lbvh_for(n, pass, [&](int t, int begin, int end) {
+			int k = 0;
+			for (int j = begin; j < end; j++)
+				k += order[j] < nt;
+			before[t + 1] = k;
+		});
+		for (int t = 0; t < pass; t++)
+			before[t + 1] += before[t];
+		lbvh_for(n, pass, [&](int t, int begin, int end) {
+			int tri = before[t], sph = begin - before[t];
+			for (int j = begin; j < end; j++) {
+				int p = order[j];
+				if (p < nt) {
+					m.v0[tri] = corners[3 * p];
+					m.v1[tri] = corners[3 * p + 1];
+					m.v2[tri] = corners[3 * p + 2];
+					m.set_edges(tri);
+					s.prims[j].type = PRIM_TRIANGLE;
+					s.prims[j].index = tri++;
+				}
+				else {
+					for (int k = 0; k < 4; k++)
+						(*sphere[k])[sph] = spheres[4 * (p - nt) + k];
+					s.prims[j].type = PRIM_SPHERE;
+					s.prims[j].index = sph++;
+				}
+			}
+		});
+		bvh_fill_stats(s.nodes, count, t0, stats);
+	}
+
+	std::vector<float> vx, vy, vz;
+	std::vector<int> corners;		// three per triangle
+	std::vector<float> spheres;		// centre and radius of each
+};
+
+#endif
@@ -0,0 +1,175 @@
+#ifndef SCENE_CACHEH
+#define SCENE_CACHEH
+
+// Binary cache of a built scene, so a run on an unchanged mesh maps the
+// scene instead of parsing the OBJ file and building the tree.
+//
+// The file is a header and then the scene's block as scene_builder laid it
+// out: the tree, the primitive list and the flat arrays, each aligned to
+// SCENE_ALIGN, with the header giving the offset of every array in the
+// block.  A hit maps the file and points a scene into the mapping, so the
+// arrays are used where they lie; the mapping must stay open while the
+// scene is in use, and the scene must not go to free_scene().  The header
+// holds the size, modification time and a hash of the source file, and a
+// version and the sizes of the stored structures, so a cache of a changed
+// mesh or of another build is taken as a miss, as is one whose counts and
+// offsets put an array outside its block.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "mapped_file.h"
+#include "scene.h"
+
+#define SCENE_CACHE_VERSION 1
+
+struct scene_cache_header {
+	char magic[8];					// "CRSCENE", written last
+	uint32_t version;
+	uint32_t header_bytes;
+	uint32_t node_bytes;			// sizeof(bvh_node)
+	uint32_t prim_bytes;			// sizeof(primitive)
+	uint64_t source_bytes;
+	int64_t source_mtime;
+	uint64_t source_hash;
+	uint64_t block_bytes;
+	int32_t node_count;
+	int32_t prim_count;
+	int32_t vertex_count;
+	int32_t triangle_count;
+	int32_t sphere_count;
+	int32_t reserved;
+	uint64_t offsets[SCENE_ARRAYS];	// in the block, as scene_for_arrays() visits
+};
+
+static_assert(sizeof(scene_cache_header) % SCENE_ALIGN == 0, "scene block must stay aligned in the cache");
+
+// Size and modification time of path; false if it cannot be read
+inline bool scene_source_stat(const char *path, uint64_t& bytes, int64_t& mtime) {
+#ifdef _WIN32
+	struct _stat64 st;
+	if (_stat64(path, &st) != 0)
+		return false;
+#else
+	struct stat st;
+	if (stat(path, &st) != 0)
+		return false;
+#endif
+	bytes = (uint64_t)st.st_size;
+	mtime = (int64_t)st.st_mtime;
+	return true;
+}
+
+// 64-bit hash of the contents of path, a word at a time; false if it
+// cannot be mapped
+inline bool scene_source_hash(const char *path, uint64_t& hash) {
+	mapped_file file;
+	if (!file.open(path))
+		return false;
+	const char *p = file.data();
+	size_t n = file.size(), i = 0;
+	uint64_t h = 0xcbf29ce484222325ull ^ n;
+	for (; i + 8 <= n; i += 8) {
+		uint64_t w;
+		memcpy(&w, p + i, 8);
+		h = (h ^ w) * 0x100000001b3ull;
+		h ^= h >> 29;
+	}
+	for (; i < n; i++)
+		h = (h ^ (unsigned char)p[i]) * 0x100000001b3ull;
+	hash = h;
+	return true;
+}
+
+// Writes s to path as the cache of source; false on failure, with no
+// usable cache left at path
+inline bool save_scene_cache(const char *path, const char *source, scene& s) {
+	scene_cache_header h;
+	memset(&h, 0, sizeof(h));
+	if (!scene_source_stat(source, h.source_bytes, h.source_mtime) || !scene_source_hash(source, h.source_hash))
+		return false;
+	h.version = SCENE_CACHE_VERSION;
+	h.header_bytes = sizeof(h);
+	h.node_bytes = sizeof(bvh_node);
+	h.prim_bytes = sizeof(primitive);
+	h.block_bytes = s.bytes;
+	h.node_count = s.node_count;
+	h.prim_count = s.prim_count;
+	h.vertex_count = s.triangles.vertex_count;
+	h.triangle_count = s.triangles.triangle_count;
+	h.sphere_count = s.spheres.count;
+	int k = 0;
+	scene_for_arrays(s, [&](auto *&p) { h.offsets[k++] = (uint64_t)((const char *)p - s.block); });
+
+	// The magic goes in last, so a file cut short is never taken for a cache
+	FILE *fp = fopen(path, "wb");
+	if (!fp)
+		return false;
+	bool ok = fwrite(&h, sizeof(h), 1, fp) == 1 && fwrite(s.block, 1, s.bytes, fp) == s.bytes;
+	memcpy(h.magic, "CRSCENE", 8);
+	ok = ok && fflush(fp) == 0 && fseek(fp, 0, SEEK_SET) == 0 && fwrite(h.magic, 8, 1, fp) == 1;
+	ok = fclose(fp) == 0 && ok;
+	if (!ok)
+		remove(path);
+	return ok;
+}
+
+// Maps the cache at path into file and points s into it if it is a cache
+// of source as it is now; false on a miss
+inline bool open_scene_cache(const char *path, const char *source, mapped_file& file, scene& s) {
+	uint64_t bytes, hash;
+	int64_t mtime;
+	if (!file.open(path) || !scene_source_stat(source, bytes, mtime))
+		return false;
+
+	scene_cache_header h;
+	if (file.size() < sizeof(h)) {
+		file.close();
+		return false;
+	}
+	memcpy(&h, file.data(), sizeof(h));
+	bool ok = memcmp(h.magic, "CRSCENE", 8) == 0 && h.version == SCENE_CACHE_VERSION && h.header_bytes == sizeof(h)
+		&& h.node_bytes == sizeof(bvh_node) && h.prim_bytes == sizeof(primitive)
+		&& h.block_bytes <= file.size() - sizeof(h)
+		&& h.source_bytes == bytes && h.source_mtime == mtime
+		&& h.node_count >= 0 && h.vertex_count >= 0 && h.triangle_count >= 0 && h.sphere_count >= 0
+		&& h.prim_count == h.triangle_count + h.sphere_count && h.node_count <= 2 * (int64_t)h.prim_count;
+
+	// Every array inside the block at the size its count gives it, so a
+	// damaged header cannot point a traversal outside the mapping
+	static const int count_of[SCENE_ARRAYS] = { 0, 1, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4 };
+	uint64_t counts[] = { (uint64_t)h.node_count, (uint64_t)h.prim_count, (uint64_t)h.vertex_count,
+		(uint64_t)h.triangle_count, (uint64_t)h.sphere_count };
+	uint64_t sizes[SCENE_ARRAYS];
+	int k = 0;
+	scene_for_arrays(s, [&](auto *&p) { sizes[k++] = sizeof(*p); });
+	for (k = 0; k < SCENE_ARRAYS && ok; k++) {
+		uint64_t n = counts[count_of[k]] * sizes[k];
+		ok = h.offsets[k] % SCENE_ALIGN == 0 && h.offsets[k] <= h.block_bytes && n <= h.block_bytes - h.offsets[k];
+	}
+
+	// Only hashed once everything cheaper has matched
+	if (!ok || !scene_source_hash(source, hash) || hash != h.source_hash) {
+		file.close();
+		return false;
+	}
+
+	s = scene();
+	s.block = (char *)file.data() + sizeof(h);
+	s.bytes = h.block_bytes;
+	s.node_count = h.node_count;
+	s.prim_count = h.prim_count;
+	s.triangles.vertex_count = h.vertex_count;
+	s.triangles.triangle_count = h.triangle_count;
+	s.spheres.count = h.sphere_count;
+	k = 0;
+	scene_for_arrays(s, [&](auto *&p) {
+		typedef decltype(p + 0) pointer;
+		p = (pointer)(s.block + h.offsets[k++]);
+	});
+	return true;
+}
+
+#endif
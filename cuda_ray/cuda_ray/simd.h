@@ -0,0 +1,119 @@
+#ifndef SIMDH
+#define SIMDH
+
+// The few vector operations the SIMD intersection needs, over SIMD_WIDTH
+// floats: AVX-512 gives 16, AVX or AVX2 8, SSE 4, and anything else a
+// plain loop over 4.  SIMD_WIDTH can be set lower than the compiler
+// allows, down to 4, to compare widths on one machine.  Host only.
+
+#include <float.h>
+
+#if defined(__AVX__) || defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#define SIMD_SSE
+#endif
+
+#ifndef SIMD_WIDTH
+#if defined(__AVX512F__)
+#define SIMD_WIDTH 16
+#elif defined(__AVX__)
+#define SIMD_WIDTH 8
+#else
+#define SIMD_WIDTH 4
+#endif
+#endif
+
+#if SIMD_WIDTH == 16 && defined(__AVX512F__)
+
+typedef __m512 simd_float;
+typedef __mmask16 simd_mask;
+
+inline simd_float simd_set1(float a) { return _mm512_set1_ps(a); }
+inline simd_float simd_load(const float *p) { return _mm512_loadu_ps(p); }
+inline void simd_store(float *p, simd_float a) { _mm512_storeu_ps(p, a); }
+inline simd_float simd_add(simd_float a, simd_float b) { return _mm512_add_ps(a, b); }
+inline simd_float simd_sub(simd_float a, simd_float b) { return _mm512_sub_ps(a, b); }
+inline simd_float simd_mul(simd_float a, simd_float b) { return _mm512_mul_ps(a, b); }
+inline simd_float simd_div(simd_float a, simd_float b) { return _mm512_div_ps(a, b); }
+inline simd_float simd_abs(simd_float a) { return _mm512_abs_ps(a); }
+inline simd_mask simd_lt(simd_float a, simd_float b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+inline simd_mask simd_le(simd_float a, simd_float b) { return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+inline simd_mask simd_and(simd_mask a, simd_mask b) { return (simd_mask)(a & b); }
+inline int simd_bits(simd_mask m) { return (int)m; }
+inline simd_float simd_select(simd_mask m, simd_float a, simd_float b) { return _mm512_mask_blend_ps(m, b, a); }
+
+#elif SIMD_WIDTH == 8 && defined(__AVX__)
+
+typedef __m256 simd_float;
+typedef __m256 simd_mask;
+
+inline simd_float simd_set1(float a) { return _mm256_set1_ps(a); }
+inline simd_float simd_load(const float *p) { return _mm256_loadu_ps(p); }
+inline void simd_store(float *p, simd_float a) { _mm256_storeu_ps(p, a); }
+inline simd_float simd_add(simd_float a, simd_float b) { return _mm256_add_ps(a, b); }
+inline simd_float simd_sub(simd_float a, simd_float b) { return _mm256_sub_ps(a, b); }
+inline simd_float simd_mul(simd_float a, simd_float b) { return _mm256_mul_ps(a, b); }
+inline simd_float simd_div(simd_float a, simd_float b) { return _mm256_div_ps(a, b); }
+inline simd_float simd_abs(simd_float a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.f), a); }
+inline simd_mask simd_lt(simd_float a, simd_float b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+inline simd_mask simd_le(simd_float a, simd_float b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+inline simd_mask simd_and(simd_mask a, simd_mask b) { return _mm256_and_ps(a, b); }
+inline int simd_bits(simd_mask m) { return _mm256_movemask_ps(m); }
+inline simd_float simd_select(simd_mask m, simd_float a, simd_float b) { return _mm256_blendv_ps(b, a, m); }
+
+#elif SIMD_WIDTH == 4 && defined(SIMD_SSE)
+
+typedef __m128 simd_float;
+typedef __m128 simd_mask;
+
+inline simd_float simd_set1(float a) { return _mm_set1_ps(a); }
+inline simd_float simd_load(const float *p) { return _mm_loadu_ps(p); }
+inline void simd_store(float *p, simd_float a) { _mm_storeu_ps(p, a); }
+inline simd_float simd_add(simd_float a, simd_float b) { return _mm_add_ps(a, b); }
+inline simd_float simd_sub(simd_float a, simd_float b) { return _mm_sub_ps(a, b); }
+inline simd_float simd_mul(simd_float a, simd_float b) { return _mm_mul_ps(a, b); }
+inline simd_float simd_div(simd_float a, simd_float b) { return _mm_div_ps(a, b); }
+inline simd_float simd_abs(simd_float a) { return _mm_andnot_ps(_mm_set1_ps(-0.f), a); }
+inline simd_mask simd_lt(simd_float a, simd_float b) { return _mm_cmplt_ps(a, b); }
+inline simd_mask simd_le(simd_float a, simd_float b) { return _mm_cmple_ps(a, b); }
+inline simd_mask simd_and(simd_mask a, simd_mask b) { return _mm_and_ps(a, b); }
+inline int simd_bits(simd_mask m) { return _mm_movemask_ps(m); }
+inline simd_float simd_select(simd_mask m, simd_float a, simd_float b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+
+#else
+
+// Plain loops, which the compiler may still vectorise
+#define SIMD_SCALAR
+
+struct simd_float {
+	float v[SIMD_WIDTH];
+};
+struct simd_mask {
+	int bits;
+};
+
+inline simd_float simd_set1(float a) { simd_float r; for (int i = 0; i < SIMD_WIDTH; i++) r.v[i] = a; return r; }
+inline simd_float simd_load(const float *p) { simd_float r; for (int i = 0; i < SIMD_WIDTH; i++) r.v[i] = p[i]; return r; }
+inline void simd_store(float *p, simd_float a) { for (int i = 0; i < SIMD_WIDTH; i++) p[i] = a.v[i]; }
+inline simd_float simd_add(simd_float a, simd_float b) { for (int i = 0; i < SIMD_WIDTH; i++) a.v[i] += b.v[i]; return a; }
+inline simd_float simd_sub(simd_float a, simd_float b) { for (int i = 0; i < SIMD_WIDTH; i++) a.v[i] -= b.v[i]; return a; }
+inline simd_float simd_mul(simd_float a, simd_float b) { for (int i = 0; i < SIMD_WIDTH; i++) a.v[i] *= b.v[i]; return a; }
+inline simd_float simd_div(simd_float a, simd_float b) { for (int i = 0; i < SIMD_WIDTH; i++) a.v[i] /= b.v[i]; return a; }
+inline simd_float simd_abs(simd_float a) { for (int i = 0; i < SIMD_WIDTH; i++) a.v[i] = fabsf(a.v[i]); return a; }
+inline simd_mask simd_lt(simd_float a, simd_float b) { simd_mask m = { 0 }; for (int i = 0; i < SIMD_WIDTH; i++) m.bits |= (a.v[i] < b.v[i]) << i; return m; }
+inline simd_mask simd_le(simd_float a, simd_float b) { simd_mask m = { 0 }; for (int i = 0; i < SIMD_WIDTH; i++) m.bits |= (a.v[i] <= b.v[i]) << i; return m; }
+inline simd_mask simd_and(simd_mask a, simd_mask b) { a.bits &= b.bits; return a; }
+inline int simd_bits(simd_mask m) { return m.bits; }
+inline simd_float simd_select(simd_mask m, simd_float a, simd_float b) { for (int i = 0; i < SIMD_WIDTH; i++) if (m.bits >> i & 1) b.v[i] = a.v[i]; return b; }
+
+#endif
+
+// Lowest set bit of a non-zero mask
+inline int simd_lowest(int bits) {
+	int i = 0;
+	while (!(bits >> i & 1))
+		i++;
+	return i;
+}
+
+#endif
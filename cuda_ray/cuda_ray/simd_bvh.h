@@ -0,0 +1,415 @@
+#ifndef SIMD_BVHH
+#define SIMD_BVHH
+
+// BVH whose leaves hold triangles in groups of SIMD_WIDTH, for the host
+// backend, with one ray tested against a whole group at once.
+//
+// A group keeps the first corner and the two edges of each of its
+// triangles component by component, so the Moller-Trumbore test of
+// triangle::hit() runs across the lanes with a handful of loads and one
+// mask at the end; unused lanes of a leaf's last group have zero edges,
+// which the determinant test rejects.  The tree comes from either builder
+// over a triangle_mesh and is then collapsed: a subtree becomes a leaf
+// where testing its triangles group by group costs no more, by the SAH,
+// than going on down it.
+//
+// hit_scalar() tests the same groups lane by lane, for comparison, and
+// hit_packet() traces SIMD_WIDTH coherent rays, such as primary rays of
+// neighbouring pixels, through the tree together: a node is entered if
+// any of them hits its box, and a triangle is tested against all of
+// them at once.
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include "simd.h"
+#include "bvh.h"
+#include "lbvh.h"
+#include "triangle_mesh.h"
+
+#define SIMD_GROUP_COST 2.f		// of testing a group, against 1 for a node
+#define SIMD_MAX_LEAF_GROUPS 2
+
+struct simd_group {
+	float v0[3][SIMD_WIDTH];
+	float e1[3][SIMD_WIDTH];
+	float e2[3][SIMD_WIDTH];
+	int count;		// lanes in use
+};
+
+// Triangle k of g against r, as triangle::hit()
+inline bool simd_lane_hit(const simd_group& g, int k, const ray& r, float t_min, float t_max, hit_record& rec) {
+	vec3 e1(g.e1[0][k], g.e1[1][k], g.e1[2][k]), e2(g.e2[0][k], g.e2[1][k], g.e2[2][k]);
+	vec3 pvec = cross(r.direction(), e2);
+	float aNum = dot(pvec, e1);
+	if (fabsf(aNum) < 1E-8)
+		return false;
+
+	vec3 tvec = r.origin() - vec3(g.v0[0][k], g.v0[1][k], g.v0[2][k]);
+	float u = dot(pvec, tvec) / aNum;
+	if (u < 0.0 || u > 1.0)
+		return false;
+
+	vec3 qVec = cross(tvec, e1);
+	float v = dot(qVec, r.direction()) / aNum;
+	if (v < 0.0 || u + v > 1.0)
+		return false;
+
+	float t = dot(qVec, e2) / aNum;
+	if (t < t_min || t > t_max)
+		return false;
+
+	rec.t = t;
+	rec.p = r.point_at_parameter(rec.t);
+	rec.normal = unit_vector(cross(e1, e2));
+	return true;
+}
+
+// The groups of a tree as bvh_traverse() tests its primitives, all lanes
+// of a group at once
+struct simd_groups {
+	const simd_group *groups;
+
+	bool hit(int i, const ray& r, float t_min, float t_max, hit_record& rec) const {
+		const simd_group& g = groups[i];
+		vec3 o = r.origin(), d = r.direction();
+		simd_float dx = simd_set1(d[0]), dy = simd_set1(d[1]), dz = simd_set1(d[2]);
+		simd_float e1x = simd_load(g.e1[0]), e1y = simd_load(g.e1[1]), e1z = simd_load(g.e1[2]);
+		simd_float e2x = simd_load(g.e2[0]), e2y = simd_load(g.e2[1]), e2z = simd_load(g.e2[2]);
+
+		// pvec = d x e2, det = pvec . e1
+		simd_float px = simd_sub(simd_mul(dy, e2z), simd_mul(dz, e2y));
+		simd_float py = simd_sub(simd_mul(dz, e2x), simd_mul(dx, e2z));
+		simd_float pz = simd_sub(simd_mul(dx, e2y), simd_mul(dy, e2x));
+		simd_float det = simd_add(simd_add(simd_mul(px, e1x), simd_mul(py, e1y)), simd_mul(pz, e1z));
+
+		simd_float tx = simd_sub(simd_set1(o[0]), simd_load(g.v0[0]));
+		simd_float ty = simd_sub(simd_set1(o[1]), simd_load(g.v0[1]));
+		simd_float tz = simd_sub(simd_set1(o[2]), simd_load(g.v0[2]));
+		simd_float u = simd_div(simd_add(simd_add(simd_mul(px, tx), simd_mul(py, ty)), simd_mul(pz, tz)), det);
+
+		// qvec = tvec x e1
+		simd_float qx = simd_sub(simd_mul(ty, e1z), simd_mul(tz, e1y));
+		simd_float qy = simd_sub(simd_mul(tz, e1x), simd_mul(tx, e1z));
+		simd_float qz = simd_sub(simd_mul(tx, e1y), simd_mul(ty, e1x));
+		simd_float v = simd_div(simd_add(simd_add(simd_mul(qx, dx), simd_mul(qy, dy)), simd_mul(qz, dz)), det);
+		simd_float t = simd_div(simd_add(simd_add(simd_mul(qx, e2x), simd_mul(qy, e2y)), simd_mul(qz, e2z)), det);
+
+		simd_float zero = simd_set1(0.f), one = simd_set1(1.f);
+		simd_mask m = simd_le(simd_set1(1E-8f), simd_abs(det));
+		m = simd_and(m, simd_and(simd_le(zero, u), simd_le(u, one)));
+		m = simd_and(m, simd_and(simd_le(zero, v), simd_le(simd_add(u, v), one)));
+		m = simd_and(m, simd_and(simd_le(simd_set1(t_min), t), simd_le(t, simd_set1(t_max))));
+		int bits = simd_bits(m);
+		if (!bits)
+			return false;
+
+		// Nearest of the lanes hit
+		float ts[SIMD_WIDTH];
+		simd_store(ts, t);
+		int k = simd_lowest(bits);
+		for (int b = bits & (bits - 1); b; b &= b - 1) {
+			int j = simd_lowest(b);
+			if (ts[j] < ts[k])
+				k = j;
+		}
+		rec.t = ts[k];
+		rec.p = r.point_at_parameter(rec.t);
+		rec.normal = unit_vector(cross(vec3(g.e1[0][k], g.e1[1][k], g.e1[2][k]), vec3(g.e2[0][k], g.e2[1][k], g.e2[2][k])));
+		return true;
+	}
+};
+
+// The same groups tested one lane at a time
+struct simd_groups_scalar {
+	const simd_group *groups;
+
+	bool hit(int i, const ray& r, float t_min, float t_max, hit_record& rec) const {
+		bool hit_anything = false;
+		for (int k = 0; k < groups[i].count; k++)
+			if (simd_lane_hit(groups[i], k, r, t_min, t_max, rec)) {
+				hit_anything = true;
+				t_max = rec.t;
+			}
+		return hit_anything;
+	}
+};
+
+class simd_bvh : public hitable {
+public:
+	virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+		simd_groups g = { groups.data() };
+		return bvh_traverse(nodes.data(), (int)nodes.size(), g, r, t_min, t_max, rec);
+	}
+
+	bool hit_scalar(const ray& r, float t_min, float t_max, hit_record& rec) const {
+		simd_groups_scalar g = { groups.data() };
+		return bvh_traverse(nodes.data(), (int)nodes.size(), g, r, t_min, t_max, rec);
+	}
+
+	virtual aabb bounding_box() const { return bvh_bounds(nodes.data(), (int)nodes.size()); }
+
+	// Nearest hits of rays[0..SIMD_WIDTH), into hit and rec
+	void hit_packet(const ray *rays, float t_min, float t_max, bool *hit, hit_record *rec) const;
+
+	std::vector<bvh_node> nodes;		// a leaf's first and count are of groups
+	std::vector<simd_group> groups;
+	int triangle_count;
+};
+
+inline void simd_bvh::hit_packet(const ray *rays, float t_min, float t_max, bool *hit, hit_record *rec) const {
+	float o[3][SIMD_WIDTH], d[3][SIMD_WIDTH], inv[3][SIMD_WIDTH], closest[SIMD_WIDTH];
+	int id[SIMD_WIDTH];
+	for (int k = 0; k < SIMD_WIDTH; k++) {
+		for (int a = 0; a < 3; a++) {
+			o[a][k] = rays[k].origin()[a];
+			d[a][k] = rays[k].direction()[a];
+			inv[a][k] = 1.0f / d[a][k];
+		}
+		closest[k] = t_max;
+		id[k] = -1;
+		hit[k] = false;
+	}
+	if (nodes.empty())
+		return;
+
+	simd_float ox = simd_load(o[0]), oy = simd_load(o[1]), oz = simd_load(o[2]);
+	simd_float dx = simd_load(d[0]), dy = simd_load(d[1]), dz = simd_load(d[2]);
+	simd_float lo_t = simd_set1(t_min), zero = simd_set1(0.f), one = simd_set1(1.f), eps = simd_set1(1E-8f);
+	simd_float ov[3] = { ox, oy, oz }, iv[3] = { simd_load(inv[0]), simd_load(inv[1]), simd_load(inv[2]) };
+
+	// Lanes that hit the box of node n before their closest hit, and the
+	// nearest entry among them; the slabs as hit_slabs() orders them
+	auto enter = [&](const bvh_node& n, float& first) {
+		simd_float t0v = lo_t, t1v = simd_load(closest);
+		for (int a = 0; a < 3; a++) {
+			simd_float t0 = simd_mul(simd_sub(simd_set1(n.lo[a]), ov[a]), iv[a]);
+			simd_float t1 = simd_mul(simd_sub(simd_set1(n.hi[a]), ov[a]), iv[a]);
+			simd_mask swap = simd_lt(t1, t0);
+			simd_float near_t = simd_select(swap, t1, t0), far_t = simd_select(swap, t0, t1);
+			t0v = simd_select(simd_lt(t0v, near_t), near_t, t0v);
+			t1v = simd_select(simd_lt(far_t, t1v), far_t, t1v);
+		}
+		int bits = simd_bits(simd_le(t0v, t1v));
+		float ts[SIMD_WIDTH];
+		simd_store(ts, t0v);
+		first = FLT_MAX;
+		for (int b = bits; b; b &= b - 1)
+			first = std::min(first, ts[simd_lowest(b)]);
+		return bits;
+	};
+
+	int stack[BVH_STACK];
+	float stack_t[BVH_STACK];
+	int top = 0, n = 0;
+	float first0, first1;
+	if (!enter(nodes[0], first0))
+		return;
+
+	for (;;) {
+		const bvh_node& node = nodes[n];
+
+		if (node.count > 0) {
+			for (int gi = node.first; gi < node.first + node.count; gi++) {
+				const simd_group& g = groups[gi];
+				for (int k = 0; k < g.count; k++) {
+					// One triangle against every ray of the packet
+					simd_float e1x = simd_set1(g.e1[0][k]), e1y = simd_set1(g.e1[1][k]), e1z = simd_set1(g.e1[2][k]);
+					simd_float e2x = simd_set1(g.e2[0][k]), e2y = simd_set1(g.e2[1][k]), e2z = simd_set1(g.e2[2][k]);
+					simd_float px = simd_sub(simd_mul(dy, e2z), simd_mul(dz, e2y));
+					simd_float py = simd_sub(simd_mul(dz, e2x), simd_mul(dx, e2z));
+					simd_float pz = simd_sub(simd_mul(dx, e2y), simd_mul(dy, e2x));
+					simd_float det = simd_add(simd_add(simd_mul(px, e1x), simd_mul(py, e1y)), simd_mul(pz, e1z));
+
+					simd_float tx = simd_sub(ox, simd_set1(g.v0[0][k]));
+					simd_float ty = simd_sub(oy, simd_set1(g.v0[1][k]));
+					simd_float tz = simd_sub(oz, simd_set1(g.v0[2][k]));
+					simd_float u = simd_div(simd_add(simd_add(simd_mul(px, tx), simd_mul(py, ty)), simd_mul(pz, tz)), det);
+
+					simd_float qx = simd_sub(simd_mul(ty, e1z), simd_mul(tz, e1y));
+					simd_float qy = simd_sub(simd_mul(tz, e1x), simd_mul(tx, e1z));
+					simd_float qz = simd_sub(simd_mul(tx, e1y), simd_mul(ty, e1x));
+					simd_float v = simd_div(simd_add(simd_add(simd_mul(qx, dx), simd_mul(qy, dy)), simd_mul(qz, dz)), det);
+					simd_float t = simd_div(simd_add(simd_add(simd_mul(qx, e2x), simd_mul(qy, e2y)), simd_mul(qz, e2z)), det);
+
+					simd_mask m = simd_le(eps, simd_abs(det));
+					m = simd_and(m, simd_and(simd_le(zero, u), simd_le(u, one)));
+					m = simd_and(m, simd_and(simd_le(zero, v), simd_le(simd_add(u, v), one)));
+					m = simd_and(m, simd_and(simd_le(lo_t, t), simd_le(t, simd_load(closest))));
+					int bits = simd_bits(m);
+					if (!bits)
+						continue;
+
+					float ts[SIMD_WIDTH];
+					simd_store(ts, t);
+					for (; bits; bits &= bits - 1) {
+						int j = simd_lowest(bits);
+						closest[j] = ts[j];
+						id[j] = gi * SIMD_WIDTH + k;
+					}
+				}
+			}
+		}
+		else {
+			int h0 = enter(nodes[node.first], first0);
+			int h1 = enter(nodes[node.first + 1], first1);
+
+			if (h0 && h1) {
+				bool left_first = first0 <= first1;
+				stack[top] = left_first ? node.first + 1 : node.first;
+				stack_t[top++] = left_first ? first1 : first0;
+				n = left_first ? node.first : node.first + 1;
+				continue;
+			}
+			if (h0 || h1) {
+				n = h0 ? node.first : node.first + 1;
+				continue;
+			}
+		}
+
+		// Next node on the stack that some ray may still hit first
+		float farthest = closest[0];
+		for (int k = 1; k < SIMD_WIDTH; k++)
+			farthest = std::max(farthest, closest[k]);
+		while (top > 0 && stack_t[top - 1] > farthest)
+			top--;
+		if (top == 0)
+			break;
+		n = stack[--top];
+	}
+
+	for (int k = 0; k < SIMD_WIDTH; k++) {
+		if (id[k] < 0)
+			continue;
+		const simd_group& g = groups[id[k] / SIMD_WIDTH];
+		int j = id[k] % SIMD_WIDTH;
+		hit[k] = true;
+		rec[k].t = closest[k];
+		rec[k].p = rays[k].point_at_parameter(closest[k]);
+		rec[k].normal = unit_vector(cross(vec3(g.e1[0][j], g.e1[1][j], g.e1[2][j]), vec3(g.e2[0][j], g.e2[1][j], g.e2[2][j])));
+	}
+}
+
+// Host side collapse of a tree over a mesh into SIMD leaves
+class simd_bvh_builder {
+public:
+	simd_bvh_builder(const triangle_mesh& mesh, const bvh_node *nodes, const int *order, simd_bvh& out)
+		: mesh(mesh), in(nodes), order(order), out(out) {}
+
+	// SAH cost of the subtree at n relative to its area, and the range of
+	// sorted triangles under it; marks the nodes that become leaves
+	float plan(int n, int& first, int& count) {
+		const bvh_node& node = in[n];
+		if (node.count > 0) {
+			first = node.first;
+			count = node.count;
+			leaf[n] = true;
+			return groups_of(count) * SIMD_GROUP_COST;
+		}
+
+		int fl, cl, fr, cr;
+		float cost_l = plan(node.first, fl, cl);
+		float cost_r = plan(node.first + 1, fr, cr);
+		first = std::min(fl, fr);
+		count = cl + cr;
+
+		float area = half_area(node);
+		float split_cost = BVH_TRAVERSAL_COST + (area > 0.f
+			? (half_area(in[node.first]) * cost_l + half_area(in[node.first + 1]) * cost_r) / area
+			: cost_l + cost_r);
+		float leaf_cost = groups_of(count) * SIMD_GROUP_COST;
+		leaf[n] = groups_of(count) <= SIMD_MAX_LEAF_GROUPS && leaf_cost <= split_cost;
+		range[n] = std::make_pair(first, count);
+		return leaf[n] ? leaf_cost : split_cost;
+	}
+
+	// Copies the subtree at n to slot s of the output
+	void emit(int n, int s) {
+		const bvh_node& node = in[n];
+		bvh_node& o = out.nodes[s];
+		std::copy(node.lo, node.lo + 3, o.lo);
+		std::copy(node.hi, node.hi + 3, o.hi);
+		if (!leaf[n]) {
+			int c = (int)out.nodes.size();
+			out.nodes.resize(c + 2);
+			out.nodes[s].first = c;
+			out.nodes[s].count = 0;
+			emit(node.first, c);
+			emit(node.first + 1, c + 1);
+			return;
+		}
+
+		int first = node.count > 0 ? node.first : range[n].first;
+		int count = node.count > 0 ? node.count : range[n].second;
+		o.first = (int)out.groups.size();
+		o.count = groups_of(count);
+		for (int i = 0; i < count; i += SIMD_WIDTH) {
+			simd_group g = simd_group();
+			g.count = std::min(SIMD_WIDTH, count - i);
+			for (int k = 0; k < g.count; k++) {
+				int t = order[first + i + k], a = mesh.v0[t];
+				g.v0[0][k] = mesh.vx[a];
+				g.v0[1][k] = mesh.vy[a];
+				g.v0[2][k] = mesh.vz[a];
+				g.e1[0][k] = mesh.e1x[t];
+				g.e1[1][k] = mesh.e1y[t];
+				g.e1[2][k] = mesh.e1z[t];
+				g.e2[0][k] = mesh.e2x[t];
+				g.e2[1][k] = mesh.e2y[t];
+				g.e2[2][k] = mesh.e2z[t];
+			}
+			out.groups.push_back(g);
+		}
+	}
+
+	const triangle_mesh& mesh;
+	const bvh_node *in;
+	const int *order;
+	simd_bvh& out;
+	std::vector<bool> leaf;
+	std::vector<std::pair<int, int> > range;
+
+private:
+	static int groups_of(int count) { return (count + SIMD_WIDTH - 1) / SIMD_WIDTH; }
+
+	static float half_area(const bvh_node& node) {
+		float dx = node.hi[0] - node.lo[0], dy = node.hi[1] - node.lo[1], dz = node.hi[2] - node.lo[2];
+		return dx * dy + dy * dz + dz * dx;
+	}
+};
+
+// SIMD tree over mesh, by binned SAH or as a linear BVH collapsed to SIMD
+// leaves, on up to threads threads, all cores for 0.  The mesh stays with
+// the caller; the tree holds copies of its triangles.
+inline simd_bvh *build_simd_bvh(const triangle_mesh& mesh, int threads = 0, bool lbvh = false, bvh_build_stats *stats = nullptr) {
+	auto t0 = std::chrono::steady_clock::now();
+	int n = mesh.triangle_count;
+	std::unique_ptr<aabb[]> boxes(new aabb[std::max(n, 1)]);
+	std::unique_ptr<int[]> order(new int[std::max(n, 1)]);
+	lbvh_for(n, lbvh_threads(n, threads), [&](int, int begin, int end) {
+		for (int i = begin; i < end; i++)
+			boxes[i] = mesh.bounding_box(i);
+	});
+
+	int count;
+	std::unique_ptr<bvh_node[]> nodes(lbvh ? build_lbvh_nodes(boxes.get(), n, threads, order.get(), count)
+		: build_bvh_nodes(boxes.get(), n, threads, order.get(), count));
+
+	simd_bvh *tree = new simd_bvh();
+	tree->triangle_count = n;
+	if (count > 0) {
+		simd_bvh_builder b(mesh, nodes.get(), order.get(), *tree);
+		int first, under;
+		b.leaf.assign(count, false);
+		b.range.resize(count);
+		b.plan(0, first, under);
+		tree->nodes.resize(1);
+		b.emit(0, 0);
+	}
+	bvh_fill_stats(tree->nodes.data(), (int)tree->nodes.size(), t0, stats);
+	return tree;
+}
+
+#endif
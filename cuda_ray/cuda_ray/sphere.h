@@ -5,14 +5,18 @@
 
 class sphere: public hitable  {
     public:
-        __device__ sphere() {}
-        __device__ sphere(vec3 cen, float r) : center(cen), radius(r)  {};
-        __device__ virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
+        __host__ __device__ sphere() {}
+        __host__ __device__ sphere(vec3 cen, float r) : center(cen), radius(r)  {};
+        __host__ __device__ virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
+        __host__ __device__ virtual aabb bounding_box() const {
+            vec3 d(radius, radius, radius);
+            return aabb(center - d, center + d);
+        }
         vec3 center;
         float radius;
 };
 
-__device__ bool sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+__host__ __device__ bool sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
     vec3 oc = r.origin() - center;
     float a = dot(r.direction(), r.direction());
     float b = dot(oc, r.direction());
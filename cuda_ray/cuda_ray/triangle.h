@@ -6,9 +6,9 @@
 
 class triangle : public hitable {
 public:
-	__device__ triangle() {}
+	__host__ __device__ triangle() {}
 
-	__device__ triangle(vec3& aa, vec3& bb, vec3& cc, vec3& nn, float s = 1.0) : a(aa), b(bb), c(cc), normal(nn), scale(s) {
+	__host__ __device__ triangle(vec3& aa, vec3& bb, vec3& cc, vec3& nn, float s = 1.0) : a(aa), b(bb), c(cc), normal(nn), scale(s) {
 		// edge vectors
 		e1 = b - a;
 		e2 = c - a;
@@ -19,7 +19,13 @@ public:
 		d = dot(normal, a);
 	};
 
-	__device__ virtual bool hit(const ray& r, float tmin, float t_max, hit_record&) const;
+	__host__ __device__ virtual bool hit(const ray& r, float tmin, float t_max, hit_record&) const;
+	__host__ __device__ virtual aabb bounding_box() const {
+		aabb box(a, a);
+		box.grow(b);
+		box.grow(c);
+		return box;
+	}
 	
 
 	vec3 a, b, c;
@@ -30,12 +36,12 @@ public:
 	float scale;
 };
 
-__device__ bool triangle::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+__host__ __device__ bool triangle::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
 	vec3 pvec = cross(r.direction(), e2);
 	float aNum = dot(pvec, e1);
 
 	// Backfacing / nearly parallel, or close to the limit of precision ?
-	if (abs(aNum) < 1E-8)
+	if (fabsf(aNum) < 1E-8)
 		return false;
 
 	vec3 tvec = r.origin() - a;
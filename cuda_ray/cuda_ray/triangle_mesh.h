@@ -0,0 +1,202 @@
+#ifndef TRIANGLE_MESHH
+#define TRIANGLE_MESHH
+
+// Triangles as flat arrays, one per component, in place of a triangle
+// object and a hitable pointer per face.
+//
+// A triangle is the indices of its three corners in the shared vertex
+// arrays and its two edges from the first corner, 36 bytes against 104
+// for a triangle object and the pointer to it, before the allocator's
+// overhead for each triangle on the heap; the vertices add 12 bytes
+// each, around half a vertex per face in a closed mesh.  The normal is worked out for a hit when it is reported.
+// hit() is an ordinary member over the index of the triangle, so a
+// traversal reaching a leaf reads its triangles from consecutive entries
+// of the same arrays.
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "hitable.h"
+#include "obj_file.h"
+
+struct triangle_mesh {
+	int vertex_count;
+	int triangle_count;
+	float *vx, *vy, *vz;
+	int *v0, *v1, *v2;			// corners
+	float *e1x, *e1y, *e1z;		// v1 - v0
+	float *e2x, *e2y, *e2z;		// v2 - v0
+
+	// Moller-Trumbore, as triangle::hit()
+	__host__ __device__ bool hit(int i, const ray& r, float t_min, float t_max, hit_record& rec) const {
+		int a = v0[i];
+		vec3 e1(e1x[i], e1y[i], e1z[i]), e2(e2x[i], e2y[i], e2z[i]);
+		vec3 pvec = cross(r.direction(), e2);
+		float aNum = dot(pvec, e1);
+
+		// Backfacing / nearly parallel, or close to the limit of precision ?
+		if (fabsf(aNum) < 1E-8)
+			return false;
+
+		vec3 tvec = r.origin() - vec3(vx[a], vy[a], vz[a]);
+		float u = dot(pvec, tvec) / aNum;
+		if (u < 0.0 || u > 1.0)
+			return false;
+
+		vec3 qVec = cross(tvec, e1);
+		float v = dot(qVec, r.direction()) / aNum;
+		if (v < 0.0 || u + v > 1.0)
+			return false;
+
+		float t = dot(qVec, e2) / aNum;
+		if (t < t_min || t > t_max)
+			return false;
+
+		rec.t = t;
+		rec.p = r.point_at_parameter(rec.t);
+		rec.normal = unit_vector(cross(e1, e2));
+		return true;
+	}
+
+	__host__ __device__ aabb bounding_box(int i) const {
+		int c[3] = { v0[i], v1[i], v2[i] };
+		aabb box;
+		for (int k = 0; k < 3; k++)
+			box.grow(vec3(vx[c[k]], vy[c[k]], vz[c[k]]));
+		return box;
+	}
+
+	// Edges of triangle i from its corners
+	__host__ __device__ void set_edges(int i) {
+		int a = v0[i], b = v1[i], c = v2[i];
+		e1x[i] = vx[b] - vx[a];
+		e1y[i] = vy[b] - vy[a];
+		e1z[i] = vz[b] - vz[a];
+		e2x[i] = vx[c] - vx[a];
+		e2y[i] = vy[c] - vy[a];
+		e2z[i] = vz[c] - vz[a];
+	}
+};
+
+inline size_t triangle_mesh_bytes(const triangle_mesh& m) {
+	return (size_t)m.vertex_count * 3 * sizeof(float) + (size_t)m.triangle_count * (3 * sizeof(int) + 6 * sizeof(float));
+}
+
+// Allocates the arrays of a mesh of the sizes given, as new[] arrays that
+// free_triangle_mesh() releases
+inline void alloc_triangle_mesh(triangle_mesh& m, int vertex_count, int triangle_count) {
+	int nv = std::max(vertex_count, 1), nt = std::max(triangle_count, 1);
+	m.vertex_count = vertex_count;
+	m.triangle_count = triangle_count;
+	m.vx = new float[nv];
+	m.vy = new float[nv];
+	m.vz = new float[nv];
+	m.v0 = new int[nt];
+	m.v1 = new int[nt];
+	m.v2 = new int[nt];
+	m.e1x = new float[nt];
+	m.e1y = new float[nt];
+	m.e1z = new float[nt];
+	m.e2x = new float[nt];
+	m.e2y = new float[nt];
+	m.e2z = new float[nt];
+}
+
+inline void free_triangle_mesh(triangle_mesh& m) {
+	float *f[] = { m.vx, m.vy, m.vz, m.e1x, m.e1y, m.e1z, m.e2x, m.e2y, m.e2z };
+	int *v[] = { m.v0, m.v1, m.v2 };
+	for (float *p : f)
+		delete[] p;
+	for (int *p : v)
+		delete[] p;
+	m = triangle_mesh();
+}
+
+// Mesh of the vertices and faces ReadOBJFile() gives; OBJ indices count
+// from 1, faces out of range are dropped
+inline void create_triangle_mesh(float **vertex, int **face, int VN, int FN, triangle_mesh& m) {
+	int kept = 0;
+	for (int i = 0; i < FN; i++)
+		if (std::min(face[0][i], std::min(face[1][i], face[2][i])) >= 1 && std::max(face[0][i], std::max(face[1][i], face[2][i])) <= VN)
+			kept++;
+
+	alloc_triangle_mesh(m, VN, kept);
+	std::copy(vertex[0], vertex[0] + VN, m.vx);
+	std::copy(vertex[1], vertex[1] + VN, m.vy);
+	std::copy(vertex[2], vertex[2] + VN, m.vz);
+
+	int k = 0;
+	for (int i = 0; i < FN; i++) {
+		if (std::min(face[0][i], std::min(face[1][i], face[2][i])) < 1 || std::max(face[0][i], std::max(face[1][i], face[2][i])) > VN)
+			continue;
+		m.v0[k] = face[0][i] - 1;
+		m.v1[k] = face[1][i] - 1;
+		m.v2[k] = face[2][i] - 1;
+		m.set_edges(k);
+		k++;
+	}
+}
+
+// Mesh of an OBJ file, parsed straight into its arrays on up to threads
+// threads, all cores for 0; faces out of range are dropped.  False if the
+// file cannot be read.
+inline bool load_triangle_mesh(const char *path, triangle_mesh& m, int threads = 0, obj_load_stats *stats = nullptr) {
+	m = triangle_mesh();
+	bool read = read_obj(path, threads, [&](int nv, int nt) {
+		alloc_triangle_mesh(m, nv, nt);
+		obj_output out = { m.vx, m.vy, m.vz, m.v0, m.v1, m.v2, 0, 1 };
+		return out;
+	}, stats);
+	if (!read)
+		return false;
+
+	// Edges, and any faces out of range found on the way
+	int nv = m.vertex_count;
+	std::atomic<int> bad(0);
+	obj_for(m.triangle_count, threads, [&](int begin, int end) {
+		int found = 0;
+		for (int i = begin; i < end; i++) {
+			if (std::min(m.v0[i], std::min(m.v1[i], m.v2[i])) < 0 || std::max(m.v0[i], std::max(m.v1[i], m.v2[i])) >= nv)
+				found++;
+			else
+				m.set_edges(i);
+		}
+		bad += found;
+	});
+	if (bad) {
+		int k = 0;
+		for (int i = 0; i < m.triangle_count; i++) {
+			if (std::min(m.v0[i], std::min(m.v1[i], m.v2[i])) < 0 || std::max(m.v0[i], std::max(m.v1[i], m.v2[i])) >= nv)
+				continue;
+			m.v0[k] = m.v0[i];
+			m.v1[k] = m.v1[i];
+			m.v2[k] = m.v2[i];
+			m.set_edges(k);
+			k++;
+		}
+		m.triangle_count = k;
+	}
+	return true;
+}
+
+// Puts triangle order[i] at i, for the leaf order of a tree over the mesh
+inline void reorder_triangle_mesh(triangle_mesh& m, const int *order) {
+	int n = m.triangle_count;
+	std::vector<int> tmp_i(n);
+	std::vector<float> tmp_f(n);
+	int *vi[] = { m.v0, m.v1, m.v2 };
+	float *vf[] = { m.e1x, m.e1y, m.e1z, m.e2x, m.e2y, m.e2z };
+	for (int *p : vi) {
+		for (int i = 0; i < n; i++)
+			tmp_i[i] = p[order[i]];
+		std::copy(tmp_i.begin(), tmp_i.end(), p);
+	}
+	for (float *p : vf) {
+		for (int i = 0; i < n; i++)
+			tmp_f[i] = p[order[i]];
+		std::copy(tmp_f.begin(), tmp_f.end(), p);
+	}
+}
+
+#endif
@@ -5,6 +5,8 @@
 #include <stdlib.h>
 #include <iostream>
 
+#include "host_device.h"
+
 class vec3  {
 
 